@@ -0,0 +1,62 @@
+#include "glyph_cache.h"
+
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+
+namespace my_lcd
+{
+    esp_err_t glyph_cache_init(glyph_cache_t* cache, const hd44780_t* lcd, const glyph_bitmap_t* table, size_t table_len)
+    {
+        CHECK_ARG(cache && lcd && table && table_len < MY_LCD_GLYPH_EMPTY_SLOT);
+        if (lcd->font != HD44780_FONT_5X8) return ESP_ERR_NOT_SUPPORTED;
+
+        cache->lcd = lcd;
+        cache->table = table;
+        cache->table_len = table_len;
+        cache->hits = 0;
+        cache->misses = 0;
+        glyph_cache_invalidate(cache);
+
+        return ESP_OK;
+    }
+
+    esp_err_t glyph_cache_get(glyph_cache_t* cache, uint8_t glyph, char* code)
+    {
+        CHECK_ARG(cache && code && glyph < cache->table_len);
+
+        size_t victim = 0;
+        cache->clock++;
+        for (size_t i = 0; i < MY_LCD_CGRAM_SLOTS; i++)
+        {
+            if (cache->slot_glyph[i] == glyph)
+            {
+                cache->slot_stamp[i] = cache->clock;
+                cache->hits++;
+                *code = static_cast<char>(i);
+                return ESP_OK;
+            }
+            // Empty slots have zero stamp, so they are always picked before any used one
+            if (cache->slot_stamp[i] < cache->slot_stamp[victim]) victim = i;
+        }
+
+        // Miss: invalidate the slot first, so that a failed upload doesn't leave stale mapping behind
+        cache->slot_glyph[victim] = MY_LCD_GLYPH_EMPTY_SLOT;
+        cache->slot_stamp[victim] = 0;
+        CHECK(upload_character(cache->lcd, victim, cache->table[glyph]));
+        cache->slot_glyph[victim] = glyph;
+        cache->slot_stamp[victim] = cache->clock;
+        cache->misses++;
+        *code = static_cast<char>(victim);
+
+        return ESP_OK;
+    }
+
+    void glyph_cache_invalidate(glyph_cache_t* cache)
+    {
+        memset(cache->slot_glyph, MY_LCD_GLYPH_EMPTY_SLOT, sizeof(cache->slot_glyph));
+        memset(cache->slot_stamp, 0, sizeof(cache->slot_stamp));
+        cache->clock = 0;
+    }
+} // namespace my_lcd
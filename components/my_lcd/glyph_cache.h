@@ -0,0 +1,69 @@
+/**
+ * @file glyph_cache.h
+ * @author Paul Kutukov
+ * @brief CGRAM custom character cache for HD44780-compatible displays.
+ * The controller has only 8 user-defined character slots (5x8 font), so a larger glyph table is multiplexed onto them
+ * with least-recently-used replacement. Glyphs are uploaded only on a cache miss.
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include "my_lcd.h"
+
+#define MY_LCD_CGRAM_SLOTS 8u
+#define MY_LCD_GLYPH_ROWS 8u
+#define MY_LCD_GLYPH_EMPTY_SLOT 0xFFu
+
+namespace my_lcd
+{
+    /// @brief 5x8 custom character bitmap: one byte per row, 5 LSBs are used (MSB of those is the leftmost pixel)
+    typedef uint8_t glyph_bitmap_t[MY_LCD_GLYPH_ROWS];
+
+    /**
+     * CGRAM slot cache descriptor. Initialize with glyph_cache_init before use.
+     */
+    struct glyph_cache_t
+    {
+        const hd44780_t* lcd;                       //!< LCD the cache is bound to
+        const glyph_bitmap_t* table;                //!< Glyph bitmaps indexed by glyph ID
+        size_t table_len;                           //!< Number of glyphs in the table
+        uint8_t slot_glyph[MY_LCD_CGRAM_SLOTS];     //!< Glyph ID currently loaded into each slot (MY_LCD_GLYPH_EMPTY_SLOT == none)
+        uint32_t slot_stamp[MY_LCD_CGRAM_SLOTS];    //!< Last use "time" of each slot, for LRU replacement
+        uint32_t clock;                             //!< Monotonic use counter
+        uint32_t hits;                              //!< Lookups served without an upload
+        uint32_t misses;                            //!< Lookups that required a CGRAM upload
+    };
+
+    /**
+     * @brief Bind a cache to an LCD and a glyph table. All slots are considered empty.
+     *
+     * @param cache Cache descriptor
+     * @param lcd LCD descriptor (5x8 font only)
+     * @param table Glyph bitmaps, must outlive the cache
+     * @param table_len Number of glyphs (IDs 0..table_len-1, less than MY_LCD_GLYPH_EMPTY_SLOT)
+     * @return `ESP_OK` on success, `ESP_ERR_NOT_SUPPORTED` for 5x10 font
+     */
+    esp_err_t glyph_cache_init(glyph_cache_t* cache, const hd44780_t* lcd, const glyph_bitmap_t* table, size_t table_len);
+
+    /**
+     * @brief Get the character code to print for a glyph, uploading it into the least recently used slot on a miss.
+     *
+     * An upload moves the cursor to (0, 0), so resolve all glyphs of a frame before positioning the cursor and printing.
+     * Glyphs resolved within one frame are never evicted by each other as long as there are no more than 8 of them.
+     *
+     * @param cache Cache descriptor
+     * @param glyph Glyph ID
+     * @param code Character code (0..7) to be passed to putc (output)
+     * @return `ESP_OK` on success
+     */
+    esp_err_t glyph_cache_get(glyph_cache_t* cache, uint8_t glyph, char* code);
+
+    /**
+     * @brief Forget the contents of all slots (call after the LCD has been re-initialized or power-cycled)
+     *
+     * @param cache Cache descriptor
+     */
+    void glyph_cache_invalidate(glyph_cache_t* cache);
+} // namespace my_lcd
@@ -16,6 +16,9 @@
 #include <stdint.h>
 
 #define MAX_REGISTERS 255
+#define MB_DIAG_TASKS 9
+#define MB_JOURNAL_WINDOW_RECORDS 4
+#define MB_JOURNAL_RECORD_REGS 8
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,7 +61,33 @@ typedef struct
     float vlim_man;
     float vpwr;
     float dac_vlim;
-    uint16_t data_block1[MAX_REGISTERS - 2 * 4];
+    uint16_t cal_active; // Calibration table capture status
+    uint16_t cal_index;
+    uint16_t cal_count;
+    float cal_fit_gain; // Last calibration sweep result
+    float cal_fit_offset;
+    float cal_fit_rms_residual; // LSB
+    float cal_fit_max_residual; // LSB
+    uint16_t cal_fit_result; // esp_err_t of the last sweep
+    uint32_t diag_uptime_s; // Diagnostics block, updated every CONFIG_PERF_SAMPLE_PERIOD_MS
+    uint32_t diag_dac_writes;
+    uint32_t diag_lcd_bytes;
+    uint32_t diag_mb_requests;
+    uint32_t diag_nvs_writes; // NVS entries written
+    uint32_t diag_free_heap;
+    uint32_t diag_min_free_heap;
+    uint32_t diag_trace_events;
+    uint16_t diag_task_cpu_permille[MB_DIAG_TASKS]; // main, MY_MENU_task, mb_slave_loop, uart_console_parser, console_server, console_worker (pool total), params_flush, IDLE0, IDLE1
+    uint16_t diag_task_stack_free[MB_DIAG_TASKS]; // Bytes, same order
+    uint32_t journal_head_seq; // Event journal export: newest record in flash (0 = empty)
+    uint32_t journal_window_seq; // First record in journal_window, the oldest kept at or after journal_read_seq (0 = none)
+    uint16_t journal_window[MB_JOURNAL_WINDOW_RECORDS * MB_JOURNAL_RECORD_REGS]; // journal::record_t (16 bytes each), unused records are 0
+    uint64_t sync_time_us; // Master clock when power_man..dac_vlim were last updated (0 = not synchronized)
+    int32_t sync_drift_ppb; // Device clock rate error against the master
+    uint32_t sync_rtt_us; // Shortest sync round trip in the estimation window
+    uint16_t sync_state; // timesync::states: 0 = none, 1 = synchronized, 2 = stale
+    uint16_t sync_samples; // Exchanges used by the estimate
+    uint16_t data_block1[MAX_REGISTERS - 2 * 8 - 4 - 2 * 8 - 2 * MB_DIAG_TASKS - 4 - MB_JOURNAL_WINDOW_RECORDS * MB_JOURNAL_RECORD_REGS - 10];
 } input_reg_params_t;
 #pragma pack(pop)
 
@@ -67,7 +96,17 @@ typedef struct
 {
     float power_setpoint;
     float vlim_setpoint;
-    uint16_t test_regs[MAX_REGISTERS - 2 * 2];
+    float cal_measurement; // Calibration table capture/sweep: measured output, posted by coil 2
+    uint16_t cal_channel; // Calibration table capture/sweep parameters, start by coil 1
+    uint16_t cal_code_from;
+    uint16_t cal_code_to;
+    uint16_t cal_points;
+    uint16_t cal_settle_ms; // Calibration sweep settle time, start by coil 3 (0 = default)
+    uint32_t journal_read_seq; // Event journal export: first record wanted in journal_window
+    uint64_t sync_master_us; // Time sync exchange: master clock when the request was sent, us (Unix epoch)
+    uint32_t sync_prev_rtt_us; // Round trip of the previous exchange as measured by the master (0 = unknown)
+    uint16_t sync_seq; // Exchange number, written last in the same request: completes the exchange
+    uint16_t test_regs[MAX_REGISTERS - 2 * 3 - 5 - 2 - 7];
 } holding_reg_params_t;
 #pragma pack(pop)
 
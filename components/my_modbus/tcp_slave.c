@@ -38,8 +38,10 @@ void slave_operation_func(void *arg)
     for(;;) {
         // Check for read/write events of Modbus master for certain events
         (void)mbc_slave_check_event(slave_handle, MB_READ_WRITE_MASK);
-        ESP_ERROR_CHECK_WITHOUT_ABORT(mbc_slave_get_param_info(slave_handle, &reg_info, MB_PAR_INFO_GET_TOUT));
-        if ((reg_info.type != MB_EVENT_NO_EVENTS) && (mb_event_handler_func)) mb_event_handler_func(&reg_info);
+        // Events of several requests wake this loop once: take every queued notification, so that they don't lag behind
+        for (uint32_t tout = MB_PAR_INFO_GET_TOUT; mbc_slave_get_param_info(slave_handle, &reg_info, tout) == ESP_OK; tout = 0) {
+            if ((reg_info.type != MB_EVENT_NO_EVENTS) && (mb_event_handler_func)) mb_event_handler_func(&reg_info);
+        }
     }
 }
 
@@ -76,7 +78,7 @@ esp_err_t slave_init(mb_communication_info_t* comm_info, void (*event_handler_fu
     // Initialization of Input Registers area
     reg_area.type = MB_PARAM_INPUT;
     reg_area.start_offset = MB_REG_INPUT_START_AREA0;
-    reg_area.address = (void*)&(input_reg_params.data_block1[0]);
+    reg_area.address = (void*)&input_reg_params;
     reg_area.size = sizeof(input_reg_params);
     err = mbc_slave_set_descriptor(slave_handle, reg_area);
     MB_RETURN_ON_FALSE((err == ESP_OK), ESP_ERR_INVALID_STATE,
@@ -0,0 +1,58 @@
+/**
+ * @file ESP32Encoder.h
+ * @author MSU
+ * @brief Host simulation shim: PCNT quadrature counter. The simulation turns the knob with sim_turn (counts, signed).
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+enum puType
+{
+    up,
+    down,
+    none
+};
+
+class ESP32Encoder
+{
+public:
+    static inline puType useInternalWeakPullResistors = puType::down;
+
+    void attachHalfQuad(int a, int b)
+    {
+        (void)a;
+        (void)b;
+    }
+    void attachFullQuad(int a, int b)
+    {
+        (void)a;
+        (void)b;
+    }
+    int64_t getCount()
+    {
+        return sim_count;
+    }
+    int64_t clearCount()
+    {
+        return sim_count = 0;
+    }
+    int64_t setCount(int64_t v)
+    {
+        return sim_count = v;
+    }
+    void setFilter(uint16_t v)
+    {
+        (void)v;
+    }
+
+    static void sim_turn(int64_t counts)
+    {
+        sim_count += counts;
+    }
+
+private:
+    static inline int64_t sim_count = 0;
+};
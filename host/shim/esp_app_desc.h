@@ -0,0 +1,20 @@
+/**
+ * @file esp_app_desc.h
+ * @author MSU
+ * @brief Host simulation shim: application description. The simulation has no firmware image, its ELF SHA-256 is all zeros.
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int esp_app_get_elf_sha256(char* dst, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+/**
+ * @file esp_console.h
+ * @author MSU
+ * @brief Host simulation shim: console command descriptor (the debug console itself is not part of the simulation)
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef int (*esp_console_cmd_func_t)(int argc, char** argv);
+
+typedef struct
+{
+    const char* command;
+    const char* help;
+    const char* hint;
+    esp_console_cmd_func_t func;
+    void* argtable;
+} esp_console_cmd_t;
@@ -0,0 +1,22 @@
+/**
+ * @file esp_cpu.h
+ * @author MSU
+ * @brief Host simulation shim: CPU cycle counter. Counts simulated busy waits (virtual time) plus the host CPU time
+ * of the simulation thread, both scaled to the target CPU clock (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ).
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t esp_cpu_get_cycle_count(void);
+int esp_cpu_get_core_id(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+/**
+ * @file esp_event.h
+ * @author MSU
+ * @brief Host simulation shim: event loop types
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef const char* esp_event_base_t;
@@ -0,0 +1,32 @@
+/**
+ * @file esp_heap_caps.h
+ * @author MSU
+ * @brief Host simulation shim: heap statistics. The host allocator's in-use bytes are reported against a fixed
+ * heap size (SIM_HEAP_SIZE), capabilities are ignored. Simulated task stacks are much larger than on the target,
+ * so only changes of the free size are meaningful.
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_HEAP_SIZE (64u * 1024u * 1024u)
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps); ///< The free size, fragmentation isn't modelled
+size_t heap_caps_get_total_size(uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file esp_memory_utils.h
+ * @author MSU
+ * @brief Host simulation shim: memory region checks. The executable's read-only image stands in for flash (DROM).
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool esp_ptr_in_drom(const void* p);
+
+#ifdef __cplusplus
+}
+#endif
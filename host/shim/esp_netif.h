@@ -0,0 +1,12 @@
+/**
+ * @file esp_netif.h
+ * @author MSU
+ * @brief Host simulation shim: network interface handle (the simulation has no network stack)
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include "esp_err.h"
+
+typedef struct esp_netif_obj esp_netif_t;
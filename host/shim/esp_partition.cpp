@@ -0,0 +1,93 @@
+/**
+ * @file esp_partition.cpp
+ * @author MSU
+ * @brief Host simulation shim: RAM-backed data partitions. Nothing persists between runs.
+ * @date 2026-10-16
+ *
+ */
+
+#include "esp_partition.h"
+
+#include <string.h>
+
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+struct sim_partition_t
+{
+    esp_partition_t info;
+    uint8_t* data;
+};
+
+static uint8_t journal_data[0x40000];
+/// @brief Same labels, subtypes and sizes as partitions.csv
+static sim_partition_t partitions[] = {
+    { .info = { .flash_chip = NULL, .type = ESP_PARTITION_TYPE_DATA, .subtype = static_cast<esp_partition_subtype_t>(0x41),
+        .address = 0x37F000, .size = sizeof(journal_data), .erase_size = SIM_FLASH_SECTOR_SIZE, .label = "journal",
+        .encrypted = false, .readonly = false }, .data = journal_data }
+};
+static bool erased = false;
+
+static sim_partition_t* find(const esp_partition_t* p)
+{
+    for (auto&& i : partitions)
+    {
+        if (&(i.info) == p) return &i;
+    }
+    return NULL;
+}
+static bool in_range(const esp_partition_t* p, size_t offset, size_t size)
+{
+    return (offset <= p->size) && (size <= p->size - offset);
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    if (!erased)
+    {
+        for (auto&& i : partitions) memset(i.data, 0xFF, i.info.size);
+        erased = true;
+    }
+    for (auto&& i : partitions)
+    {
+        if (i.info.type != type) continue;
+        if ((subtype != ESP_PARTITION_SUBTYPE_ANY) && (i.info.subtype != subtype)) continue;
+        if (label && strcmp(label, i.info.label)) continue;
+        return &(i.info);
+    }
+    return NULL;
+}
+esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset, void* dst, size_t size)
+{
+    sim_partition_t* s = find(p);
+    if (!s || !in_range(p, offset, size)) return ESP_ERR_INVALID_ARG;
+    memcpy(dst, s->data + offset, size);
+    return ESP_OK;
+}
+esp_err_t esp_partition_write(const esp_partition_t* p, size_t offset, const void* src, size_t size)
+{
+    sim_partition_t* s = find(p);
+    if (!s || !in_range(p, offset, size)) return ESP_ERR_INVALID_ARG;
+    const uint8_t* b = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) s->data[offset + i] &= b[i]; // Programming only clears bits
+    return ESP_OK;
+}
+esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t offset, size_t size)
+{
+    sim_partition_t* s = find(p);
+    if (!s || !in_range(p, offset, size)) return ESP_ERR_INVALID_ARG;
+    if ((offset % p->erase_size) || (size % p->erase_size)) return ESP_ERR_INVALID_SIZE;
+    memset(s->data + offset, 0xFF, size);
+    return ESP_OK;
+}
+esp_err_t esp_partition_mmap(const esp_partition_t* p, size_t offset, size_t size, esp_partition_mmap_memory_t memory,
+    const void** out_ptr, esp_partition_mmap_handle_t* out_handle)
+{
+    sim_partition_t* s = find(p);
+    if (!s || !in_range(p, offset, size)) return ESP_ERR_INVALID_ARG;
+    *out_ptr = s->data + offset;
+    *out_handle = 0;
+    return ESP_OK;
+}
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
@@ -0,0 +1,174 @@
+/**
+ * @file esp_system.cpp
+ * @author MSU
+ * @brief Host simulation shim: error names, logging, ROM routines and restart
+ * @date 2026-10-16
+ *
+ */
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "esp_app_desc.h"
+#include "rom/ets_sys.h"
+#include "rom/crc.h"
+
+#include "sim_kernel.h"
+
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <map>
+#include <string>
+
+static vprintf_like_t log_func = vprintf;
+static esp_log_level_t default_level = static_cast<esp_log_level_t>(CONFIG_LOG_DEFAULT_LEVEL);
+static std::map<std::string, esp_log_level_t> tag_levels;
+static size_t heap_min_free = SIM_HEAP_SIZE;
+static shutdown_handler_t shutdown_handlers[SIM_MAX_SHUTDOWN_HANDLERS];
+static size_t shutdown_handler_count = 0;
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_INVALID_MAC: return "ESP_ERR_INVALID_MAC";
+    case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+    case ESP_ERR_NOT_ALLOWED: return "ESP_ERR_NOT_ALLOWED";
+    default: return "UNKNOWN ERROR";
+    }
+}
+void sim_error_check_failed(esp_err_t rc, const char* file, int line, const char* function, const char* expression, int abort_on_error)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK%s failed: esp_err_t 0x%x (%s) at %lld us\nfile: \"%s\" line %d\nfunc: %s\nexpression: %s\n",
+        abort_on_error ? "" : "_WITHOUT_ABORT", rc, esp_err_to_name(rc), static_cast<long long>(sim_kernel::now_us()), file, line,
+        function, expression);
+    if (abort_on_error) abort();
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+    vprintf_like_t ret = log_func;
+    log_func = func;
+    return ret;
+}
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    if (!strcmp(tag, "*"))
+    {
+        default_level = level;
+        tag_levels.clear();
+        return;
+    }
+    tag_levels[tag] = level;
+}
+esp_log_level_t esp_log_level_get(const char* tag)
+{
+    auto it = tag_levels.find(tag);
+    return it == tag_levels.end() ? default_level : it->second;
+}
+uint32_t esp_log_timestamp(void)
+{
+    return static_cast<uint32_t>(sim_kernel::now_us() / 1000);
+}
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    if (level > esp_log_level_get(tag)) return;
+    va_list args;
+    va_start(args, format);
+    log_func(format, args);
+    va_end(args);
+}
+
+void ets_delay_us(uint32_t us)
+{
+    sim_kernel::advance_us(us);
+}
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    int64_t ns = sim_kernel::now_us() * 1000 + static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    return static_cast<uint32_t>(ns * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
+int esp_cpu_get_core_id(void)
+{
+    return 0;
+}
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    size_t used = mallinfo2().uordblks;
+    size_t free = used < SIM_HEAP_SIZE ? SIM_HEAP_SIZE - used : 0;
+    if (free < heap_min_free) heap_min_free = free;
+    return free;
+}
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    heap_caps_get_free_size(caps);
+    return heap_min_free;
+}
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    return SIM_HEAP_SIZE;
+}
+/// @brief The executable's read-only image (code, .rodata) stands in for flash; .data, .bss, heap and stacks are excluded
+bool esp_ptr_in_drom(const void* p)
+{
+    extern char __executable_start, __data_start;
+    return (p >= &__executable_start) && (p < &__data_start);
+}
+/// @brief Log decoders skip the ELF check for an all-zero SHA
+int esp_app_get_elf_sha256(char* dst, size_t size)
+{
+    if (!size) return 0;
+    size_t n = (size - 1 < 64) ? size - 1 : 64;
+    memset(dst, '0', n);
+    dst[n] = '\0';
+    return static_cast<int>(n + 1);
+}
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    if (shutdown_handler_count >= SIM_MAX_SHUTDOWN_HANDLERS) return ESP_ERR_NO_MEM;
+    shutdown_handlers[shutdown_handler_count++] = handler;
+    return ESP_OK;
+}
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+void esp_restart(void)
+{
+    for (size_t i = shutdown_handler_count; i > 0; i--) shutdown_handlers[i - 1]();
+    printf("Restart requested at %lld us, simulation ends\n", static_cast<long long>(sim_kernel::now_us()));
+    fflush(stdout);
+    exit(0);
+}
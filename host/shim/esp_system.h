@@ -0,0 +1,39 @@
+/**
+ * @file esp_system.h
+ * @author MSU
+ * @brief Host simulation shim: system API
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_SHUTDOWN_HANDLERS 8
+
+typedef void (*shutdown_handler_t)(void);
+
+typedef enum
+{
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC
+} esp_reset_reason_t;
+
+/// @brief Handlers run in esp_restart(), last registered first
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+void esp_restart(void) __attribute__((noreturn));
+/// @brief Every simulation run starts from power-on
+esp_reset_reason_t esp_reset_reason(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,136 @@
+/**
+ * @file esp_timer.cpp
+ * @author MSU
+ * @brief Host simulation shim: esp_timer. Alarms are served by the "esp_timer" task (priority 22, as on the target)
+ * in deadline order, ties in creation order.
+ * @date 2026-10-16
+ *
+ */
+
+#include "esp_timer.h"
+
+#include "sim_kernel.h"
+
+#include <vector>
+
+#define SIM_ESP_TIMER_TASK_PRIORITY 22
+#define SIM_ESP_TIMER_INACTIVE INT64_MAX
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+    bool skip_unhandled_events;
+    int64_t alarm_us;
+    int64_t period_us; ///< 0 == one-shot
+};
+
+static std::vector<esp_timer*> timers;
+static TaskHandle_t timer_task_handle = NULL;
+
+static esp_timer* next_due()
+{
+    esp_timer* ret = NULL;
+    for (auto t : timers)
+    {
+        if (t->alarm_us != SIM_ESP_TIMER_INACTIVE && (!ret || t->alarm_us < ret->alarm_us)) ret = t;
+    }
+    return ret;
+}
+static void timer_task(void* arg)
+{
+    for (;;)
+    {
+        esp_timer* t = next_due();
+        int64_t now = sim_kernel::now_us();
+        if (!t || t->alarm_us > now)
+        {
+            sim_kernel::block_on(&timers, t ? t->alarm_us : SIM_ESP_TIMER_INACTIVE);
+            continue;
+        }
+        if (t->period_us)
+        {
+            t->alarm_us += t->period_us;
+            // Missed periods are dropped rather than replayed back to back
+            if (t->skip_unhandled_events && t->alarm_us <= now) t->alarm_us = now + t->period_us;
+        }
+        else
+        {
+            t->alarm_us = SIM_ESP_TIMER_INACTIVE;
+        }
+        t->callback(t->arg);
+    }
+}
+static esp_err_t arm(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (!timer) return ESP_ERR_INVALID_ARG;
+    if (timer->alarm_us != SIM_ESP_TIMER_INACTIVE) return ESP_ERR_INVALID_STATE;
+    timer->alarm_us = sim_kernel::now_us() + static_cast<int64_t>(timeout_us);
+    timer->period_us = static_cast<int64_t>(period_us);
+    sim_kernel::wake_waiters(&timers);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle)
+{
+    if (!args || !args->callback || !out_handle) return ESP_ERR_INVALID_ARG;
+    if (!timer_task_handle)
+    {
+        assert(xTaskCreate(timer_task, "esp_timer", CONFIG_ESP_TIMER_TASK_STACK_SIZE, NULL, SIM_ESP_TIMER_TASK_PRIORITY,
+            &timer_task_handle) == pdPASS);
+    }
+    esp_timer* t = new esp_timer { .callback = args->callback, .arg = args->arg, .name = args->name,
+        .skip_unhandled_events = args->skip_unhandled_events, .alarm_us = SIM_ESP_TIMER_INACTIVE, .period_us = 0 };
+    timers.push_back(t);
+    *out_handle = t;
+    return ESP_OK;
+}
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return arm(timer, timeout_us, 0);
+}
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (!period) return ESP_ERR_INVALID_ARG;
+    return arm(timer, period, period);
+}
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (!timer) return ESP_ERR_INVALID_ARG;
+    if (timer->alarm_us == SIM_ESP_TIMER_INACTIVE) return ESP_ERR_INVALID_STATE;
+    uint64_t period = timer->period_us ? timeout_us : 0;
+    timer->alarm_us = SIM_ESP_TIMER_INACTIVE;
+    return arm(timer, timeout_us, period);
+}
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer) return ESP_ERR_INVALID_ARG;
+    if (timer->alarm_us == SIM_ESP_TIMER_INACTIVE) return ESP_ERR_INVALID_STATE;
+    timer->alarm_us = SIM_ESP_TIMER_INACTIVE;
+    sim_kernel::wake_waiters(&timers);
+    return ESP_OK;
+}
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (!timer) return ESP_ERR_INVALID_ARG;
+    if (timer->alarm_us != SIM_ESP_TIMER_INACTIVE) return ESP_ERR_INVALID_STATE;
+    for (auto it = timers.begin(); it != timers.end(); it++)
+    {
+        if (*it == timer)
+        {
+            timers.erase(it);
+            break;
+        }
+    }
+    delete timer;
+    return ESP_OK;
+}
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer && timer->alarm_us != SIM_ESP_TIMER_INACTIVE;
+}
+int64_t esp_timer_get_time(void)
+{
+    return sim_kernel::now_us();
+}
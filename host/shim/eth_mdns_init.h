@@ -0,0 +1,17 @@
+/**
+ * @file eth_mdns_init.h
+ * @author MSU
+ * @brief Host simulation shim: mDNS service registration is a no-op
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define MDNS_MAX_HOSTNAME_LEN 64
+
+static inline void mdns_start_service(const char* hostname, const char* version) { (void)hostname; (void)version; }
+static inline void mdns_register_modbus(int port, uint32_t slave_id) { (void)port; (void)slave_id; }
+static inline void mdns_register_console(int port) { (void)port; }
+static inline void mdns_register_echo(int port) { (void)port; }
@@ -0,0 +1,775 @@
+/**
+ * @file freertos.cpp
+ * @author MSU
+ * @brief Host simulation shim: FreeRTOS kernel objects on top of a deterministic coroutine scheduler (ucontext).
+ * Blocking calls park the calling task on a wait object with an absolute virtual deadline; state changes wake all waiters
+ * of the object, which then re-check their condition. When no task is ready, virtual time jumps to the nearest deadline.
+ * Not modeled: multiple cores, mutex priority inheritance, time slicing (equal priorities rotate only at blocking points).
+ * @date 2026-10-16
+ *
+ */
+
+#include "sim_kernel.h"
+
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+#include <ucontext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** Host stack per task: firmware stack sizes are far too small for glibc printf, so they are only used as a lower bound */
+#define SIM_MIN_STACK_SIZE (256 * 1024)
+#define SIM_NEVER INT64_MAX
+#define SIM_TICK_US (1000000 / configTICK_RATE_HZ)
+
+enum sim_task_states
+{
+    TASK_READY,
+    TASK_BLOCKED,
+    TASK_DELETED
+};
+
+struct sim_task_t
+{
+    ucontext_t ctx;
+    void* stack;
+    size_t stack_size;
+    char name[16];
+    UBaseType_t prio;
+    TaskFunction_t fn;
+    void* arg;
+    sim_task_states state;
+    const void* wait_obj;
+    int64_t wake_us;
+    bool timed_out;
+    uint64_t last_run_seq; ///< Round robin among equal priorities: the task that ran least recently goes first
+    uint32_t notify_value[configTASK_NOTIFICATION_ARRAY_ENTRIES];
+    bool notify_pending[configTASK_NOTIFICATION_ARRAY_ENTRIES];
+    int64_t cpu_us;
+    uint32_t switches;
+};
+
+enum sim_queue_types
+{
+    QUEUE_PLAIN,
+    QUEUE_MUTEX,
+    QUEUE_RECURSIVE_MUTEX,
+    QUEUE_SEMAPHORE
+};
+
+struct sim_queue_t
+{
+    sim_queue_types type;
+    uint8_t* buf;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t count;
+    UBaseType_t head;
+    TaskHandle_t holder; ///< Mutex owner
+    UBaseType_t recursion;
+};
+
+struct sim_event_group_t
+{
+    EventBits_t bits;
+};
+
+static std::vector<sim_task_t*> tasks;
+static sim_task_t* current = NULL;
+static ucontext_t scheduler_ctx;
+static int64_t virtual_now_us = 0;
+static uint64_t run_seq = 0;
+static bool stopped = false;
+static int suspend_all = 0;
+
+static void switch_to_scheduler()
+{
+    sim_task_t* t = current;
+    assert(t && "Blocking call outside of a task");
+    swapcontext(&(t->ctx), &scheduler_ctx);
+}
+/// @brief Switch out if a ready task has a higher priority than the running one (preemption at API boundaries)
+static void maybe_preempt()
+{
+    if (!current || suspend_all) return;
+    for (auto t : tasks)
+    {
+        if (t->state == TASK_READY && t->prio > current->prio)
+        {
+            switch_to_scheduler();
+            return;
+        }
+    }
+}
+static void task_entry()
+{
+    sim_task_t* t = current;
+    t->fn(t->arg);
+    // Returning from a task function is a bug in FreeRTOS, here it just ends the task
+    vTaskDelete(NULL);
+}
+static void wake_expired()
+{
+    for (auto t : tasks)
+    {
+        if (t->state == TASK_BLOCKED && t->wake_us <= virtual_now_us)
+        {
+            t->state = TASK_READY;
+            t->wait_obj = NULL;
+            t->timed_out = true;
+        }
+    }
+}
+static sim_task_t* pick_ready()
+{
+    sim_task_t* best = NULL;
+    for (auto t : tasks)
+    {
+        if (t->state != TASK_READY) continue;
+        if (!best || t->prio > best->prio || (t->prio == best->prio && t->last_run_seq < best->last_run_seq)) best = t;
+    }
+    return best;
+}
+static void reap_deleted()
+{
+    for (auto t : tasks)
+    {
+        if (t->state == TASK_DELETED && t->stack && t != current)
+        {
+            free(t->stack);
+            t->stack = NULL;
+        }
+    }
+}
+static sim_task_t* resolve(TaskHandle_t task)
+{
+    return task ? task : current;
+}
+
+namespace sim_kernel
+{
+    int64_t now_us()
+    {
+        return virtual_now_us;
+    }
+    /// @brief Consume virtual CPU time in the running context (busy wait, modeled execution cost)
+    void advance_us(int64_t us)
+    {
+        if (us <= 0) return;
+        virtual_now_us += us;
+        if (current) current->cpu_us += us;
+    }
+    bool in_task()
+    {
+        return current != NULL;
+    }
+    /// @brief Run the scheduler from the host main thread
+    /// @param until_us Virtual time to stop at (stop() ends the run earlier)
+    void run(int64_t until_us)
+    {
+        stopped = false;
+        while (!stopped && virtual_now_us < until_us)
+        {
+            wake_expired();
+            sim_task_t* t = pick_ready();
+            if (!t)
+            {
+                int64_t next = SIM_NEVER;
+                for (auto b : tasks)
+                {
+                    if (b->state == TASK_BLOCKED && b->wake_us < next) next = b->wake_us;
+                }
+                if (next == SIM_NEVER || next > until_us)
+                {
+                    virtual_now_us = until_us;
+                    break;
+                }
+                if (next > virtual_now_us) virtual_now_us = next;
+                continue;
+            }
+            current = t;
+            t->last_run_seq = ++run_seq;
+            t->switches++;
+            swapcontext(&scheduler_ctx, &(t->ctx));
+            current = NULL;
+            reap_deleted();
+        }
+    }
+    /// @brief End run() at the next scheduling point
+    void stop()
+    {
+        stopped = true;
+        if (current) switch_to_scheduler();
+    }
+    bool is_stopped()
+    {
+        return stopped;
+    }
+    /// @brief Make all tasks blocked on an object ready (they re-check their wait condition)
+    void wake_waiters(const void* obj)
+    {
+        for (auto t : tasks)
+        {
+            if (t->state == TASK_BLOCKED && t->wait_obj == obj)
+            {
+                t->state = TASK_READY;
+                t->wait_obj = NULL;
+                t->timed_out = false;
+            }
+        }
+        maybe_preempt();
+    }
+    /// @brief Block the running task on an object
+    /// @param obj Wait object (any address), NULL == just sleep
+    /// @param deadline_us Absolute virtual time, SIM_NEVER == forever
+    /// @return False if the deadline has passed
+    bool block_on(const void* obj, int64_t deadline_us)
+    {
+        if (deadline_us <= virtual_now_us) return false;
+        current->state = TASK_BLOCKED;
+        current->wait_obj = obj;
+        current->wake_us = deadline_us;
+        current->timed_out = false;
+        switch_to_scheduler();
+        return !current->timed_out;
+    }
+    int64_t ticks_to_deadline(TickType_t ticks)
+    {
+        if (ticks == portMAX_DELAY) return SIM_NEVER;
+        return virtual_now_us + static_cast<int64_t>(ticks) * SIM_TICK_US;
+    }
+    size_t get_task_stats(task_stats_t* out, size_t max)
+    {
+        size_t n = 0;
+        for (auto t : tasks)
+        {
+            if (n >= max) break;
+            out[n++] = { .name = t->name, .prio = t->prio, .cpu_us = t->cpu_us, .switches = t->switches, .deleted = t->state == TASK_DELETED };
+        }
+        return n;
+    }
+} // namespace sim_kernel
+
+using sim_kernel::ticks_to_deadline;
+using sim_kernel::block_on;
+using sim_kernel::wake_waiters;
+
+/**
+ * Tasks
+ */
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+BaseType_t xPortInIsrContext(void)
+{
+    return current ? pdFALSE : pdTRUE;
+}
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg, UBaseType_t prio,
+    TaskHandle_t* handle, BaseType_t core)
+{
+    sim_task_t* t = static_cast<sim_task_t*>(calloc(1, sizeof(sim_task_t)));
+    if (!t) return pdFAIL;
+    t->stack_size = stack_depth * 16 > SIM_MIN_STACK_SIZE ? stack_depth * 16 : SIM_MIN_STACK_SIZE;
+    t->stack = malloc(t->stack_size);
+    if (!t->stack)
+    {
+        free(t);
+        return pdFAIL;
+    }
+    strncpy(t->name, name ? name : "", sizeof(t->name) - 1);
+    t->prio = prio < configMAX_PRIORITIES ? prio : configMAX_PRIORITIES - 1;
+    t->fn = fn;
+    t->arg = arg;
+    t->state = TASK_READY;
+    t->last_run_seq = 0;
+    getcontext(&(t->ctx));
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = t->stack_size;
+    t->ctx.uc_link = &scheduler_ctx;
+    makecontext(&(t->ctx), task_entry, 0);
+    tasks.push_back(t);
+    if (handle) *handle = t;
+    maybe_preempt();
+    return pdPASS;
+}
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg, UBaseType_t prio,
+    StackType_t* stack, StaticTask_t* tcb, BaseType_t core)
+{
+    // Host stacks are always allocated by the kernel, the static buffers only have to exist
+    assert(stack && tcb);
+    TaskHandle_t h = NULL;
+    xTaskCreatePinnedToCore(fn, name, stack_depth, arg, prio, &h, core);
+    return h;
+}
+void vTaskDelete(TaskHandle_t task)
+{
+    sim_task_t* t = resolve(task);
+    assert(t);
+    t->state = TASK_DELETED;
+    t->wait_obj = NULL;
+    if (t == current) switch_to_scheduler(); // Never returns, the stack is freed by the scheduler
+}
+void vTaskDelay(TickType_t ticks)
+{
+    if (!ticks)
+    {
+        sim_task_yield();
+        return;
+    }
+    block_on(NULL, ticks_to_deadline(ticks));
+}
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake, TickType_t increment)
+{
+    TickType_t wake = *previous_wake + increment;
+    *previous_wake = wake;
+    TickType_t now = xTaskGetTickCount();
+    if (static_cast<int32_t>(wake - now) <= 0) return pdFALSE;
+    block_on(NULL, static_cast<int64_t>(wake) * SIM_TICK_US);
+    return pdTRUE;
+}
+TickType_t xTaskGetTickCount(void)
+{
+    return static_cast<TickType_t>(virtual_now_us / SIM_TICK_US);
+}
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current;
+}
+const char* pcTaskGetName(TaskHandle_t task)
+{
+    sim_task_t* t = resolve(task);
+    return t ? t->name : "";
+}
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t prio)
+{
+    sim_task_t* t = resolve(task);
+    assert(t);
+    t->prio = prio < configMAX_PRIORITIES ? prio : configMAX_PRIORITIES - 1;
+    maybe_preempt();
+}
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    sim_task_t* t = resolve(task);
+    return t ? t->prio : 0;
+}
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    sim_task_t* t = resolve(task);
+    return t ? static_cast<UBaseType_t>(t->stack_size) : 0;
+}
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    UBaseType_t n = 0;
+    for (auto t : tasks) n += (t->state != TASK_DELETED);
+    return n;
+}
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t len, uint32_t* total_run_time)
+{
+    UBaseType_t n = 0;
+    for (size_t i = 0; i < tasks.size() && n < len; i++)
+    {
+        sim_task_t* t = tasks[i];
+        if (t->state == TASK_DELETED) continue;
+        status[n++] = {
+            .xHandle = t,
+            .pcTaskName = t->name,
+            .xTaskNumber = static_cast<UBaseType_t>(i),
+            .eCurrentState = t == current ? eRunning : (t->state == TASK_READY ? eReady : eBlocked),
+            .uxCurrentPriority = t->prio,
+            .uxBasePriority = t->prio,
+            .ulRunTimeCounter = static_cast<uint32_t>(t->cpu_us),
+            .pxStackBase = static_cast<StackType_t*>(t->stack),
+            .usStackHighWaterMark = static_cast<uint32_t>(t->stack_size),
+            .xCoreID = 0
+        };
+    }
+    if (total_run_time) *total_run_time = static_cast<uint32_t>(virtual_now_us);
+    return n;
+}
+void vTaskSuspendAll(void)
+{
+    suspend_all++;
+}
+BaseType_t xTaskResumeAll(void)
+{
+    assert(suspend_all > 0);
+    suspend_all--;
+    maybe_preempt();
+    return pdFALSE;
+}
+void sim_task_yield(void)
+{
+    if (!current) return;
+    switch_to_scheduler();
+}
+
+/**
+ * Task notifications
+ */
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear_on_exit, TickType_t ticks)
+{
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    int64_t deadline = ticks_to_deadline(ticks);
+    for (;;)
+    {
+        if (current->notify_value[index])
+        {
+            uint32_t ret = current->notify_value[index];
+            current->notify_value[index] = clear_on_exit ? 0 : ret - 1;
+            current->notify_pending[index] = false;
+            return ret;
+        }
+        if (!block_on(&(current->notify_value[index]), deadline)) return 0;
+    }
+}
+BaseType_t xTaskNotifyIndexed(TaskHandle_t task, UBaseType_t index, uint32_t value, eNotifyAction action)
+{
+    assert(task);
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    BaseType_t ret = pdPASS;
+    switch (action)
+    {
+    case eSetBits:
+        task->notify_value[index] |= value;
+        break;
+    case eIncrement:
+        task->notify_value[index]++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notify_value[index] = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notify_pending[index]) ret = pdFAIL;
+        else task->notify_value[index] = value;
+        break;
+    default:
+        break;
+    }
+    task->notify_pending[index] = true;
+    wake_waiters(&(task->notify_value[index]));
+    return ret;
+}
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_prio_woken)
+{
+    xTaskNotifyGive(task);
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+}
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* higher_prio_woken)
+{
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+    return xTaskNotify(task, value, action);
+}
+BaseType_t xTaskNotifyWaitIndexed(UBaseType_t index, uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t ticks)
+{
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    int64_t deadline = ticks_to_deadline(ticks);
+    if (!current->notify_pending[index]) current->notify_value[index] &= ~clear_on_entry;
+    for (;;)
+    {
+        if (current->notify_pending[index])
+        {
+            if (value) *value = current->notify_value[index];
+            current->notify_value[index] &= ~clear_on_exit;
+            current->notify_pending[index] = false;
+            return pdTRUE;
+        }
+        if (!block_on(&(current->notify_value[index]), deadline))
+        {
+            if (value) *value = current->notify_value[index];
+            return pdFALSE;
+        }
+    }
+}
+BaseType_t xTaskNotifyStateClearIndexed(TaskHandle_t task, UBaseType_t index)
+{
+    sim_task_t* t = task ? task : current;
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    BaseType_t ret = t->notify_pending[index] ? pdTRUE : pdFALSE;
+    t->notify_pending[index] = false;
+    return ret;
+}
+
+/**
+ * Queues and semaphores
+ */
+
+static QueueHandle_t queue_new(sim_queue_types type, UBaseType_t length, UBaseType_t item_size)
+{
+    sim_queue_t* q = static_cast<sim_queue_t*>(calloc(1, sizeof(sim_queue_t)));
+    assert(q);
+    q->type = type;
+    q->length = length;
+    q->item_size = item_size;
+    if (item_size)
+    {
+        q->buf = static_cast<uint8_t*>(calloc(length, item_size));
+        assert(q->buf);
+    }
+    return q;
+}
+/// @brief Put an item without blocking
+static bool queue_put(QueueHandle_t q, const void* item, bool front)
+{
+    if (q->count >= q->length) return false;
+    if (q->item_size)
+    {
+        UBaseType_t slot;
+        if (front)
+        {
+            q->head = (q->head + q->length - 1) % q->length;
+            slot = q->head;
+        }
+        else
+        {
+            slot = (q->head + q->count) % q->length;
+        }
+        if (item) memcpy(q->buf + slot * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    if (q->type == QUEUE_MUTEX || q->type == QUEUE_RECURSIVE_MUTEX) q->holder = NULL;
+    return true;
+}
+/// @brief Take an item without blocking
+static bool queue_get(QueueHandle_t q, void* item, bool peek)
+{
+    if (!q->count) return false;
+    if (q->item_size && item) memcpy(item, q->buf + q->head * q->item_size, q->item_size);
+    if (peek) return true;
+    if (q->item_size) q->head = (q->head + 1) % q->length;
+    q->count--;
+    if (q->type == QUEUE_MUTEX || q->type == QUEUE_RECURSIVE_MUTEX) q->holder = current;
+    return true;
+}
+static BaseType_t queue_receive(QueueHandle_t q, void* item, TickType_t ticks, bool peek)
+{
+    assert(q);
+    int64_t deadline = ticks_to_deadline(ticks);
+    for (;;)
+    {
+        if (queue_get(q, item, peek))
+        {
+            if (!peek) wake_waiters(q);
+            return pdTRUE;
+        }
+        if (!ticks || !current || !block_on(q, deadline)) return pdFALSE;
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return queue_new(QUEUE_PLAIN, length, item_size);
+}
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer)
+{
+    assert(buffer);
+    return queue_new(QUEUE_PLAIN, length, item_size);
+}
+void vQueueDelete(QueueHandle_t q)
+{
+    if (!q) return;
+    free(q->buf);
+    free(q);
+}
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void* item, TickType_t ticks, BaseType_t front)
+{
+    assert(q);
+    int64_t deadline = ticks_to_deadline(ticks);
+    for (;;)
+    {
+        if (queue_put(q, item, front))
+        {
+            wake_waiters(q);
+            return pdTRUE;
+        }
+        if (!ticks || !current || !block_on(q, deadline)) return errQUEUE_FULL;
+    }
+}
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* higher_prio_woken)
+{
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+    if (!queue_put(q, item, false)) return errQUEUE_FULL;
+    wake_waiters(q);
+    return pdTRUE;
+}
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void* item)
+{
+    assert(q && q->length == 1);
+    q->count = 0;
+    q->head = 0;
+    return xQueueGenericSend(q, item, 0, pdFALSE);
+}
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    return queue_receive(q, item, ticks, false);
+}
+BaseType_t xQueueReceiveFromISR(QueueHandle_t q, void* item, BaseType_t* higher_prio_woken)
+{
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+    return queue_receive(q, item, 0, false);
+}
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    return queue_receive(q, item, ticks, true);
+}
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    assert(q);
+    q->count = 0;
+    q->head = 0;
+    wake_waiters(q);
+    return pdPASS;
+}
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t q)
+{
+    return q->count;
+}
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t q)
+{
+    return q->length - q->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    QueueHandle_t q = queue_new(QUEUE_MUTEX, 1, 0);
+    q->count = 1;
+    return q;
+}
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer)
+{
+    assert(buffer);
+    return xSemaphoreCreateMutex();
+}
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    QueueHandle_t q = queue_new(QUEUE_RECURSIVE_MUTEX, 1, 0);
+    q->count = 1;
+    return q;
+}
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer)
+{
+    assert(buffer);
+    return xSemaphoreCreateRecursiveMutex();
+}
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_new(QUEUE_SEMAPHORE, 1, 0);
+}
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer)
+{
+    assert(buffer);
+    return xSemaphoreCreateBinary();
+}
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    QueueHandle_t q = queue_new(QUEUE_SEMAPHORE, max, 0);
+    q->count = initial;
+    return q;
+}
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+    return queue_receive(s, NULL, ticks, false);
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    assert(s);
+    if (s->type == QUEUE_MUTEX && s->holder != current) return pdFALSE;
+    return xQueueGenericSend(s, NULL, 0, pdFALSE);
+}
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks)
+{
+    assert(s && s->type == QUEUE_RECURSIVE_MUTEX);
+    if (s->holder == current && !s->count)
+    {
+        s->recursion++;
+        return pdTRUE;
+    }
+    BaseType_t ret = xSemaphoreTake(s, ticks);
+    if (ret == pdTRUE) s->recursion = 1;
+    return ret;
+}
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s)
+{
+    assert(s && s->type == QUEUE_RECURSIVE_MUTEX);
+    if (s->holder != current || !s->recursion) return pdFALSE;
+    if (--s->recursion) return pdTRUE;
+    return xQueueGenericSend(s, NULL, 0, pdFALSE);
+}
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t* higher_prio_woken)
+{
+    return xQueueSendFromISR(s, NULL, higher_prio_woken);
+}
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t s, BaseType_t* higher_prio_woken)
+{
+    return xQueueReceiveFromISR(s, NULL, higher_prio_woken);
+}
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s)
+{
+    return s->count;
+}
+
+/**
+ * Event groups
+ */
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return static_cast<EventGroupHandle_t>(calloc(1, sizeof(sim_event_group_t)));
+}
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* buffer)
+{
+    assert(buffer);
+    return xEventGroupCreate();
+}
+void vEventGroupDelete(EventGroupHandle_t g)
+{
+    free(g);
+}
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    g->bits |= bits;
+    EventBits_t ret = g->bits;
+    wake_waiters(g);
+    return ret;
+}
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    EventBits_t ret = g->bits;
+    g->bits &= ~bits;
+    return ret;
+}
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g)
+{
+    return g->bits;
+}
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks)
+{
+    int64_t deadline = ticks_to_deadline(ticks);
+    for (;;)
+    {
+        EventBits_t cur = g->bits;
+        bool done = wait_for_all ? ((cur & bits) == bits) : ((cur & bits) != 0);
+        if (done)
+        {
+            if (clear_on_exit) g->bits &= ~bits;
+            return cur;
+        }
+        if (!ticks || !block_on(g, deadline)) return g->bits;
+    }
+}
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t g, EventBits_t bits, BaseType_t* higher_prio_woken)
+{
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+    xEventGroupSetBits(g, bits);
+    return pdPASS;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_queue_t* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer);
+void vQueueDelete(QueueHandle_t q);
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void* item, TickType_t ticks, BaseType_t front);
+#define xQueueSend(q, item, ticks) xQueueGenericSend(q, item, ticks, pdFALSE)
+#define xQueueSendToBack(q, item, ticks) xQueueGenericSend(q, item, ticks, pdFALSE)
+#define xQueueSendToFront(q, item, ticks) xQueueGenericSend(q, item, ticks, pdTRUE)
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* higher_prio_woken);
+#define xQueueSendToBackFromISR(q, item, woken) xQueueSendFromISR(q, item, woken)
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void* item);
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t q, void* item, BaseType_t* higher_prio_woken);
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t q);
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t q);
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t q);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_task_t* TaskHandle_t;
+
+typedef enum
+{
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+typedef enum
+{
+    eRunning = 0,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid
+} eTaskState;
+
+typedef struct
+{
+    TaskHandle_t xHandle;
+    const char* pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    StackType_t* pxStackBase;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg, UBaseType_t prio,
+    TaskHandle_t* handle, BaseType_t core);
+#define xTaskCreate(fn, name, stack, arg, prio, handle) xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle, tskNO_AFFINITY)
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg, UBaseType_t prio,
+    StackType_t* stack, StaticTask_t* tcb, BaseType_t core);
+#define xTaskCreateStatic(fn, name, stack, arg, prio, stack_buf, tcb) \
+    xTaskCreateStaticPinnedToCore(fn, name, stack, arg, prio, stack_buf, tcb, tskNO_AFFINITY)
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake, TickType_t increment);
+#define vTaskDelayUntil(prev, inc) ((void)xTaskDelayUntil(prev, inc))
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char* pcTaskGetName(TaskHandle_t task);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t prio);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t len, uint32_t* total_run_time);
+void vTaskSuspendAll(void);
+BaseType_t xTaskResumeAll(void);
+void sim_task_yield(void);
+#define taskYIELD() sim_task_yield()
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyIndexed(TaskHandle_t task, UBaseType_t index, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWaitIndexed(UBaseType_t index, uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t ticks);
+BaseType_t xTaskNotifyStateClearIndexed(TaskHandle_t task, UBaseType_t index);
+#define ulTaskNotifyTake(clear, ticks) ulTaskNotifyTakeIndexed(0, clear, ticks)
+#define xTaskNotify(task, value, action) xTaskNotifyIndexed(task, 0, value, action)
+#define xTaskNotifyWait(clear_entry, clear_exit, value, ticks) xTaskNotifyWaitIndexed(0, clear_entry, clear_exit, value, ticks)
+#define xTaskNotifyStateClear(task) xTaskNotifyStateClearIndexed(task, 0)
+#define xTaskNotifyGiveIndexed(task, index) xTaskNotifyIndexed(task, index, 0, eIncrement)
+#define xTaskNotifyGive(task) xTaskNotifyGiveIndexed(task, 0)
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_prio_woken);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* higher_prio_woken);
+
+#ifdef __cplusplus
+}
+#endif
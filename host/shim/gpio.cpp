@@ -0,0 +1,135 @@
+/**
+ * @file gpio.cpp
+ * @author MSU
+ * @brief Host simulation shim: GPIO matrix state and edge interrupts
+ * @date 2026-10-16
+ *
+ */
+
+#include "driver/gpio.h"
+
+struct pin_state_t
+{
+    gpio_mode_t mode;
+    uint32_t level;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void* isr_arg;
+};
+
+static pin_state_t pins[GPIO_NUM_MAX] = {};
+static bool isr_service_installed = false;
+static sim_gpio_listener_t output_listener = NULL;
+
+static bool valid(gpio_num_t pin)
+{
+    return pin >= 0 && pin < GPIO_NUM_MAX;
+}
+static bool edge_matches(gpio_int_type_t t, uint32_t from, uint32_t to)
+{
+    switch (t)
+    {
+    case GPIO_INTR_POSEDGE:
+        return !from && to;
+    case GPIO_INTR_NEGEDGE:
+        return from && !to;
+    case GPIO_INTR_ANYEDGE:
+        return from != to;
+    case GPIO_INTR_LOW_LEVEL:
+        return !to;
+    case GPIO_INTR_HIGH_LEVEL:
+        return to;
+    default:
+        return false;
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t* cfg)
+{
+    if (!cfg) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < GPIO_NUM_MAX; i++)
+    {
+        if (!(cfg->pin_bit_mask & (1ULL << i))) continue;
+        pins[i].mode = cfg->mode;
+        pins[i].intr_type = cfg->intr_type;
+    }
+    return ESP_OK;
+}
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    pins[pin].mode = mode;
+    return ESP_OK;
+}
+esp_err_t gpio_set_pull_mode(gpio_num_t pin, gpio_pull_mode_t pull)
+{
+    return valid(pin) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    level = level ? 1 : 0;
+    bool changed = pins[pin].level != level;
+    pins[pin].level = level;
+    if (changed && (pins[pin].mode & GPIO_MODE_OUTPUT) && output_listener) output_listener(pin, level);
+    return ESP_OK;
+}
+int gpio_get_level(gpio_num_t pin)
+{
+    return valid(pin) ? static_cast<int>(pins[pin].level) : 0;
+}
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (isr_service_installed) return ESP_ERR_INVALID_STATE;
+    isr_service_installed = true;
+    return ESP_OK;
+}
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t isr, void* arg)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    if (!isr_service_installed) return ESP_ERR_INVALID_STATE;
+    pins[pin].isr = isr;
+    pins[pin].isr_arg = arg;
+    return ESP_OK;
+}
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    pins[pin].isr = NULL;
+    return ESP_OK;
+}
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    pins[pin].intr_type = type;
+    return ESP_OK;
+}
+esp_err_t gpio_intr_enable(gpio_num_t pin)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    pins[pin].intr_enabled = true;
+    return ESP_OK;
+}
+esp_err_t gpio_intr_disable(gpio_num_t pin)
+{
+    if (!valid(pin)) return ESP_ERR_INVALID_ARG;
+    pins[pin].intr_enabled = false;
+    return ESP_OK;
+}
+
+/// @brief Observe output level changes (called in the context of the task that changed the level)
+void sim_gpio_set_output_listener(sim_gpio_listener_t listener)
+{
+    output_listener = listener;
+}
+/// @brief Drive an input pin. A matching edge runs the pin's ISR immediately, in the caller's context.
+void sim_gpio_set_input(gpio_num_t pin, uint32_t level)
+{
+    if (!valid(pin)) return;
+    level = level ? 1 : 0;
+    uint32_t from = pins[pin].level;
+    pins[pin].level = level;
+    pin_state_t& p = pins[pin];
+    if (p.isr && p.intr_enabled && edge_matches(p.intr_type, from, level)) p.isr(p.isr_arg);
+}
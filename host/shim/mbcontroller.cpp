@@ -0,0 +1,216 @@
+/**
+ * @file mbcontroller.cpp
+ * @author MSU
+ * @brief Host simulation shim: esp-modbus slave controller. One port task (CONFIG_FMB_PORT_TASK_PRIO) serves the simulated
+ * master's requests one at a time; every request costs SIM_MB_REQUEST_COST_US of virtual CPU time (TCP/IP stack and
+ * protocol handling on the target).
+ * @date 2026-10-16
+ *
+ */
+
+#include "mbcontroller.h"
+
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+
+#include <string.h>
+
+#define SIM_MB_REQUEST_COST_US 250
+#define SIM_MB_QUEUE_LEN 8
+
+static const char TAG[] = "SIM_MB";
+
+struct request_t
+{
+    mb_param_type_t type;
+    bool write;
+    uint16_t reg;
+    uint16_t count;
+    uint16_t* data;
+    esp_err_t result;
+    SemaphoreHandle_t done;
+};
+
+struct slave_t
+{
+    mb_register_area_descriptor_t areas[MB_PARAM_COUNT];
+    bool has_area[MB_PARAM_COUNT];
+    SemaphoreHandle_t lock;
+    EventGroupHandle_t events;
+    QueueHandle_t notifications;
+    QueueHandle_t requests;
+    bool started;
+};
+
+static slave_t slave = {};
+static uint32_t request_count = 0;
+
+/// @brief Copy a register range between the master buffer and the area (16-bit registers, little-endian as on the target)
+static esp_err_t access_registers(const mb_register_area_descriptor_t* a, request_t* r, uint8_t** address)
+{
+    if (r->reg < a->start_offset) return ESP_ERR_NOT_FOUND;
+    size_t byte_offset = (r->reg - a->start_offset) * 2u;
+    if (byte_offset + r->count * 2u > a->size) return ESP_ERR_NOT_FOUND;
+    uint8_t* p = static_cast<uint8_t*>(a->address) + byte_offset;
+    if (r->write) memcpy(p, r->data, r->count * 2u);
+    else memcpy(r->data, p, r->count * 2u);
+    *address = p;
+    return ESP_OK;
+}
+static esp_err_t access_bits(const mb_register_area_descriptor_t* a, request_t* r, uint8_t** address)
+{
+    if (r->reg < a->start_offset) return ESP_ERR_NOT_FOUND;
+    size_t bit = r->reg - a->start_offset;
+    if ((bit + r->count + 7) / 8 > a->size) return ESP_ERR_NOT_FOUND;
+    uint8_t* bytes = static_cast<uint8_t*>(a->address);
+    for (size_t i = 0; i < r->count; i++, bit++)
+    {
+        uint8_t mask = 1u << (bit % 8);
+        if (r->write)
+        {
+            if (r->data[i]) bytes[bit / 8] |= mask;
+            else bytes[bit / 8] &= ~mask;
+        }
+        else
+        {
+            r->data[i] = (bytes[bit / 8] & mask) ? 1 : 0;
+        }
+    }
+    *address = bytes + (r->reg - a->start_offset) / 8;
+    return ESP_OK;
+}
+static mb_event_group_t event_for(const request_t* r)
+{
+    switch (r->type)
+    {
+    case MB_PARAM_HOLDING:
+        return r->write ? MB_EVENT_HOLDING_REG_WR : MB_EVENT_HOLDING_REG_RD;
+    case MB_PARAM_INPUT:
+        return MB_EVENT_INPUT_REG_RD;
+    case MB_PARAM_COIL:
+        return r->write ? MB_EVENT_COILS_WR : MB_EVENT_COILS_RD;
+    default:
+        return MB_EVENT_DISCRETE_RD;
+    }
+}
+static void port_task(void* arg)
+{
+    request_t* r;
+    for (;;)
+    {
+        xQueueReceive(slave.requests, &r, portMAX_DELAY);
+        ets_delay_us(SIM_MB_REQUEST_COST_US);
+        request_count++;
+        uint8_t* address = NULL;
+        if (!slave.has_area[r->type] || (r->write && (r->type == MB_PARAM_INPUT || r->type == MB_PARAM_DISCRETE)))
+        {
+            r->result = ESP_ERR_NOT_SUPPORTED;
+        }
+        else
+        {
+            const mb_register_area_descriptor_t* a = &(slave.areas[r->type]);
+            xSemaphoreTake(slave.lock, portMAX_DELAY);
+            bool bits = (r->type == MB_PARAM_COIL) || (r->type == MB_PARAM_DISCRETE);
+            r->result = bits ? access_bits(a, r, &address) : access_registers(a, r, &address);
+            xSemaphoreGive(slave.lock);
+        }
+        if (r->result == ESP_OK)
+        {
+            mb_param_info_t info = {
+                .time_stamp = static_cast<uint32_t>(esp_timer_get_time()),
+                .mb_offset = r->reg,
+                .type = event_for(r),
+                .address = address,
+                .size = r->count
+            };
+            // Like esp-modbus: notifications are dropped when the application doesn't keep up
+            xQueueSend(slave.notifications, &info, 0);
+            xEventGroupSetBits(slave.events, info.type);
+        }
+        xSemaphoreGive(r->done);
+    }
+}
+
+esp_err_t mbc_slave_create_tcp(mb_communication_info_t* config, void** handle)
+{
+    MB_RETURN_ON_FALSE(config && handle, ESP_ERR_INVALID_ARG, TAG, "invalid arguments");
+    MB_RETURN_ON_FALSE(!slave.lock, ESP_ERR_INVALID_STATE, TAG, "slave already created");
+    slave.lock = xSemaphoreCreateMutex();
+    slave.events = xEventGroupCreate();
+    slave.notifications = xQueueCreate(CONFIG_FMB_CONTROLLER_NOTIFY_QUEUE_SIZE, sizeof(mb_param_info_t));
+    slave.requests = xQueueCreate(SIM_MB_QUEUE_LEN, sizeof(request_t*));
+    assert(slave.lock && slave.events && slave.notifications && slave.requests);
+    ESP_LOGI(TAG, "Simulated Modbus TCP slave, port %u, uid %u", config->tcp_opts.port, config->tcp_opts.uid);
+    *handle = &slave;
+    return ESP_OK;
+}
+esp_err_t mbc_slave_set_descriptor(void* handle, mb_register_area_descriptor_t descr)
+{
+    MB_RETURN_ON_FALSE(handle == &slave, ESP_ERR_INVALID_ARG, TAG, "invalid handle");
+    MB_RETURN_ON_FALSE(descr.type < MB_PARAM_COUNT && descr.address && descr.size, ESP_ERR_INVALID_ARG, TAG, "invalid descriptor");
+    slave.areas[descr.type] = descr;
+    slave.has_area[descr.type] = true;
+    return ESP_OK;
+}
+esp_err_t mbc_slave_start(void* handle)
+{
+    MB_RETURN_ON_FALSE(handle == &slave, ESP_ERR_INVALID_ARG, TAG, "invalid handle");
+    MB_RETURN_ON_FALSE(!slave.started, ESP_ERR_INVALID_STATE, TAG, "already started");
+    slave.started = true;
+    assert(xTaskCreate(port_task, "mb_port", CONFIG_FMB_PORT_TASK_STACK_SIZE, NULL, CONFIG_FMB_PORT_TASK_PRIO, NULL) == pdPASS);
+    return ESP_OK;
+}
+esp_err_t mbc_slave_delete(void* handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+mb_event_group_t mbc_slave_check_event(void* handle, mb_event_group_t group)
+{
+    assert(handle == &slave);
+    EventBits_t bits = xEventGroupWaitBits(slave.events, group, pdTRUE, pdFALSE, portMAX_DELAY);
+    return static_cast<mb_event_group_t>(bits & group);
+}
+esp_err_t mbc_slave_get_param_info(void* handle, mb_param_info_t* reg_info, uint32_t timeout)
+{
+    MB_RETURN_ON_FALSE(handle == &slave && reg_info, ESP_ERR_INVALID_ARG, TAG, "invalid arguments");
+    if (xQueueReceive(slave.notifications, reg_info, pdMS_TO_TICKS(timeout)) != pdTRUE)
+    {
+        reg_info->type = MB_EVENT_NO_EVENTS;
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+esp_err_t mbc_slave_lock(void* handle)
+{
+    MB_RETURN_ON_FALSE(handle == &slave, ESP_ERR_INVALID_ARG, TAG, "invalid handle");
+    xSemaphoreTake(slave.lock, portMAX_DELAY);
+    return ESP_OK;
+}
+esp_err_t mbc_slave_unlock(void* handle)
+{
+    MB_RETURN_ON_FALSE(handle == &slave, ESP_ERR_INVALID_ARG, TAG, "invalid handle");
+    xSemaphoreGive(slave.lock);
+    return ESP_OK;
+}
+
+/// @brief Issue a request from the simulated master and wait for the response
+/// @return ESP_ERR_INVALID_STATE if the slave is not running, ESP_ERR_NOT_FOUND if the range is outside the register areas
+esp_err_t sim_mb_request(mb_param_type_t type, bool write, uint16_t reg, uint16_t* data, uint16_t count)
+{
+    if (!slave.started) return ESP_ERR_INVALID_STATE;
+    if (type >= MB_PARAM_COUNT || !data || !count) return ESP_ERR_INVALID_ARG;
+    request_t r = { .type = type, .write = write, .reg = reg, .count = count, .data = data, .result = ESP_FAIL,
+        .done = xSemaphoreCreateBinary() };
+    assert(r.done);
+    request_t* p = &r;
+    xQueueSend(slave.requests, &p, portMAX_DELAY);
+    xSemaphoreTake(r.done, portMAX_DELAY);
+    vSemaphoreDelete(r.done);
+    return r.result;
+}
+uint32_t sim_mb_get_request_count(void)
+{
+    return request_count;
+}
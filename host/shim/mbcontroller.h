@@ -0,0 +1,115 @@
+/**
+ * @file mbcontroller.h
+ * @author MSU
+ * @brief Host simulation shim: esp-modbus slave controller API. Requests come from the simulated master (sim_mb_request)
+ * and are served by a port task that accesses the register areas under the slave lock and notifies the application,
+ * like the esp-modbus TCP port does.
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    MB_EVENT_NO_EVENTS = 0x00,
+    MB_EVENT_HOLDING_REG_WR = 0x01,
+    MB_EVENT_HOLDING_REG_RD = 0x02,
+    MB_EVENT_INPUT_REG_RD = 0x04,
+    MB_EVENT_COILS_WR = 0x08,
+    MB_EVENT_COILS_RD = 0x10,
+    MB_EVENT_DISCRETE_RD = 0x20,
+    MB_EVENT_STACK_STARTED = 0x40
+} mb_event_group_t;
+
+typedef enum
+{
+    MB_PARAM_HOLDING = 0x00,
+    MB_PARAM_INPUT,
+    MB_PARAM_COIL,
+    MB_PARAM_DISCRETE,
+    MB_PARAM_COUNT
+} mb_param_type_t;
+
+typedef enum
+{
+    MB_RTU,
+    MB_ASCII,
+    MB_TCP
+} mb_comm_mode_t;
+
+typedef enum
+{
+    MB_IPV4 = 0,
+    MB_IPV6 = 1
+} mb_addr_type_t;
+
+typedef struct
+{
+    uint32_t time_stamp;
+    uint16_t mb_offset;
+    mb_event_group_t type;
+    uint8_t* address;
+    size_t size;
+} mb_param_info_t;
+
+typedef struct
+{
+    uint16_t start_offset;
+    mb_param_type_t type;
+    void* address;
+    size_t size;
+} mb_register_area_descriptor_t;
+
+typedef struct
+{
+    mb_comm_mode_t mode;
+    uint16_t port;
+    uint8_t uid;
+    mb_addr_type_t addr_type;
+    void* ip_addr_table;
+    void* ip_netif_ptr;
+} mb_tcp_opts_t;
+
+typedef union
+{
+    mb_tcp_opts_t tcp_opts;
+} mb_communication_info_t;
+
+#define MB_RETURN_ON_FALSE(a, err_code, tag, format, ...) do { \
+        if (!(a)) { \
+            ESP_LOGE(tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+            return err_code; \
+        } \
+    } while (0)
+
+esp_err_t mbc_slave_create_tcp(mb_communication_info_t* config, void** handle);
+esp_err_t mbc_slave_set_descriptor(void* handle, mb_register_area_descriptor_t descr);
+esp_err_t mbc_slave_start(void* handle);
+esp_err_t mbc_slave_delete(void* handle);
+mb_event_group_t mbc_slave_check_event(void* handle, mb_event_group_t group);
+esp_err_t mbc_slave_get_param_info(void* handle, mb_param_info_t* reg_info, uint32_t timeout);
+esp_err_t mbc_slave_lock(void* handle);
+esp_err_t mbc_slave_unlock(void* handle);
+
+/** Simulation side: blocking master request, registers are 16-bit words (coils and discrete inputs: one bit per word) */
+esp_err_t sim_mb_request(mb_param_type_t type, bool write, uint16_t reg, uint16_t* data, uint16_t count);
+uint32_t sim_mb_get_request_count(void);
+
+#ifdef __cplusplus
+}
+#endif
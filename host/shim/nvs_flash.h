@@ -0,0 +1,20 @@
+/**
+ * @file nvs_flash.h
+ * @author MSU
+ * @brief Host simulation shim: NVS types referenced by public headers. Parameters are kept in RAM by the simulation (sim_params.cpp).
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
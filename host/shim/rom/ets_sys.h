@@ -0,0 +1,20 @@
+/**
+ * @file ets_sys.h
+ * @author MSU
+ * @brief Host simulation shim: busy wait consumes virtual CPU time of the calling task
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void ets_delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
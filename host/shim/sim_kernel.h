@@ -0,0 +1,43 @@
+/**
+ * @file sim_kernel.h
+ * @author MSU
+ * @brief Host simulation kernel: virtual time and the deterministic task scheduler behind the FreeRTOS shim.
+ * One virtual CPU. The highest-priority ready task runs until it blocks, yields or readies a task of higher priority
+ * (preemption happens at kernel API calls only). Code takes no virtual time except busy waits (ets_delay_us)
+ * and explicit charges (advance_us), so the same scenario always produces the same trace.
+ * @date 2026-10-16
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace sim_kernel
+{
+    /// @brief Per-task accounting, see get_task_stats
+    struct task_stats_t
+    {
+        const char* name;
+        UBaseType_t prio;
+        int64_t cpu_us; ///< Virtual CPU time consumed
+        uint32_t switches; ///< Times the task was switched in
+        bool deleted;
+    };
+
+    int64_t now_us();
+    void advance_us(int64_t us);
+    bool in_task();
+
+    void run(int64_t until_us);
+    void stop();
+    bool is_stopped();
+
+    void wake_waiters(const void* obj);
+    bool block_on(const void* obj, int64_t deadline_us);
+    int64_t ticks_to_deadline(TickType_t ticks);
+
+    size_t get_task_stats(task_stats_t* out, size_t max);
+} // namespace sim_kernel
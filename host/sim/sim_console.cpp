@@ -0,0 +1,33 @@
+/**
+ * @file sim_console.cpp
+ * @author MSU
+ * @brief Host simulation: the debug console is not simulated (scenario scripts play the operator's part).
+ * Log output still goes through the deferred logging pipeline, to stdout.
+ * @date 2026-10-16
+ *
+ */
+
+#include "dbg_console.h"
+
+#include "esp_log.h"
+#include "log_defer.h"
+#include "log_route.h"
+
+#include <stdio.h>
+
+static const char TAG[] = "SIM_CONSOLE";
+
+static void log_sink(const char* line, size_t len, uint8_t sinks)
+{
+    if (!(sinks & (1u << log_route::SINK_UART))) return;
+    fwrite(line, 1, len, stdout);
+}
+
+namespace dbg_console
+{
+    void init()
+    {
+        ESP_ERROR_CHECK(log_defer::init(log_sink));
+        ESP_LOGI(TAG, "Debug console is not simulated");
+    }
+} // namespace dbg_console
@@ -0,0 +1,176 @@
+/**
+ * @file sim_hal.cpp
+ * @author MSU
+ * @brief Host simulation: my_hal implementation. Pin layout and shift-register chains are the same as on the board (my_hal.cpp);
+ * latched shift-register words are delivered to the plant (DACs) and to the HD44780 model (LCD bus), output enable
+ * and LCD E/RS come through the GPIO shim. Every shift-register bit costs 2 us of busy wait, as the bit-banged driver does.
+ * @date 2026-10-16
+ *
+ */
+
+#include "my_hal.h"
+
+#include "macros.h"
+#include "my_encoder.h"
+#include "my_button.h"
+#include "static_alloc.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+
+#include "sim_lcd.h"
+#include "sim_plant.h"
+
+#define ENCODER_MAX_COUNTS (MY_PWR_MAX / ENCODER_RESOLUTION_STEP)
+#define ENCODER_MIN_COUNTS 0
+/** Bit-banged shift-register clock: two 1 us delays per bit (see my_hal::sr_write) */
+#define SIM_SR_BIT_US 2
+
+static const char TAG[] = "SIM_HAL";
+
+static esp_err_t lcd_write_callback(const my_lcd::hd44780_t* lcd, uint8_t b);
+
+const gpio_num_t pin_btn = GPIO_NUM_35;
+const gpio_num_t pin_oe = GPIO_NUM_14;
+const gpio_num_t pin_lcd_rs = GPIO_NUM_32;
+const gpio_num_t pin_lcd_e = GPIO_NUM_33;
+const gpio_num_t pin_enc_a = GPIO_NUM_39;
+const gpio_num_t pin_enc_b = GPIO_NUM_36;
+
+/** Shift-register chain lengths, bytes */
+static const size_t sr_len[] = { 3, 1 };
+
+static SemaphoreHandle_t sr_mutex_handle = NULL;
+static my_hal::sr_stats_t sr_stats = {};
+/// @brief Byte latched into the LCD data bus shift register
+static uint8_t lcd_bus = 0;
+
+static my_lcd::hd44780_t lcd_cfg =
+{
+    lcd_write_callback,
+    {
+        pin_lcd_rs,
+        pin_lcd_e,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        GPIO_NUM_NC,
+        static_cast<gpio_num_t>(HD44780_NOT_USED)
+    },
+    my_lcd::hd44780_font_t::HD44780_FONT_5X8,
+    2,
+    true
+};
+
+/// @brief Board wiring of the output pins
+static void output_listener(gpio_num_t pin, uint32_t level)
+{
+    if (pin == pin_oe) sim_plant::set_output_enable(!level); //Active low
+    else if (pin == pin_lcd_e && !level) sim_lcd::strobe(gpio_get_level(pin_lcd_rs) > 0, lcd_bus);
+}
+
+namespace my_hal
+{
+    esp_err_t init_safe_state()
+    {
+        const uint32_t zero = 0;
+        ESP_LOGI(TAG, "HAL initialization (simulated)");
+        sim_gpio_set_output_listener(output_listener);
+        const gpio_num_t outputs[] = { pin_oe, pin_lcd_rs, pin_lcd_e };
+        for (auto&& i : outputs)
+        {
+            ESP_ERROR_CHECK(gpio_set_direction(i, GPIO_MODE_OUTPUT));
+            ESP_ERROR_CHECK(gpio_set_level(i, i == pin_oe ? 1 : 0));
+        }
+        const gpio_num_t inputs[] = { pin_btn, pin_enc_a, pin_enc_b };
+        for (auto&& i : inputs) ESP_ERROR_CHECK(gpio_set_direction(i, GPIO_MODE_INPUT));
+
+        static StaticSemaphore_t sr_mutex_buffer;
+        sr_mutex_handle = static_alloc::create_mutex("sr_bus", &sr_mutex_buffer);
+        for (size_t i = 0; i < ARRAY_SIZE(sr_len); i++) sr_write(static_cast<sr_types>(i), reinterpret_cast<const uint8_t*>(&zero));
+        set_output_enable(true);
+        return ESP_OK;
+    }
+    esp_err_t init_inputs()
+    {
+        ESP_ERROR_CHECK(my_button::init(pin_btn, true));
+        ESP_ERROR_CHECK(my_encoder::init(pin_enc_a, pin_enc_b, ENCODER_MIN_COUNTS, static_cast<int32_t>(ENCODER_MAX_COUNTS)));
+        return ESP_OK;
+    }
+    /// @brief There is no network stack in the simulation, Modbus requests come from the simulated master directly
+    esp_err_t init_network()
+    {
+        ESP_LOGI(TAG, "Network is not simulated");
+        return ESP_OK;
+    }
+
+    my_lcd::hd44780_t* get_lcd_config()
+    {
+        return &lcd_cfg;
+    }
+    int64_t get_encoder_counts()
+    {
+        return my_encoder::get_position();
+    }
+    esp_netif_t* get_netif()
+    {
+        return NULL;
+    }
+    bool get_btn_pressed()
+    {
+        return gpio_get_level(pin_btn) > 0;
+    }
+    void reset_encoder()
+    {
+        my_encoder::reset();
+    }
+    /// @brief Write bytes to a shift register chain. Bus arbitration is a plain mutex here: with one virtual CPU
+    /// a transfer is never interrupted, so DAC writes never wait for an LCD byte.
+    void sr_write(sr_types t, const uint8_t* contents)
+    {
+        assert(t < ARRAY_SIZE(sr_len));
+        assert(sr_mutex_handle);
+        int64_t start = esp_timer_get_time();
+        while (xSemaphoreTake(sr_mutex_handle, portMAX_DELAY) != pdTRUE);
+        if (t == SR_DAC)
+        {
+            uint32_t waited = static_cast<uint32_t>(esp_timer_get_time() - start);
+            sr_stats.dac_writes++;
+            sr_stats.dac_wait_total_us += waited;
+            if (waited > sr_stats.dac_wait_max_us) sr_stats.dac_wait_max_us = waited;
+        }
+        else
+        {
+            sr_stats.lcd_bytes++;
+        }
+        ets_delay_us(SIM_SR_BIT_US * 8 * sr_len[t]);
+        if (t == SR_DAC) sim_plant::set_dac_word(contents[0] | (contents[1] << 8) | (contents[2] << 16));
+        else lcd_bus = contents[0];
+        xSemaphoreGive(sr_mutex_handle);
+    }
+    sr_stats_t get_sr_stats()
+    {
+        return sr_stats;
+    }
+    void reset_sr_stats()
+    {
+        sr_stats = {};
+    }
+    void set_output_enable(bool v)
+    {
+        ESP_ERROR_CHECK(gpio_set_level(pin_oe, !v)); //Active Low
+    }
+} // namespace my_hal
+
+static esp_err_t lcd_write_callback(const my_lcd::hd44780_t* lcd, uint8_t b)
+{
+    my_hal::sr_write(my_hal::sr_types::SR_LCD, &b);
+    return ESP_OK;
+}
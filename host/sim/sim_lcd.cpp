@@ -0,0 +1,157 @@
+/**
+ * @file sim_lcd.cpp
+ * @author MSU
+ * @brief Host simulation: HD44780 model, fed on the falling edge of E with the byte latched in the LCD shift register.
+ * Execution times are taken from the datasheet (37 us, 1.52 ms for clear/home), a byte that arrives earlier is counted
+ * as a busy violation (the real controller would drop or corrupt it). Rendering: CGRAM glyphs are shown as '#',
+ * codes outside of printable ASCII as '?'.
+ * @date 2026-10-16
+ *
+ */
+
+#include "sim_lcd.h"
+
+#include "sim_kernel.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define LCD_DDRAM_SIZE 0x80
+#define LCD_CGRAM_SIZE 0x40
+#define LCD_LINE2_ADDR 0x40
+#define LCD_EXEC_US 37
+#define LCD_EXEC_LONG_US 1520
+
+static uint8_t ddram[LCD_DDRAM_SIZE];
+static uint8_t cgram[LCD_CGRAM_SIZE];
+static uint8_t address = 0;
+static bool cgram_selected = false;
+static bool increment = true;
+static bool display_on = false;
+static int shift = 0;
+static int64_t busy_until_us = 0;
+static sim_lcd::stats_t stats = {};
+static bool ddram_initialized = false;
+
+static void step_address()
+{
+    uint8_t size = cgram_selected ? LCD_CGRAM_SIZE : LCD_DDRAM_SIZE;
+    address = static_cast<uint8_t>((address + (increment ? 1 : size - 1)) % size);
+}
+static int64_t execute(uint8_t cmd)
+{
+    if (cmd & 0x80)
+    {
+        address = cmd & 0x7F;
+        cgram_selected = false;
+    }
+    else if (cmd & 0x40)
+    {
+        address = cmd & 0x3F;
+        cgram_selected = true;
+    }
+    else if (cmd & 0x20)
+    {
+        // Function set: bus width, lines and font are fixed by the board
+    }
+    else if (cmd & 0x10)
+    {
+        if (cmd & 0x08) shift += (cmd & 0x04) ? 1 : -1;
+        else address = static_cast<uint8_t>((address + ((cmd & 0x04) ? 1 : LCD_DDRAM_SIZE - 1)) % LCD_DDRAM_SIZE);
+    }
+    else if (cmd & 0x08)
+    {
+        display_on = (cmd & 0x04) != 0;
+    }
+    else if (cmd & 0x04)
+    {
+        increment = (cmd & 0x02) != 0;
+    }
+    else if (cmd & 0x02)
+    {
+        address = 0;
+        cgram_selected = false;
+        shift = 0;
+        return LCD_EXEC_LONG_US;
+    }
+    else if (cmd & 0x01)
+    {
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+        cgram_selected = false;
+        increment = true;
+        shift = 0;
+        return LCD_EXEC_LONG_US;
+    }
+    return LCD_EXEC_US;
+}
+
+namespace sim_lcd
+{
+    /// @brief E falling edge
+    /// @param rs RS level: true == data, false == instruction
+    /// @param bus Data bus (D0..D7)
+    void strobe(bool rs, uint8_t bus)
+    {
+        if (!ddram_initialized)
+        {
+            memset(ddram, ' ', sizeof(ddram));
+            ddram_initialized = true;
+        }
+        int64_t now = sim_kernel::now_us();
+        if (now < busy_until_us) stats.busy_violations++;
+        int64_t exec = LCD_EXEC_US;
+        if (rs)
+        {
+            stats.data_bytes++;
+            if (cgram_selected) cgram[address] = bus;
+            else ddram[address] = bus;
+            step_address();
+        }
+        else
+        {
+            stats.commands++;
+            exec = execute(bus);
+        }
+        busy_until_us = now + exec;
+    }
+    /// @brief Get visible text of a line
+    /// @param line 0..SIM_LCD_LINES-1
+    /// @param buf Output, at least SIM_LCD_COLUMNS + 1 chars
+    /// @param len Buffer length
+    void get_line(size_t line, char* buf, size_t len)
+    {
+        size_t n = 0;
+        for (; n < SIM_LCD_COLUMNS && n + 1 < len; n++)
+        {
+            if (!display_on || !ddram_initialized)
+            {
+                buf[n] = ' ';
+                continue;
+            }
+            int col = (static_cast<int>(n) - shift) % 40;
+            if (col < 0) col += 40;
+            uint8_t c = ddram[(line ? LCD_LINE2_ADDR : 0) + col];
+            if (c < 0x08) buf[n] = '#';
+            else if (c < 0x20 || c > 0x7E) buf[n] = '?';
+            else buf[n] = static_cast<char>(c);
+        }
+        buf[n] = '\0';
+    }
+    /// @brief Print the screen to stdout
+    void print()
+    {
+        char line[SIM_LCD_COLUMNS + 1];
+        printf("+--------+\n");
+        for (size_t i = 0; i < SIM_LCD_LINES; i++)
+        {
+            get_line(i, line, sizeof(line));
+            printf("|%s|\n", line);
+        }
+        printf("+--------+\n");
+    }
+    stats_t get_stats()
+    {
+        return stats;
+    }
+} // namespace sim_lcd
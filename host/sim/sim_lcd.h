@@ -0,0 +1,23 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define SIM_LCD_COLUMNS 8
+#define SIM_LCD_LINES 2
+
+/// @brief HD44780 controller model (8-bit bus): DDRAM/CGRAM, address counter, entry mode, display shift and busy time
+namespace sim_lcd
+{
+    struct stats_t
+    {
+        uint32_t commands;
+        uint32_t data_bytes;
+        uint32_t busy_violations; ///< Bytes strobed while the controller was still executing the previous instruction
+    };
+
+    void strobe(bool rs, uint8_t bus);
+    void get_line(size_t line, char* buf, size_t len);
+    void print();
+    stats_t get_stats();
+} // namespace sim_lcd
@@ -0,0 +1,227 @@
+/**
+ * @file sim_main.cpp
+ * @author MSU
+ * @brief Host simulation entry point. Runs the firmware boot sequence and control loop (same modules as the target build,
+ * HAL and parameter storage replaced) against the plant and LCD models, driven by a scenario script.
+ * Prints loop timing, bus, Modbus and per-task CPU statistics at the end; optionally writes a CSV trace of the plant.
+ * With --bench, runs the benchmark suite (bench.cpp) after boot instead of the control loop and scenario.
+ * @date 2026-10-16
+ *
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "mbcontroller.h"
+#include "modbus_params.h"
+
+#include "boot.h"
+#include "control.h"
+#include "cmd_bus.h"
+#include "my_hal.h"
+#include "my_button.h"
+#include "bench.h"
+#include "static_alloc.h"
+#include "log_defer.h"
+#include "log_route.h"
+
+#include "sim_kernel.h"
+#include "sim_scenario.h"
+#include "sim_lcd.h"
+#include "sim_plant.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Same as app_main (main.cpp) */
+#define SIM_CONTROL_TASK_PRIORITY 2
+#define SIM_CONTROL_TASK_STACK_SIZE 4096
+#define SIM_SCENARIO_TASK_PRIORITY 16
+#define SIM_TRACE_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#define SIM_TRACE_TASK_STACK_SIZE 4096
+#define SIM_MAX_TASKS 32
+
+static const char TAG[] = "SIM";
+
+/// @brief Control loop timing, virtual time
+struct loop_stats_t
+{
+    uint32_t iterations;
+    int64_t period_min_us;
+    int64_t period_max_us;
+    int64_t period_total_us;
+    int64_t step_max_us;
+    int64_t step_total_us;
+};
+
+static loop_stats_t loop_stats = { .iterations = 0, .period_min_us = INT64_MAX, .period_max_us = 0, .period_total_us = 0,
+    .step_max_us = 0, .step_total_us = 0 };
+static FILE* trace_file = NULL;
+static uint32_t trace_period_ms = 10;
+static uint32_t bench_iterations = 0; ///< 0 == no benchmark, run the scenario
+static const char* bench_filter = NULL;
+static bool bench_json = false;
+
+/// @brief app_main equivalent, plus loop timing
+static void control_task(void* arg)
+{
+    cmd_bus::init();
+    esp_err_t ret = boot::run();
+    if (ret != ESP_OK) ESP_LOGE(TAG, "Init failed: %s", esp_err_to_name(ret));
+    control::init(ret == ESP_OK);
+    if (bench_iterations)
+    {
+        ret = bench::run(bench_filter, bench_iterations, bench_json);
+        if (ret != ESP_OK) ESP_LOGE(TAG, "Benchmark failed: %s", esp_err_to_name(ret));
+        sim_kernel::stop();
+        vTaskDelete(NULL);
+    }
+
+    int64_t last_start = -1;
+    for (;;)
+    {
+        int64_t start = sim_kernel::now_us();
+        control::step();
+        int64_t took = sim_kernel::now_us() - start;
+        loop_stats.iterations++;
+        loop_stats.step_total_us += took;
+        if (took > loop_stats.step_max_us) loop_stats.step_max_us = took;
+        if (last_start >= 0)
+        {
+            int64_t period = start - last_start;
+            loop_stats.period_total_us += period;
+            if (period < loop_stats.period_min_us) loop_stats.period_min_us = period;
+            if (period > loop_stats.period_max_us) loop_stats.period_max_us = period;
+        }
+        last_start = start;
+        my_button::wait_event(pdMS_TO_TICKS(CONTROL_LOOP_PERIOD_MS));
+    }
+}
+/// @brief Sample the plant and the published state at a fixed virtual period (takes no virtual time)
+static void trace_task(void* arg)
+{
+    fprintf(trace_file, "t_ms,remote,on,pwr_set,vlim_set,vpwr_code,vlim_code,oe,v_amp,v_lim,v_heater,r_heater,p_heater,t_heater\n");
+    int64_t next = 0;
+    for (;;)
+    {
+        auto s = sim_plant::get_state();
+        fprintf(trace_file, "%.3f,%u,%u,%.4f,%.3f,%" PRIu32 ",%" PRIu32 ",%u,%.5f,%.4f,%.5f,%.4f,%.6f,%.3f\n",
+            sim_kernel::now_us() / 1000.0, coil_reg_params.coil_0, discrete_reg_params.discrete_input0, input_reg_params.power_man,
+            input_reg_params.vlim_man, s.vpwr_code, s.vlim_code, s.output_enabled, s.v_amp, s.v_lim, s.v_heater, s.r_heater,
+            s.p_heater, s.t_heater);
+        next += trace_period_ms * 1000;
+        sim_kernel::block_on(NULL, next);
+    }
+}
+static void print_summary()
+{
+    int64_t now = sim_kernel::now_us();
+    printf("\n=== Simulation summary: %.3f ms virtual time ===\n", now / 1000.0);
+    if (loop_stats.iterations > 1)
+    {
+        printf("Control loop: %" PRIu32 " iterations, period min/mean/max = %.3f/%.3f/%.3f ms, step mean/max = %.1f/%lld us\n",
+            loop_stats.iterations, loop_stats.period_min_us / 1000.0,
+            loop_stats.period_total_us / 1000.0 / (loop_stats.iterations - 1), loop_stats.period_max_us / 1000.0,
+            static_cast<double>(loop_stats.step_total_us) / loop_stats.iterations, static_cast<long long>(loop_stats.step_max_us));
+    }
+    auto sr = my_hal::get_sr_stats();
+    printf("Shift registers: %" PRIu32 " DAC writes (wait max %" PRIu32 " us), %" PRIu32 " LCD bytes\n", sr.dac_writes,
+        sr.dac_wait_max_us, sr.lcd_bytes);
+    auto lcd = sim_lcd::get_stats();
+    printf("LCD: %" PRIu32 " commands, %" PRIu32 " data bytes, %" PRIu32 " busy violations\n", lcd.commands, lcd.data_bytes,
+        lcd.busy_violations);
+    printf("Modbus: %" PRIu32 " requests served\n", sim_mb_get_request_count());
+    printf("Button: %" PRIu32 " dropped events\n", my_button::get_dropped_events());
+
+    sim_kernel::task_stats_t tasks[SIM_MAX_TASKS];
+    size_t n = sim_kernel::get_task_stats(tasks, SIM_MAX_TASKS);
+    printf("%-16s %4s %12s %7s %9s\n", "Task", "Prio", "CPU,us", "CPU,%", "Switches");
+    for (size_t i = 0; i < n; i++)
+    {
+        printf("%-16s %4" PRIu32 " %12lld %7.3f %9" PRIu32 "%s\n", tasks[i].name, tasks[i].prio, static_cast<long long>(tasks[i].cpu_us),
+            now ? 100.0 * tasks[i].cpu_us / now : 0.0, tasks[i].switches, tasks[i].deleted ? " (deleted)" : "");
+    }
+    sim_lcd::print();
+}
+static void usage(const char* self)
+{
+    fprintf(stderr, "Usage: %s <scenario> [--trace <file.csv>] [--trace-ms <period>] [--log <none|error|warn|info|debug>]\n"
+        "       %s --bench <iterations> [--bench-case <name>] [--json] [--log <level>]\n", self, self);
+}
+
+int main(int argc, char** argv)
+{
+    const char* scenario = NULL;
+    const char* trace_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--trace") && i + 1 < argc) trace_path = argv[++i];
+        else if (!strcmp(argv[i], "--trace-ms") && i + 1 < argc) trace_period_ms = static_cast<uint32_t>(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--log") && i + 1 < argc)
+        {
+            const char* levels[] = { "none", "error", "warn", "info", "debug" };
+            const char* l = argv[++i];
+            bool found = false;
+            for (size_t j = 0; j < sizeof(levels) / sizeof(levels[0]); j++)
+            {
+                if (strcmp(l, levels[j])) continue;
+                log_route::set_level("*", LOG_ROUTE_ALL_SINKS, static_cast<esp_log_level_t>(j));
+                found = true;
+            }
+            if (!found)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc) bench_iterations = static_cast<uint32_t>(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--bench-case") && i + 1 < argc) bench_filter = argv[++i];
+        else if (!strcmp(argv[i], "--json")) bench_json = true;
+        else if (argv[i][0] != '-' && !scenario) scenario = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (bench_iterations)
+    {
+        assert(xTaskCreate(control_task, "main", SIM_CONTROL_TASK_STACK_SIZE, NULL, SIM_CONTROL_TASK_PRIORITY, NULL) == pdPASS);
+        sim_kernel::run(INT64_MAX);
+        log_defer::flush();
+        return 0;
+    }
+    if (!scenario || !trace_period_ms)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!sim_scenario::load(scenario)) return 1;
+    if (trace_path)
+    {
+        trace_file = fopen(trace_path, "w");
+        if (!trace_file)
+        {
+            fprintf(stderr, "Can't open %s\n", trace_path);
+            return 1;
+        }
+    }
+
+    assert(xTaskCreate(control_task, "main", SIM_CONTROL_TASK_STACK_SIZE, NULL, SIM_CONTROL_TASK_PRIORITY, NULL) == pdPASS);
+    sim_scenario::start(SIM_SCENARIO_TASK_PRIORITY);
+    if (trace_file) assert(xTaskCreate(trace_task, "trace", SIM_TRACE_TASK_STACK_SIZE, NULL, SIM_TRACE_TASK_PRIORITY, NULL) == pdPASS);
+    sim_kernel::run(sim_scenario::get_end_us());
+
+    if (trace_file) fclose(trace_file);
+    log_defer::flush(); // The kernel is stopped, records captured after the last drain are still pending
+    print_summary();
+    uint32_t failures = sim_scenario::get_failures();
+    if (failures)
+    {
+        fprintf(stderr, "%" PRIu32 " expectation(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
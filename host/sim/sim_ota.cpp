@@ -0,0 +1,37 @@
+/**
+ * @file sim_ota.cpp
+ * @author MSU
+ * @brief Host simulation: firmware updates are not simulated (no flash partitions to boot from). The output hold an update
+ * uses is, scenario command cmd safe_hold.
+ * @date 2026-10-16
+ *
+ */
+
+#include "ota.h"
+
+#include "esp_log.h"
+
+static const char TAG[] = "SIM_OTA";
+static const char* const state_names[] = { "idle", "receiving", "rebooting", "verifying", "disabled" };
+
+namespace ota
+{
+    esp_err_t init()
+    {
+        ESP_LOGI(TAG, "Firmware update is not simulated");
+        return ESP_OK;
+    }
+    bool is_active()
+    {
+        return false;
+    }
+    status_t get_status()
+    {
+        return { .state = OTA_IDLE, .received = 0, .size = 0, .last_result = ESP_OK, .updates = 0, .auth_failures = 0,
+            .last_duration_ms = 0 };
+    }
+    const char* get_state_name(states s)
+    {
+        return (s < OTA_COUNT) ? state_names[s] : "?";
+    }
+} // namespace ota
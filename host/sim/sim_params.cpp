@@ -0,0 +1,105 @@
+/**
+ * @file sim_params.cpp
+ * @author MSU
+ * @brief Host simulation: my_params kept in RAM, with the firmware defaults (params.cpp). Nothing persists between runs.
+ * @date 2026-10-16
+ *
+ */
+
+#include "params.h"
+
+#include <string.h>
+
+static const char TAG[] = "SIM_PARAMS";
+
+static my_dac_cal_t dac_cal = { 1, 0, 1, 0 };
+static float dac_soft_sentinel = 5.0f;
+static float last_set_pwr = 0;
+static float last_set_vlim = 5.0f;
+static char hostname[32] = "cpwr";
+static my_dac_cal_table_t cal_tables[my_dac::CH_COUNT];
+static bool has_cal_table[my_dac::CH_COUNT] = {};
+static uint32_t save_count = 0;
+
+namespace my_params
+{
+    const my_dac_cal_t default_dac_cal = { 1, 0, 1, 0 };
+
+    esp_err_t init()
+    {
+        ESP_LOGI(TAG, "Parameters are kept in RAM (defaults)");
+        return ESP_OK;
+    }
+    esp_err_t init_spiffs()
+    {
+        return ESP_OK;
+    }
+    /// @brief Every save counts as one entry written
+    uint32_t get_nvs_writes()
+    {
+        return save_count;
+    }
+    esp_err_t save()
+    {
+        save_count++;
+        ESP_LOGI(TAG, "Save #%" PRIu32, save_count);
+        return ESP_OK;
+    }
+
+    const my_dac_cal_t* get_dac_cal()
+    {
+        return &dac_cal;
+    }
+    void set_dac_cal(my_dac_cal_t* c)
+    {
+        dac_cal = *c;
+    }
+    const my_dac_cal_table_t* get_dac_cal_table(my_dac::channels ch)
+    {
+        return has_cal_table[ch] ? &(cal_tables[ch]) : NULL;
+    }
+    esp_err_t set_dac_cal_table(my_dac::channels ch, const my_dac_cal_table_t* table)
+    {
+        if (!table)
+        {
+            has_cal_table[ch] = false;
+            return ESP_OK;
+        }
+        if (!my_dac::validate_cal_table(table, MY_DAC_CAL_TABLE_SIZE(table->count))) return ESP_ERR_INVALID_ARG;
+        memcpy(&(cal_tables[ch]), table, MY_DAC_CAL_TABLE_SIZE(table->count));
+        has_cal_table[ch] = true;
+        return ESP_OK;
+    }
+    float get_dac_soft_sentinel()
+    {
+        return dac_soft_sentinel;
+    }
+    void set_dac_soft_sentinel(float v)
+    {
+        dac_soft_sentinel = v;
+    }
+    float get_last_saved_vpwr()
+    {
+        return last_set_pwr;
+    }
+    float get_last_saved_vlim()
+    {
+        return last_set_vlim;
+    }
+    void set_last_saved_vpwr(float v)
+    {
+        last_set_pwr = v;
+    }
+    void set_last_saved_vlim(float v)
+    {
+        last_set_vlim = v;
+    }
+    const char* get_hostname()
+    {
+        return hostname;
+    }
+    void set_hostname(const char* n)
+    {
+        strncpy(hostname, n, sizeof(hostname) - 1);
+    }
+} // namespace my_params
@@ -0,0 +1,136 @@
+/**
+ * @file sim_plant.cpp
+ * @author MSU
+ * @brief Host simulation: heater output stage and sensor heater. The output stage is the inverse of the nominal my_dac mapping
+ * with adjustable gain/offset errors (what calibration is supposed to find); the heater voltage is clamped by the voltage limit
+ * and gated by output enable. The heater is a first-order thermal model with a temperature-dependent resistance:
+ * R = R0 * (1 + alpha * (T - Tamb)), C * dT/dt = V^2 / R - (T - Tamb) / Rth. State is integrated lazily on virtual time.
+ * @date 2026-10-16
+ *
+ */
+
+#include "sim_plant.h"
+
+#include "sim_kernel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define PLANT_STEP_US 1000
+#define PLANT_VREF 5.0f
+#define PLANT_VPWR_FULL_SCALE 0x03FF
+#define PLANT_VLIM_FULL_SCALE 0x00FF
+#define PLANT_VPWR_OUTPUT_DIVIDER ((750.0f + 68.0f + 3000.0f) / (750.0f + 68.0f / 2))
+
+struct params_t
+{
+    float gain_vpwr; ///< Output stage error: DAC volts = gain * nominal input + offset (same convention as my_dac_cal_t)
+    float offset_vpwr;
+    float gain_vlim;
+    float offset_vlim;
+    float r0; ///< Ohm at ambient temperature
+    float alpha; ///< 1/K
+    float rth; ///< K/W
+    float cth; ///< J/K
+    float t_amb; ///< Degrees C
+};
+
+static params_t params = { .gain_vpwr = 1, .offset_vpwr = 0, .gain_vlim = 1, .offset_vlim = 0,
+    .r0 = 10, .alpha = 0.0035f, .rth = 4000, .cth = 5e-5f, .t_amb = 25 };
+static const struct
+{
+    const char* name;
+    float* value;
+} param_names[] =
+{
+    { "gain_vpwr", &params.gain_vpwr },
+    { "offset_vpwr", &params.offset_vpwr },
+    { "gain_vlim", &params.gain_vlim },
+    { "offset_vlim", &params.offset_vlim },
+    { "r0", &params.r0 },
+    { "alpha", &params.alpha },
+    { "rth", &params.rth },
+    { "cth", &params.cth },
+    { "t_amb", &params.t_amb }
+};
+
+static sim_plant::state_t state = { .vpwr_code = 0, .vlim_code = 0, .output_enabled = false, .v_amp = 0, .v_lim = 0,
+    .v_heater = 0, .r_heater = 10, .p_heater = 0, .t_heater = 25 };
+static int64_t last_update_us = 0;
+
+static void update_outputs()
+{
+    float dac_vpwr = state.vpwr_code * (PLANT_VREF / PLANT_VPWR_FULL_SCALE);
+    float dac_vlim = state.vlim_code * (PLANT_VREF / PLANT_VLIM_FULL_SCALE);
+    state.v_amp = (dac_vpwr - params.offset_vpwr) / (params.gain_vpwr * PLANT_VPWR_OUTPUT_DIVIDER);
+    if (state.v_amp < 0) state.v_amp = 0;
+    // Inverse of my_math::vlim_to_dac_vlim
+    state.v_lim = (5.831f - (dac_vlim - params.offset_vlim) / params.gain_vlim) / 0.66f;
+    float v = state.v_amp < state.v_lim ? state.v_amp : state.v_lim;
+    state.v_heater = (state.output_enabled && v > 0) ? v : 0;
+    state.r_heater = params.r0 * (1 + params.alpha * (state.t_heater - params.t_amb));
+    state.p_heater = state.v_heater * state.v_heater / state.r_heater;
+}
+/// @brief Integrate the thermal state up to the current virtual time (inputs are constant since the last call)
+static void advance()
+{
+    int64_t now = sim_kernel::now_us();
+    while (last_update_us < now)
+    {
+        int64_t dt_us = now - last_update_us;
+        if (dt_us > PLANT_STEP_US) dt_us = PLANT_STEP_US;
+        float dt = dt_us * 1e-6f;
+        update_outputs();
+        state.t_heater += dt * (state.p_heater - (state.t_heater - params.t_amb) / params.rth) / params.cth;
+        last_update_us += dt_us;
+    }
+    update_outputs();
+}
+
+namespace sim_plant
+{
+    /// @brief Latch a new DAC shift-register word (see my_dac write_code for the layout)
+    void set_dac_word(uint32_t word)
+    {
+        advance();
+        state.vpwr_code = ((word & 0xFFu) << 2) | ((word >> 8) & 0x03u);
+        state.vlim_code = (word >> 16) & 0xFFu;
+        update_outputs();
+    }
+    void set_output_enable(bool v)
+    {
+        advance();
+        state.output_enabled = v;
+        update_outputs();
+    }
+    state_t get_state()
+    {
+        advance();
+        return state;
+    }
+    /// @brief What an external meter reads: heater voltage (output enable gated) or the voltage limit
+    float measure(bool vlim)
+    {
+        advance();
+        return vlim ? state.v_lim : state.v_heater;
+    }
+    /// @brief Change a model parameter (see print_params for the names)
+    /// @return False if there is no such parameter
+    bool set_param(const char* name, float v)
+    {
+        advance();
+        for (auto&& p : param_names)
+        {
+            if (strcmp(p.name, name)) continue;
+            *(p.value) = v;
+            update_outputs();
+            return true;
+        }
+        return false;
+    }
+    void print_params()
+    {
+        for (auto&& p : param_names) printf("%s = %g\n", p.name, *(p.value));
+    }
+} // namespace sim_plant
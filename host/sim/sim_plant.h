@@ -0,0 +1,27 @@
+#pragma once
+
+#include <inttypes.h>
+
+/// @brief Heater output stage and sensor heater model driven by the DAC shift-register word and the output enable line
+namespace sim_plant
+{
+    struct state_t
+    {
+        uint32_t vpwr_code;
+        uint32_t vlim_code;
+        bool output_enabled;
+        float v_amp; ///< Heater amplifier setpoint (before the limit), V
+        float v_lim; ///< Voltage limit, V
+        float v_heater; ///< Heater voltage, V
+        float r_heater; ///< Ohm
+        float p_heater; ///< W
+        float t_heater; ///< Degrees C
+    };
+
+    void set_dac_word(uint32_t word);
+    void set_output_enable(bool v);
+    state_t get_state();
+    float measure(bool vlim);
+    bool set_param(const char* name, float v);
+    void print_params();
+} // namespace sim_plant
@@ -0,0 +1,565 @@
+/**
+ * @file sim_scenario.cpp
+ * @author MSU
+ * @brief Host simulation: scenario script parser and driver task. Every line is "<t_ms> <command> [args]", events are executed
+ * in time order (file order for equal times) by a task that runs above all firmware tasks except esp_timer.
+ * Button presses include contact bounce, encoder turns can be spread over time to exercise acceleration.
+ * @date 2026-10-16
+ *
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "mbcontroller.h"
+#include "driver/gpio.h"
+#include "ESP32Encoder.h"
+#include "modbus_params.h"
+#include "perf.h"
+#include "log_route.h"
+#include "cmd_bus.h"
+#include "journal.h"
+#include "timesync.h"
+
+#include "sim_kernel.h"
+#include "sim_scenario.h"
+#include "sim_lcd.h"
+#include "sim_plant.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define SCENARIO_TASK_STACK_SIZE 4096
+#define SCENARIO_LOAD_TASK_STACK_SIZE 4096
+/** Contact bounce on every button edge: toggles, spacing */
+#define SCENARIO_BOUNCE_TOGGLES 4
+#define SCENARIO_BOUNCE_SPACING_US 300
+#define SCENARIO_ENCODER_STEP_US (CONFIG_ENCODER_SAMPLE_PERIOD_MS * 1000)
+#define SCENARIO_DEFAULT_TAIL_US 1000000
+/** Input registers read by every load request */
+#define SCENARIO_LOAD_REGS 16
+#define SCENARIO_SYNC_TASK_STACK_SIZE 4096
+/** Simulated master clock at virtual time 0: 2026-10-16 00:00:00 UTC */
+#define SCENARIO_MASTER_EPOCH_US 1792108800000000LL
+
+static const char TAG[] = "SCENARIO";
+static const gpio_num_t pin_btn = GPIO_NUM_35;
+
+enum commands
+{
+    CMD_BUTTON_LEVEL,
+    CMD_ENCODER,
+    CMD_MB_COIL,
+    CMD_MB_WRITE,
+    CMD_MB_READ,
+    CMD_MB_LOAD,
+    CMD_MEASURE,
+    CMD_PLANT,
+    CMD_LCD,
+    CMD_STATUS,
+    CMD_PERF,
+    CMD_LOG_LEVEL,
+    CMD_LOG_RATE,
+    CMD_LOG_STATS,
+    CMD_BUS,
+    CMD_BUS_STATS,
+    CMD_JOURNAL,
+    CMD_TIME_SYNC,
+    CMD_TIME_SYNC_STATUS,
+    CMD_EXPECT,
+    CMD_END
+};
+struct event_t
+{
+    int64_t t_us;
+    size_t line;
+    commands cmd;
+    std::string name;
+    double a;
+    double b;
+};
+enum field_types
+{
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_FLOAT
+};
+struct field_t
+{
+    const char* name;
+    mb_param_type_t area;
+    size_t offset;
+    field_types type;
+};
+#define HOLDING_FIELD(f, t) { #f, MB_PARAM_HOLDING, offsetof(holding_reg_params_t, f), t }
+#define INPUT_FIELD(f, t) { #f, MB_PARAM_INPUT, offsetof(input_reg_params_t, f), t }
+static const field_t fields[] =
+{
+    HOLDING_FIELD(power_setpoint, FIELD_FLOAT),
+    HOLDING_FIELD(vlim_setpoint, FIELD_FLOAT),
+    HOLDING_FIELD(cal_measurement, FIELD_FLOAT),
+    HOLDING_FIELD(cal_channel, FIELD_U16),
+    HOLDING_FIELD(cal_code_from, FIELD_U16),
+    HOLDING_FIELD(cal_code_to, FIELD_U16),
+    HOLDING_FIELD(cal_points, FIELD_U16),
+    HOLDING_FIELD(cal_settle_ms, FIELD_U16),
+    HOLDING_FIELD(journal_read_seq, FIELD_U32),
+    INPUT_FIELD(power_man, FIELD_FLOAT),
+    INPUT_FIELD(vlim_man, FIELD_FLOAT),
+    INPUT_FIELD(vpwr, FIELD_FLOAT),
+    INPUT_FIELD(dac_vlim, FIELD_FLOAT),
+    INPUT_FIELD(cal_active, FIELD_U16),
+    INPUT_FIELD(cal_index, FIELD_U16),
+    INPUT_FIELD(cal_count, FIELD_U16),
+    INPUT_FIELD(cal_fit_gain, FIELD_FLOAT),
+    INPUT_FIELD(cal_fit_offset, FIELD_FLOAT),
+    INPUT_FIELD(cal_fit_rms_residual, FIELD_FLOAT),
+    INPUT_FIELD(cal_fit_max_residual, FIELD_FLOAT),
+    INPUT_FIELD(cal_fit_result, FIELD_U16),
+    INPUT_FIELD(diag_uptime_s, FIELD_U32),
+    INPUT_FIELD(diag_dac_writes, FIELD_U32),
+    INPUT_FIELD(diag_lcd_bytes, FIELD_U32),
+    INPUT_FIELD(diag_mb_requests, FIELD_U32),
+    INPUT_FIELD(diag_nvs_writes, FIELD_U32),
+    INPUT_FIELD(diag_trace_events, FIELD_U32),
+    INPUT_FIELD(journal_head_seq, FIELD_U32),
+    INPUT_FIELD(journal_window_seq, FIELD_U32),
+    INPUT_FIELD(sync_rtt_us, FIELD_U32),
+    INPUT_FIELD(sync_state, FIELD_U16),
+    INPUT_FIELD(sync_samples, FIELD_U16)
+};
+#undef HOLDING_FIELD
+#undef INPUT_FIELD
+/// @brief Board state checked by "expect" besides the Modbus registers, same values as the status command prints
+struct state_key_t
+{
+    const char* name;
+    double (*get)();
+};
+static const state_key_t state_keys[] =
+{
+    { "on", [] { return static_cast<double>(discrete_reg_params.discrete_input0); } },
+    { "remote", [] { return static_cast<double>(coil_reg_params.coil_0); } },
+    { "oe", [] { return static_cast<double>(sim_plant::get_state().output_enabled); } },
+    { "vpwr_code", [] { return static_cast<double>(sim_plant::get_state().vpwr_code); } },
+    { "vlim_code", [] { return static_cast<double>(sim_plant::get_state().vlim_code); } },
+    { "v_amp", [] { return static_cast<double>(sim_plant::get_state().v_amp); } },
+    { "v_lim", [] { return static_cast<double>(sim_plant::get_state().v_lim); } },
+    { "v_heater", [] { return static_cast<double>(sim_plant::get_state().v_heater); } },
+    { "p_heater", [] { return static_cast<double>(sim_plant::get_state().p_heater); } },
+    { "t_heater", [] { return static_cast<double>(sim_plant::get_state().t_heater); } }
+};
+
+static std::vector<event_t> events;
+static int64_t end_us = 0;
+static uint32_t failures = 0;
+
+struct load_t
+{
+    double rate_hz;
+    int64_t until_us;
+};
+
+struct sync_t
+{
+    int64_t period_us;
+    int64_t until_us;
+    double drift_ppm;
+};
+
+static const field_t* find_field(const char* name)
+{
+    for (auto&& f : fields)
+    {
+        if (!strcmp(f.name, name)) return &f;
+    }
+    return NULL;
+}
+static const state_key_t* find_state_key(const char* name)
+{
+    for (auto&& k : state_keys)
+    {
+        if (!strcmp(k.name, name)) return &k;
+    }
+    return NULL;
+}
+static esp_err_t write_field(const field_t* f, double v)
+{
+    uint16_t regs[2];
+    if (f->type == FIELD_FLOAT)
+    {
+        float fv = static_cast<float>(v);
+        memcpy(regs, &fv, sizeof(fv));
+    }
+    else if (f->type == FIELD_U32)
+    {
+        uint32_t uv = static_cast<uint32_t>(v);
+        memcpy(regs, &uv, sizeof(uv));
+    }
+    else
+    {
+        regs[0] = static_cast<uint16_t>(v);
+    }
+    return sim_mb_request(f->area, true, static_cast<uint16_t>(f->offset / 2), regs, f->type == FIELD_U16 ? 1 : 2);
+}
+static esp_err_t read_field(const field_t* f, double* v)
+{
+    uint16_t regs[2];
+    esp_err_t err = sim_mb_request(f->area, false, static_cast<uint16_t>(f->offset / 2), regs, f->type == FIELD_U16 ? 1 : 2);
+    if (err != ESP_OK) return err;
+    if (f->type == FIELD_FLOAT)
+    {
+        float fv;
+        memcpy(&fv, regs, sizeof(fv));
+        *v = fv;
+    }
+    else if (f->type == FIELD_U32)
+    {
+        uint32_t uv;
+        memcpy(&uv, regs, sizeof(uv));
+        *v = uv;
+    }
+    else
+    {
+        *v = regs[0];
+    }
+    return ESP_OK;
+}
+static esp_err_t write_coil(uint16_t n, bool v)
+{
+    uint16_t bit = v ? 1 : 0;
+    return sim_mb_request(MB_PARAM_COIL, true, n, &bit, 1);
+}
+/// @brief Simulated Modbus master polling the input registers at a fixed rate (SCADA-like load)
+static void load_task(void* arg)
+{
+    load_t* l = static_cast<load_t*>(arg);
+    int64_t period_us = static_cast<int64_t>(1e6 / l->rate_hz);
+    int64_t next = sim_kernel::now_us();
+    uint32_t errors = 0, sent = 0;
+    uint16_t regs[SCENARIO_LOAD_REGS];
+    while (next < l->until_us)
+    {
+        if (sim_mb_request(MB_PARAM_INPUT, false, 0, regs, SCENARIO_LOAD_REGS) != ESP_OK) errors++;
+        sent++;
+        next += period_us;
+        sim_kernel::block_on(NULL, next);
+    }
+    ESP_LOGI(TAG, "Modbus load finished: %" PRIu32 " requests, %" PRIu32 " errors", sent, errors);
+    delete l;
+    vTaskDelete(NULL);
+}
+/// @brief Master clock of the time_sync command: virtual time plus an epoch, running drift_ppm fast
+static int64_t master_clock_us(double drift_ppm)
+{
+    int64_t t = sim_kernel::now_us();
+    return SCENARIO_MASTER_EPOCH_US + t + llround(t * drift_ppm / 1e6);
+}
+/// @brief Simulated Modbus master synchronizing the device's clock: one exchange per period, the round trip measured by
+/// the master goes with the next one. Reports the device's estimate error against the master clock at the end.
+static void sync_task(void* arg)
+{
+    sync_t* s = static_cast<sync_t*>(arg);
+    int64_t next = sim_kernel::now_us();
+    uint32_t errors = 0, sent = 0, rtt = 0;
+    uint16_t seq = 0;
+    while (next < s->until_us)
+    {
+        uint16_t regs[7];
+        uint64_t t1 = static_cast<uint64_t>(master_clock_us(s->drift_ppm));
+        memcpy(regs, &t1, sizeof(t1));
+        memcpy(regs + 4, &rtt, sizeof(rtt));
+        regs[6] = ++seq;
+        esp_err_t err = sim_mb_request(MB_PARAM_HOLDING, true, offsetof(holding_reg_params_t, sync_master_us) / 2, regs, 7);
+        if (err != ESP_OK) errors++;
+        rtt = (err == ESP_OK) ? static_cast<uint32_t>(master_clock_us(s->drift_ppm) - t1) : 0;
+        sent++;
+        next += s->period_us;
+        sim_kernel::block_on(NULL, next);
+    }
+    int64_t estimate;
+    if (timesync::now_us(&estimate))
+    {
+        printf("[%10.3f ms] time_sync: %" PRIu32 " exchanges, %" PRIu32 " errors, estimate error %+" PRId64 " us\n",
+            sim_kernel::now_us() / 1000.0, sent, errors, estimate - master_clock_us(s->drift_ppm));
+    }
+    else ESP_LOGE(TAG, "time_sync: not synchronized after %" PRIu32 " exchanges", sent);
+    delete s;
+    vTaskDelete(NULL);
+}
+static void print_status()
+{
+    auto s = sim_plant::get_state();
+    char l0[SIM_LCD_COLUMNS + 1], l1[SIM_LCD_COLUMNS + 1];
+    sim_lcd::get_line(0, l0, sizeof(l0));
+    sim_lcd::get_line(1, l1, sizeof(l1));
+    printf("[%10.3f ms] on=%u remote=%u codes=%" PRIu32 "/%" PRIu32 " oe=%u Vamp=%.4f Vlim=%.3f Vh=%.4f R=%.3f P=%.5f T=%.2f lcd=\"%s|%s\"\n",
+        sim_kernel::now_us() / 1000.0, discrete_reg_params.discrete_input0, coil_reg_params.coil_0, s.vpwr_code, s.vlim_code,
+        s.output_enabled, s.v_amp, s.v_lim, s.v_heater, s.r_heater, s.p_heater, s.t_heater, l0, l1);
+}
+static void execute(const event_t& e)
+{
+    esp_err_t err = ESP_OK;
+    switch (e.cmd)
+    {
+    case CMD_BUTTON_LEVEL:
+        sim_gpio_set_input(pin_btn, e.a > 0);
+        break;
+    case CMD_ENCODER:
+        ESP32Encoder::sim_turn(static_cast<int64_t>(e.a));
+        break;
+    case CMD_MB_COIL:
+        err = write_coil(static_cast<uint16_t>(e.a), e.b > 0);
+        break;
+    case CMD_MB_WRITE:
+        err = write_field(find_field(e.name.c_str()), e.a);
+        break;
+    case CMD_MB_READ:
+    {
+        double v = NAN;
+        err = read_field(find_field(e.name.c_str()), &v);
+        if (err == ESP_OK) printf("[%10.3f ms] %s = %g\n", sim_kernel::now_us() / 1000.0, e.name.c_str(), v);
+        break;
+    }
+    case CMD_MB_LOAD:
+    {
+        load_t* l = new load_t { .rate_hz = e.a, .until_us = sim_kernel::now_us() + static_cast<int64_t>(e.b * 1000) };
+        assert(xTaskCreate(load_task, "mb_load", SCENARIO_LOAD_TASK_STACK_SIZE, l, uxTaskPriorityGet(NULL), NULL) == pdPASS);
+        break;
+    }
+    case CMD_MEASURE:
+    {
+        // External meter reading posted like a calibration operator would: measurement register, then coil 2
+        float v = sim_plant::measure(e.name == "vlim");
+        ESP_LOGI(TAG, "Measured %s = %.4f V", e.name.c_str(), v);
+        err = write_field(find_field("cal_measurement"), v);
+        if (err == ESP_OK) err = write_coil(2, true);
+        break;
+    }
+    case CMD_PLANT:
+        if (!sim_plant::set_param(e.name.c_str(), static_cast<float>(e.a))) err = ESP_ERR_NOT_FOUND;
+        break;
+    case CMD_LCD:
+        printf("[%10.3f ms] LCD:\n", sim_kernel::now_us() / 1000.0);
+        sim_lcd::print();
+        break;
+    case CMD_STATUS:
+        print_status();
+        break;
+    case CMD_PERF:
+        printf("[%10.3f ms] Perf:\n", sim_kernel::now_us() / 1000.0);
+        perf::print_tasks();
+        perf::print_counters();
+        perf::print_trace(static_cast<size_t>(e.a));
+        break;
+    case CMD_LOG_LEVEL:
+        err = log_route::set_level(e.name.c_str(), static_cast<uint8_t>(e.a), static_cast<esp_log_level_t>(e.b));
+        break;
+    case CMD_LOG_RATE:
+        err = log_route::set_rate(e.name.c_str(), static_cast<uint16_t>(e.a), static_cast<uint16_t>(e.b));
+        break;
+    case CMD_LOG_STATS:
+        printf("[%10.3f ms] Log routing:\n", sim_kernel::now_us() / 1000.0);
+        log_route::print_rules();
+        break;
+    case CMD_BUS:
+    {
+        // Console command, waits for the control loop like a console session does
+        cmd_bus::cmd_t c = { .type = static_cast<cmd_bus::cmd_types>(e.a), .source = cmd_bus::SRC_CONSOLE };
+        if ((c.type == cmd_bus::CMD_OUTPUT) || (c.type == cmd_bus::CMD_SAFE_HOLD)) c.enable = e.b > 0;
+        else c.value = static_cast<float>(e.b);
+        err = cmd_bus::call(&c);
+        break;
+    }
+    case CMD_BUS_STATS:
+    {
+        auto st = cmd_bus::get_stats();
+        printf("[%10.3f ms] cmd_bus: posted=%" PRIu32 " rejected=%" PRIu32 " executed=%" PRIu32 " max_depth=%" PRIu32 "\n",
+            sim_kernel::now_us() / 1000.0, st.posted, st.rejected, st.executed, st.max_depth);
+        break;
+    }
+    case CMD_JOURNAL:
+        printf("[%10.3f ms] Journal:\n", sim_kernel::now_us() / 1000.0);
+        journal::print(static_cast<size_t>(e.a));
+        break;
+    case CMD_TIME_SYNC:
+    {
+        sync_t* s = new sync_t { .period_us = static_cast<int64_t>(e.a * 1000), .until_us = sim_kernel::now_us() + static_cast<int64_t>(e.b * 1000),
+            .drift_ppm = atof(e.name.c_str()) };
+        assert(xTaskCreate(sync_task, "mb_sync", SCENARIO_SYNC_TASK_STACK_SIZE, s, uxTaskPriorityGet(NULL), NULL) == pdPASS);
+        break;
+    }
+    case CMD_TIME_SYNC_STATUS:
+        printf("[%10.3f ms] Time sync:\n", sim_kernel::now_us() / 1000.0);
+        timesync::print_status();
+        break;
+    case CMD_EXPECT:
+    {
+        // Board state keys first, anything else is a register read over Modbus like mb_read
+        double v = NAN;
+        const state_key_t* k = find_state_key(e.name.c_str());
+        if (k) v = k->get();
+        else err = read_field(find_field(e.name.c_str()), &v);
+        if (err != ESP_OK) failures++;
+        else if (!(fabs(v - e.a) <= e.b))
+        {
+            printf("[%10.3f ms] FAIL line %zu: %s = %g, expected %g +/- %g\n", sim_kernel::now_us() / 1000.0, e.line, e.name.c_str(), v,
+                e.a, e.b);
+            failures++;
+        }
+        break;
+    }
+    case CMD_END:
+        sim_kernel::stop();
+        break;
+    }
+    if (err != ESP_OK) ESP_LOGE(TAG, "Line %zu: %s", e.line, esp_err_to_name(err));
+}
+static void scenario_task(void* arg)
+{
+    for (auto&& e : events)
+    {
+        if (e.t_us > sim_kernel::now_us()) sim_kernel::block_on(NULL, e.t_us);
+        execute(e);
+    }
+    vTaskDelete(NULL);
+}
+static void add(int64_t t_us, size_t line, commands cmd, const char* name = "", double a = 0, double b = 0)
+{
+    events.push_back({ .t_us = t_us, .line = line, .cmd = cmd, .name = name, .a = a, .b = b });
+}
+/// @brief Button edge with contact bounce: the level chatters before settling
+static void add_button_edge(int64_t t_us, size_t line, bool level)
+{
+    for (int i = 0; i < SCENARIO_BOUNCE_TOGGLES; i++) add(t_us + i * SCENARIO_BOUNCE_SPACING_US, line, CMD_BUTTON_LEVEL, "", (i % 2) ? !level : level);
+    add(t_us + SCENARIO_BOUNCE_TOGGLES * SCENARIO_BOUNCE_SPACING_US, line, CMD_BUTTON_LEVEL, "", level);
+}
+static bool parse_line(char* s, size_t line)
+{
+    char* hash = strchr(s, '#');
+    if (hash) *hash = '\0';
+    char* tok[5] = {};
+    size_t n = 0;
+    for (char* t = strtok(s, " \t\r\n"); t && n < 5; t = strtok(NULL, " \t\r\n")) tok[n++] = t;
+    if (!n) return true;
+    if (n < 2) return false;
+    char* end;
+    double t_ms = strtod(tok[0], &end);
+    if (*end || t_ms < 0) return false;
+    int64_t t = static_cast<int64_t>(t_ms * 1000);
+    const char* c = tok[1];
+    double a = n > 2 ? atof(tok[2]) : 0;
+    double b = n > 3 ? atof(tok[3]) : 0;
+
+    if (!strcmp(c, "button") && n == 3)
+    {
+        add_button_edge(t, line, true);
+        add_button_edge(t + static_cast<int64_t>(a * 1000), line, false);
+    }
+    else if (!strcmp(c, "encoder") && (n == 3 || n == 4))
+    {
+        // Spread over the duration in sampling periods, the last step takes the remainder
+        int64_t counts = static_cast<int64_t>(a);
+        int64_t steps = n == 4 ? std::max<int64_t>(1, static_cast<int64_t>(b * 1000) / SCENARIO_ENCODER_STEP_US) : 1;
+        int64_t done = 0;
+        for (int64_t i = 0; i < steps; i++)
+        {
+            int64_t next = counts * (i + 1) / steps;
+            add(t + i * SCENARIO_ENCODER_STEP_US, line, CMD_ENCODER, "", static_cast<double>(next - done));
+            done = next;
+        }
+    }
+    else if (!strcmp(c, "mb_coil") && n == 4) add(t, line, CMD_MB_COIL, "", a, b);
+    else if (!strcmp(c, "mb_write") && n == 4 && find_field(tok[2]) && find_field(tok[2])->area == MB_PARAM_HOLDING)
+        add(t, line, CMD_MB_WRITE, tok[2], atof(tok[3]));
+    else if (!strcmp(c, "mb_read") && n == 3 && find_field(tok[2])) add(t, line, CMD_MB_READ, tok[2]);
+    else if (!strcmp(c, "mb_load") && n == 4 && a > 0) add(t, line, CMD_MB_LOAD, "", a, b);
+    else if (!strcmp(c, "measure") && n == 3 && (!strcmp(tok[2], "vpwr") || !strcmp(tok[2], "vlim"))) add(t, line, CMD_MEASURE, tok[2]);
+    else if (!strcmp(c, "plant") && n == 4) add(t, line, CMD_PLANT, tok[2], atof(tok[3]));
+    else if (!strcmp(c, "lcd") && n == 2) add(t, line, CMD_LCD);
+    else if (!strcmp(c, "status") && n == 2) add(t, line, CMD_STATUS);
+    else if (!strcmp(c, "perf") && (n == 2 || n == 3)) add(t, line, CMD_PERF, "", n == 3 ? a : 16);
+    else if (!strcmp(c, "log_level") && n == 5)
+    {
+        uint8_t sinks;
+        esp_log_level_t level;
+        if (!log_route::parse_sinks(tok[2], &sinks) || !log_route::parse_level(tok[4], &level)) return false;
+        add(t, line, CMD_LOG_LEVEL, tok[3], sinks, level);
+    }
+    else if (!strcmp(c, "log_rate") && (n == 4 || n == 5)) add(t, line, CMD_LOG_RATE, tok[2], atof(tok[3]), n == 5 ? atof(tok[4]) : 0);
+    else if (!strcmp(c, "log_stats") && n == 2) add(t, line, CMD_LOG_STATS);
+    else if (!strcmp(c, "cmd") && (n == 3 || n == 4))
+    {
+        static const cmd_bus::cmd_types scriptable[] = { cmd_bus::CMD_SET_PWR, cmd_bus::CMD_SET_VLIM, cmd_bus::CMD_SET_VPWR_DAC,
+            cmd_bus::CMD_SET_VLIM_DAC, cmd_bus::CMD_OUTPUT, cmd_bus::CMD_OVERRIDE_ERRORS, cmd_bus::CMD_CAL_POST, cmd_bus::CMD_CAL_ABORT,
+            cmd_bus::CMD_SAFE_HOLD };
+        const cmd_bus::cmd_types* type = std::find_if(std::begin(scriptable), std::end(scriptable),
+            [&](cmd_bus::cmd_types x) { return !strcmp(cmd_bus::get_type_name(x), tok[2]); });
+        if (type == std::end(scriptable)) return false;
+        add(t, line, CMD_BUS, "", *type, n == 4 ? atof(tok[3]) : 0);
+    }
+    else if (!strcmp(c, "cmd_stats") && n == 2) add(t, line, CMD_BUS_STATS);
+    else if (!strcmp(c, "journal") && (n == 2 || n == 3)) add(t, line, CMD_JOURNAL, "", n == 3 ? a : 20);
+    else if (!strcmp(c, "time_sync") && (n == 4 || n == 5) && a > 0) add(t, line, CMD_TIME_SYNC, n == 5 ? tok[4] : "0", a, b);
+    else if (!strcmp(c, "timesync") && n == 2) add(t, line, CMD_TIME_SYNC_STATUS);
+    else if (!strcmp(c, "expect") && (n == 4 || n == 5) && (find_state_key(tok[2]) || find_field(tok[2])))
+        add(t, line, CMD_EXPECT, tok[2], atof(tok[3]), n == 5 ? atof(tok[4]) : 0);
+    else if (!strcmp(c, "end") && n == 2)
+    {
+        add(t, line, CMD_END);
+        end_us = t;
+    }
+    else return false;
+    return true;
+}
+
+namespace sim_scenario
+{
+    /// @brief Parse a scenario file
+    /// @return False on a syntax error (reported to stderr)
+    bool load(const char* path)
+    {
+        FILE* f = fopen(path, "r");
+        if (!f)
+        {
+            fprintf(stderr, "Can't open %s\n", path);
+            return false;
+        }
+        char buf[256];
+        size_t line = 0;
+        bool ok = true;
+        while (fgets(buf, sizeof(buf), f))
+        {
+            line++;
+            if (!parse_line(buf, line))
+            {
+                fprintf(stderr, "%s:%zu: syntax error\n", path, line);
+                ok = false;
+            }
+        }
+        fclose(f);
+        std::stable_sort(events.begin(), events.end(), [](const event_t& x, const event_t& y) { return x.t_us < y.t_us; });
+        if (!end_us && !events.empty()) end_us = events.back().t_us + SCENARIO_DEFAULT_TAIL_US;
+        return ok;
+    }
+    /// @brief Virtual time the scenario ends at ("end" command, or one second after the last event)
+    int64_t get_end_us()
+    {
+        return end_us;
+    }
+    void start(UBaseType_t priority)
+    {
+        assert(xTaskCreate(scenario_task, "scenario", SCENARIO_TASK_STACK_SIZE, NULL, priority, NULL) == pdPASS);
+    }
+    /// @brief Failed "expect" lines so far, including register reads that failed
+    uint32_t get_failures()
+    {
+        return failures;
+    }
+} // namespace sim_scenario
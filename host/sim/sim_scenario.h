@@ -0,0 +1,14 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+
+/// @brief Scenario scripts: timed operator, Modbus master and plant actions, see host/README.md
+namespace sim_scenario
+{
+    bool load(const char* path);
+    int64_t get_end_us();
+    void start(UBaseType_t priority);
+    uint32_t get_failures();
+} // namespace sim_scenario
@@ -0,0 +1,220 @@
+/**
+ * @file bench.cpp
+ * @author MSU
+ * @brief Microbenchmarks of the firmware hot paths: every case is called N times in the calling task, each call is timed
+ * with the CPU cycle counter. Reports min/mean/p99/max cycles and the free heap change, as a table or as JSON lines
+ * (one object per case, tagged with the firmware version and target) for regression tracking between versions.
+ * Cases never touch the DACs, which belong to the control loop, and the suite refuses to run while the heater is driven.
+ * @date 2026-10-16
+ *
+ */
+
+#include "bench.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "macros.h"
+#include "my_hal.h"
+#include "my_dac.h"
+#include "menu.h"
+#include "modbus.h"
+#include "control.h"
+#include "cal_capture.h"
+#include "cal_sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Longest wait for a repaint in progress before the LCD case is skipped */
+#define BENCH_LCD_LOCK_TIMEOUT_MS 1000
+
+static const char TAG[] = "BENCH";
+
+static bool json_output = false;
+/// @brief Output of the printf case: stdout, or the null device in JSON mode (console captures are too small for N lines)
+static FILE* printf_stream = NULL;
+
+/// @brief Benchmark case: one call of the hot path
+struct bench_case_t
+{
+    const char* name;
+    void (*fn)(uint32_t i);
+    esp_err_t (*begin)(); ///< Optional, called before the first iteration: an error skips the case
+    void (*done)(); ///< Optional, called after the last iteration
+};
+
+/// @brief The LCD chain is shared with the menu: hold off repaints for the whole case
+static esp_err_t case_sr_write_begin()
+{
+    return menu::lock(BENCH_LCD_LOCK_TIMEOUT_MS) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+/// @brief LCD chain only: the display latches data on E, which isn't strobed here
+static void case_sr_write(uint32_t i)
+{
+    uint8_t b = static_cast<uint8_t>(i);
+    my_hal::sr_write(my_hal::sr_types::SR_LCD, &b);
+}
+static void case_sr_write_done()
+{
+    menu::unlock();
+}
+/// @brief Alternating values, so that formatting is never skipped
+static void case_menu_set_values(uint32_t i)
+{
+    menu::set_values((i & 1) ? 1.234f : 2.345f, 4.5f);
+}
+static void case_lcd_puts(uint32_t i)
+{
+    menu::print_at(0, 0, (i & 1) ? "12345678" : "87654321");
+}
+/// @brief Slave lock, coil read, unlock
+static void case_modbus_lock(uint32_t i)
+{
+    modbus::get_remote_enabled();
+}
+static esp_err_t case_printf_begin()
+{
+    if (!json_output)
+    {
+        printf_stream = stdout;
+        return ESP_OK;
+    }
+    printf_stream = fopen("/dev/null", "w");
+    if (!printf_stream) return ESP_ERR_NOT_FOUND;
+    setvbuf(printf_stream, NULL, _IONBF, 0); // A buffer allocated on the first write would count as a leak
+    return ESP_OK;
+}
+static void case_printf(uint32_t i)
+{
+    fprintf(printf_stream, "%8" PRIu32 "\r", i);
+    fflush(printf_stream);
+}
+/// @brief Keep the counter line apart from the results
+static void case_printf_done()
+{
+    if (printf_stream == stdout) printf("\n");
+    else fclose(printf_stream);
+    printf_stream = NULL;
+}
+
+static const bench_case_t cases[] = {
+    { "sr_write", case_sr_write, case_sr_write_begin, case_sr_write_done },
+    { "menu_set_values", case_menu_set_values, NULL, NULL },
+    { "lcd_puts", case_lcd_puts, NULL, NULL },
+    { "modbus_lock", case_modbus_lock, NULL, NULL },
+    { "printf", case_printf, case_printf_begin, case_printf_done },
+};
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *static_cast<const uint32_t*>(a);
+    uint32_t y = *static_cast<const uint32_t*>(b);
+    return (x > y) - (x < y);
+}
+/// @brief Time one case. A sample is retaken if the task migrated to the other core (cycle counters are per core).
+/// @param samples Buffer for the per-call cycle counts (sorted on return)
+static void run_case(const bench_case_t* c, uint32_t iterations, uint32_t* samples, bench::result_t* res)
+{
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        int core;
+        uint32_t cycles;
+        do
+        {
+            core = esp_cpu_get_core_id();
+            uint32_t start = esp_cpu_get_cycle_count();
+            c->fn(i);
+            cycles = esp_cpu_get_cycle_count() - start;
+        } while (core != esp_cpu_get_core_id());
+        samples[i] = cycles;
+        total += cycles;
+    }
+    size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    if (c->done) c->done();
+
+    qsort(samples, iterations, sizeof(samples[0]), compare_u32);
+    res->name = c->name;
+    res->iterations = iterations;
+    res->min = samples[0];
+    res->mean = static_cast<uint32_t>(total / iterations);
+    res->p99 = samples[(static_cast<uint64_t>(iterations) * 99u) / 100u];
+    res->max = samples[iterations - 1];
+    res->heap_delta = static_cast<int32_t>(heap_before - heap_after);
+}
+
+namespace bench
+{
+    /// @brief Run the benchmark suite in the calling task and print the results to stdout
+    /// @param filter Case name, NULL or "all" for every case
+    /// @param iterations Calls per case, 1..BENCH_MAX_ITERATIONS
+    /// @param json True == one JSON object per line, false == table
+    /// @param cancelled Optional, polled between cases: true stops the suite
+    /// @return ESP_ERR_INVALID_ARG, ESP_ERR_NOT_FOUND (no case matches filter), ESP_ERR_INVALID_STATE if the output is driven
+    /// (output on, heater voltage set, ramp or calibration in progress), ESP_ERR_NO_MEM, ESP_ERR_TIMEOUT if cancelled or a case
+    /// was skipped (LCD busy)
+    esp_err_t run(const char* filter, uint32_t iterations, bool json, bool (*cancelled)())
+    {
+        if (!iterations || iterations > BENCH_MAX_ITERATIONS) return ESP_ERR_INVALID_ARG;
+        if (filter && !strcmp(filter, "all")) filter = NULL;
+        bool found = !filter;
+        for (size_t i = 0; i < ARRAY_SIZE(cases) && !found; i++) found = !strcmp(cases[i].name, filter);
+        if (!found) return ESP_ERR_NOT_FOUND;
+        if (control::is_output_on() || my_dac::get_vpwr() != 0 || my_dac::is_ramping() || cal_capture::is_active() || cal_sweep::is_active())
+        {
+            ESP_LOGW(TAG, "Output is driven, disable it first");
+            return ESP_ERR_INVALID_STATE;
+        }
+        uint32_t* samples = static_cast<uint32_t*>(malloc(iterations * sizeof(uint32_t)));
+        if (!samples) return ESP_ERR_NO_MEM;
+        json_output = json;
+
+        if (!json) printf("%-16s %6s %9s %9s %9s %9s %8s\n", "Case", "N", "Min,cyc", "Mean,cyc", "P99,cyc", "Max,cyc", "Heap,B");
+        esp_err_t ret = ESP_OK;
+        for (size_t i = 0; i < ARRAY_SIZE(cases); i++)
+        {
+            if (filter && strcmp(cases[i].name, filter)) continue;
+            if (cancelled && cancelled())
+            {
+                ret = ESP_ERR_TIMEOUT;
+                break;
+            }
+            if (cases[i].begin && ((ret = cases[i].begin()) != ESP_OK))
+            {
+                ESP_LOGW(TAG, "%s skipped: %s", cases[i].name, esp_err_to_name(ret));
+                continue;
+            }
+            result_t r;
+            run_case(&cases[i], iterations, samples, &r);
+            if (json)
+            {
+                printf("{\"fw\":\"%s\",\"target\":\"%s\",\"cpu_mhz\":%d,\"case\":\"%s\",\"n\":%" PRIu32 ",\"min\":%" PRIu32
+                    ",\"mean\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 ",\"heap_delta\":%" PRIi32 "}\n",
+                    FIRMWARE_VERSION_STR, CONFIG_IDF_TARGET, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, r.name, r.iterations, r.min, r.mean,
+                    r.p99, r.max, r.heap_delta);
+            }
+            else
+            {
+                printf("%-16s %6" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %8" PRIi32 "\n", r.name, r.iterations,
+                    r.min, r.mean, r.p99, r.max, r.heap_delta);
+            }
+        }
+        free(samples);
+        menu::repaint(); //Restore the screen after lcd_puts/menu_set_values
+
+        if (!json)
+        {
+            printf("CPU %d MHz, free heap %u B (min %u B)\n", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+                static_cast<unsigned>(heap_caps_get_free_size(MALLOC_CAP_DEFAULT)),
+                static_cast<unsigned>(heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT)));
+        }
+        return ret;
+    }
+} // namespace bench
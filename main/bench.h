@@ -0,0 +1,24 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_MAX_ITERATIONS 4096
+
+namespace bench
+{
+    /// @brief Per-case result, CPU cycles per call (esp_cpu_get_cycle_count)
+    struct result_t
+    {
+        const char* name;
+        uint32_t iterations;
+        uint32_t min;
+        uint32_t mean;
+        uint32_t p99;
+        uint32_t max;
+        int32_t heap_delta; ///< Free heap lost over the whole case, bytes (negative == freed)
+    };
+
+    esp_err_t run(const char* filter, uint32_t iterations, bool json, bool (*cancelled)() = NULL);
+} // namespace bench
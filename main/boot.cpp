@@ -0,0 +1,221 @@
+/**
+ * @file boot.cpp
+ * @author MSU
+ * @brief Boot orchestrator. The heater output is brought into a safe state first, then independent subsystems are initialized
+ * concurrently: network stack, Modbus and console on the PRO CPU, LCD on the APP CPU, user inputs in the calling task.
+ * SPIFFS mount and consistency check are deferred to a low-priority background task. Every stage is timestamped,
+ * so that the boot timeline (including the time of the first Modbus request served) can be inspected from the console.
+ * The same stage results decide whether a freshly updated image is healthy (see ota.cpp).
+ * @date 2026-10-16
+ *
+ */
+
+#include "boot.h"
+
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "my_hal.h"
+#include "my_dac.h"
+#include "cal_capture.h"
+#include "cal_sweep.h"
+#include "perf.h"
+#include "static_alloc.h"
+#include "params.h"
+#include "journal.h"
+#include "menu.h"
+#include "modbus.h"
+#include "dbg_console.h"
+#include "ota.h"
+#include "eth_mdns_init.h"
+
+#define BOOT_NETWORK_DONE_BIT BIT0
+#define BOOT_DISPLAY_DONE_BIT BIT1
+#define BOOT_TASK_STACK_SIZE 4096
+#define BOOT_TASK_PRIORITY 2
+
+static const char TAG[] = "BOOT";
+
+static const char* const stage_names[boot::STAGE_COUNT] =
+{
+    "safe_state",
+    "params",
+    "journal",
+    "inputs",
+    "network",
+    "mdns",
+    "modbus",
+    "console",
+    "ota",
+    "display",
+    "spiffs",
+    "first_mb_request"
+};
+static boot::stage_record_t timeline[boot::STAGE_COUNT] = {};
+static EventGroupHandle_t boot_event_group = NULL;
+
+static void stage_start(boot::stages s)
+{
+    timeline[s].start_us = esp_timer_get_time();
+    timeline[s].core = xPortGetCoreID();
+}
+static esp_err_t stage_end(boot::stages s, esp_err_t result)
+{
+    timeline[s].result = result;
+    timeline[s].end_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Stage %s: %" PRId64 " ms (took %" PRId64 " us, core %d): %s", stage_names[s], timeline[s].end_us / 1000,
+        timeline[s].end_us - timeline[s].start_us, timeline[s].core, esp_err_to_name(result));
+    return result;
+}
+
+/// @brief Network stack, mDNS, Modbus slave, console (mostly useful over Ethernet) and the firmware update receiver
+/// @param arg Not used
+static void network_task(void* arg)
+{
+    stage_start(boot::STAGE_NETWORK);
+    stage_end(boot::STAGE_NETWORK, my_hal::init_network());
+
+    stage_start(boot::STAGE_MODBUS);
+    modbus::init(my_hal::get_netif());
+    modbus::set_setpoints(my_params::get_last_saved_vpwr(), my_params::get_last_saved_vlim());
+    stage_end(boot::STAGE_MODBUS, ESP_OK);
+
+    stage_start(boot::STAGE_MDNS);
+    mdns_start_service(my_params::get_hostname(), FIRMWARE_VERSION_STR);
+    mdns_register_modbus(CONFIG_FMB_TCP_PORT_DEFAULT, CONFIG_FMB_CONTROLLER_SLAVE_ID);
+    mdns_register_console(CONFIG_CONSOLE_PORT);
+    mdns_register_echo(CONFIG_ECHO_PORT);
+    stage_end(boot::STAGE_MDNS, ESP_OK);
+
+    stage_start(boot::STAGE_CONSOLE);
+    dbg_console::init();
+    stage_end(boot::STAGE_CONSOLE, ESP_OK);
+
+    stage_start(boot::STAGE_OTA);
+    stage_end(boot::STAGE_OTA, ota::init());
+
+    xEventGroupSetBits(boot_event_group, BOOT_NETWORK_DONE_BIT);
+    vTaskDelete(NULL);
+}
+/// @brief LCD init is dominated by the controller's power-on and command delays, so it runs alongside the network stack
+/// @param arg Not used
+static void display_task(void* arg)
+{
+    stage_start(boot::STAGE_DISPLAY);
+    esp_err_t ret = menu::init(my_hal::get_lcd_config());
+    if (ret == ESP_OK) menu::print_str("Hello"); //menu::print_message(menu::localized_messages::initializing);
+    stage_end(boot::STAGE_DISPLAY, ret);
+
+    xEventGroupSetBits(boot_event_group, BOOT_DISPLAY_DONE_BIT);
+    vTaskDelete(NULL);
+}
+/// @brief SPIFFS check walks the whole partition and is not needed for control, so it runs at the lowest priority
+/// @param arg Not used
+static void spiffs_task(void* arg)
+{
+    stage_start(boot::STAGE_SPIFFS);
+    stage_end(boot::STAGE_SPIFFS, my_params::init_spiffs());
+    vTaskDelete(NULL);
+}
+
+namespace boot
+{
+    /// @brief Bring up all subsystems. Returns once everything except SPIFFS has been initialized.
+    /// Must be called once, from the control task.
+    /// @return ESP_OK, or the first error among the stages that are essential for operation (safe state, params, inputs, network, display)
+    esp_err_t run()
+    {
+        static StaticEventGroup_t boot_event_group_buffer;
+        boot_event_group = static_alloc::create_event_group("boot", &boot_event_group_buffer);
+#if CONFIG_BOOT_SETTLE_DELAY_MS > 0
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BOOT_SETTLE_DELAY_MS));
+#endif
+
+        // Nothing else may run before the shift registers hold zeros
+        stage_start(STAGE_SAFE_STATE);
+        stage_end(STAGE_SAFE_STATE, my_hal::init_safe_state());
+
+        stage_start(STAGE_PARAMS);
+        stage_end(STAGE_PARAMS, my_params::init());
+        stage_start(STAGE_JOURNAL);
+        stage_end(STAGE_JOURNAL, journal::init());
+        my_dac::init(my_params::get_dac_cal());
+        cal_capture::init();
+        cal_sweep::init();
+        perf::init();
+        for (size_t i = 0; i < my_dac::CH_COUNT; i++)
+        {
+            auto ch = static_cast<my_dac::channels>(i);
+            my_dac::set_cal_table(ch, my_params::get_dac_cal_table(ch));
+        }
+
+        assert(xTaskCreate(spiffs_task, "boot_spiffs", BOOT_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL) == pdPASS);
+        assert(xTaskCreatePinnedToCore(network_task, "boot_network", BOOT_TASK_STACK_SIZE, NULL, BOOT_TASK_PRIORITY, NULL, PRO_CPU_NUM) == pdPASS);
+        assert(xTaskCreatePinnedToCore(display_task, "boot_display", BOOT_TASK_STACK_SIZE, NULL, BOOT_TASK_PRIORITY, NULL, APP_CPU_NUM) == pdPASS);
+
+        stage_start(STAGE_INPUTS);
+        stage_end(STAGE_INPUTS, my_hal::init_inputs());
+
+        xEventGroupWaitBits(boot_event_group, BOOT_NETWORK_DONE_BIT | BOOT_DISPLAY_DONE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        ESP_LOGI(TAG, "Boot finished in %" PRId64 " ms", esp_timer_get_time() / 1000);
+        static_alloc::print_report();
+
+        esp_err_t ret = get_result();
+        if (ret != ESP_OK) ESP_LOGE(TAG, "Init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    /// @return ESP_OK, the first error among the stages that are essential for operation, ESP_ERR_TIMEOUT while one is unfinished
+    esp_err_t get_result()
+    {
+        const stages essential[] = { STAGE_SAFE_STATE, STAGE_PARAMS, STAGE_INPUTS, STAGE_NETWORK, STAGE_DISPLAY };
+        for (auto s : essential)
+        {
+            if (!timeline[s].end_us) return ESP_ERR_TIMEOUT;
+            if (timeline[s].result != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Stage failed: %s", stage_names[s]);
+                return timeline[s].result;
+            }
+        }
+        return ESP_OK;
+    }
+    /// @brief Record the time of the first Modbus request served. Cheap enough to be called on every request.
+    void mark_first_modbus_request()
+    {
+        if (timeline[STAGE_FIRST_MODBUS_REQUEST].end_us) return;
+        timeline[STAGE_FIRST_MODBUS_REQUEST].start_us = timeline[STAGE_MODBUS].end_us;
+        timeline[STAGE_FIRST_MODBUS_REQUEST].core = xPortGetCoreID();
+        timeline[STAGE_FIRST_MODBUS_REQUEST].result = ESP_OK;
+        timeline[STAGE_FIRST_MODBUS_REQUEST].end_us = esp_timer_get_time();
+    }
+
+    const stage_record_t* get_stage(stages s)
+    {
+        assert(s < STAGE_COUNT);
+        return &(timeline[s]);
+    }
+    const char* get_stage_name(stages s)
+    {
+        assert(s < STAGE_COUNT);
+        return stage_names[s];
+    }
+    /// @brief Print boot timeline to stdout (for the debug console)
+    void print_timeline()
+    {
+        printf("%-18s %10s %10s %10s %4s %s\n", "Stage", "Start,us", "End,us", "Took,us", "Core", "Result");
+        for (size_t i = 0; i < STAGE_COUNT; i++)
+        {
+            const stage_record_t& r = timeline[i];
+            if (!r.end_us)
+            {
+                printf("%-18s %10s\n", stage_names[i], r.start_us ? "running" : "pending");
+                continue;
+            }
+            printf("%-18s %10" PRId64 " %10" PRId64 " %10" PRId64 " %4d %s\n", stage_names[i], r.start_us, r.end_us, r.end_us - r.start_us, r.core,
+                esp_err_to_name(r.result));
+        }
+    }
+} // namespace boot
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+namespace boot
+{
+    enum stages
+    {
+        STAGE_SAFE_STATE,
+        STAGE_PARAMS,
+        STAGE_JOURNAL,
+        STAGE_INPUTS,
+        STAGE_NETWORK,
+        STAGE_MDNS,
+        STAGE_MODBUS,
+        STAGE_CONSOLE,
+        STAGE_OTA,
+        STAGE_DISPLAY,
+        STAGE_SPIFFS,
+        STAGE_FIRST_MODBUS_REQUEST,
+        STAGE_COUNT
+    };
+
+    /// @brief Boot timeline entry, times are esp_timer microseconds (since the app started)
+    struct stage_record_t
+    {
+        int64_t start_us; ///< 0 == stage has not started
+        int64_t end_us; ///< 0 == stage has not finished
+        int core;
+        esp_err_t result;
+    };
+
+    esp_err_t run();
+    esp_err_t get_result();
+    void mark_first_modbus_request();
+
+    const stage_record_t* get_stage(stages s);
+    const char* get_stage_name(stages s);
+    void print_timeline();
+} // namespace boot
@@ -0,0 +1,164 @@
+/**
+ * @file cal_capture.cpp
+ * @author MSU
+ * @brief Multi-point DAC calibration table capture. The DAC is stepped through evenly spaced codes, for every code
+ * an externally measured output voltage is posted (debug console or Modbus), then the next code is applied.
+ * After the last point the table is sorted, stored into the devcal partition and applied.
+ * The control loop must not write the DACs while a capture is active.
+ * @date 2026-10-16
+ *
+ */
+
+#include "cal_capture.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "params.h"
+#include "cal_sweep.h"
+#include "perf.h"
+#include "static_alloc.h"
+
+#include <math.h>
+
+static const char TAG[] = "CAL_CAPTURE";
+
+static SemaphoreHandle_t session_mutex = NULL;
+static volatile bool active = false;
+static my_dac::channels channel = my_dac::CH_VPWR;
+static uint32_t first_code = 0;
+static uint32_t final_code = 0;
+static uint16_t point_index = 0;
+static uint16_t count = 0;
+static my_dac_cal_table_t table;
+
+static uint32_t code_for_index(uint16_t i)
+{
+    float step = (static_cast<float>(final_code) - first_code) / (count - 1);
+    return static_cast<uint32_t>(first_code + step * i + 0.5f);
+}
+/// @brief Leave the output in a safe state: heater voltage at zero, limit back to the last saved setpoint
+static void finish_output()
+{
+    if (channel == my_dac::CH_VPWR) my_dac::set_code(my_dac::CH_VPWR, 0);
+    else my_dac::set_vlim_target(my_params::get_last_saved_vlim());
+}
+/// @brief Sort the captured points by measured voltage and store the table
+/// @return ESP_ERR_INVALID_RESPONSE if two points have the same measured voltage (non-monotonic output), see also my_params::set_dac_cal_table
+static esp_err_t complete()
+{
+    my_dac_cal_point_t* p = table.points;
+    for (size_t i = 1; i < table.count; i++)
+    {
+        my_dac_cal_point_t t = p[i];
+        size_t j = i;
+        for (; j > 0 && p[j - 1].volts > t.volts; j--) p[j] = p[j - 1];
+        p[j] = t;
+    }
+    for (size_t i = 1; i < table.count; i++)
+    {
+        if (!(p[i].volts > p[i - 1].volts))
+        {
+            ESP_LOGE(TAG, "Duplicate measurement %.4f V (codes %.0f, %.0f)", p[i].volts, p[i - 1].code, p[i].code);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    esp_err_t err = my_params::set_dac_cal_table(channel, &table);
+    if (err == ESP_OK) my_dac::set_cal_table(channel, &table);
+    return err;
+}
+
+namespace cal_capture
+{
+    void init()
+    {
+        static StaticSemaphore_t session_mutex_buffer;
+        session_mutex = static_alloc::create_mutex("cal_capture", &session_mutex_buffer);
+    }
+    /// @brief Begin capture: the first code is applied immediately
+    /// @param ch DAC channel
+    /// @param code_from First DAC code
+    /// @param code_to Last DAC code
+    /// @param points Number of points, 2..MY_DAC_CAL_TABLE_MAX_POINTS
+    /// @return ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE if a capture or a gain/offset sweep is already active
+    esp_err_t start(my_dac::channels ch, uint32_t code_from, uint32_t code_to, uint16_t points)
+    {
+        if (ch >= my_dac::CH_COUNT || points < 2 || points > MY_DAC_CAL_TABLE_MAX_POINTS) return ESP_ERR_INVALID_ARG;
+        if (code_from == code_to || code_from > my_dac::get_full_scale(ch) || code_to > my_dac::get_full_scale(ch)) return ESP_ERR_INVALID_ARG;
+        if (!session_mutex) return ESP_ERR_INVALID_STATE;
+
+        xSemaphoreTake(session_mutex, portMAX_DELAY);
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+        if (!active && !cal_sweep::is_active())
+        {
+            channel = ch;
+            first_code = code_from;
+            final_code = code_to;
+            count = points;
+            point_index = 0;
+            table.count = 0;
+            active = true;
+            my_dac::set_code(channel, code_for_index(0));
+            ESP_LOGI(TAG, "Channel %d: %u points, codes %" PRIu32 "..%" PRIu32, ch, points, code_from, code_to);
+            err = ESP_OK;
+        }
+        xSemaphoreGive(session_mutex);
+        return err;
+    }
+    /// @brief Record the measured output for the current code and advance to the next one
+    /// @param volts Measured output (heater amplifier voltage or voltage limit), volts
+    /// @return ESP_ERR_INVALID_STATE if no capture is active, see also complete()
+    esp_err_t post_measurement(float volts)
+    {
+        if (!isfinite(volts)) return ESP_ERR_INVALID_ARG;
+        if (!session_mutex) return ESP_ERR_INVALID_STATE;
+        xSemaphoreTake(session_mutex, portMAX_DELAY);
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+        if (active)
+        {
+            table.points[table.count].volts = volts;
+            table.points[table.count].code = code_for_index(point_index);
+            table.count++;
+            perf::trace(perf::EV_CAL_POINT, code_for_index(point_index));
+            ESP_LOGI(TAG, "Point %u/%u: code %" PRIu32 " -> %.4f V", point_index + 1, count, code_for_index(point_index), volts);
+            if (++point_index < count)
+            {
+                my_dac::set_code(channel, code_for_index(point_index));
+                err = ESP_OK;
+            }
+            else
+            {
+                err = complete();
+                ESP_LOGI(TAG, "Capture finished: %s", esp_err_to_name(err));
+                finish_output();
+                active = false;
+            }
+        }
+        xSemaphoreGive(session_mutex);
+        return err;
+    }
+    /// @brief Abandon capture (calibration is not changed)
+    void abort()
+    {
+        if (!session_mutex) return;
+        xSemaphoreTake(session_mutex, portMAX_DELAY);
+        if (active)
+        {
+            finish_output();
+            active = false;
+            ESP_LOGW(TAG, "Capture aborted at point %u/%u", point_index + 1, count);
+        }
+        xSemaphoreGive(session_mutex);
+    }
+    bool is_active()
+    {
+        return active;
+    }
+    status_t get_status()
+    {
+        status_t ret = { .active = active, .ch = channel, .index = point_index, .count = count, .code = 0 };
+        if (ret.active) ret.code = code_for_index(point_index);
+        return ret;
+    }
+} // namespace cal_capture
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "my_dac.h"
+
+namespace cal_capture
+{
+    struct status_t
+    {
+        bool active;
+        my_dac::channels ch;
+        uint16_t index; ///< Point being measured
+        uint16_t count;
+        uint32_t code; ///< DAC code currently applied
+    };
+
+    void init();
+    esp_err_t start(my_dac::channels ch, uint32_t code_from, uint32_t code_to, uint16_t points);
+    esp_err_t post_measurement(float volts);
+    void abort();
+    bool is_active();
+    status_t get_status();
+} // namespace cal_capture
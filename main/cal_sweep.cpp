@@ -0,0 +1,272 @@
+/**
+ * @file cal_sweep.cpp
+ * @author MSU
+ * @brief Automated gain/offset DAC calibration. A background task steps the DAC through evenly spaced codes,
+ * waits for the output to settle and then for a measurement posted by an external meter (debug console or Modbus).
+ * Gain and offset are fitted by least squares, residuals are reported, and the result is stored via my_params::set_dac_cal.
+ * The task doesn't write the DACs itself: every code goes to the control loop as a cmd_bus::CMD_CAL_STEP command, and the
+ * loop writes nothing else to the DACs while a sweep is active. Modbus service is not affected.
+ * @date 2026-10-16
+ *
+ */
+
+#include "cal_sweep.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "cal_capture.h"
+#include "cmd_bus.h"
+#include "perf.h"
+#include "static_alloc.h"
+#include "params.h"
+
+#include <math.h>
+
+#define CAL_SWEEP_TASK_STACK_SIZE 4096
+#define CAL_SWEEP_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+static const char TAG[] = "CAL_SWEEP";
+
+static SemaphoreHandle_t session_mutex = NULL;
+/// @brief Posted measurements (length 1), NAN means abort
+static QueueHandle_t measurement_queue = NULL;
+static volatile bool active = false;
+static volatile bool waiting = false;
+static volatile uint16_t point_index = 0;
+static cal_sweep::config_t config;
+static cal_sweep::result_t result = { .err = ESP_ERR_INVALID_STATE };
+/// @brief Fit data: DAC-referred calibration input (x) and DAC voltage (y), see my_dac::get_cal_input
+static float fit_x[MY_DAC_CAL_TABLE_MAX_POINTS];
+static float fit_y[MY_DAC_CAL_TABLE_MAX_POINTS];
+static float measured[MY_DAC_CAL_TABLE_MAX_POINTS];
+static float residuals[MY_DAC_CAL_TABLE_MAX_POINTS];
+
+static uint32_t code_for_index(uint16_t i)
+{
+    float step = (static_cast<float>(config.code_to) - config.code_from) / (config.points - 1);
+    return static_cast<uint32_t>(config.code_from + step * i + 0.5f);
+}
+/// @brief Have the control loop write the swept channel and wait for it. A full command queue is retried, so that the final
+/// restore is never lost.
+/// @param restore True: leave the output in a safe state (heater voltage at zero, limit back to the last saved setpoint)
+static esp_err_t apply_code(uint32_t code, bool restore)
+{
+    cmd_bus::cmd_t c = { .type = cmd_bus::CMD_CAL_STEP, .source = cmd_bus::SRC_CAL };
+    c.step = { .channel = static_cast<uint8_t>(config.ch), .restore = restore, .code = code };
+    esp_err_t err;
+    while ((err = cmd_bus::call(&c)) == ESP_ERR_NO_MEM) vTaskDelay(1);
+    return err;
+}
+/// @brief Wait for a posted value
+/// @param ticks Timeout
+/// @param v Value (output)
+/// @return ESP_ERR_TIMEOUT if nothing was posted, ESP_ERR_NOT_FINISHED if aborted
+static esp_err_t wait_posted(TickType_t ticks, float* v)
+{
+    if (xQueueReceive(measurement_queue, v, ticks) != pdTRUE) return ESP_ERR_TIMEOUT;
+    return isnan(*v) ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+/// @brief Least-squares fit y = gain * x + offset over the captured points, residuals in DAC codes
+/// @return ESP_ERR_INVALID_RESPONSE if the points are degenerate or the slope is not positive (wrong channel or meter polarity)
+static esp_err_t fit()
+{
+    size_t n = result.points;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sx += fit_x[i];
+        sy += fit_y[i];
+        sxx += static_cast<double>(fit_x[i]) * fit_x[i];
+        sxy += static_cast<double>(fit_x[i]) * fit_y[i];
+    }
+    double denom = n * sxx - sx * sx;
+    if (!(fabs(denom) > 1e-12)) return ESP_ERR_INVALID_RESPONSE;
+    double gain = (n * sxy - sx * sy) / denom;
+    double offset = (sy - gain * sx) / n;
+    if (!isfinite(gain) || !isfinite(offset) || !(gain > 0)) return ESP_ERR_INVALID_RESPONSE;
+
+    float lsb = my_dac::get_lsb_volts(config.ch);
+    double sum_sq = 0;
+    float max_abs = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        residuals[i] = static_cast<float>((fit_y[i] - (gain * fit_x[i] + offset)) / lsb);
+        sum_sq += static_cast<double>(residuals[i]) * residuals[i];
+        if (fabsf(residuals[i]) > max_abs) max_abs = fabsf(residuals[i]);
+    }
+    result.gain = static_cast<float>(gain);
+    result.offset = static_cast<float>(offset);
+    result.rms_residual = static_cast<float>(sqrt(sum_sq / n));
+    result.max_residual = max_abs;
+    return ESP_OK;
+}
+/// @brief Store the fitted coefficients of the swept channel, the other channel keeps its calibration
+static esp_err_t store()
+{
+    my_dac_cal_t c = *(my_params::get_dac_cal());
+    if (config.ch == my_dac::CH_VPWR)
+    {
+        c.gain_vpwr = result.gain;
+        c.offset_vpwr = result.offset;
+    }
+    else
+    {
+        c.gain_vlim = result.gain;
+        c.offset_vlim = result.offset;
+    }
+    my_params::set_dac_cal(&c);
+    if (my_dac::has_cal_table(config.ch)) ESP_LOGW(TAG, "Channel %d has a calibration table, it takes precedence over gain/offset", config.ch);
+    return my_params::save();
+}
+
+static void sweep_task(void* arg)
+{
+    esp_err_t err = ESP_OK;
+    for (uint16_t i = 0; (i < config.points) && (err == ESP_OK); i++)
+    {
+        point_index = i;
+        uint32_t code = code_for_index(i);
+        err = apply_code(code, false);
+        if (err != ESP_OK) break;
+        float v;
+        // Only abort can be posted while settling
+        if (wait_posted(pdMS_TO_TICKS(config.settle_ms), &v) == ESP_ERR_NOT_FINISHED)
+        {
+            err = ESP_ERR_NOT_FINISHED;
+            break;
+        }
+        waiting = true;
+        err = wait_posted(pdMS_TO_TICKS(config.timeout_ms), &v);
+        waiting = false;
+        if (err != ESP_OK) break;
+        measured[i] = v;
+        fit_x[i] = my_dac::get_cal_input(config.ch, v);
+        fit_y[i] = my_dac::code_to_dac_volts(config.ch, code);
+        result.points = i + 1;
+        perf::trace(perf::EV_CAL_POINT, code);
+        ESP_LOGI(TAG, "Point %u/%u: code %" PRIu32 " -> %.4f V", i + 1, config.points, code, v);
+    }
+    apply_code(0, true);
+
+    if (err == ESP_OK) err = fit();
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Fit: gain = %.5f, offset = %.5f, residuals: rms = %.2f LSB, max = %.2f LSB", result.gain, result.offset,
+            result.rms_residual, result.max_residual);
+        err = store();
+    }
+    result.err = err;
+    ESP_LOGI(TAG, "Sweep finished: %s", esp_err_to_name(err));
+
+    xSemaphoreTake(session_mutex, portMAX_DELAY);
+    active = false;
+    xSemaphoreGive(session_mutex);
+    vTaskDelete(NULL);
+}
+
+namespace cal_sweep
+{
+    void init()
+    {
+        static StaticSemaphore_t session_mutex_buffer;
+        STATIC_QUEUE_STORAGE(measurement_queue, 1, float);
+        session_mutex = static_alloc::create_mutex("cal_sweep", &session_mutex_buffer);
+        measurement_queue = static_alloc::create_queue("cal_measurement", 1, sizeof(float), measurement_queue_storage, &measurement_queue_buffer);
+    }
+    /// @brief Start a sweep in the background, the first code is applied by the next control loop iteration
+    /// @param cfg Sweep parameters (copied)
+    /// @return ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE if a sweep or a table capture is already active
+    esp_err_t start(const config_t* cfg)
+    {
+        if (!cfg || cfg->ch >= my_dac::CH_COUNT || cfg->points < 2 || cfg->points > MY_DAC_CAL_TABLE_MAX_POINTS) return ESP_ERR_INVALID_ARG;
+        uint32_t fs = my_dac::get_full_scale(cfg->ch);
+        if (cfg->code_from == cfg->code_to || cfg->code_from > fs || cfg->code_to > fs || !cfg->timeout_ms) return ESP_ERR_INVALID_ARG;
+        if (!session_mutex) return ESP_ERR_INVALID_STATE;
+
+        xSemaphoreTake(session_mutex, portMAX_DELAY);
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+        if (!active && !cal_capture::is_active())
+        {
+            config = *cfg;
+            point_index = 0;
+            waiting = false;
+            result = { .err = ESP_ERR_NOT_FINISHED, .ch = cfg->ch, .points = 0, .gain = NAN, .offset = NAN,
+                .rms_residual = NAN, .max_residual = NAN };
+            xQueueReset(measurement_queue);
+            active = true;
+            ESP_LOGI(TAG, "Channel %d: %u points, codes %" PRIu32 "..%" PRIu32 ", settle %" PRIu32 " ms", cfg->ch, cfg->points,
+                cfg->code_from, cfg->code_to, cfg->settle_ms);
+            assert(xTaskCreate(sweep_task, "cal_sweep", CAL_SWEEP_TASK_STACK_SIZE, NULL, CAL_SWEEP_TASK_PRIORITY, NULL) == pdPASS);
+            err = ESP_OK;
+        }
+        xSemaphoreGive(session_mutex);
+        return err;
+    }
+    /// @brief Post the measured output for the current point. Values posted before the output has settled are rejected.
+    /// @param volts Measured output (heater amplifier voltage or voltage limit), volts
+    /// @return ESP_ERR_INVALID_STATE if the sweep isn't waiting for a measurement
+    esp_err_t post_measurement(float volts)
+    {
+        if (!isfinite(volts)) return ESP_ERR_INVALID_ARG;
+        if (!active || !waiting) return ESP_ERR_INVALID_STATE;
+        xQueueOverwrite(measurement_queue, &volts);
+        return ESP_OK;
+    }
+    /// @brief Abandon the sweep (calibration is not changed). Returns immediately, the task cleans up in the background.
+    void abort()
+    {
+        if (!session_mutex) return;
+        xSemaphoreTake(session_mutex, portMAX_DELAY);
+        if (active)
+        {
+            float v = NAN;
+            xQueueOverwrite(measurement_queue, &v);
+            ESP_LOGW(TAG, "Sweep aborted at point %u/%u", point_index + 1, config.points);
+        }
+        xSemaphoreGive(session_mutex);
+    }
+    bool is_active()
+    {
+        return active;
+    }
+    status_t get_status()
+    {
+        status_t ret = { .active = active, .waiting = waiting, .ch = config.ch, .index = point_index, .count = config.points, .code = 0 };
+        if (ret.active) ret.code = code_for_index(ret.index);
+        return ret;
+    }
+    /// @brief Get the outcome of the last sweep
+    /// @return err == ESP_ERR_NOT_FINISHED while a sweep is running, ESP_ERR_INVALID_STATE if there was none
+    result_t get_result()
+    {
+        return result;
+    }
+    /// @brief Print the last sweep's points, residuals and fit to stdout (for the debug console)
+    void print_report()
+    {
+        if (active)
+        {
+            printf("Sweep running: point %u/%u%s\n", point_index + 1, config.points, waiting ? ", waiting for measurement" : "");
+            return;
+        }
+        if (result.err == ESP_ERR_INVALID_STATE)
+        {
+            printf("No sweep since boot\n");
+            return;
+        }
+        printf("%5s %10s %10s %10s\n", "Code", "Meas,V", "DAC,V", "Resid,LSB");
+        bool fitted = isfinite(result.gain);
+        for (size_t i = 0; i < result.points; i++)
+        {
+            printf("%5" PRIu32 " %10.4f %10.4f ", code_for_index(i), measured[i], fit_y[i]);
+            if (fitted) printf("%10.2f\n", residuals[i]);
+            else printf("%10s\n", "-");
+        }
+        printf("Channel %d: gain = %.5f, offset = %.5f, rms = %.2f LSB, max = %.2f LSB: %s\n", result.ch, result.gain, result.offset,
+            result.rms_residual, result.max_residual, esp_err_to_name(result.err));
+    }
+} // namespace cal_sweep
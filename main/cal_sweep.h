@@ -0,0 +1,48 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+#include "my_dac.h"
+
+namespace cal_sweep
+{
+    struct config_t
+    {
+        my_dac::channels ch;
+        uint32_t code_from;
+        uint32_t code_to;
+        uint16_t points;
+        uint32_t settle_ms; ///< Delay after every code change before a measurement is accepted
+        uint32_t timeout_ms; ///< Max wait for a measurement
+    };
+    struct status_t
+    {
+        bool active;
+        bool waiting; ///< Settled, waiting for a measurement
+        my_dac::channels ch;
+        uint16_t index; ///< Point being measured
+        uint16_t count;
+        uint32_t code; ///< DAC code currently applied
+    };
+    /// @brief Outcome of the last sweep: gain/offset (as in my_dac_cal_t) fitted by least squares
+    struct result_t
+    {
+        esp_err_t err;
+        my_dac::channels ch;
+        uint16_t points;
+        float gain;
+        float offset;
+        float rms_residual; ///< DAC codes (LSB)
+        float max_residual; ///< DAC codes (LSB), largest absolute value
+    };
+
+    void init();
+    esp_err_t start(const config_t* cfg);
+    esp_err_t post_measurement(float volts);
+    void abort();
+    bool is_active();
+    status_t get_status();
+    result_t get_result();
+    void print_report();
+} // namespace cal_sweep
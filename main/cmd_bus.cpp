@@ -0,0 +1,130 @@
+/**
+ * @file cmd_bus.cpp
+ * @author MSU
+ * @brief Command bus to the control loop: a fixed-capacity lock-free MPSC queue (bounded ring with a sequence number per
+ * cell). Producers (console sessions, Modbus, the loop itself) claim a cell with one compare-and-swap and publish it by
+ * bumping its sequence number, so posting never blocks and never takes a lock. The control loop is the only consumer
+ * and executes every queued command, in posting order, at the start of each iteration.
+ * @date 2026-10-16
+ *
+ */
+
+#include "cmd_bus.h"
+
+#include "esp_log.h"
+
+#include "macros.h"
+
+static_assert((CMD_BUS_CAPACITY & (CMD_BUS_CAPACITY - 1)) == 0, "CMD_BUS_CAPACITY must be a power of 2");
+static_assert(CMD_BUS_NOTIFY_INDEX < configTASK_NOTIFICATION_ARRAY_ENTRIES, "Raise CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES");
+
+/// @brief Cell i holds a command when seq == pos + 1 (pos: the position it was posted at), is free when seq == pos
+struct cell_t
+{
+    uint32_t seq;
+    cmd_bus::cmd_t cmd;
+};
+
+static const char TAG[] = "CMD_BUS";
+static const char* const type_names[] = { "set_pwr", "set_vlim", "set_vpwr_dac", "set_vlim_dac", "output", "override_errors",
+    "cal_capture", "cal_sweep", "cal_post", "cal_abort", "safe_hold", "cal_step" };
+static const char* const source_names[] = { "console", "modbus", "button", "ota", "cal" };
+static_assert(ARRAY_SIZE(type_names) == cmd_bus::CMD_COUNT);
+static_assert(ARRAY_SIZE(source_names) == cmd_bus::SRC_COUNT);
+
+static cell_t cells[CMD_BUS_CAPACITY];
+static uint32_t post_pos = 0;
+static uint32_t drain_pos = 0; ///< Consumer only
+static uint32_t reply_seq = 0;
+static cmd_bus::stats_t stats = {};
+
+namespace cmd_bus
+{
+    /// @brief Call once, before anything posts
+    void init()
+    {
+        for (uint32_t i = 0; i < CMD_BUS_CAPACITY; i++) cells[i].seq = i;
+        post_pos = drain_pos = 0;
+    }
+    /// @brief Queue a command, any task. Doesn't block.
+    /// @return False if the queue is full
+    bool post(const cmd_t* c)
+    {
+        uint32_t pos = __atomic_load_n(&post_pos, __ATOMIC_RELAXED);
+        cell_t* cell;
+        for (;;)
+        {
+            cell = &(cells[pos & (CMD_BUS_CAPACITY - 1)]);
+            int32_t diff = static_cast<int32_t>(__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) - pos);
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&post_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (diff < 0)
+            {
+                __atomic_add_fetch(&(stats.rejected), 1, __ATOMIC_RELAXED);
+                return false;
+            }
+            else pos = __atomic_load_n(&post_pos, __ATOMIC_RELAXED);
+        }
+        cell->cmd = *c;
+        __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&(stats.posted), 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    /// @brief Queue a command and wait for the control loop to execute it (one loop period at most), not from the control task
+    /// @return The command's result, ESP_ERR_NO_MEM if the queue is full
+    esp_err_t call(cmd_t* c)
+    {
+        esp_err_t result = ESP_FAIL;
+        c->result = &result;
+        c->waiter = xTaskGetCurrentTaskHandle();
+        c->reply_seq = __atomic_add_fetch(&reply_seq, 1, __ATOMIC_RELAXED);
+        xTaskNotifyStateClearIndexed(NULL, CMD_BUS_NOTIFY_INDEX);
+        if (!post(c)) return ESP_ERR_NO_MEM;
+        // result is on this stack frame: return only once the control loop is done with it
+        uint32_t reply = 0;
+        while ((xTaskNotifyWaitIndexed(CMD_BUS_NOTIFY_INDEX, 0, 0, &reply, portMAX_DELAY) != pdTRUE) || (reply != c->reply_seq));
+        return result;
+    }
+    /// @brief Execute every queued command, in posting order. Control task only.
+    /// @return Commands executed
+    size_t drain(handler_t h)
+    {
+        size_t n = 0;
+        for (;;)
+        {
+            cell_t* cell = &(cells[drain_pos & (CMD_BUS_CAPACITY - 1)]);
+            if (__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) != drain_pos + 1) break;
+            cmd_t c = cell->cmd;
+            __atomic_store_n(&(cell->seq), drain_pos + CMD_BUS_CAPACITY, __ATOMIC_RELEASE);
+            drain_pos++;
+
+            esp_err_t err = h(&c);
+            if (err != ESP_OK) ESP_LOGW(TAG, "%s from %s: %s", type_names[c.type], source_names[c.source], esp_err_to_name(err));
+            if (c.result) *(c.result) = err;
+            if (c.waiter) xTaskNotifyIndexed(c.waiter, CMD_BUS_NOTIFY_INDEX, c.reply_seq, eSetValueWithOverwrite);
+            n++;
+        }
+        stats.executed += n;
+        if (n > stats.max_depth) stats.max_depth = n;
+        return n;
+    }
+    stats_t get_stats()
+    {
+        stats_t ret;
+        ret.posted = __atomic_load_n(&(stats.posted), __ATOMIC_RELAXED);
+        ret.rejected = __atomic_load_n(&(stats.rejected), __ATOMIC_RELAXED);
+        ret.executed = stats.executed;
+        ret.max_depth = stats.max_depth;
+        return ret;
+    }
+    const char* get_type_name(cmd_types t)
+    {
+        return (t < CMD_COUNT) ? type_names[t] : "?";
+    }
+    const char* get_source_name(sources s)
+    {
+        return (s < SRC_COUNT) ? source_names[s] : "?";
+    }
+} // namespace cmd_bus
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/// @brief Queue capacity, commands, power of 2
+#define CMD_BUS_CAPACITY 16
+/// @brief Task notification index call() waits for the reply on: reserved for it, other notifications never end the wait
+#define CMD_BUS_NOTIFY_INDEX 1
+
+/// @brief Commands to the control loop: every actor that changes the output goes through this one ordered queue,
+/// which the control loop drains completely at the start of every iteration
+namespace cmd_bus
+{
+    enum cmd_types : uint8_t
+    {
+        CMD_SET_PWR, ///< Local power setpoint, W (held until the knob is turned)
+        CMD_SET_VLIM, ///< Voltage limit, V (saved)
+        CMD_SET_VPWR_DAC, ///< Raw Vpwr DAC output, V, only while the output is off
+        CMD_SET_VLIM_DAC, ///< Raw Vlim DAC output, V, only in local mode
+        CMD_OUTPUT, ///< Enable or disable the output, like the button
+        CMD_OVERRIDE_ERRORS, ///< Allow operation after a failed init
+        CMD_CAL_CAPTURE, ///< Start a calibration table capture
+        CMD_CAL_SWEEP, ///< Start a gain/offset sweep
+        CMD_CAL_POST, ///< Measurement for the running capture or sweep, V
+        CMD_CAL_ABORT,
+        CMD_SAFE_HOLD, ///< Firmware update: output off and held off, every other command refused, until released
+        CMD_CAL_STEP, ///< Gain/offset sweep point or end, from the sweep task while the sweep is active
+
+        CMD_COUNT
+    };
+    enum sources : uint8_t
+    {
+        SRC_CONSOLE,
+        SRC_MODBUS,
+        SRC_BUTTON,
+        SRC_OTA, ///< Firmware update receiver
+        SRC_CAL, ///< Calibration sweep task
+
+        SRC_COUNT
+    };
+    struct cal_args_t
+    {
+        uint8_t channel; ///< my_dac::channels
+        uint16_t code_from;
+        uint16_t code_to;
+        uint16_t points;
+        uint16_t settle_ms; ///< Sweep only
+    };
+    struct cal_step_t
+    {
+        uint8_t channel; ///< my_dac::channels
+        bool restore; ///< True: back to the safe state (heater voltage at zero, saved limit) instead of code
+        uint32_t code;
+    };
+    struct cmd_t
+    {
+        cmd_types type;
+        sources source;
+        union
+        {
+            float value;
+            bool enable;
+            cal_args_t cal;
+            cal_step_t step;
+        };
+        esp_err_t* result; ///< Optional, set once the command has been executed
+        TaskHandle_t waiter; ///< Optional, notified on CMD_BUS_NOTIFY_INDEX once the command has been executed, with reply_seq
+        uint32_t reply_seq; ///< Set by call(): the waiter only returns on the reply to its own command
+    };
+    struct stats_t
+    {
+        uint32_t posted;
+        uint32_t rejected; ///< Queue full
+        uint32_t executed;
+        uint32_t max_depth; ///< Most commands drained in one iteration
+    };
+    typedef esp_err_t (*handler_t)(const cmd_t* c);
+
+    void init();
+    bool post(const cmd_t* c);
+    esp_err_t call(cmd_t* c);
+    size_t drain(handler_t h);
+    stats_t get_stats();
+    const char* get_type_name(cmd_types t);
+    const char* get_source_name(sources s);
+} // namespace cmd_bus
@@ -0,0 +1,542 @@
+/**
+ * @file console_server.cpp
+ * @author MSU
+ * @brief TCP console server: up to CONSOLE_SERVER_MAX_SESSIONS clients on one port, served by a single task that
+ * select()s over non-blocking sockets. Every session has its own line editor (echo, history, completion) and output
+ * stream; completed lines are handed to a small pool of worker tasks, so a long command only holds up its own session.
+ * Bytes received while a session's command runs are kept as type-ahead, Ctrl-C interrupts the command.
+ * @date 2026-10-16
+ *
+ */
+
+#include "console_server.h"
+
+#include "static_alloc.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "linenoise/linenoise.h"
+#include "sdkconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define CONSOLE_SERVER_TASK_STACK_SIZE 3072
+#define CONSOLE_SERVER_TASK_PRIORITY 1
+/** Same peak as the UART console parser: argtable parsing plus printf of floats in the calibration and bench commands */
+#define CONSOLE_SERVER_WORKER_STACK_SIZE 6144
+#define CONSOLE_SERVER_WORKER_PRIORITY 1
+/** select() timeout: type-ahead of a session whose command just finished waits this long at most */
+#define CONSOLE_SERVER_POLL_MS 50
+/** Back-off after the listening socket failed */
+#define CONSOLE_SERVER_RETRY_MS 1000
+/** A client that doesn't take output for this long is disconnected */
+#define CONSOLE_SERVER_SEND_TIMEOUT_MS 1000
+#define CONSOLE_SERVER_HISTORY CONFIG_CONSOLE_SERVER_HISTORY
+/** Bytes received while the session's command runs */
+#define CONSOLE_SERVER_PENDING_LEN 64
+/** A probe answer arriving later is text typed into a line-mode client (e.g. nc) by its terminal, not a terminal of ours */
+#define CONSOLE_SERVER_PROBE_WINDOW_MS 500
+
+#define TELNET_IAC 0xFF
+#define TELNET_WILL 0xFB
+#define TELNET_DONT 0xFE
+
+enum input_states : uint8_t
+{
+    INPUT_TEXT,
+    INPUT_ESC, ///< After ESC
+    INPUT_CSI, ///< After ESC [, until the final byte
+    INPUT_IAC, ///< After a telnet IAC
+    INPUT_IAC_OPTION ///< After IAC WILL/WONT/DO/DONT
+};
+struct session_t
+{
+    int sock; ///< -1: free slot
+    FILE* out; ///< stdout of the session's commands
+    SemaphoreHandle_t tx_mutex; ///< Echo, command output and logs are sent whole, and the socket isn't closed under a sender
+    volatile bool busy; ///< Queued for or being run by a worker: line belongs to the worker
+    volatile bool dead; ///< Client gone or stuck, closed by the server task once not busy
+    bool interactive; ///< Prompt and echo, false in the console's batch modes
+    bool smart; ///< The terminal answered the probe: echo, escape sequences and editing
+    int64_t probe_until_us; ///< End of the probe answer window
+    input_states input;
+    char line[CONSOLE_SERVER_LINE_LEN];
+    size_t len;
+    char pending[CONSOLE_SERVER_PENDING_LEN];
+    size_t pending_len;
+    char history[CONSOLE_SERVER_HISTORY][CONSOLE_SERVER_LINE_LEN];
+    size_t history_count; ///< Lines added so far, the newest one is history[(history_count - 1) % CONSOLE_SERVER_HISTORY]
+    size_t history_pos; ///< Lines back from the newest while browsing, 0: a new line
+};
+
+static const char TAG[] = "CON_SRV";
+static const char smart_prompt[] = LOG_COLOR_I CONFIG_IDF_TARGET "> " LOG_RESET_COLOR;
+static const char dumb_prompt[] = CONFIG_IDF_TARGET "> ";
+static const char probe_query[] = "\033[5n"; ///< Device status report, terminals answer ESC [ 0 n
+static const char greeting[] = "\r\nType 'help' to get the list of commands.\r\n";
+static session_t sessions[CONSOLE_SERVER_MAX_SESSIONS];
+static console_server::handlers_t handlers;
+static uint16_t port;
+static QueueHandle_t line_queue = NULL; ///< Session indexes with a complete line
+
+/// @brief Send all of data, waiting up to CONSOLE_SERVER_SEND_TIMEOUT_MS for the client to take it. Call under tx_mutex.
+static void send_raw(session_t* s, const char* data, size_t len)
+{
+    while (len && !s->dead && (s->sock >= 0))
+    {
+        ssize_t n = send(s->sock, data, len, 0);
+        if (n > 0)
+        {
+            data += n;
+            len -= n;
+            continue;
+        }
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            fd_set w;
+            FD_ZERO(&w);
+            FD_SET(s->sock, &w);
+            struct timeval tv = { .tv_sec = CONSOLE_SERVER_SEND_TIMEOUT_MS / 1000, .tv_usec = (CONSOLE_SERVER_SEND_TIMEOUT_MS % 1000) * 1000 };
+            if (select(s->sock + 1, NULL, &w, NULL, &tv) > 0) continue;
+        }
+        s->dead = true;
+    }
+}
+/// @brief Call under tx_mutex
+/// @param crlf Send LF as CR LF, for terminals that don't add the CR themselves
+static void send_all(session_t* s, const char* data, size_t len, bool crlf)
+{
+    if (!crlf)
+    {
+        send_raw(s, data, len);
+        return;
+    }
+    while (len)
+    {
+        const char* lf = static_cast<const char*>(memchr(data, '\n', len));
+        size_t chunk = lf ? static_cast<size_t>(lf - data) : len;
+        send_raw(s, data, chunk);
+        if (!lf) break;
+        send_raw(s, "\r\n", 2);
+        data += chunk + 1;
+        len -= chunk + 1;
+    }
+}
+static void send_locked(session_t* s, const char* data, size_t len, bool crlf)
+{
+    while (xSemaphoreTake(s->tx_mutex, portMAX_DELAY) != pdTRUE);
+    send_all(s, data, len, crlf);
+    xSemaphoreGive(s->tx_mutex);
+}
+static void send_str(session_t* s, const char* str)
+{
+    send_locked(s, str, strlen(str), false);
+}
+/// @brief Session output stream backend (fopencookie), output of dead sessions is dropped
+static ssize_t cookie_write(void* cookie, const char* buf, size_t size)
+{
+    session_t* s = static_cast<session_t*>(cookie);
+    send_locked(s, buf, size, s->smart);
+    return size;
+}
+/// @brief Prompt and the line typed so far, from the start of the terminal line
+static void redraw(session_t* s)
+{
+    if (!s->interactive) return;
+    if (!s->smart)
+    {
+        send_str(s, dumb_prompt);
+        return;
+    }
+    while (xSemaphoreTake(s->tx_mutex, portMAX_DELAY) != pdTRUE);
+    send_all(s, "\r\033[K", 4, false);
+    send_all(s, smart_prompt, strlen(smart_prompt), false);
+    send_all(s, s->line, s->len, false);
+    xSemaphoreGive(s->tx_mutex);
+}
+static void history_add(session_t* s)
+{
+    s->history_pos = 0;
+    if (s->history_count && (strcmp(s->history[(s->history_count - 1) % CONSOLE_SERVER_HISTORY], s->line) == 0)) return;
+    memcpy(s->history[s->history_count % CONSOLE_SERVER_HISTORY], s->line, s->len + 1);
+    s->history_count++;
+}
+/// @param back Lines back from the newest, 0: empty line
+static void history_show(session_t* s, size_t back)
+{
+    if (back > MIN(s->history_count, static_cast<size_t>(CONSOLE_SERVER_HISTORY))) return;
+    s->history_pos = back;
+    if (back) strcpy(s->line, s->history[(s->history_count - back) % CONSOLE_SERVER_HISTORY]);
+    else s->line[0] = '\0';
+    s->len = strlen(s->line);
+    redraw(s);
+}
+/// @brief Tab: complete the command name, or list the candidates and complete their common prefix
+static void complete(session_t* s)
+{
+    linenoiseCompletions lc = { 0, NULL };
+    s->line[s->len] = '\0';
+    esp_console_get_completion(s->line, &lc);
+    if (lc.len == 1)
+    {
+        s->len = snprintf(s->line, sizeof(s->line), "%s ", lc.cvec[0]);
+        s->len = MIN(s->len, sizeof(s->line) - 1);
+    }
+    else if (lc.len > 1)
+    {
+        size_t common = strlen(lc.cvec[0]);
+        send_str(s, "\r\n");
+        for (size_t i = 0; i < lc.len; i++)
+        {
+            send_str(s, lc.cvec[i]);
+            send_str(s, (i + 1 < lc.len) ? "  " : "\r\n");
+            size_t j = 0;
+            while ((j < common) && (lc.cvec[i][j] == lc.cvec[0][j])) j++;
+            common = j;
+        }
+        if (common > s->len)
+        {
+            memcpy(s->line, lc.cvec[0], MIN(common, sizeof(s->line) - 1));
+            s->len = MIN(common, sizeof(s->line) - 1);
+        }
+    }
+    for (size_t i = 0; i < lc.len; i++) free(lc.cvec[i]);
+    free(lc.cvec);
+    redraw(s);
+}
+/// @brief Line editor, one received byte
+/// @return True if a line is complete (NUL-terminated in line)
+static bool edit(session_t* s, uint8_t c)
+{
+    const bool echo = s->interactive && s->smart;
+    switch (s->input)
+    {
+    case INPUT_ESC:
+        s->input = (c == '[') ? INPUT_CSI : INPUT_TEXT;
+        return false;
+    case INPUT_CSI:
+        if ((c >= 0x20) && (c < 0x40)) return false; // Parameters
+        s->input = INPUT_TEXT;
+        if (c == 'A') history_show(s, s->history_pos + 1);
+        else if ((c == 'B') && s->history_pos) history_show(s, s->history_pos - 1);
+        else if ((c == 'n') && !s->smart && (esp_timer_get_time() < s->probe_until_us)) // Probe answer
+        {
+            s->smart = true;
+            redraw(s);
+        }
+        return false;
+    case INPUT_IAC:
+        s->input = ((c >= TELNET_WILL) && (c <= TELNET_DONT)) ? INPUT_IAC_OPTION : INPUT_TEXT;
+        return false;
+    case INPUT_IAC_OPTION:
+        s->input = INPUT_TEXT;
+        return false;
+    default:
+        break;
+    }
+    switch (c)
+    {
+    case '\033':
+        s->input = INPUT_ESC;
+        return false;
+    case TELNET_IAC:
+        s->input = INPUT_IAC;
+        return false;
+    case '\r':
+    case '\n':
+        if (!s->len)
+        {
+            if (echo && (c == '\r'))
+            {
+                send_str(s, "\r\n");
+                redraw(s);
+            }
+            return false; // Empty lines and the LF of CR LF
+        }
+        s->line[s->len] = '\0';
+        if (echo) send_str(s, "\r\n");
+        if (s->interactive) history_add(s);
+        return true;
+    case '\b':
+    case 0x7F:
+        if (!s->len) return false;
+        s->len--;
+        if (echo) send_str(s, "\b \b");
+        return false;
+    case 0x03: // Ctrl-C: drop the line
+        s->len = 0;
+        s->history_pos = 0;
+        if (echo) send_str(s, "^C\r\n");
+        redraw(s);
+        return false;
+    case 0x04: // Ctrl-D on an empty line: log out
+        if (!s->len) s->dead = true;
+        return false;
+    case 0x15: // Ctrl-U: clear the line
+        s->len = 0;
+        if (echo) redraw(s);
+        return false;
+    case '\t':
+        if (echo) complete(s);
+        return false;
+    default:
+        if ((c < 0x20) || (s->len >= sizeof(s->line) - 1)) return false;
+        s->line[s->len++] = c;
+        if (echo) send_locked(s, reinterpret_cast<const char*>(&c), 1, false);
+        return false;
+    }
+}
+/// @brief Received bytes: line editing, or type-ahead and Ctrl-C while the session's command runs
+static void consume(size_t index, const char* data, size_t len)
+{
+    session_t* s = &(sessions[index]);
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s->busy)
+        {
+            if (data[i] == 0x03) handlers.interrupt(index);
+            else if (s->pending_len < sizeof(s->pending)) s->pending[s->pending_len++] = data[i];
+            continue;
+        }
+        if (!edit(s, data[i])) continue;
+        s->busy = true;
+        xQueueSend(line_queue, &index, portMAX_DELAY); // Never blocks, holds every session
+    }
+}
+static void close_session(size_t index)
+{
+    session_t* s = &(sessions[index]);
+    while (xSemaphoreTake(s->tx_mutex, portMAX_DELAY) != pdTRUE);
+    close(s->sock);
+    s->sock = -1;
+    xSemaphoreGive(s->tx_mutex);
+    fclose(s->out); // Nothing left to send to
+    s->out = NULL;
+    ESP_LOGI(TAG, "Session %u closed", index);
+}
+static void accept_client(int listener)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sock = accept(listener, reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
+    if (sock < 0) return;
+    size_t index = 0;
+    while ((index < CONSOLE_SERVER_MAX_SESSIONS) && ((sessions[index].sock >= 0) || sessions[index].busy)) index++;
+    if (index >= CONSOLE_SERVER_MAX_SESSIONS)
+    {
+        static const char busy_msg[] = "All console sessions are taken\r\n";
+        send(sock, busy_msg, sizeof(busy_msg) - 1, MSG_DONTWAIT);
+        close(sock);
+        ESP_LOGW(TAG, "Refused a client, all %u sessions are taken", CONSOLE_SERVER_MAX_SESSIONS);
+        return;
+    }
+    int on = 1, idle = CONFIG_EXAMPLE_KEEPALIVE_IDLE, interval = CONFIG_EXAMPLE_KEEPALIVE_INTERVAL, count = CONFIG_EXAMPLE_KEEPALIVE_COUNT;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Echo goes out byte by byte
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    session_t* s = &(sessions[index]);
+    static const cookie_io_functions_t io = { .read = NULL, .write = cookie_write, .seek = NULL, .close = NULL };
+    s->out = fopencookie(s, "w", io);
+    if (!s->out)
+    {
+        close(sock);
+        return;
+    }
+    setvbuf(s->out, NULL, _IOLBF, 0);
+    s->dead = false;
+    s->interactive = true;
+    s->smart = false;
+    s->input = INPUT_TEXT;
+    s->len = s->pending_len = s->history_count = s->history_pos = 0;
+    while (xSemaphoreTake(s->tx_mutex, portMAX_DELAY) != pdTRUE);
+    s->sock = sock;
+    xSemaphoreGive(s->tx_mutex);
+    handlers.opened(index);
+    ESP_LOGI(TAG, "Session %u: %s:%u", index, inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+    send_str(s, greeting);
+    console_server::probe(index);
+    redraw(s);
+}
+static void receive(size_t index)
+{
+    char buf[64];
+    session_t* s = &(sessions[index]);
+    ssize_t n = recv(s->sock, buf, sizeof(buf), 0);
+    if (n > 0) consume(index, buf, n);
+    else if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) s->dead = true;
+}
+static int open_listener()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) return -1;
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ((bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(sock, 1) != 0))
+    {
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    return sock;
+}
+/// @brief The only task touching the sockets' receive side: accepts, reads and edits, closes
+/// @param arg Not used
+static void server_task(void* arg)
+{
+    int listener;
+    while ((listener = open_listener()) < 0)
+    {
+        ESP_LOGE(TAG, "Can't listen on port %u (errno %d)", port, errno);
+        vTaskDelay(pdMS_TO_TICKS(CONSOLE_SERVER_RETRY_MS));
+    }
+    ESP_LOGI(TAG, "Listening on port %u, %u sessions", port, CONSOLE_SERVER_MAX_SESSIONS);
+    while (true)
+    {
+        fd_set r;
+        FD_ZERO(&r);
+        FD_SET(listener, &r);
+        int max_fd = listener;
+        for (size_t i = 0; i < CONSOLE_SERVER_MAX_SESSIONS; i++)
+        {
+            session_t* s = &(sessions[i]);
+            if ((s->sock < 0) || s->busy) continue;
+            if (s->dead)
+            {
+                close_session(i);
+                continue;
+            }
+            if (s->pending_len) // Type-ahead of a finished command, may start the next one
+            {
+                char typed[CONSOLE_SERVER_PENDING_LEN];
+                size_t len = s->pending_len;
+                memcpy(typed, s->pending, len);
+                s->pending_len = 0;
+                consume(i, typed, len);
+            }
+        }
+        for (size_t i = 0; i < CONSOLE_SERVER_MAX_SESSIONS; i++)
+        {
+            if ((sessions[i].sock < 0) || sessions[i].dead) continue;
+            FD_SET(sessions[i].sock, &r);
+            max_fd = MAX(max_fd, sessions[i].sock);
+        }
+        struct timeval tv = { .tv_sec = 0, .tv_usec = CONSOLE_SERVER_POLL_MS * 1000 };
+        int n = select(max_fd + 1, &r, NULL, NULL, &tv);
+        if (n < 0)
+        {
+            ESP_LOGE(TAG, "select: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(CONSOLE_SERVER_POLL_MS));
+            continue;
+        }
+        if (!n) continue;
+        for (size_t i = 0; i < CONSOLE_SERVER_MAX_SESSIONS; i++)
+        {
+            if ((sessions[i].sock >= 0) && FD_ISSET(sessions[i].sock, &r)) receive(i);
+        }
+        if (FD_ISSET(listener, &r)) accept_client(listener);
+    }
+}
+/// @brief Runs the lines of any session, with stdout sent to it
+/// @param arg Worker index
+static void worker_task(void* arg)
+{
+    const size_t worker = reinterpret_cast<size_t>(arg);
+    size_t index;
+    while (true)
+    {
+        while (xQueueReceive(line_queue, &index, portMAX_DELAY) != pdTRUE);
+        session_t* s = &(sessions[index]);
+        FILE* console_stdout = stdout;
+        stdout = s->out; // stdout is per task
+        s->interactive = handlers.line(index, worker, s->line);
+        fflush(stdout);
+        stdout = console_stdout;
+        s->len = 0;
+        s->history_pos = 0;
+        redraw(s);
+        s->busy = false;
+    }
+}
+
+namespace console_server
+{
+    /// @brief Start serving console sessions on a TCP port
+    /// @param h Handlers, copied
+    esp_err_t init(uint16_t p, const handlers_t* h)
+    {
+        if (!h || !h->opened || !h->line || !h->interrupt) return ESP_ERR_INVALID_ARG;
+        port = p;
+        handlers = *h;
+        static StaticSemaphore_t tx_mutex_buffers[CONSOLE_SERVER_MAX_SESSIONS];
+        for (size_t i = 0; i < CONSOLE_SERVER_MAX_SESSIONS; i++)
+        {
+            sessions[i].sock = -1;
+            sessions[i].tx_mutex = static_alloc::create_mutex("console_tx", &(tx_mutex_buffers[i]));
+        }
+        STATIC_QUEUE_STORAGE(line_queue, CONSOLE_SERVER_MAX_SESSIONS, size_t);
+        line_queue = static_alloc::create_queue("console_lines", CONSOLE_SERVER_MAX_SESSIONS, sizeof(size_t), line_queue_storage,
+            &line_queue_buffer);
+        static_alloc::add_buffer("console_sessions", sizeof(sessions));
+
+        static StackType_t worker_stacks[CONSOLE_SERVER_WORKERS][CONSOLE_SERVER_WORKER_STACK_SIZE];
+        static StaticTask_t worker_tcbs[CONSOLE_SERVER_WORKERS];
+        for (size_t i = 0; i < CONSOLE_SERVER_WORKERS; i++)
+        {
+            static_alloc::create_task(worker_task, "console_worker", CONSOLE_SERVER_WORKER_STACK_SIZE, reinterpret_cast<void*>(i),
+                CONSOLE_SERVER_WORKER_PRIORITY, worker_stacks[i], &(worker_tcbs[i]));
+        }
+        static StackType_t server_stack[CONSOLE_SERVER_TASK_STACK_SIZE];
+        static StaticTask_t server_tcb;
+        static_alloc::create_task(server_task, "console_server", sizeof(server_stack), NULL, CONSOLE_SERVER_TASK_PRIORITY, server_stack,
+            &server_tcb);
+        return ESP_OK;
+    }
+    /// @brief Send log output to every session, any task
+    /// @param text Text lines (LF is sent as CR LF to terminals), false for binary log frames
+    void broadcast(const char* data, size_t len, bool text)
+    {
+        for (size_t i = 0; i < CONSOLE_SERVER_MAX_SESSIONS; i++)
+        {
+            session_t* s = &(sessions[i]);
+            if ((s->sock < 0) || s->dead) continue; // Checked again under tx_mutex
+            send_locked(s, data, len, text && s->smart);
+        }
+    }
+    /// @brief Re-probe the session's terminal: plain line mode until it answers
+    void probe(size_t session)
+    {
+        if (session >= CONSOLE_SERVER_MAX_SESSIONS) return;
+        sessions[session].smart = false;
+        sessions[session].probe_until_us = esp_timer_get_time() + CONSOLE_SERVER_PROBE_WINDOW_MS * 1000;
+        send_str(&(sessions[session]), probe_query);
+    }
+    bool is_connected(size_t session)
+    {
+        return (session < CONSOLE_SERVER_MAX_SESSIONS) && (sessions[session].sock >= 0);
+    }
+} // namespace console_server
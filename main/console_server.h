@@ -0,0 +1,34 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "sdkconfig.h"
+
+/// @brief Simultaneous TCP console sessions
+#define CONSOLE_SERVER_MAX_SESSIONS CONFIG_CONSOLE_SERVER_MAX_SESSIONS
+/// @brief Tasks running session commands, more sessions than that queue up
+#define CONSOLE_SERVER_WORKERS CONFIG_CONSOLE_SERVER_WORKERS
+/// @brief Longest command line, NUL included
+#define CONSOLE_SERVER_LINE_LEN 256
+
+namespace console_server
+{
+    struct handlers_t
+    {
+        /// @brief A client took the session slot, called in the server task
+        void (*opened)(size_t session);
+        /// @brief Run a command line, called in a worker task with stdout sent to the session
+        /// @param worker Worker index, 0..CONSOLE_SERVER_WORKERS-1: one line at a time per worker
+        /// @return True if the session is interactive (prompt, echo and line editing), false for raw line reads
+        bool (*line)(size_t session, size_t worker, char* line);
+        /// @brief Ctrl-C while the session's command is running, called in the server task
+        void (*interrupt)(size_t session);
+    };
+
+    esp_err_t init(uint16_t port, const handlers_t* h);
+    void broadcast(const char* data, size_t len, bool text);
+    void probe(size_t session);
+    bool is_connected(size_t session);
+} // namespace console_server
@@ -0,0 +1,375 @@
+/**
+ * @file control.cpp
+ * @author MSU
+ * @brief Heater control loop, extracted from app_main so that it can be driven by the host simulation as well.
+ * Every iteration: button events, commands from the bus (console, Modbus calibration requests), remote (Modbus) or
+ * local (encoder) setpoints, DAC outputs, LCD and Modbus status, diagnostics sampling.
+ * Only this task drives the DACs and the output state: everyone else posts to cmd_bus, including the calibration sweep task.
+ * Every change is journaled.
+ * @date 2026-10-16
+ *
+ */
+
+#include "control.h"
+
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "menu.h"
+#include "params.h"
+#include "my_dac.h"
+#include "cmd_bus.h"
+#include "journal.h"
+#include "my_hal.h"
+#include "modbus.h"
+#include "my_math.h"
+#include "my_button.h"
+#include "cal_capture.h"
+#include "cal_sweep.h"
+#include "perf.h"
+
+#include <math.h>
+
+static_assert((static_cast<int>(journal::SRC_CONSOLE) == cmd_bus::SRC_CONSOLE) && (static_cast<int>(journal::SRC_MODBUS) == cmd_bus::SRC_MODBUS) &&
+    (static_cast<int>(journal::SRC_BUTTON) == cmd_bus::SRC_BUTTON), "Command sources are journaled as they are");
+
+/// @brief Last journaled setpoint
+struct journaled_t
+{
+    float value;
+    int64_t t_us;
+};
+
+static const char TAG[] = "CONTROL";
+
+static bool init_ok = true;
+static bool is_on = false;
+static bool remote = false;
+static bool calibrating = false;
+static bool pwr_override = false; ///< Local power set by a command, until the knob is turned
+static bool safe_hold = false; ///< Firmware update: output held off, see cmd_bus::CMD_SAFE_HOLD
+static uint32_t step_count = 0;
+static int64_t pwr_override_counts; ///< Encoder counts when the override was set
+static my_button::event_t btn_event;
+static modbus::cal_request_t cal_req;
+static float pwr_to_set;
+static float vlim_to_set;
+static journaled_t journaled_pwr = { .value = NAN, .t_us = 0 };
+static journaled_t journaled_vlim = { .value = NAN, .t_us = 0 };
+
+static journal::sources journal_source(cmd_bus::sources s)
+{
+    if (s == cmd_bus::SRC_OTA) return journal::SRC_OTA;
+    if (s == cmd_bus::SRC_CAL) return journal::SRC_INTERNAL;
+    return static_cast<journal::sources>(s);
+}
+/// @brief Journal a setpoint if it has changed
+/// @param now False: at most once per CONFIG_JOURNAL_SETPOINT_INTERVAL_MS (the final value of a change still gets journaled)
+static void journal_setpoint(journal::events ev, journal::sources src, float value, bool now)
+{
+    journaled_t* j = (ev == journal::EV_VLIM_SETPOINT) ? &journaled_vlim : &journaled_pwr;
+    if (value == j->value) return;
+    int64_t t = esp_timer_get_time();
+    if (!now && (t - j->t_us < CONFIG_JOURNAL_SETPOINT_INTERVAL_MS * 1000ll)) return;
+    j->value = value;
+    j->t_us = t;
+    journal::record(ev, src, value);
+}
+static void set_output(bool on, journal::sources src)
+{
+    if (on == is_on) return;
+    is_on = on;
+    journal::record(journal::EV_OUTPUT, src, on ? 1 : 0);
+    if (on) return;
+    if (remote) journal::record(journal::EV_REMOTE, src, 0);
+    modbus::disable_remote();
+    remote = false;
+    my_dac::set_vpwr(0);
+}
+static my_dac::channels to_channel(uint8_t ch)
+{
+    return (ch == my_dac::CH_VLIM) ? my_dac::CH_VLIM : my_dac::CH_VPWR;
+}
+/// @brief Apply a bus command
+static esp_err_t apply(const cmd_bus::cmd_t* c)
+{
+    // A firmware update is being written: nothing but turning the output off (or releasing the hold) is allowed
+    if (safe_hold && (c->type != cmd_bus::CMD_SAFE_HOLD) && (c->type != cmd_bus::CMD_CAL_ABORT) &&
+        !((c->type == cmd_bus::CMD_OUTPUT) && !c->enable) && !((c->type == cmd_bus::CMD_CAL_STEP) && c->step.restore))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    switch (c->type)
+    {
+    case cmd_bus::CMD_SET_PWR:
+        if (remote) return ESP_ERR_INVALID_STATE; // Modbus owns the setpoint
+        if ((c->value < 0) || (c->value > MY_PWR_MAX)) return ESP_ERR_INVALID_ARG;
+        pwr_to_set = c->value;
+        pwr_override = true;
+        pwr_override_counts = my_hal::get_encoder_counts();
+        return ESP_OK;
+    case cmd_bus::CMD_SET_VLIM:
+        if (remote) return ESP_ERR_INVALID_STATE;
+        if ((c->value < MY_VLIM_MIN) || (c->value > MY_VLIM_MAX)) return ESP_ERR_INVALID_ARG;
+        vlim_to_set = c->value;
+        my_dac::set_vlim_target(vlim_to_set);
+        my_params::set_last_saved_vlim(vlim_to_set);
+        return ESP_OK;
+    case cmd_bus::CMD_SET_VPWR_DAC:
+        if (is_on || calibrating) return ESP_ERR_INVALID_STATE; // Would be overwritten on the next iteration
+        my_dac::set_vpwr(c->value);
+        return ESP_OK;
+    case cmd_bus::CMD_SET_VLIM_DAC:
+        if (remote || calibrating) return ESP_ERR_INVALID_STATE;
+        my_dac::set_vlim(c->value);
+        return ESP_OK;
+    case cmd_bus::CMD_OUTPUT:
+        if (c->enable && !init_ok) return ESP_ERR_INVALID_STATE;
+        set_output(c->enable, journal_source(c->source));
+        ESP_LOGI(TAG, "Output %s by %s", c->enable ? "enabled" : "disabled", cmd_bus::get_source_name(c->source));
+        return ESP_OK;
+    case cmd_bus::CMD_OVERRIDE_ERRORS:
+        init_ok = true;
+        my_hal::set_output_enable(true);
+        return ESP_OK;
+    case cmd_bus::CMD_CAL_CAPTURE:
+        return cal_capture::start(to_channel(c->cal.channel), c->cal.code_from, c->cal.code_to, c->cal.points);
+    case cmd_bus::CMD_CAL_SWEEP:
+    {
+        cal_sweep::config_t cfg = { .ch = to_channel(c->cal.channel), .code_from = c->cal.code_from, .code_to = c->cal.code_to,
+            .points = c->cal.points, .settle_ms = c->cal.settle_ms ? c->cal.settle_ms : static_cast<uint32_t>(CONFIG_CAL_SWEEP_SETTLE_MS),
+            .timeout_ms = CONFIG_CAL_SWEEP_TIMEOUT_S * 1000u };
+        return cal_sweep::start(&cfg);
+    }
+    case cmd_bus::CMD_CAL_POST:
+        if (cal_sweep::is_active()) return cal_sweep::post_measurement(c->value);
+        return cal_capture::post_measurement(c->value);
+    case cmd_bus::CMD_CAL_ABORT:
+        cal_capture::abort();
+        cal_sweep::abort();
+        return ESP_OK;
+    case cmd_bus::CMD_SAFE_HOLD:
+        if (c->enable == safe_hold) return ESP_OK;
+        safe_hold = c->enable;
+        if (safe_hold)
+        {
+            cal_capture::abort();
+            cal_sweep::abort();
+            set_output(false, journal_source(c->source));
+            my_hal::set_output_enable(false);
+        }
+        else if (init_ok) my_hal::set_output_enable(true);
+        ESP_LOGW(TAG, "Output %s by %s", safe_hold ? "held off" : "released", cmd_bus::get_source_name(c->source));
+        return ESP_OK;
+    case cmd_bus::CMD_CAL_STEP:
+        if (!cal_sweep::is_active()) return ESP_ERR_INVALID_STATE;
+        if (!c->step.restore) my_dac::set_code(to_channel(c->step.channel), c->step.code);
+        else if (to_channel(c->step.channel) == my_dac::CH_VPWR) my_dac::set_code(my_dac::CH_VPWR, 0);
+        else my_dac::set_vlim_target(my_params::get_last_saved_vlim());
+        return ESP_OK;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+/// @brief Journal a command that has been applied
+static void journal_cmd(const cmd_bus::cmd_t* c)
+{
+    auto src = journal_source(c->source);
+    switch (c->type)
+    {
+    case cmd_bus::CMD_SET_PWR:
+        journal_setpoint(journal::EV_PWR_SETPOINT, src, c->value, true);
+        break;
+    case cmd_bus::CMD_SET_VLIM:
+        journal_setpoint(journal::EV_VLIM_SETPOINT, src, c->value, true);
+        break;
+    case cmd_bus::CMD_SET_VPWR_DAC:
+        journal::record(journal::EV_VPWR_DAC, src, c->value);
+        break;
+    case cmd_bus::CMD_SET_VLIM_DAC:
+        journal::record(journal::EV_VLIM_DAC, src, c->value);
+        break;
+    case cmd_bus::CMD_OVERRIDE_ERRORS:
+        journal::record(journal::EV_OVERRIDE_ERRORS, src, 0);
+        break;
+    case cmd_bus::CMD_CAL_CAPTURE:
+    case cmd_bus::CMD_CAL_SWEEP:
+        journal::record(journal::EV_CAL_START, src, c->cal.channel);
+        break;
+    case cmd_bus::CMD_CAL_ABORT:
+        journal::record(journal::EV_CAL_ABORT, src, 0);
+        break;
+    case cmd_bus::CMD_SAFE_HOLD:
+        journal::record(journal::EV_SAFE_HOLD, src, c->enable ? 1 : 0);
+        break;
+    default: // Output is journaled by set_output, measurements are not journaled
+        break;
+    }
+}
+/// @brief Execute a bus command, in the control task
+static esp_err_t execute(const cmd_bus::cmd_t* c)
+{
+    esp_err_t err = apply(c);
+    if (err == ESP_OK) journal_cmd(c);
+    return err;
+}
+/// @brief Modbus calibration coils, as bus commands
+static void post_cal_request()
+{
+    if (!modbus::get_cal_request(&cal_req)) return;
+    cmd_bus::cmd_t c = {};
+    c.source = cmd_bus::SRC_MODBUS;
+    c.cal = { .channel = static_cast<uint8_t>(cal_req.channel), .code_from = cal_req.code_from, .code_to = cal_req.code_to,
+        .points = cal_req.points, .settle_ms = cal_req.settle_ms };
+    if (cal_req.start)
+    {
+        c.type = cmd_bus::CMD_CAL_CAPTURE;
+        cmd_bus::post(&c);
+    }
+    if (cal_req.sweep)
+    {
+        c.type = cmd_bus::CMD_CAL_SWEEP;
+        cmd_bus::post(&c);
+    }
+    if (cal_req.post)
+    {
+        c.type = cmd_bus::CMD_CAL_POST;
+        c.value = cal_req.measurement;
+        cmd_bus::post(&c);
+    }
+}
+
+namespace control
+{
+    /// @brief Set the initial output state. Call once, after all subsystems have been initialized.
+    /// @param ok False if initialization failed: the outputs stay disabled until the console overrides it
+    void init(bool ok)
+    {
+        init_ok = ok;
+        vlim_to_set = my_params::get_last_saved_vlim();
+        if (!init_ok)
+        {
+            ESP_LOGE(TAG, "Init failed. Operation prohibited.");
+            return;
+        }
+        my_dac::set_vpwr(0);
+        my_dac::set_vlim_target(vlim_to_set);
+        my_hal::set_output_enable(true);
+    }
+    /// @brief One control loop iteration, doesn't block
+    void step()
+    {
+        perf::trace(perf::EV_CONTROL_STEP, 0);
+        step_count++;
+        bool btn_toggle = false;
+        while (my_button::get_event(&btn_event, 0))
+        {
+            perf::trace(perf::EV_BUTTON, btn_event.type);
+            if (btn_event.type == my_button::BTN_PRESS) btn_toggle = !btn_toggle;
+        }
+        post_cal_request();
+        calibrating = cal_capture::is_active() || cal_sweep::is_active();
+        cmd_bus::drain(execute);
+        bool was_remote = remote;
+        remote = modbus::get_remote_enabled();
+        if (remote && safe_hold)
+        {
+            modbus::disable_remote(); // Would enable the output
+            remote = false;
+        }
+        if (remote != was_remote) journal::record(journal::EV_REMOTE, journal::SRC_MODBUS, remote ? 1 : 0);
+        if (remote)
+        {
+            set_output(true, journal::SRC_MODBUS);
+            pwr_override = false;
+            pwr_to_set = modbus::get_pwr_setpoint();
+            vlim_to_set = modbus::get_vlim_setpoint();
+            journal_setpoint(journal::EV_PWR_SETPOINT, journal::SRC_MODBUS, pwr_to_set, !was_remote);
+            journal_setpoint(journal::EV_VLIM_SETPOINT, journal::SRC_MODBUS, vlim_to_set, !was_remote);
+            my_params::set_last_saved_vpwr(pwr_to_set); //Flushed to NVS with a delay, only when changed
+            my_params::set_last_saved_vlim(vlim_to_set);
+            my_hal::reset_encoder();
+        }
+        else
+        {
+            int64_t counts = my_hal::get_encoder_counts();
+            if (pwr_override && (counts != pwr_override_counts)) pwr_override = false; // The knob takes over
+            if (!pwr_override) pwr_to_set = my_math::encoder_to_power(counts);
+            if (is_on && !pwr_override) journal_setpoint(journal::EV_PWR_SETPOINT, journal::SRC_KNOB, pwr_to_set, false);
+        }
+        //Calibration table capture and gain/offset sweep drive the DACs themselves
+        calibrating = cal_capture::is_active() || cal_sweep::is_active();
+        if (calibrating && btn_toggle)
+        {
+            cal_capture::abort();
+            cal_sweep::abort();
+            calibrating = false;
+            journal::record(journal::EV_CAL_ABORT, journal::SRC_BUTTON, 0);
+            btn_toggle = false; // The press only cancels, it doesn't toggle the output too
+        }
+        if (is_on)
+        {
+            if (!calibrating)
+            {
+                my_dac::set_vpwr(my_math::power_to_vpwr(pwr_to_set));
+                if (remote) my_dac::set_vlim_target(vlim_to_set);
+            }
+            if (btn_toggle)
+            {
+                set_output(false, journal::SRC_BUTTON);
+                ESP_LOGI(TAG, "Manual disable");
+            }
+        }
+        else
+        {
+            if (!pwr_override) my_hal::reset_encoder();
+            if (btn_toggle && !safe_hold)
+            {
+                set_output(true, journal::SRC_BUTTON);
+                ESP_LOGI(TAG, "Manual enable");
+            }
+        }
+        bool need_repaint = menu::set_values(is_on ? pwr_to_set : NAN, vlim_to_set);
+        need_repaint |= menu::set_status(remote, is_on, my_dac::is_ramping());
+        if (need_repaint) menu::repaint();
+        modbus::set_values(is_on, pwr_to_set, vlim_to_set, my_dac::get_vpwr(), my_dac::get_vlim());
+        if (cal_sweep::is_active())
+        {
+            auto sweep_status = cal_sweep::get_status();
+            modbus::set_cal_status(true, sweep_status.index, sweep_status.count);
+        }
+        else
+        {
+            auto cal_status = cal_capture::get_status();
+            modbus::set_cal_status(cal_status.active, cal_status.index, cal_status.count);
+        }
+        auto sweep_result = cal_sweep::get_result();
+        modbus::set_cal_fit(sweep_result.err, sweep_result.gain, sweep_result.offset, sweep_result.rms_residual, sweep_result.max_residual);
+        if (perf::sample())
+        {
+            auto diag = perf::get_diag();
+            modbus::set_diag(&diag);
+        }
+    }
+    /// @brief Iterations since boot, any task (firmware update health check)
+    uint32_t get_step_count()
+    {
+        return __atomic_load_n(&step_count, __ATOMIC_RELAXED);
+    }
+    /// @brief Output state as last set by the control loop, any task
+    bool is_output_on()
+    {
+        return __atomic_load_n(&is_on, __ATOMIC_RELAXED);
+    }
+    /// @brief Run the control loop forever in the calling task
+    void run()
+    {
+        for (;;)
+        {
+            step();
+            my_button::wait_event(pdMS_TO_TICKS(CONTROL_LOOP_PERIOD_MS)); //Loop period, cut short by a button event
+        }
+    }
+} // namespace control
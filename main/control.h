@@ -0,0 +1,18 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+/** Control loop period, ms (cut short by a button event) */
+#define CONTROL_LOOP_PERIOD_MS 30
+
+/// @brief Heater control loop: user inputs and Modbus setpoints to the DACs, LCD and Modbus status.
+/// Independent of the HAL implementation, so that it also runs in the host simulation build.
+namespace control
+{
+    void init(bool init_ok);
+    void step();
+    void run();
+    uint32_t get_step_count();
+    bool is_output_on();
+} // namespace control
@@ -3,8 +3,22 @@
 #include "macros.h"
 #include "params.h"
 #include "my_hal.h"
-#include "my_math.h"
-#include "eth_console_vfs.h"
+#include "cmd_bus.h"
+#include "journal.h"
+#include "timesync.h"
+#include "ota.h"
+#include "menu.h"
+#include "my_encoder.h"
+#include "my_button.h"
+#include "boot.h"
+#include "cal_capture.h"
+#include "cal_sweep.h"
+#include "bench.h"
+#include "perf.h"
+#include "static_alloc.h"
+#include "log_defer.h"
+#include "log_route.h"
+#include "console_server.h"
 #include "eth_mdns_init.h"
 
 #include "esp_linenoise.h"
@@ -15,6 +29,8 @@
 #include "esp_chip_info.h"
 #include "esp_log.h"
 #include "esp_flash.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
 #include "driver/uart_vfs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -23,71 +39,268 @@
 #include <cstring>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdarg.h>
+#include <sys/param.h>
 
 #define PROMPT_STR CONFIG_IDF_TARGET
 #define PROMPT_MAX_LEN 32
 #define MAX_CMDLINE_LENGTH 256
+#define MAX_CMDLINE_ARGS 8
+/** Peak use is argtable parsing plus printf of floats in the calibration and bench commands */
+#define CONSOLE_PARSER_TASK_STACK_SIZE 6144
+#define CONSOLE_PARSER_TASK_PRIORITY 1
+/** Back-off after a failed read (e.g. no Ethernet client), reads block otherwise */
+#define CONSOLE_READ_RETRY_MS 20
+/** JSON mode: captured stdout of one command, longer output is cut and flagged */
+#define CONSOLE_CAPTURE_LEN 1536
+/** JSON mode: "key":value pairs of one command (print_kv) */
+#define CONSOLE_KV_LEN 512
+/** Separates commands on one line */
+#define CONSOLE_CMD_SEPARATOR ';'
 
 using namespace my_dbg_helpers;
 
-enum console_instances : size_t {
+enum console_types : uint8_t {
     CONSOLE_INST_UART = 0,
-    CONSOLE_INST_ETH,
-
-    CONSOLE_TOTAL_INST
+    CONSOLE_INST_ETH
+};
+/** Session 0 is the UART, the others are the TCP server's sessions in order */
+#define CONSOLE_TOTAL_INST (1 + CONSOLE_SERVER_MAX_SESSIONS)
+/** Tasks that run commands: the UART parser and the TCP server's workers */
+#define CONSOLE_TOTAL_EXECUTORS (1 + CONSOLE_SERVER_WORKERS)
+enum console_modes : uint8_t
+{
+    CONSOLE_MODE_INTERACTIVE, ///< linenoise: prompt, echo, editing and history
+    CONSOLE_MODE_BATCH, ///< Raw lines, command output followed by an "OK" or "ERR <code>" line
+    CONSOLE_MODE_JSON ///< Raw lines, one JSON object line per command
+};
+/// @brief JSON mode buffers of a task that runs commands
+struct exec_buffers_t
+{
+    char capture[CONSOLE_CAPTURE_LEN];
+    char kv[CONSOLE_KV_LEN];
 };
 struct console_instance_t
 {
-    console_instances type;
-    esp_linenoise_handle_t linenoise_handle;
-    int stdout_fd;
+    console_types type;
+    esp_linenoise_handle_t linenoise_handle; ///< UART only, the TCP server edits lines itself
+    int stdin_fd;
+    console_modes mode;
+    exec_buffers_t* buffers; ///< Of the task running the session's command
+    size_t kv_len; ///< Used part of buffers->kv
+    const esp_console_cmd_t* running; ///< Command being executed, NULL when idle
+    int64_t started_us; ///< When running started
+    volatile bool cancel; ///< Set by another session, polled by long-running commands (is_cancelled)
 };
 
 static const char* TAG = "DBG_MENU";
 static const char interactive_prompt[] = LOG_COLOR_I PROMPT_STR "> " LOG_RESET_COLOR;
 static const char dumb_prompt[] = PROMPT_STR "> ";
 TaskHandle_t parser_task_handle;
-QueueHandle_t interop_queue_handle;
-static dbg_console::interop_cmd_t interop_cmd;
-static console_instance_t consoles[CONSOLE_TOTAL_INST] = { { .type = CONSOLE_INST_UART }, { .type = CONSOLE_INST_ETH } };
-static SemaphoreHandle_t esp_console_mutex = NULL;
-static vprintf_like_t default_vprintf = NULL;
+static console_instance_t consoles[CONSOLE_TOTAL_INST];
+/** esp_console_run() parses into a line buffer of its own: only the commands it dispatches (help) take this */
+static SemaphoreHandle_t esp_console_run_mutex = NULL;
+/** Commands doing read-modify-write of the DAC calibration */
+static SemaphoreHandle_t dac_cmd_mutex = NULL;
+static exec_buffers_t exec_buffers[CONSOLE_TOTAL_EXECUTORS];
 
 static void initialize_console();
 static void probe_terminal(esp_linenoise_handle_t h);
 
 namespace my_dbg_commands {
-    static console_instance_t* console_context = NULL;
+    /** Session whose command the calling task runs, NULL outside of commands */
+    static thread_local console_instance_t* session = NULL;
 
     int dump_nvs(int argc, char** argv)
     {
         auto dac_cal = my_params::get_dac_cal();
-        printf("DAC cal:\n"
-            "\tVpwr: (%f, %f)\n"
-            "\tVlim: (%f, %f)\n"
-            "DAC soft sentinel = %f\n"
-            "Last saved:\n"
-            "\tVpwr = %f\n"
-            "\tVlim = %f\n",
-            dac_cal->gain_vpwr, dac_cal->offset_vpwr,
-            dac_cal->gain_vlim, dac_cal->offset_vlim,
-            my_params::get_dac_soft_sentinel(),
-            my_params::get_last_saved_vpwr(),
-            my_params::get_last_saved_vlim());
+        print_kv("dac_cal_vpwr_gain", "%f", dac_cal->gain_vpwr);
+        print_kv("dac_cal_vpwr_offset", "%f", dac_cal->offset_vpwr);
+        print_kv("dac_cal_vlim_gain", "%f", dac_cal->gain_vlim);
+        print_kv("dac_cal_vlim_offset", "%f", dac_cal->offset_vlim);
+        print_kv("dac_soft_sentinel", "%f", my_params::get_dac_soft_sentinel());
+        print_kv("last_saved_vpwr", "%f", my_params::get_last_saved_vpwr());
+        print_kv("last_saved_vlim", "%f", my_params::get_last_saved_vlim());
         return 0;
     }
     int hw_report(int argc, char** argv)
     {
-        printf("Vpwr set = %f\n"
-            "Vlim set = %f\n"
-            "Btn pressed = %i\n"
-            "Encoder value = %" PRIi64 "\n",
-            my_dac::get_vpwr(),
-            my_dac::get_vlim(),
-            my_hal::get_btn_pressed(),
-            my_hal::get_encoder_counts());
+        auto lcd_stats = menu::get_stats();
+        print_kv("vpwr_set", "%f", my_dac::get_vpwr());
+        print_kv("vlim_set", "%f", my_dac::get_vlim());
+        print_kv("btn_pressed", "%i", my_hal::get_btn_pressed());
+        print_kv("btn_debounced", "%i", my_button::is_pressed());
+        print_kv("btn_dropped_events", "%" PRIu32, my_button::get_dropped_events());
+        print_kv("encoder_value", "%" PRIi64, my_hal::get_encoder_counts());
+        print_kv("encoder_raw", "%" PRIi64, my_encoder::get_raw_counts());
+        print_kv("encoder_velocity_cps", "%.1f", my_encoder::get_velocity());
+        print_kv("lcd_glyph_hits", "%" PRIu32, lcd_stats.glyph_hits);
+        print_kv("lcd_glyph_misses", "%" PRIu32, lcd_stats.glyph_misses);
+        print_kv("lcd_repaints_requested", "%" PRIu32, lcd_stats.repaints_requested);
+        print_kv("lcd_repaints_performed", "%" PRIu32, lcd_stats.repaints_performed);
+        return 0;
+    }
+    static int bus_stats(int argc, char** argv)
+    {
+        auto st = my_hal::get_sr_stats();
+        print_kv("dac_writes", "%" PRIu32, st.dac_writes);
+        print_kv("dac_wait_max_us", "%" PRIu32, st.dac_wait_max_us);
+        print_kv("dac_wait_mean_us", "%.1f", st.dac_writes ? static_cast<double>(st.dac_wait_total_us) / st.dac_writes : 0.0);
+        print_kv("lcd_bytes", "%" PRIu32, st.lcd_bytes);
+        print_kv("lcd_deferred_to_dac", "%" PRIu32, st.lcd_yields);
+        if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) my_hal::reset_sr_stats();
+        return 0;
+    }
+    /// @brief Parse DAC channel name
+    /// @return False if not recognized
+    static bool parse_channel(const char* arg, my_dac::channels* ch)
+    {
+        if (strcmp(arg, "vpwr") == 0) *ch = my_dac::CH_VPWR;
+        else if (strcmp(arg, "vlim") == 0) *ch = my_dac::CH_VLIM;
+        else return false;
+        return true;
+    }
+    /// @brief Parse cal_capture/cal_sweep arguments: <vpwr|vlim> <code_from> <code_to> <points> [settle_ms]
+    /// @return 0 or a command return code
+    static int parse_cal_args(int argc, char** argv, cmd_bus::cal_args_t* args)
+    {
+        my_dac::channels ch;
+        unsigned from, to, points, settle = 0;
+        if (argc < 5) return 1;
+        if (!parse_channel(argv[1], &ch)) return 2;
+        if (sscanf(argv[2], "%u", &from) != 1 || sscanf(argv[3], "%u", &to) != 1 || sscanf(argv[4], "%u", &points) != 1) return 2;
+        if ((argc > 5) && (sscanf(argv[5], "%u", &settle) != 1)) return 2;
+        if ((from > UINT16_MAX) || (to > UINT16_MAX) || (points > UINT16_MAX) || (settle > UINT16_MAX)) return 3;
+        *args = { .channel = static_cast<uint8_t>(ch), .code_from = static_cast<uint16_t>(from), .code_to = static_cast<uint16_t>(to),
+            .points = static_cast<uint16_t>(points), .settle_ms = static_cast<uint16_t>(settle) };
+        return 0;
+    }
+    /// @brief Execute a command in the control loop and wait for the result
+    static esp_err_t bus_call(cmd_bus::cmd_t* c)
+    {
+        c->source = cmd_bus::SRC_CONSOLE;
+        esp_err_t err = cmd_bus::call(c);
+        if (err == ESP_ERR_NO_MEM) printf("Control loop command queue is full, try again\n");
+        else if (err != ESP_OK) printf("%s rejected: %s\n", cmd_bus::get_type_name(c->type), esp_err_to_name(err));
+        return err;
+    }
+    static int cal_capture_start(int argc, char** argv)
+    {
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_CAL_CAPTURE };
+        int ret = parse_cal_args(argc, argv, &(c.cal));
+        if (ret) return ret;
+        esp_err_t err = bus_call(&c);
+        if (err == ESP_OK) printf("Measure the output and post it with cal_post <volts>\n");
+        return err;
+    }
+    static int cal_post(int argc, char** argv)
+    {
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_CAL_POST };
+        if (argc < 2) return 1;
+        if (sscanf(argv[1], "%f", &(c.value)) != 1) return 2;
+        bool sweep = cal_sweep::is_active();
+        esp_err_t err = bus_call(&c);
+        if (sweep) return err;
+        auto st = cal_capture::get_status();
+        if (st.active) printf("Point %u/%u: code %" PRIu32 "\n", st.index + 1, st.count, st.code);
+        else if (err == ESP_OK) printf("Capture complete, table stored\n");
+        return err;
+    }
+    static int cal_abort(int argc, char** argv)
+    {
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_CAL_ABORT };
+        return bus_call(&c);
+    }
+    static int cal_sweep_start(int argc, char** argv)
+    {
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_CAL_SWEEP };
+        int ret = parse_cal_args(argc, argv, &(c.cal));
+        if (ret) return ret;
+        esp_err_t err = bus_call(&c);
+        if (err == ESP_OK) printf("Post every settled measurement with cal_post <volts>, progress: cal_sweep_report\n");
+        return err;
+    }
+    static int cal_sweep_report(int argc, char** argv)
+    {
+        cal_sweep::print_report();
+        return 0;
+    }
+    static int cal_table(int argc, char** argv)
+    {
+        my_dac::channels ch;
+        if (argc < 2) return 1;
+        if (!parse_channel(argv[1], &ch)) return 2;
+        if ((argc > 2) && (strcmp(argv[2], "clear") == 0))
+        {
+            while (xSemaphoreTake(dac_cmd_mutex, portMAX_DELAY) != pdTRUE);
+            esp_err_t err = my_params::set_dac_cal_table(ch, NULL);
+            if (err == ESP_OK) my_dac::set_cal_table(ch, NULL);
+            xSemaphoreGive(dac_cmd_mutex);
+            return err;
+        }
+        auto t = my_params::get_dac_cal_table(ch);
+        if (!t)
+        {
+            printf("No table, gain/offset calibration is used\n");
+            return 0;
+        }
+        printf("%" PRIu32 " points (%s):\n", t->count, my_dac::has_cal_table(ch) ? "applied" : "not applied");
+        for (size_t i = 0; i < t->count; i++) printf("\t%8.4f V -> %7.1f\n", t->points[i].volts, t->points[i].code);
+        return 0;
+    }
+    static int dev_info(int argc, char** argv)
+    {
+        auto info = my_params::get_dev_info();
+        print_kv("name", "%s", info->name);
+        print_kv("manufacturer", "%s", info->manufacturer);
+        print_kv("model", "%s", info->model);
+        print_kv("sn", "%s", info->sn);
+        print_kv("pcb_rev", "%s", info->pcb_rev);
+        return 0;
+    }
+    static int nvs_stats(int argc, char** argv)
+    {
+        my_params::print_nvs_stats();
+        return 0;
+    }
+    static int boot_report(int argc, char** argv)
+    {
+        boot::print_timeline();
         return 0;
     }
+    static int perf_report(int argc, char** argv)
+    {
+        perf::print_tasks();
+        perf::print_counters();
+        return 0;
+    }
+    static int ram_report(int argc, char** argv)
+    {
+        static_alloc::print_report();
+        return 0;
+    }
+    static int trace_dump(int argc, char** argv)
+    {
+        unsigned max = 0;
+        if ((argc > 1) && (strcmp(argv[1], "clear") == 0))
+        {
+            perf::clear_trace();
+            return 0;
+        }
+        if ((argc > 1) && (sscanf(argv[1], "%u", &max) != 1)) return 2;
+        perf::print_trace(max);
+        return 0;
+    }
+    static int run_bench(int argc, char** argv)
+    {
+        unsigned iterations = BENCH_DEFAULT_ITERATIONS;
+        if ((argc > 1) && (sscanf(argv[1], "%u", &iterations) != 1)) return 2;
+        const char* filter = (argc > 2) ? argv[2] : NULL;
+        bool json = (argc > 3) && (strcmp(argv[3], "json") == 0);
+        return bench::run(filter, iterations, json, is_cancelled);
+    }
     /* 'version' command */
     static int get_version(int argc, char** argv)
     {
@@ -148,34 +361,32 @@ namespace my_dbg_commands {
     }
     static int set_vpwr_cal(int argc, char** argv)
     {
-        static my_dac_cal_t c = { 0 };
-
+        float gain, offset;
         if (argc < 2) return 1;
-        c.offset_vpwr = my_params::get_dac_cal()->offset_vpwr;
-        int ret = sscanf(argv[1], "%f", &(c.gain_vpwr));
-        if (!ret) return 2;
-        if (argc > 2)
-        {
-            ret = sscanf(argv[2], "%f", &(c.offset_vpwr));
-            if (!ret) return 2;
-        }
+        if (sscanf(argv[1], "%f", &gain) != 1) return 2;
+        if ((argc > 2) && (sscanf(argv[2], "%f", &offset) != 1)) return 2;
+
+        while (xSemaphoreTake(dac_cmd_mutex, portMAX_DELAY) != pdTRUE);
+        my_dac_cal_t c = *(my_params::get_dac_cal()); // The other channel's calibration is kept
+        c.gain_vpwr = gain;
+        if (argc > 2) c.offset_vpwr = offset;
         my_params::set_dac_cal(&c);
+        xSemaphoreGive(dac_cmd_mutex);
         return 0;
     }
     static int set_vlim_cal(int argc, char** argv)
     {
-        static my_dac_cal_t c = { 0 };
-
+        float gain, offset;
         if (argc < 2) return 1;
-        c.offset_vlim = my_params::get_dac_cal()->offset_vlim;
-        int ret = sscanf(argv[1], "%f", &(c.gain_vlim));
-        if (!ret) return 2;
-        if (argc > 2)
-        {
-            ret = sscanf(argv[2], "%f", &(c.offset_vlim));
-            if (!ret) return 2;
-        }
+        if (sscanf(argv[1], "%f", &gain) != 1) return 2;
+        if ((argc > 2) && (sscanf(argv[2], "%f", &offset) != 1)) return 2;
+
+        while (xSemaphoreTake(dac_cmd_mutex, portMAX_DELAY) != pdTRUE);
+        my_dac_cal_t c = *(my_params::get_dac_cal()); // The other channel's calibration is kept
+        c.gain_vlim = gain;
+        if (argc > 2) c.offset_vlim = offset;
         my_params::set_dac_cal(&c);
+        xSemaphoreGive(dac_cmd_mutex);
         return 0;
     }
     static int set_sn(int argc, char** argv)
@@ -202,53 +413,150 @@ namespace my_dbg_commands {
         my_params::reset_dev_info_dbg();
         return 0;
     }
-    static int set_vpwr_dac(int argc, char** argv)
+    /// @brief Commands with one float argument: <cmd> <value>
+    static int float_cmd(cmd_bus::cmd_types type, int argc, char** argv)
     {
         if (argc < 2) return 1;
-        float val;
-        int read = sscanf(argv[1], "%f", &val);
+        cmd_bus::cmd_t c = { .type = type };
+        int read = sscanf(argv[1], "%f", &(c.value));
         if (read < 1) return 2;
-        my_dac::set_vpwr(val);
-        return 0;
+        return bus_call(&c);
+    }
+    static int set_vpwr_dac(int argc, char** argv)
+    {
+        return float_cmd(cmd_bus::CMD_SET_VPWR_DAC, argc, argv);
     }
     static int set_vlim_dac(int argc, char** argv)
     {
-        if (argc < 2) return 1;
-        float val;
-        int read = sscanf(argv[1], "%f", &val);
-        if (read < 1) return 2;
-        my_dac::set_vlim(val);
-        return 0;
+        return float_cmd(cmd_bus::CMD_SET_VLIM_DAC, argc, argv);
     }
     static int set_pwr(int argc, char** argv)
     {
-        if (argc < 2) return 1;
-        float val;
-        int read = sscanf(argv[1], "%f", &val);
-        if (read < 1) return 2;
-        if ((val < 0) || (val > MY_PWR_MAX)) return 3;
-        my_dac::set_vpwr(my_math::power_to_vpwr(val));
-        return 0;
+        return float_cmd(cmd_bus::CMD_SET_PWR, argc, argv);
     }
     static int set_vlim(int argc, char** argv)
+    {
+        return float_cmd(cmd_bus::CMD_SET_VLIM, argc, argv);
+    }
+    static int output(int argc, char** argv)
     {
         if (argc < 2) return 1;
-        float val;
-        int read = sscanf(argv[1], "%f", &val);
-        if (read < 1) return 2;
-        if ((val < MY_VLIM_MIN) || (val > MY_VLIM_MAX)) return 3;
-        my_dac::set_vlim(my_math::vlim_to_dac_vlim(val));
-        my_params::set_last_saved_vlim(val);
-        return 0;
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_OUTPUT };
+        c.enable = bool_arg_helper(argc, argv);
+        return bus_call(&c);
     }
     static int override_error(int argc, char** argv)
     {
-        my_dbg_helpers::interop_enqueue(dbg_console::interop_cmds::override_errors, NULL);
+        cmd_bus::cmd_t c = { .type = cmd_bus::CMD_OVERRIDE_ERRORS };
+        return bus_call(&c);
+    }
+    static int cmd_stats(int argc, char** argv)
+    {
+        auto st = cmd_bus::get_stats();
+        print_kv("posted", "%" PRIu32, st.posted);
+        print_kv("rejected", "%" PRIu32, st.rejected);
+        print_kv("executed", "%" PRIu32, st.executed);
+        print_kv("max_depth", "%" PRIu32, st.max_depth);
+        return 0;
+    }
+    static int journal_print(int argc, char** argv)
+    {
+        unsigned count = 20;
+        if ((argc > 1) && (sscanf(argv[1], "%u", &count) != 1)) return 2;
+        journal::print(count);
+        return 0;
+    }
+    static int journal_stats(int argc, char** argv)
+    {
+        auto st = journal::get_stats();
+        print_kv("recorded", "%" PRIu32, st.recorded);
+        print_kv("dropped", "%" PRIu32, st.dropped);
+        print_kv("flushes", "%" PRIu32, st.flushes);
+        print_kv("flush_max_us", "%" PRIu32, st.flush_max_us);
+        print_kv("head_seq", "%" PRIu32, st.head_seq);
+        print_kv("tail_seq", "%" PRIu32, st.tail_seq);
+        print_kv("capacity", "%zu", st.capacity);
+        return 0;
+    }
+    static int time_sync(int argc, char** argv)
+    {
+        auto st = timesync::get_status();
+        int64_t master_us = 0;
+        timesync::now_us(&master_us);
+        print_kv("state", "%s", timesync::get_state_name(st.state));
+        print_kv("master_time_us", "%" PRId64, master_us);
+        print_kv("offset_us", "%" PRId64, st.offset_us);
+        print_kv("drift_ppb", "%" PRId32, st.drift_ppb);
+        print_kv("rtt_min_us", "%" PRIu32, st.rtt_min_us);
+        print_kv("residual_us", "%.1f", st.residual_us);
+        print_kv("samples", "%u", st.samples);
+        print_kv("used", "%u", st.used);
+        print_kv("exchanges", "%" PRIu32, st.exchanges);
+        print_kv("rejected", "%" PRIu32, st.rejected);
+        print_kv("steps", "%" PRIu32, st.steps);
+        return 0;
+    }
+    static int ota_status(int argc, char** argv)
+    {
+        auto st = ota::get_status();
+        const esp_partition_t* running = esp_ota_get_running_partition();
+        const esp_partition_t* next = esp_ota_get_next_update_partition(NULL);
+        print_kv("state", "%s", ota::get_state_name(st.state));
+        print_kv("running", "%s", running ? running->label : "?");
+        print_kv("next", "%s", next ? next->label : "none");
+        print_kv("received", "%" PRIu32, st.received);
+        print_kv("size", "%" PRIu32, st.size);
+        print_kv("updates", "%" PRIu32, st.updates);
+        print_kv("auth_failures", "%" PRIu32, st.auth_failures);
+        print_kv("last_result", "%s", esp_err_to_name(st.last_result));
+        print_kv("last_duration_ms", "%" PRIu32, st.last_duration_ms);
         return 0;
     }
     static int log_set_debug(int argc, char** argv)
     {
-        esp_log_level_set("*", esp_log_level_t::ESP_LOG_DEBUG);
+        return log_route::set_level("*", LOG_ROUTE_ALL_SINKS, esp_log_level_t::ESP_LOG_DEBUG);
+    }
+    static int log_level(int argc, char** argv)
+    {
+        if (argc < 2)
+        {
+            log_route::print_rules();
+            return 0;
+        }
+        if (argc < 4) return 1;
+        uint8_t sinks;
+        esp_log_level_t level;
+        if (!log_route::parse_sinks(argv[1], &sinks)) return 2;
+        if (!log_route::parse_level(argv[3], &level)) return 2;
+        return log_route::set_level(argv[2], sinks, level);
+    }
+    static int log_rate(int argc, char** argv)
+    {
+        unsigned per_s, burst = 0;
+        if (argc < 3) return 1;
+        if (sscanf(argv[2], "%u", &per_s) != 1) return 2;
+        if ((argc > 3) && (sscanf(argv[3], "%u", &burst) != 1)) return 2;
+        if ((per_s > UINT16_MAX) || (burst > UINT16_MAX)) return 3;
+        return log_route::set_rate(argv[1], per_s, burst);
+    }
+    static int log_stats(int argc, char** argv)
+    {
+        log_route::print_rules();
+        log_defer::stats_t s = log_defer::get_stats();
+        printf("Records: captured %" PRIu32 ", output %" PRIu32 ", dropped %" PRIu32 ", truncated %" PRIu32 ", formatted immediately %" PRIu32 "\n",
+            s.captured, s.rendered, s.dropped, s.truncated, s.immediate);
+        return 0;
+    }
+    static int log_format(int argc, char** argv)
+    {
+        if (argc < 2)
+        {
+            printf("%s\n", log_defer::get_format() == log_defer::FORMAT_BINARY ? "binary" : "text");
+            return 0;
+        }
+        if (strcmp(argv[1], "text") == 0) log_defer::set_format(log_defer::FORMAT_TEXT);
+        else if (strcmp(argv[1], "binary") == 0) log_defer::set_format(log_defer::FORMAT_BINARY);
+        else return 2;
         return 0;
     }
     static int get_reset_reason(int argc, char** argv)
@@ -271,8 +579,68 @@ namespace my_dbg_commands {
     }
     static int probe(int argc, char** argv)
     {
-        assert(console_context);
-        probe_terminal(console_context->linenoise_handle);
+        assert(session);
+        if (session->type == CONSOLE_INST_ETH) console_server::probe(session - &(consoles[1]));
+        else probe_terminal(session->linenoise_handle);
+        return 0;
+    }
+    static int set_enc_accel(int argc, char** argv)
+    {
+        if (argc < 4)
+        {
+            auto a = my_encoder::get_accel();
+            printf("Threshold = %.1f counts/s, slope = %.3f /(counts/s), max gain = %.1f\n", a->threshold_cps, a->slope, a->max_gain);
+            return argc > 1 ? 1 : 0;
+        }
+        my_encoder::accel_cfg_t c;
+        if (sscanf(argv[1], "%f", &(c.threshold_cps)) != 1) return 2;
+        if (sscanf(argv[2], "%f", &(c.slope)) != 1) return 2;
+        if (sscanf(argv[3], "%f", &(c.max_gain)) != 1) return 2;
+        if ((c.threshold_cps < 0) || (c.slope < 0) || (c.max_gain < 1)) return 3;
+        my_encoder::set_accel(&c);
+        return 0;
+    }
+    static int console_mode(int argc, char** argv)
+    {
+        static const char* const names[] = { "interactive", "batch", "json" };
+        assert(session);
+        if (argc < 2)
+        {
+            print_kv("mode", "%s", names[session->mode]);
+            return 0;
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(names); i++)
+        {
+            if (strcmp(argv[1], names[i])) continue;
+            session->mode = static_cast<console_modes>(i);
+            return 0;
+        }
+        return 2;
+    }
+    static int sessions(int argc, char** argv)
+    {
+        static const char* const types[] = { "uart", "eth" };
+        static const char* const modes[] = { "interactive", "batch", "json" };
+        int64_t now = esp_timer_get_time();
+        printf("%-3s %-5s %-12s %-24s %10s\n", "Id", "Type", "Mode", "Running", "For, ms");
+        for (size_t i = 0; i < CONSOLE_TOTAL_INST; i++)
+        {
+            const console_instance_t* c = &(consoles[i]);
+            if ((c->type == CONSOLE_INST_ETH) && !console_server::is_connected(i - 1)) continue;
+            const esp_console_cmd_t* cmd = c->running; // Read once, the session may finish meanwhile
+            printf("%-3zu %-5s %-12s %-24s", i, types[c->type], modes[c->mode], cmd ? cmd->command : "-");
+            if (cmd) printf(" %10" PRIi64, (now - c->started_us) / 1000);
+            printf("%s\n", (c == session) ? " (this)" : "");
+        }
+        return 0;
+    }
+    static int cancel(int argc, char** argv)
+    {
+        unsigned id;
+        if (argc < 2) return 1;
+        if ((sscanf(argv[1], "%u", &id) != 1) || (id >= CONSOLE_TOTAL_INST)) return 2;
+        if (!consoles[id].running) return 3;
+        consoles[id].cancel = true;
         return 0;
     }
     static int set_hostname(int argc, char** argv)
@@ -293,6 +661,65 @@ static const esp_console_cmd_t commands[] = {
         .help = "Report hardware state",
         .hint = NULL,
         .func = &my_dbg_commands::hw_report },
+    { .command = "bus_stats",
+        .help = "Report shift-register bus arbitration statistics (DAC worst-case wait). 'bus_stats reset' clears them after printing.",
+        .hint = NULL,
+        .func = &my_dbg_commands::bus_stats },
+    { .command = "cal_capture",
+        .help = "Capture multi-point DAC calibration table: cal_capture <vpwr|vlim> <code_from> <code_to> <points>. "
+            "Every point waits for cal_post. The control loop doesn't drive the DACs meanwhile, the button aborts.",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_capture_start },
+    { .command = "cal_sweep",
+        .help = "Automated gain/offset DAC calibration: cal_sweep <vpwr|vlim> <code_from> <code_to> <points> [settle_ms]. "
+            "Runs in the background, every point waits for cal_post after settling; the result is fitted by least squares and saved.",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_sweep_start },
+    { .command = "cal_sweep_report",
+        .help = "Print calibration sweep progress, or the last sweep's points, fit residuals (LSB) and coefficients",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_sweep_report },
+    { .command = "cal_post",
+        .help = "Post measured output for the current calibration point (volts): table capture or sweep",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_post },
+    { .command = "cal_abort",
+        .help = "Abort calibration table capture or sweep",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_abort },
+    { .command = "cal_table",
+        .help = "Print DAC calibration table: cal_table <vpwr|vlim> ['clear' to remove it and use gain/offset]",
+        .hint = NULL,
+        .func = &my_dbg_commands::cal_table },
+    { .command = "dev_info",
+        .help = "Print device info strings (stored in the devcal partition)",
+        .hint = NULL,
+        .func = &my_dbg_commands::dev_info },
+    { .command = "nvs_stats",
+        .help = "Report NVS parameter write counts, pending (dirty) keys, NVS usage and estimated flash wear",
+        .hint = NULL,
+        .func = &my_dbg_commands::nvs_stats },
+    { .command = "boot_report",
+        .help = "Print boot timeline: per-stage timestamps (esp_timer, us), core and result, time of the first Modbus request",
+        .hint = NULL,
+        .func = &my_dbg_commands::boot_report },
+    { .command = "perf",
+        .help = "Report per-task CPU usage (last sampling window) and stack high-water marks, subsystem counters and heap",
+        .hint = NULL,
+        .func = &my_dbg_commands::perf_report },
+    { .command = "ram_report",
+        .help = "Report statically allocated tasks, queues, mutexes and buffers (bytes, peak stack use) and the heap state",
+        .hint = NULL,
+        .func = &my_dbg_commands::ram_report },
+    { .command = "trace",
+        .help = "Dump the event trace ring (cycle timestamps per core): trace [max events]. 'trace clear' forgets recorded events.",
+        .hint = NULL,
+        .func = &my_dbg_commands::trace_dump },
+    { .command = "bench",
+        .help = "Microbenchmark firmware hot paths (cycles per call, heap change): bench [iterations] [case|all] ['json' for one JSON object per line]. "
+            "Cases: sr_write, menu_set_values, lcd_puts, modbus_lock, printf. The output must be disabled.",
+        .hint = NULL,
+        .func = &my_dbg_commands::run_bench },
     { .command = "version",
         .help = "Get version of chip and SDK",
         .hint = NULL,
@@ -330,33 +757,73 @@ static const esp_console_cmd_t commands[] = {
         .hint = NULL,
         .func = &my_dbg_commands::test_nvs_crc },
     { .command = "reset_dev_info",
-        .help = "Reset device info SPIFFS file",
+        .help = "Clear device info strings (devcal partition and legacy SPIFFS file)",
         .hint = NULL,
         .func = &my_dbg_commands::reset_dev_info },
     { .command = "set_pwr",
-        .help = "Set output power",
+        .help = "Set output power, W, local mode only. Held until the knob is turned.",
         .hint = NULL,
         .func = &my_dbg_commands::set_pwr },
     { .command = "set_vlim",
-        .help = "Set overvoltage protection threshold",
+        .help = "Set overvoltage protection threshold, V, local mode only",
         .hint = NULL,
         .func = &my_dbg_commands::set_vlim },
     { .command = "set_vpwr_dac",
-        .help = "Set Vpwr DAC directly",
+        .help = "Set Vpwr DAC directly, V, only while the output is disabled",
         .hint = NULL,
         .func = &my_dbg_commands::set_vpwr_dac },
     { .command = "set_vlim_dac",
-        .help = "Set Vlim DAC directly",
+        .help = "Set Vlim DAC directly, V, local mode only",
         .hint = NULL,
         .func = &my_dbg_commands::set_vlim_dac },
     { .command = "override_error",
         .help = "Override any startup error",
         .hint = NULL,
         .func = &my_dbg_commands::override_error },
+    { .command = "output",
+        .help = "Enable or disable the output, like the button: output <0|1>",
+        .hint = NULL,
+        .func = &my_dbg_commands::output },
+    { .command = "cmd_stats",
+        .help = "Control loop command queue statistics",
+        .hint = NULL,
+        .func = &my_dbg_commands::cmd_stats },
+    { .command = "journal",
+        .help = "Flush the control event journal and print the newest records: journal [count], default 20",
+        .hint = NULL,
+        .func = &my_dbg_commands::journal_print },
+    { .command = "journal_stats",
+        .help = "Control event journal counters and the range of sequence numbers kept in flash",
+        .hint = NULL,
+        .func = &my_dbg_commands::journal_stats },
+    { .command = "timesync",
+        .help = "Modbus master clock estimate: offset, drift and exchange counters",
+        .hint = NULL,
+        .func = &my_dbg_commands::time_sync },
+    { .command = "ota",
+        .help = "Firmware update receiver state, running and next OTA partition, result of the last update",
+        .hint = NULL,
+        .func = &my_dbg_commands::ota_status },
     { .command = "log_set_debug",
-        .help = "Set log level to DEBUG. This action can be undone only by a reset.",
+        .help = "Set log level to DEBUG for every tag and sink, same as log_level all * debug",
         .hint = NULL,
         .func = &my_dbg_commands::log_set_debug },
+    { .command = "log_format",
+        .help = "Get/set log output format: text or binary (decode with tools/log_decode.py and the firmware ELF)",
+        .hint = "[text|binary]",
+        .func = &my_dbg_commands::log_format },
+    { .command = "log_level",
+        .help = "Set the level of a tag (* for the default) on a sink, without arguments print the routing rules",
+        .hint = "[<uart|eth|all> <tag|*> <none|error|warn|info|debug|verbose>]",
+        .func = &my_dbg_commands::log_level },
+    { .command = "log_rate",
+        .help = "Limit a tag to <per_s> records/s, bursts of up to <burst> (default per_s). 0 removes the limit.",
+        .hint = "<tag|*> <per_s> [burst]",
+        .func = &my_dbg_commands::log_rate },
+    { .command = "log_stats",
+        .help = "Print the log routing rules with their passed/filtered/suppressed counts and the capture statistics",
+        .hint = NULL,
+        .func = &my_dbg_commands::log_stats },
     { .command = "get_reset_reason",
         .help = "Returns reset reason code",
         .hint = NULL,
@@ -373,10 +840,27 @@ static const esp_console_cmd_t commands[] = {
         .help = "Re-probe the terminal capabilities",
         .hint = NULL,
         .func = &my_dbg_commands::probe },
+    { .command = "set_enc_accel",
+        .help = "Set encoder acceleration curve (threshold_cps slope max_gain), print current one if no args. Not persistent.",
+        .hint = NULL,
+        .func = &my_dbg_commands::set_enc_accel },
     { .command = "set_hostname",
         .help = "Set mDNS hostname",
         .hint = NULL,
-        .func = &my_dbg_commands::set_hostname }
+        .func = &my_dbg_commands::set_hostname },
+    { .command = "sessions",
+        .help = "List the console sessions and the command each one is running",
+        .hint = NULL,
+        .func = &my_dbg_commands::sessions },
+    { .command = "cancel",
+        .help = "Ask the command running in another session to stop (see sessions). Long-running commands (bench) poll for it.",
+        .hint = "<session>",
+        .func = &my_dbg_commands::cancel },
+    { .command = "console_mode",
+        .help = "Set this console's mode. batch: no prompt or echo, each command is followed by OK or ERR <code>. "
+            "json: one {\"cmd\",\"ret\",\"data\",\"out\"} line per command. Both return to interactive when the client goes away.",
+        .hint = "[interactive|batch|json]",
+        .func = &my_dbg_commands::console_mode }
 };
 
 /// @brief Figure out if the terminal supports escape sequences
@@ -409,38 +893,26 @@ static void probe_terminal(esp_linenoise_handle_t h)
 #endif // CONFIG_LOG_COLORS
     }
 }
+/** Completion and hints only read the command list, which is complete before the parser tasks start: no lock */
 static void esp_console_get_completion_wrapper(const char *str, void *cb_ctx, esp_linenoise_completion_cb_t cb)
 {
-    while (xSemaphoreTakeRecursive(esp_console_mutex, portMAX_DELAY) != pdTRUE);
-
-    linenoiseCompletions lc;
+    linenoiseCompletions lc = {};
     esp_console_get_completion(str, &lc);
     for (size_t i = 0; i < lc.len; i++)
     {
         cb(cb_ctx, lc.cvec[i]);   
     }
-
-    xSemaphoreGiveRecursive(esp_console_mutex);
 }
 static char* esp_console_get_hint_wrapper(const char *str, int *color, int *bold)
 {   
-    while (xSemaphoreTakeRecursive(esp_console_mutex, portMAX_DELAY) != pdTRUE);
-
-    char* ret = const_cast<char*>(esp_console_get_hint(str, color, bold));
-
-    xSemaphoreGiveRecursive(esp_console_mutex);
-    return ret;
+    return const_cast<char*>(esp_console_get_hint(str, color, bold));
 }
-static int local_vprintf(const char *fmt, va_list args)
+/// @brief Deferred log output (runs in the log drain task): stdout and every TCP console session, as routed by log_route.
+/// Written with fwrite, binary log frames contain 0x00.
+static void log_sink(const char* data, size_t len, uint8_t sinks)
 {
-    if (!default_vprintf) return -1;
-    int ret1 = default_vprintf(fmt, args);
-    if (consoles[CONSOLE_INST_ETH].stdout_fd != fileno(stdout))
-    {
-        int ret2 = eth_console_vfs::vprintf(fmt, args);
-        return ret2 < ret1 ? ret2 : ret1;
-    }
-    return ret1;
+    if (sinks & (1u << log_route::SINK_UART)) fwrite(data, 1, len, stdout);
+    if (sinks & (1u << log_route::SINK_ETH)) console_server::broadcast(data, len, log_defer::get_format() == log_defer::FORMAT_TEXT);
 }
 /// @brief Initialize esp console, lineNoise library and install uart VFS drivers, redirecting stdout into the console.
 static void initialize_console()
@@ -451,22 +923,19 @@ static void initialize_console()
     uart_vfs_dev_port_set_rx_line_endings(CONFIG_ESP_CONSOLE_UART_NUM, ESP_LINE_ENDINGS_CR);
     uart_vfs_dev_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
 
-    ESP_ERROR_CHECK_WITHOUT_ABORT(eth_console_vfs::init_console());
-    eth_console_vfs::set_rx_line_endings(ESP_LINE_ENDINGS_CR);
-    default_vprintf = esp_log_set_vprintf(local_vprintf);
-    ESP_LOGI(TAG, "Vprintf redirected successfully");
+    ESP_ERROR_CHECK(log_defer::init(log_sink));
 
     /* Initialize the console */
     esp_console_config_t console_config = {
         .max_cmdline_length = MAX_CMDLINE_LENGTH,
-        .max_cmdline_args = 8,
+        .max_cmdline_args = MAX_CMDLINE_ARGS,
 #if CONFIG_LOG_COLORS
         .hint_color = atoi(LOG_COLOR_CYAN)
 #endif
     };
     ESP_ERROR_CHECK(esp_console_init(&console_config));
 
-    for (size_t i = 0; i < CONSOLE_TOTAL_INST; i++)
+    /* UART line editing, the TCP server has its own */
     {
         esp_linenoise_config_t config;
         esp_linenoise_get_instance_config_default(&config);
@@ -484,64 +953,209 @@ static void initialize_console()
             dumb_prompt
 #endif
         ;
-        if (i == static_cast<size_t>(CONSOLE_INST_ETH))
-        {
-            FILE *eth_rx, *eth_tx;
-            eth_console_vfs::get_streams(&eth_rx, &eth_tx);
-            config.in_fd = fileno(eth_rx);
-            config.out_fd = fileno(eth_tx);
-        }
-        consoles[i].stdout_fd = config.out_fd;
-        ESP_ERROR_CHECK(esp_linenoise_create_instance(&config, &(consoles[i].linenoise_handle)));
-        ESP_LOGI(TAG, "Console %i initialized!", i);
+        consoles[0].stdin_fd = config.in_fd;
+        ESP_ERROR_CHECK(esp_linenoise_create_instance(&config, &(consoles[0].linenoise_handle)));
+        ESP_LOGI(TAG, "UART console initialized!");
     }
+    for (size_t i = 1; i < CONSOLE_TOTAL_INST; i++) consoles[i].type = CONSOLE_INST_ETH;
 
     /* Register commands */
     esp_console_register_help_command();
     my_dbg_helpers::register_cmds(commands, ARRAY_SIZE(commands));
 }
-/// @brief Console input parser task body function.
-/// @param arg Not used
-static void parser_task(void* arg)
+/// @brief Write a JSON string literal
+static void print_json_string(const char* s, size_t len)
 {
-    char line[MAX_CMDLINE_LENGTH];
-    console_instance_t* con = reinterpret_cast<console_instance_t*>(arg);
-    switch (con->type)
+    putchar('"');
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = s[i];
+        switch (c)
+        {
+        case '"': fputs("\\\"", stdout); break;
+        case '\\': fputs("\\\\", stdout); break;
+        case '\n': fputs("\\n", stdout); break;
+        case '\r': fputs("\\r", stdout); break;
+        case '\t': fputs("\\t", stdout); break;
+        default:
+            if (c < 0x20) printf("\\u%04x", c);
+            else putchar(c);
+            break;
+        }
+    }
+    putchar('"');
+}
+/// @brief Find one of our commands
+/// @return NULL for commands esp_console registered itself (help)
+static const esp_console_cmd_t* find_command(const char* name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(commands); i++)
     {
-    case console_instances::CONSOLE_INST_ETH:
-        ESP_ERROR_CHECK_WITHOUT_ABORT(eth_console_vfs::redirect_std_streams());
+        if (strcmp(commands[i].command, name) == 0) return &(commands[i]);
+    }
+    return NULL;
+}
+/// @brief Split and run a command in the calling session's task, with its own argument buffer.
+/// Sessions run commands concurrently, commands touching shared state lock it themselves.
+static esp_err_t execute(console_instance_t* con, const char* cmd, int* ret)
+{
+    char buf[MAX_CMDLINE_LENGTH];
+    char* argv[MAX_CMDLINE_ARGS + 1] = {};
+    strncpy(buf, cmd, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    size_t argc = esp_console_split_argv(buf, argv, ARRAY_SIZE(argv));
+    if (!argc) return ESP_ERR_INVALID_ARG;
+    const esp_console_cmd_t* c = find_command(argv[0]);
+    if (!c)
+    {
+        while (xSemaphoreTake(esp_console_run_mutex, portMAX_DELAY) != pdTRUE);
+        esp_err_t err = esp_console_run(cmd, ret);
+        xSemaphoreGive(esp_console_run_mutex);
+        return err;
+    }
+    con->cancel = false;
+    con->started_us = esp_timer_get_time();
+    con->running = c;
+    *ret = c->func(argc, argv);
+    con->running = NULL;
+    return ESP_OK;
+}
+/// @brief Run one command. In JSON mode its stdout is captured and printed as one {"cmd","ret","data","out"} line.
+static void run_command(console_instance_t* con, const char* cmd)
+{
+    const console_modes mode = con->mode; // The command may change it
+    char* out = con->buffers->capture;
+    size_t out_len = 0;
+    int ret = 0;
+    my_dbg_commands::session = con;
+    con->kv_len = 0;
+    FILE* capture = (mode == CONSOLE_MODE_JSON) ? fmemopen(out, CONSOLE_CAPTURE_LEN, "w") : NULL;
+    FILE* console_stdout = stdout;
+    if (capture) stdout = capture; // stdout is per task
+    esp_err_t err = execute(con, cmd, &ret);
+    if (capture)
+    {
+        fflush(capture);
+        out_len = MIN(static_cast<size_t>(MAX(ftell(capture), 0L)), CONSOLE_CAPTURE_LEN - 1);
+        fclose(capture);
+        stdout = console_stdout;
+    }
+    my_dbg_commands::session = NULL;
+
+    switch (mode)
+    {
+    case CONSOLE_MODE_JSON:
+        printf("{\"cmd\":");
+        print_json_string(cmd, strlen(cmd));
+        if (err == ESP_OK) printf(",\"ret\":%d", ret);
+        else printf(",\"err\":\"%s\"", esp_err_to_name(err));
+        printf(",\"data\":{%.*s},\"out\":", static_cast<int>(con->kv_len), con->buffers->kv);
+        print_json_string(out, out_len);
+        if (out_len == CONSOLE_CAPTURE_LEN - 1) printf(",\"truncated\":true");
+        printf("}\n");
+        break;
+    case CONSOLE_MODE_BATCH:
+        if (err != ESP_OK) printf("ERR %s\n", esp_err_to_name(err));
+        else if (ret) printf("ERR %d\n", ret);
+        else printf("OK\n");
         break;
     default:
+        if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "Unrecognized command: '%s'\n", cmd);
+        } else if (err == ESP_OK && ret != ESP_OK) {
+            ESP_LOGW(TAG, "Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
+        } else if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Internal error: %s\n", esp_err_to_name(err));
+        }
         break;
     }
+    fflush(stdout);
+}
+/// @brief Run every command of a line, separated by CONSOLE_CMD_SEPARATOR outside of double quotes
+/// @param buffers JSON mode buffers of the calling task
+static void run_line(console_instance_t* con, char* line, exec_buffers_t* buffers)
+{
+    con->buffers = buffers;
+    bool quoted = false;
+    char* cmd = line;
+    for (char* p = line;; p++)
+    {
+        if (*p == '\\' && p[1]) p++;
+        else if (*p == '"') quoted = !quoted;
+        else if (((*p == CONSOLE_CMD_SEPARATOR) && !quoted) || !*p)
+        {
+            bool last = !*p;
+            *p = '\0';
+            while (*cmd == ' ') cmd++;
+            if (*cmd) run_command(con, cmd);
+            if (last) break;
+            cmd = p + 1;
+        }
+    }
+}
+/// @brief Blocking line read for the batch modes: no prompt, echo or editing. CR and LF both end a line.
+/// @return False on a read error (e.g. the client is gone)
+static bool read_raw_line(int fd, char* buf, size_t size)
+{
+    size_t n = 0;
+    for (;;)
+    {
+        char c;
+        if (read(fd, &c, 1) != 1) return false;
+        if ((c == '\r') || (c == '\n'))
+        {
+            if (!n) continue;
+            buf[n] = '\0';
+            return true;
+        }
+        if (n < size - 1) buf[n++] = c;
+    }
+}
+/// @brief TCP session handlers (console_server), session i is consoles[1 + i]
+static void eth_session_opened(size_t session)
+{
+    consoles[1 + session].mode = CONSOLE_MODE_INTERACTIVE; // A new client gets a prompt
+}
+static bool eth_session_line(size_t session, size_t worker, char* line)
+{
+    console_instance_t* con = &(consoles[1 + session]);
+    run_line(con, line, &(exec_buffers[1 + worker]));
+    return con->mode == CONSOLE_MODE_INTERACTIVE;
+}
+static void eth_session_interrupt(size_t session)
+{
+    consoles[1 + session].cancel = true;
+}
+/// @brief UART console input parser task body function.
+/// @param arg Session
+static void parser_task(void* arg)
+{
+    char line[MAX_CMDLINE_LENGTH];
+    console_instance_t* con = reinterpret_cast<console_instance_t*>(arg);
     probe_terminal(con->linenoise_handle);
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(20));
-                /* Get a line using linenoise.
-         * The line is returned when ENTER is pressed.
+        /* Reads block until a whole line is in. Batch modes read raw lines, interactive mode uses linenoise
+         * (the line is returned when ENTER is pressed).
          */
-        esp_err_t res = esp_linenoise_get_line(con->linenoise_handle, line, sizeof(line));
-        if (res != ESP_OK) { /* Break on EOF or error */
-            continue;
+        if (con->mode != CONSOLE_MODE_INTERACTIVE)
+        {
+            if (!read_raw_line(con->stdin_fd, line, sizeof(line)))
+            {
+                con->mode = CONSOLE_MODE_INTERACTIVE;
+                vTaskDelay(pdMS_TO_TICKS(CONSOLE_READ_RETRY_MS));
+                continue;
+            }
         }
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_linenoise_history_add(con->linenoise_handle, line));
-
-        /* Try to run the command */
-        int ret;
-        while (xSemaphoreTakeRecursive(esp_console_mutex, portMAX_DELAY) != pdTRUE);
-        my_dbg_commands::console_context = con;
-        esp_err_t err = esp_console_run(line, &ret);
-        my_dbg_commands::console_context = NULL;
-        xSemaphoreGiveRecursive(esp_console_mutex);
-        if (err == ESP_ERR_NOT_FOUND) {
-            ESP_LOGW(TAG, "Unrecognized command: '%s'\n", line);
-        } else if (err == ESP_ERR_INVALID_ARG) {
-            // command was empty
-        } else if (err == ESP_OK && ret != ESP_OK) {
-            ESP_LOGW(TAG, "Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
-        } else if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Internal error: %s\n", esp_err_to_name(err));
+        else
+        {
+            esp_err_t res = esp_linenoise_get_line(con->linenoise_handle, line, sizeof(line));
+            if (res != ESP_OK) { /* EOF or error, e.g. no client */
+                vTaskDelay(pdMS_TO_TICKS(CONSOLE_READ_RETRY_MS));
+                continue;
+            }
+            ESP_ERROR_CHECK_WITHOUT_ABORT(esp_linenoise_history_add(con->linenoise_handle, line));
         }
+        run_line(con, line, &(exec_buffers[0]));
     }
 }
 
@@ -560,6 +1174,45 @@ namespace my_dbg_helpers
             return true;
         }
     }
+    /// @brief Print a named value of a command's result: "key = value" in the text modes, a "key":value member of
+    /// "data" in JSON mode (a number if the value reads as one, a string otherwise)
+    void print_kv(const char* key, const char* fmt, ...)
+    {
+        char value[64];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(value, sizeof(value), fmt, args);
+        va_end(args);
+        console_instance_t* con = my_dbg_commands::session;
+        if (!con || (con->mode != CONSOLE_MODE_JSON))
+        {
+            printf("%s = %s\n", key, value);
+            return;
+        }
+        char* end;
+        size_t len = strlen(value);
+        double d = strtod(value, &end);
+        bool number = len && (strspn(value, "0123456789+-.eE") == len) && !*end && isfinite(d);
+        char member[sizeof(value) * 2 + 32];
+        size_t n = snprintf(member, sizeof(member), "%s\"%s\":", con->kv_len ? "," : "", key);
+        if (!number) member[n++] = '"';
+        for (const char* p = value; *p && (n < sizeof(member) - 3); p++)
+        {
+            if ((*p == '"') || (*p == '\\')) member[n++] = '\\';
+            member[n++] = (static_cast<unsigned char>(*p) < 0x20) ? ' ' : *p;
+        }
+        if (!number) member[n++] = '"';
+        if (n > CONSOLE_KV_LEN - con->kv_len) return; // Members that don't fit are left out whole
+        memcpy(con->buffers->kv + con->kv_len, member, n);
+        con->kv_len += n;
+    }
+    /// @brief Poll from long-running commands: another session asked to stop the one running in the calling task
+    /// (cancel command). False outside of console commands.
+    bool is_cancelled()
+    {
+        console_instance_t* con = my_dbg_commands::session;
+        return con && con->cancel;
+    }
     /// @brief A helper function to register an array of console commands
     /// @param arr array
     /// @param len array length
@@ -570,43 +1223,26 @@ namespace my_dbg_helpers
             esp_console_cmd_register(&(arr[i]));
         }
     }
-    /// @brief Try to enqueue a new interoperability command.
-    /// @param cmd Interop command
-    /// @param arg Interop arguments
-    /// @return True if succeeded, False otherwise.
-    bool interop_enqueue(dbg_console::interop_cmds cmd, void* arg)
-    {
-        assert(interop_queue_handle);
-
-        interop_cmd.cmd = cmd;
-        interop_cmd.args = arg;
-        if (xQueueSend(interop_queue_handle, &interop_cmd, 0) != pdTRUE)
-        {
-            printf("Failed to enqueue a new debug interoperation. Please wait for previous ones to finish.\n");
-            return false;
-        }
-        else
-        {
-            ESP_LOGD(TAG, "Enqued interop message");
-        }
-        return true;
-    }
 }
 
 
 namespace dbg_console {
     /// @brief Initialize common debug console and lineNoise, install uart VFS driver. Creates debug console task.
-    /// @param interop_queue Interoperablity queue used to execute debug commands like calibrations and error overrides
-    void init(QueueHandle_t interop_queue)
+    void init()
     {
         ESP_LOGI(TAG, "Initializing...");
-        assert(interop_queue);
-        esp_console_mutex = xSemaphoreCreateRecursiveMutex();
-        assert(esp_console_mutex);
+        static StaticSemaphore_t esp_console_run_mutex_buffer, dac_cmd_mutex_buffer;
+        esp_console_run_mutex = static_alloc::create_mutex("esp_console_run", &esp_console_run_mutex_buffer);
+        dac_cmd_mutex = static_alloc::create_mutex("console_dac", &dac_cmd_mutex_buffer);
 
-        interop_queue_handle = interop_queue;
         initialize_console();
-        assert(xTaskCreate(parser_task, "uart_console_parser", 10000, &(consoles[console_instances::CONSOLE_INST_UART]), 1, NULL) == pdPASS);
-        assert(xTaskCreate(parser_task, "eth_console_parser", 10000, &(consoles[console_instances::CONSOLE_INST_ETH]), 1, NULL) == pdPASS);
+        static_alloc::add_buffer("console_batch", sizeof(exec_buffers));
+        static StackType_t parser_stack[CONSOLE_PARSER_TASK_STACK_SIZE];
+        static StaticTask_t parser_tcb;
+        static_alloc::create_task(parser_task, "uart_console_parser", sizeof(parser_stack), &(consoles[0]), CONSOLE_PARSER_TASK_PRIORITY,
+            parser_stack, &parser_tcb);
+        static const console_server::handlers_t eth_handlers = { .opened = eth_session_opened, .line = eth_session_line,
+            .interrupt = eth_session_interrupt };
+        ESP_ERROR_CHECK_WITHOUT_ABORT(console_server::init(CONFIG_CONSOLE_PORT, &eth_handlers));
     }
 }
\ No newline at end of file
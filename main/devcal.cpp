@@ -0,0 +1,285 @@
+/**
+ * @file devcal.cpp
+ * @author MSU
+ * @brief Device info and calibration record in a dedicated raw data partition.
+ * Slot layout: record_header_t, then sections (section_header_t + data padded to 4 bytes). The header is written last,
+ * so an interrupted update leaves the slot invalid and the previous record (other slot) stays in effect.
+ * @date 2026-10-16
+ *
+ */
+
+#include "devcal.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "rom/crc.h"
+
+#include "static_alloc.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define DEVCAL_PARTITION_LABEL "devcal"
+#define DEVCAL_PARTITION_SUBTYPE static_cast<esp_partition_subtype_t>(0x40)
+#define DEVCAL_MAGIC 0x4C434544u // "DECL"
+#define DEVCAL_VERSION 1
+#define DEVCAL_SLOT_COUNT 2
+#define DEVCAL_ALIGN(x) (((x) + 3u) & ~3u)
+
+struct record_header_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t section_count;
+    uint32_t seq; ///< Incremented by every update, the valid slot with the highest one is active
+    uint32_t payload_len;
+    uint32_t payload_crc;
+    uint32_t header_crc; ///< CRC of the preceding header fields
+};
+struct section_header_t
+{
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t len; ///< Data length, without padding
+};
+
+static const char TAG[] = "DEVCAL";
+
+static const esp_partition_t* partition = NULL;
+static const uint8_t* mapped = NULL;
+static esp_partition_mmap_handle_t mmap_handle;
+static size_t slot_size = 0;
+static const record_header_t* active = NULL;
+static int active_slot = -1;
+static SemaphoreHandle_t write_mutex = NULL;
+
+static uint32_t header_crc(const record_header_t* h)
+{
+    return crc32_le(0, reinterpret_cast<const uint8_t*>(h), offsetof(record_header_t, header_crc));
+}
+/// @brief Check a slot: header, payload CRC and section chain
+/// @return Record header (mapped) if valid, NULL otherwise
+static const record_header_t* validate_slot(int slot)
+{
+    auto h = reinterpret_cast<const record_header_t*>(mapped + slot * slot_size);
+    if (h->magic != DEVCAL_MAGIC || h->header_crc != header_crc(h)) return NULL;
+    if (h->version > DEVCAL_VERSION)
+    {
+        ESP_LOGW(TAG, "Slot %d: record v%u is newer than supported v%u", slot, h->version, DEVCAL_VERSION);
+        return NULL;
+    }
+    if (h->payload_len > slot_size - sizeof(record_header_t)) return NULL;
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(h + 1);
+    if (crc32_le(0, payload, h->payload_len) != h->payload_crc)
+    {
+        ESP_LOGW(TAG, "Slot %d: payload CRC mismatch", slot);
+        return NULL;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < h->section_count; i++)
+    {
+        if (offset + sizeof(section_header_t) > h->payload_len) return NULL;
+        auto s = reinterpret_cast<const section_header_t*>(payload + offset);
+        offset += sizeof(section_header_t) + DEVCAL_ALIGN(s->len);
+    }
+    return (offset <= h->payload_len) ? h : NULL;
+}
+static void select_active()
+{
+    active = NULL;
+    active_slot = -1;
+    for (int i = 0; i < DEVCAL_SLOT_COUNT; i++)
+    {
+        auto h = validate_slot(i);
+        if (h && (!active || static_cast<int32_t>(h->seq - active->seq) > 0))
+        {
+            active = h;
+            active_slot = i;
+        }
+    }
+}
+
+/// @brief See devcal::write. Caller holds write_mutex, so the active slot can't change (or be erased) under it.
+/// All section data is copied into RAM before the inactive slot is erased.
+static esp_err_t write_locked(const devcal::section_t* sections, size_t count)
+{
+    size_t payload_len = 0;
+    for (size_t i = 0; i < count; i++) payload_len += sizeof(section_header_t) + DEVCAL_ALIGN(sections[i].len);
+    if (payload_len > slot_size - sizeof(record_header_t)) return ESP_ERR_INVALID_SIZE;
+
+    uint8_t* buf = static_cast<uint8_t*>(calloc(1, sizeof(record_header_t) + payload_len));
+    if (!buf) return ESP_ERR_NO_MEM;
+    uint8_t* p = buf + sizeof(record_header_t);
+    for (size_t i = 0; i < count; i++)
+    {
+        section_header_t s = { .type = sections[i].type, .reserved = 0, .len = static_cast<uint32_t>(sections[i].len) };
+        memcpy(p, &s, sizeof(s));
+        memcpy(p + sizeof(s), sections[i].data, sections[i].len);
+        p += sizeof(s) + DEVCAL_ALIGN(sections[i].len);
+    }
+    auto h = reinterpret_cast<record_header_t*>(buf);
+    h->magic = DEVCAL_MAGIC;
+    h->version = DEVCAL_VERSION;
+    h->section_count = count;
+    h->seq = devcal::get_seq() + 1;
+    h->payload_len = payload_len;
+    h->payload_crc = crc32_le(0, buf + sizeof(record_header_t), payload_len);
+    h->header_crc = header_crc(h);
+
+    int slot = (active_slot + 1) % DEVCAL_SLOT_COUNT;
+    size_t base = slot * slot_size;
+    esp_err_t err = esp_partition_erase_range(partition, base, slot_size);
+    if (err == ESP_OK) err = esp_partition_write(partition, base + sizeof(record_header_t), buf + sizeof(record_header_t), payload_len);
+    if (err == ESP_OK) err = esp_partition_write(partition, base, buf, sizeof(record_header_t));
+    free(buf);
+    if (err == ESP_OK)
+    {
+        select_active();
+        if (active_slot != slot) err = ESP_ERR_INVALID_CRC; // Read-back verification failed
+    }
+    ESP_LOGI(TAG, "Record seq %" PRIu32 " -> slot %d: %s", devcal::get_seq(), slot, esp_err_to_name(err));
+    return err;
+}
+/// @brief See devcal::update_section, caller holds write_mutex
+static esp_err_t update_locked(uint16_t type, const void* data, size_t len)
+{
+    const record_header_t* h = active;
+    size_t n = h ? h->section_count : 0;
+    devcal::section_t* list = static_cast<devcal::section_t*>(calloc(n + 1, sizeof(devcal::section_t)));
+    if (!list) return ESP_ERR_NO_MEM;
+    size_t count = 0;
+    if (h)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(h + 1);
+        for (size_t i = 0; i < n; i++)
+        {
+            auto s = reinterpret_cast<const section_header_t*>(p);
+            if (s->type != type) list[count++] = { .type = s->type, .data = s + 1, .len = s->len };
+            p += sizeof(section_header_t) + DEVCAL_ALIGN(s->len);
+        }
+    }
+    if (data) list[count++] = { .type = type, .data = data, .len = len };
+    esp_err_t err = write_locked(list, count);
+    free(list);
+    return err;
+}
+
+namespace devcal
+{
+    /// @brief Find and map the partition, select the newest valid record
+    /// @return ESP_ERR_NOT_FOUND if there is no devcal partition, see also esp_partition_mmap
+    esp_err_t init()
+    {
+        static StaticSemaphore_t write_mutex_buffer;
+        if (!write_mutex) write_mutex = static_alloc::create_mutex("devcal", &write_mutex_buffer);
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, DEVCAL_PARTITION_SUBTYPE, DEVCAL_PARTITION_LABEL);
+        if (!partition)
+        {
+            ESP_LOGE(TAG, "Partition '%s' not found", DEVCAL_PARTITION_LABEL);
+            return ESP_ERR_NOT_FOUND;
+        }
+        slot_size = partition->size / DEVCAL_SLOT_COUNT;
+        if (slot_size % partition->erase_size) return ESP_ERR_INVALID_SIZE;
+        const void* ptr;
+        esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle);
+        if (err != ESP_OK) return err;
+        mapped = static_cast<const uint8_t*>(ptr);
+
+        select_active();
+        if (active) ESP_LOGI(TAG, "Slot %d active: v%u, seq %" PRIu32 ", %u sections", active_slot, active->version, active->seq,
+            active->section_count);
+        else ESP_LOGW(TAG, "No valid record");
+        return ESP_OK;
+    }
+    bool is_valid()
+    {
+        return active != NULL;
+    }
+    uint32_t get_seq()
+    {
+        return active ? active->seq : 0;
+    }
+    /// @brief Find a section of the active record. Zero-copy: the pointer refers to mapped flash and remains valid
+    /// until the next-but-one update (updates alternate between two slots).
+    /// @param type Section type
+    /// @param len Section length, bytes (output, may be NULL)
+    /// @return NULL if not found
+    const void* get_section(uint16_t type, size_t* len)
+    {
+        const record_header_t* h = active;
+        if (!h) return NULL;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(h + 1);
+        for (size_t i = 0; i < h->section_count; i++)
+        {
+            auto s = reinterpret_cast<const section_header_t*>(p);
+            if (s->type == type)
+            {
+                if (len) *len = s->len;
+                return s + 1;
+            }
+            p += sizeof(section_header_t) + DEVCAL_ALIGN(s->len);
+        }
+        return NULL;
+    }
+    /// @brief Write a new record (replaces all sections) into the inactive slot and make it active
+    /// @param sections Section list, data may point into the currently active record
+    /// @param count Number of sections
+    /// @return ESP_ERR_INVALID_SIZE if the sections don't fit into a slot, see also esp_partition_erase_range, esp_partition_write
+    esp_err_t write(const section_t* sections, size_t count)
+    {
+        if (!partition) return ESP_ERR_INVALID_STATE;
+        xSemaphoreTake(write_mutex, portMAX_DELAY);
+        esp_err_t err = write_locked(sections, count);
+        xSemaphoreGive(write_mutex);
+        return err;
+    }
+    /// @brief Replace (or add) one section, keeping the rest of the active record
+    /// @param type Section type
+    /// @param data Section contents, NULL removes the section
+    /// @param len Section length, bytes
+    /// @return See write
+    esp_err_t update_section(uint16_t type, const void* data, size_t len)
+    {
+        if (!partition) return ESP_ERR_INVALID_STATE;
+        // Held from reading the active record until the new one is written: a concurrent update would erase the slot
+        // the kept sections are copied from
+        xSemaphoreTake(write_mutex, portMAX_DELAY);
+        esp_err_t err = update_locked(type, data, len);
+        xSemaphoreGive(write_mutex);
+        return err;
+    }
+    /// @brief Read-modify-write of one section: fn builds the new contents from the current ones, with no other update in
+    /// between (concurrent field updates aren't lost)
+    /// @param type Section type
+    /// @param len New section length, bytes
+    /// @param fn Called once under the write lock: fills data (len bytes) from old (NULL if there is no such section)
+    /// @param arg Passed to fn
+    /// @return ESP_ERR_NO_MEM, see also write
+    esp_err_t modify_section(uint16_t type, size_t len, modifier_t fn, void* arg)
+    {
+        if (!partition) return ESP_ERR_INVALID_STATE;
+        void* data = malloc(len);
+        if (!data) return ESP_ERR_NO_MEM;
+        xSemaphoreTake(write_mutex, portMAX_DELAY);
+        size_t old_len = 0;
+        const void* old = get_section(type, &old_len);
+        fn(data, old, old ? old_len : 0, arg);
+        esp_err_t err = update_locked(type, data, len);
+        xSemaphoreGive(write_mutex);
+        free(data);
+        return err;
+    }
+    /// @brief Erase both slots (factory state)
+    /// @return See esp_partition_erase_range
+    esp_err_t erase()
+    {
+        if (!partition) return ESP_ERR_INVALID_STATE;
+        xSemaphoreTake(write_mutex, portMAX_DELAY);
+        esp_err_t err = esp_partition_erase_range(partition, 0, slot_size * DEVCAL_SLOT_COUNT);
+        select_active();
+        xSemaphoreGive(write_mutex);
+        return err;
+    }
+} // namespace devcal
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/// @brief Raw "devcal" data partition: one CRC-protected, versioned record made of typed sections (device info, calibration tables).
+/// Two slots are used alternately, so that a power loss during an update never leaves the partition without a valid record.
+/// The partition is memory-mapped, section getters return pointers straight into flash.
+namespace devcal
+{
+    enum section_types : uint16_t
+    {
+        SECTION_DEV_INFO = 1,
+        SECTION_CAL_VPWR = 2,
+        SECTION_CAL_VLIM = 3
+    };
+
+    struct section_t
+    {
+        uint16_t type;
+        const void* data;
+        size_t len;
+    };
+    /// @brief See modify_section
+    typedef void (*modifier_t)(void* data, const void* old, size_t old_len, void* arg);
+
+    esp_err_t init();
+    bool is_valid();
+    uint32_t get_seq();
+
+    const void* get_section(uint16_t type, size_t* len);
+    esp_err_t write(const section_t* sections, size_t count);
+    esp_err_t update_section(uint16_t type, const void* data, size_t len);
+    esp_err_t modify_section(uint16_t type, size_t len, modifier_t fn, void* arg);
+    esp_err_t erase();
+} // namespace devcal
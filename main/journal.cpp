@@ -0,0 +1,444 @@
+/**
+ * @file journal.cpp
+ * @author MSU
+ * @brief Control event journal. journal::record() only stamps the event into a RAM ring (lock-free, same scheme as the perf
+ * trace: reserve a slot with an atomic increment, publish it with its position), so recording from the control loop or
+ * from inside my_dac never waits for flash. A low-priority task numbers the records and appends them to the "journal"
+ * partition in batches, every CONFIG_JOURNAL_FLUSH_PERIOD_MS or as soon as the ring is half full. The same task serves
+ * the Modbus export window (journal_read_seq -> journal_window), so the control loop never waits for the journal.
+ * The partition is a circular log of 16-byte records: the sector ahead of the write position is erased when the log
+ * reaches it, dropping the oldest records. The newest record is found at boot by the sequence numbers.
+ * @date 2026-10-16
+ *
+ */
+
+#include "journal.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "rom/crc.h"
+#include "sdkconfig.h"
+
+#include "macros.h"
+#include "static_alloc.h"
+#include "modbus.h"
+#include "modbus_params.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define JOURNAL_PARTITION_LABEL "journal"
+#define JOURNAL_PARTITION_SUBTYPE static_cast<esp_partition_subtype_t>(0x41)
+#define JOURNAL_TASK_STACK_SIZE 3072
+#define JOURNAL_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+/** Modbus export: journal_read_seq polling period */
+#define JOURNAL_EXPORT_POLL_MS 100
+/** Records written by one esp_partition_write() at most */
+#define JOURNAL_BATCH_RECORDS 32
+/** The shutdown handler gives up on the flush if another flush holds the mutex this long: esp_restart must not hang */
+#define JOURNAL_SHUTDOWN_FLUSH_TIMEOUT_MS 500
+#define JOURNAL_ERASED_SEQ UINT32_MAX
+
+static_assert(sizeof(journal::record_t) == 16, "Flash record layout");
+static_assert((journal::EV_COUNT <= 32) && (journal::SRC_COUNT <= 8), "Event and source must fit into record_t::type");
+static_assert((CONFIG_JOURNAL_RAM_RECORDS & (CONFIG_JOURNAL_RAM_RECORDS - 1)) == 0, "Journal RAM ring length must be a power of 2");
+
+/// @brief RAM ring entry. pos is the 1-based position of the record, 0 while the entry is being written.
+struct entry_t
+{
+    uint32_t pos;
+    uint8_t event;
+    uint8_t source;
+    uint32_t value; ///< float bits, or an integer (see journal::is_int_event)
+    int64_t t_us;
+};
+
+static const char TAG[] = "JOURNAL";
+static const char* const event_names[] = { "boot", "output", "remote", "pwr_setpoint", "vlim_setpoint", "vpwr_dac", "vlim_dac",
+    "override_errors", "cal_start", "cal_abort", "ramp_start", "ramp_end", "sentinel_clamp", "sentinel_release",
+    "time_sync", "safe_hold", "ota_begin", "ota_end", "ota_confirm" };
+static const char* const source_names[] = { "console", "modbus", "button", "knob", "internal", "ota" };
+static_assert(ARRAY_SIZE(event_names) == journal::EV_COUNT);
+static_assert(ARRAY_SIZE(source_names) == journal::SRC_COUNT);
+
+static entry_t ring[CONFIG_JOURNAL_RAM_RECORDS];
+static uint32_t ring_head = 0; ///< Positions reserved
+static uint32_t ring_flushed = 0; ///< Positions taken by the flusher (flushed or dropped)
+static TaskHandle_t flush_task_handle = NULL;
+static SemaphoreHandle_t flush_mutex = NULL; ///< Guards everything below
+
+static const esp_partition_t* partition = NULL;
+static const journal::record_t* mapped = NULL;
+static esp_partition_mmap_handle_t mmap_handle;
+static size_t per_sector = 0;
+static size_t capacity = 0;
+static size_t write_index = 0; ///< Next record written goes there
+static uint32_t next_seq = 1;
+static uint32_t tail_seq = 0; ///< Oldest record kept, 0 == empty
+static journal::record_t batch[JOURNAL_BATCH_RECORDS];
+static journal::stats_t stats = {};
+
+static uint8_t record_check(const journal::record_t* r)
+{
+    journal::record_t tmp = *r;
+    tmp.check = 0;
+    return static_cast<uint8_t>(crc32_le(0, reinterpret_cast<const uint8_t*>(&tmp), sizeof(tmp)));
+}
+static bool is_valid(const journal::record_t* r)
+{
+    return (r->seq != JOURNAL_ERASED_SEQ) && (r->check == record_check(r));
+}
+static bool is_erased(const journal::record_t* r)
+{
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(r);
+    for (size_t i = 0; i < sizeof(*r); i++)
+    {
+        if (b[i] != 0xFF) return false;
+    }
+    return true;
+}
+/// @brief Oldest record: first one of the sector after the write position (once the log has wrapped), else the first one
+static void find_tail()
+{
+    size_t next_sector = ((write_index / per_sector + 1) * per_sector) % capacity;
+    if (is_valid(&(mapped[next_sector]))) tail_seq = mapped[next_sector].seq;
+    else tail_seq = is_valid(&(mapped[0])) ? mapped[0].seq : 0;
+}
+/// @brief Find the write position: the newest sector is the one starting with the highest sequence number
+static void scan()
+{
+    size_t sectors = capacity / per_sector;
+    int newest = -1;
+    for (size_t s = 0; s < sectors; s++)
+    {
+        const journal::record_t* r = &(mapped[s * per_sector]);
+        if (is_valid(r) && ((newest < 0) || (static_cast<int32_t>(r->seq - mapped[newest * per_sector].seq) > 0))) newest = s;
+    }
+    if (newest < 0)
+    {
+        write_index = 0;
+        next_seq = 1;
+        tail_seq = 0;
+        return;
+    }
+    size_t base = newest * per_sector;
+    size_t last = base;
+    size_t i = 0;
+    for (; i < per_sector; i++)
+    {
+        const journal::record_t* r = &(mapped[base + i]);
+        if (is_erased(r)) break;
+        if (is_valid(r)) last = base + i;
+    }
+    // Torn records keep their position: sequence numbers stay in step with record positions
+    next_seq = mapped[last].seq + (base + i - last);
+    write_index = (base + i) % capacity;
+    find_tail();
+}
+/// @brief Append records at the write position, erasing sectors ahead of it as needed. On failure the sequence numbers of the
+/// records not written are given back, so that they stay in step with record positions (read() relies on it).
+static esp_err_t write_records(const journal::record_t* r, size_t n)
+{
+    while (n)
+    {
+        esp_err_t err = ESP_OK;
+        if ((write_index % per_sector) == 0)
+        {
+            err = esp_partition_erase_range(partition, write_index * sizeof(journal::record_t), per_sector * sizeof(journal::record_t));
+            if (err == ESP_OK) find_tail();
+        }
+        size_t k = MIN(n, per_sector - (write_index % per_sector));
+        if (err == ESP_OK) err = esp_partition_write(partition, write_index * sizeof(journal::record_t), r, k * sizeof(journal::record_t));
+        if (err != ESP_OK)
+        {
+            next_seq = r->seq;
+            return err;
+        }
+        if (!tail_seq) tail_seq = r->seq;
+        write_index = (write_index + k) % capacity;
+        r += k;
+        n -= k;
+    }
+    return ESP_OK;
+}
+/// @brief Move the published RAM records into batch[], numbering them
+/// @return Records taken, 0 if none is ready
+static size_t take_batch()
+{
+    size_t n = 0;
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    while ((n < JOURNAL_BATCH_RECORDS) && (ring_flushed != head))
+    {
+        uint32_t pos = ring_flushed + 1;
+        const entry_t* e = &(ring[(pos - 1) & (CONFIG_JOURNAL_RAM_RECORDS - 1)]);
+        uint32_t p = __atomic_load_n(&(e->pos), __ATOMIC_ACQUIRE);
+        if (static_cast<int32_t>(p - pos) > 0)
+        {
+            stats.dropped++; // Lapped by the writers
+            __atomic_store_n(&ring_flushed, pos, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (p != pos) break; // Still being written
+        entry_t copy = *e;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(e->pos), __ATOMIC_RELAXED) != pos) continue; // Overwritten meanwhile, counted as dropped next time
+
+        journal::record_t* r = &(batch[n++]);
+        uint64_t t = static_cast<uint64_t>(copy.t_us);
+        r->seq = next_seq++;
+        r->t_lo = static_cast<uint32_t>(t);
+        r->t_hi = static_cast<uint16_t>(t >> 32);
+        r->type = copy.event | (copy.source << 5);
+        memcpy(&(r->value), &(copy.value), sizeof(r->value));
+        r->check = record_check(r);
+        __atomic_store_n(&ring_flushed, pos, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+/// @brief Publish the records the Modbus master asks for, if the request or the journal has changed
+static void export_window()
+{
+    static uint32_t exported_from = 0, exported_head = 0;
+    uint32_t from = modbus::get_journal_read_seq();
+    uint32_t head = journal::get_stats().head_seq;
+    if ((from == exported_from) && (head == exported_head)) return;
+    journal::record_t window[MB_JOURNAL_WINDOW_RECORDS];
+    size_t n = journal::read(from, window, MB_JOURNAL_WINDOW_RECORDS);
+    modbus::set_journal_window(head, window, n);
+    exported_from = from;
+    exported_head = head;
+}
+static void flush_task(void* arg)
+{
+    TickType_t last_flush = xTaskGetTickCount();
+    while (true)
+    {
+        bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(JOURNAL_EXPORT_POLL_MS)) > 0;
+        if (woken || (xTaskGetTickCount() - last_flush >= pdMS_TO_TICKS(CONFIG_JOURNAL_FLUSH_PERIOD_MS)))
+        {
+            last_flush = xTaskGetTickCount();
+            ESP_ERROR_CHECK_WITHOUT_ABORT(journal::flush());
+        }
+        export_window();
+    }
+}
+/// @brief Stamp an entry into the RAM ring, see journal::record()
+static void push(journal::events ev, journal::sources src, uint32_t value, int64_t t_us)
+{
+    uint32_t pos = __atomic_add_fetch(&ring_head, 1, __ATOMIC_RELAXED);
+    entry_t* e = &(ring[(pos - 1) & (CONFIG_JOURNAL_RAM_RECORDS - 1)]);
+    __atomic_store_n(&(e->pos), 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->event = ev;
+    e->source = src;
+    e->value = value;
+    e->t_us = t_us;
+    __atomic_store_n(&(e->pos), pos, __ATOMIC_RELEASE);
+    if (flush_task_handle && (pos - __atomic_load_n(&ring_flushed, __ATOMIC_RELAXED) >= CONFIG_JOURNAL_RAM_RECORDS / 2))
+    {
+        xTaskNotifyGive(flush_task_handle);
+    }
+}
+/// @brief Write the records queued in RAM to flash
+/// @param wait Longest wait for another flush (or reader) to finish
+/// @return ESP_ERR_TIMEOUT if the wait ran out (nothing written), see also esp_partition_erase_range, esp_partition_write
+static esp_err_t flush_records(TickType_t wait)
+{
+    if (!flush_mutex || !partition) return ESP_ERR_INVALID_STATE;
+    if (xSemaphoreTake(flush_mutex, wait) != pdTRUE) return ESP_ERR_TIMEOUT;
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+    size_t written = 0;
+    for (size_t n; (err == ESP_OK) && (n = take_batch()); written += n)
+    {
+        err = write_records(batch, n);
+        if (err != ESP_OK) ESP_LOGE(TAG, "Write at record %zu failed, %zu records lost: %s", write_index, n, esp_err_to_name(err));
+    }
+    if (written)
+    {
+        uint32_t took = static_cast<uint32_t>(esp_timer_get_time() - start);
+        stats.flushes++;
+        if (took > stats.flush_max_us) stats.flush_max_us = took;
+    }
+    xSemaphoreGive(flush_mutex);
+    return err;
+}
+/// @brief Shutdown handler (esp_restart, panic is not covered). Skipped if a flush or a reader holds the mutex for too long.
+static void shutdown_flush()
+{
+    flush_records(pdMS_TO_TICKS(JOURNAL_SHUTDOWN_FLUSH_TIMEOUT_MS));
+}
+
+namespace journal
+{
+    /// @brief Find and map the partition, locate the end of the log and start the flush task.
+    /// Records made before init() are kept in RAM and written by the first flush.
+    /// @return ESP_ERR_NOT_FOUND if there is no journal partition, see also esp_partition_mmap
+    esp_err_t init()
+    {
+        static StaticSemaphore_t flush_mutex_buffer;
+        flush_mutex = static_alloc::create_mutex("journal", &flush_mutex_buffer);
+        static_alloc::add_buffer("journal_ring", sizeof(ring) + sizeof(batch));
+        record(EV_BOOT, SRC_INTERNAL, esp_reset_reason());
+
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE, JOURNAL_PARTITION_LABEL);
+        if (!partition)
+        {
+            ESP_LOGE(TAG, "Partition '%s' not found", JOURNAL_PARTITION_LABEL);
+            return ESP_ERR_NOT_FOUND;
+        }
+        if ((partition->erase_size % sizeof(record_t)) || (partition->size % partition->erase_size)) return ESP_ERR_INVALID_SIZE;
+        const void* ptr;
+        esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle);
+        if (err != ESP_OK) return err;
+        mapped = static_cast<const record_t*>(ptr);
+        per_sector = partition->erase_size / sizeof(record_t);
+        capacity = partition->size / sizeof(record_t);
+        scan();
+        ESP_LOGI(TAG, "%zu records, next seq %" PRIu32 ", oldest %" PRIu32, capacity, next_seq, tail_seq);
+
+        static StackType_t flush_task_stack[JOURNAL_TASK_STACK_SIZE];
+        static StaticTask_t flush_task_tcb;
+        flush_task_handle = static_alloc::create_task(flush_task, "journal_flush", sizeof(flush_task_stack), NULL, JOURNAL_TASK_PRIORITY,
+            flush_task_stack, &flush_task_tcb);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_register_shutdown_handler(shutdown_flush));
+        return ESP_OK;
+    }
+    /// @brief Record an event. Lock-free and doesn't touch flash: safe in the DAC write path. Not from ISRs.
+    /// @param ev Event
+    /// @param src Who caused it
+    /// @param value See events
+    void record(events ev, sources src, float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        push(ev, src, bits, esp_timer_get_time());
+    }
+    /// @brief Record an event whose value is an integer (see is_int_event), same rules as record(). Integers above 2^24 (sizes,
+    /// error codes) would lose precision as a float.
+    void record_int(events ev, sources src, uint32_t value)
+    {
+        push(ev, src, value, esp_timer_get_time());
+    }
+    /// @brief Record a device/master clock anchor (EV_TIME_SYNC), same rules as record()
+    /// @param master_s Whole second of the master clock, Unix epoch
+    /// @param t_us esp_timer time the master clock read master_s at
+    void record_time_sync(uint32_t master_s, int64_t t_us)
+    {
+        push(EV_TIME_SYNC, SRC_MODBUS, master_s, t_us);
+    }
+    /// @brief Write the records queued in RAM to flash now
+    /// @return ESP_ERR_INVALID_STATE before init() or without a partition, see also esp_partition_erase_range, esp_partition_write
+    esp_err_t flush()
+    {
+        return flush_records(portMAX_DELAY);
+    }
+    /// @brief Read flushed records, oldest first
+    /// @param from_seq First sequence number wanted, older than the oldest kept means from the oldest
+    /// @param out Records (output)
+    /// @param max Capacity of out
+    /// @return Records read, torn records are skipped
+    size_t read(uint32_t from_seq, record_t* out, size_t max)
+    {
+        if (!flush_mutex || !partition) return 0;
+        xSemaphoreTake(flush_mutex, portMAX_DELAY);
+        size_t n = 0;
+        uint32_t head_seq = next_seq - 1;
+        if (tail_seq && (static_cast<int32_t>(from_seq - tail_seq) < 0)) from_seq = tail_seq;
+        if (tail_seq && (static_cast<int32_t>(head_seq - from_seq) >= 0))
+        {
+            size_t back = head_seq - from_seq + 1;
+            size_t i = (write_index + capacity - back) % capacity;
+            for (uint32_t seq = from_seq; (n < max) && (static_cast<int32_t>(head_seq - seq) >= 0); seq++, i = (i + 1) % capacity)
+            {
+                if (is_valid(&(mapped[i])) && (mapped[i].seq == seq)) out[n++] = mapped[i];
+            }
+        }
+        xSemaphoreGive(flush_mutex);
+        return n;
+    }
+    stats_t get_stats()
+    {
+        stats_t ret = {};
+        if (flush_mutex) xSemaphoreTake(flush_mutex, portMAX_DELAY);
+        ret = stats;
+        ret.recorded = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+        ret.head_seq = tail_seq ? next_seq - 1 : 0;
+        ret.tail_seq = tail_seq;
+        ret.capacity = capacity;
+        if (flush_mutex) xSemaphoreGive(flush_mutex);
+        return ret;
+    }
+    /// @return us since the boot the record was made in
+    int64_t get_time_us(const record_t* r)
+    {
+        return static_cast<int64_t>((static_cast<uint64_t>(r->t_hi) << 32) | r->t_lo);
+    }
+    events get_event(const record_t* r)
+    {
+        return static_cast<events>(r->type & 0x1F);
+    }
+    sources get_source(const record_t* r)
+    {
+        return static_cast<sources>(r->type >> 5);
+    }
+    /// @brief Raw value, for events that store an integer (see is_int_event)
+    uint32_t get_value_bits(const record_t* r)
+    {
+        uint32_t ret;
+        memcpy(&ret, &(r->value), sizeof(ret));
+        return ret;
+    }
+    /// @brief Events whose value holds integer bits instead of a float
+    bool is_int_event(events ev)
+    {
+        return (ev == EV_TIME_SYNC) || (ev == EV_OTA_BEGIN) || (ev == EV_OTA_END);
+    }
+    const char* get_event_name(events ev)
+    {
+        return (ev < EV_COUNT) ? event_names[ev] : "?";
+    }
+    const char* get_source_name(sources src)
+    {
+        return (src < SRC_COUNT) ? source_names[src] : "?";
+    }
+    /// @brief Flush, then print the newest records, oldest first. Times restart from 0 after every boot record.
+    /// @param max Records
+    void print(size_t max)
+    {
+        esp_err_t err = flush();
+        if (err != ESP_OK) printf("Flush failed: %s\n", esp_err_to_name(err));
+        stats_t st = get_stats();
+        if (!st.head_seq)
+        {
+            printf("Journal is empty\n");
+            return;
+        }
+        uint32_t from = ((st.head_seq - st.tail_seq + 1) > max) ? st.head_seq - max + 1 : st.tail_seq;
+        printf("%10s %14s %-16s %-8s %s\n", "seq", "t, s", "event", "source", "value");
+        record_t chunk[8];
+        size_t n;
+        while ((n = read(from, chunk, ARRAY_SIZE(chunk))) > 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                const record_t* r = &(chunk[i]);
+                printf("%10" PRIu32 " %14.6f %-16s %-8s ", r->seq, get_time_us(r) / 1e6, get_event_name(get_event(r)),
+                    get_source_name(get_source(r)));
+                uint32_t bits = get_value_bits(r);
+                if (get_event(r) == EV_OTA_END) printf("%s\n", esp_err_to_name(static_cast<esp_err_t>(static_cast<int32_t>(bits))));
+                else if (is_int_event(get_event(r))) printf("%" PRIu32 "\n", bits);
+                else printf("%g\n", r->value);
+            }
+            from = chunk[n - 1].seq + 1;
+        }
+        printf("Records: %" PRIu32 "..%" PRIu32 " of %zu kept, %" PRIu32 " dropped in RAM since boot\n", st.tail_seq, st.head_seq,
+            st.capacity, st.dropped);
+    }
+} // namespace journal
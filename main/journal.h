@@ -0,0 +1,83 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/// @brief Append-only audit journal of output changes: what changed, when (esp_timer, us since boot) and who asked for it.
+/// Records are queued in RAM without locking and written to the "journal" flash partition in batches by a background task.
+namespace journal
+{
+    enum events : uint8_t
+    {
+        EV_BOOT, ///< Journal started, value: esp_reset_reason()
+        EV_OUTPUT, ///< Output enabled (1) or disabled (0)
+        EV_REMOTE, ///< Modbus remote mode entered (1) or left (0)
+        EV_PWR_SETPOINT, ///< Power setpoint, W (changes are coalesced, see CONFIG_JOURNAL_SETPOINT_INTERVAL_MS)
+        EV_VLIM_SETPOINT, ///< Voltage limit setpoint, V
+        EV_VPWR_DAC, ///< Raw Vpwr DAC output, V
+        EV_VLIM_DAC, ///< Raw Vlim DAC output, V
+        EV_OVERRIDE_ERRORS, ///< Init errors overridden, value: 0
+        EV_CAL_START, ///< Calibration capture or sweep started, value: DAC channel
+        EV_CAL_ABORT, ///< Calibration aborted, value: 0
+        EV_RAMP_START, ///< Soft heat-up/cool-down started, value: target Vpwr, V
+        EV_RAMP_END, ///< Ramp finished, value: Vpwr, V
+        EV_SENTINEL_CLAMP, ///< set_vpwr request above the soft sentinel, value: requested Vpwr, V
+        EV_SENTINEL_RELEASE, ///< Vpwr back below the sentinel, value: Vpwr, V
+        EV_TIME_SYNC, ///< The master clock read a whole second at this record's timestamp, value: that second (Unix epoch) as uint32_t bits
+        EV_SAFE_HOLD, ///< Output held off for a firmware update (1) or released (0)
+        EV_OTA_BEGIN, ///< Firmware update started, value: image size, bytes, as uint32_t bits
+        EV_OTA_END, ///< Firmware update finished, value: esp_err_t as int32_t bits (0: new image set to boot)
+        EV_OTA_CONFIRM, ///< First boot of a new image: health check passed (1) or failed, rolling back (0)
+
+        EV_COUNT
+    };
+    /// @brief Who caused the change. The first values match cmd_bus::sources (SRC_OTA is mapped by the control loop).
+    enum sources : uint8_t
+    {
+        SRC_CONSOLE,
+        SRC_MODBUS,
+        SRC_BUTTON,
+        SRC_KNOB,
+        SRC_INTERNAL, ///< The firmware itself: boot, DAC ramps and limits
+        SRC_OTA, ///< Firmware update receiver
+
+        SRC_COUNT
+    };
+    /// @brief Flash record, 16 bytes. Erased flash (seq 0xFFFFFFFF) ends the written area.
+    struct record_t
+    {
+        uint32_t seq; ///< Incremented by every record, survives reboots
+        uint32_t t_lo; ///< esp_timer_get_time(), us since boot: low 32 bits
+        uint16_t t_hi; ///< High 16 bits (48 bits: 8.9 years)
+        uint8_t type; ///< Event (low 5 bits) | source << 5
+        uint8_t check; ///< Low byte of the CRC-32 of the other fields, detects records torn by a power loss
+        float value;
+    };
+    struct stats_t
+    {
+        uint32_t recorded; ///< Since boot
+        uint32_t dropped; ///< Overwritten in RAM before they could be flushed
+        uint32_t flushes;
+        uint32_t flush_max_us;
+        uint32_t head_seq; ///< Newest record in flash, 0 == empty
+        uint32_t tail_seq; ///< Oldest record in flash
+        size_t capacity; ///< Records the partition holds
+    };
+
+    esp_err_t init();
+    void record(events ev, sources src, float value);
+    void record_int(events ev, sources src, uint32_t value);
+    void record_time_sync(uint32_t master_s, int64_t t_us);
+    esp_err_t flush();
+    size_t read(uint32_t from_seq, record_t* out, size_t max);
+    stats_t get_stats();
+    int64_t get_time_us(const record_t* r);
+    events get_event(const record_t* r);
+    sources get_source(const record_t* r);
+    uint32_t get_value_bits(const record_t* r);
+    bool is_int_event(events ev);
+    const char* get_event_name(events ev);
+    const char* get_source_name(sources src);
+    void print(size_t max);
+} // namespace journal
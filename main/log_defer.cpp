@@ -0,0 +1,768 @@
+/**
+ * @file log_defer.cpp
+ * @author MSU
+ * @brief Deferred logging: the ESP_LOG vprintf hook only captures the format pointer and the raw arguments into a per-core
+ * ring, rendering and console output happen later in a low-priority drain task. A log statement on the control path thus
+ * costs a format scan and a short copy instead of a blocking UART/TCP write.
+ * Each core has its own single-producer ring: a record is built on the caller's stack, then copied in with interrupts
+ * masked on that core only, so there is no lock shared between cores. Records carry a global sequence number, the drain
+ * task merges both rings in capture order. String arguments are copied (the caller's buffer may be gone by then).
+ * Formats that don't live in flash are formatted in the caller's context instead. Records that don't fit are dropped,
+ * counted and reported in the output.
+ * log_route decides which sinks (if any) want a record before it is captured.
+ * In binary format the records aren't rendered at all: the drain task sends the format address and the arguments
+ * (varint-encoded) in COBS frames, and tools/log_decode.py rebuilds the text from the firmware ELF on the host.
+ * @date 2026-10-16
+ *
+ */
+
+#include "log_defer.h"
+
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp_system.h"
+#include "esp_app_desc.h"
+#include "rom/crc.h"
+#include "sdkconfig.h"
+
+#include "static_alloc.h"
+#include "log_route.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define LOG_DEFER_TASK_STACK_SIZE 4096
+#define LOG_DEFER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define LOG_DEFER_RING_MASK (CONFIG_LOG_DEFER_RING_SIZE - 1u)
+#define LOG_DEFER_ALIGN(x) (((x) + 3u) & ~3u)
+#define LOG_DEFER_MAX_SPEC 16
+#define LOG_DEFER_FLUSH_TIMEOUT_MS 500
+
+/** String argument length marker: the string is in flash, its pointer follows instead of the characters */
+#define STR_IN_FLASH UINT8_MAX
+#define RECORD_FLAG_TEXT (1u << 0) ///< Payload is the formatted text (format outside flash)
+#define RECORD_FLAG_TRUNCATED (1u << 1) ///< Arguments after the captured ones didn't fit
+#define RECORD_SINKS_SHIFT 4 ///< Flags bits 4..7: log_route sink mask
+
+/** Binary frame types, see tools/log_decode.py */
+#define FRAME_SYNC 'S' ///< version, sizeof(int, long, long long, size_t, intmax_t, ptrdiff_t, void*), ELF SHA-256 prefix (hex)
+#define FRAME_RECORD 'R' ///< flags, conversions, seq (u16, counts the records sent to this sink), format address, arguments
+#define FRAME_TEXT 'T' ///< seq (u16, as above), text (record formatted in the caller's context)
+#define FRAME_DROPS 'D' ///< core, records dropped (varint)
+#define FRAME_VERSION 1
+#define FRAME_ELF_SHA_LEN 16
+/** A decoder that attaches mid-stream learns the layout within this many frames */
+#define FRAME_SYNC_INTERVAL 256
+/** Varints expand 4- and 8-byte integers by 1/4 at most */
+#define FRAME_MAX_RAW (LOG_DEFER_LINE_LEN + 16)
+
+static_assert((CONFIG_LOG_DEFER_RING_SIZE & LOG_DEFER_RING_MASK) == 0, "Ring size must be a power of 2");
+static_assert(LOG_DEFER_MAX_RECORD % 4 == 0 && LOG_DEFER_MAX_RECORD <= UINT16_MAX);
+static_assert(CONFIG_LOG_DEFER_MAX_STRING_LEN < STR_IN_FLASH);
+static_assert(LOG_DEFER_MAX_RECORD * 5 / 4 <= LOG_DEFER_LINE_LEN);
+static_assert(log_route::SINK_COUNT <= 8 - RECORD_SINKS_SHIFT);
+
+static const char TAG[] = "LOG_DEFER";
+
+/// @brief How a conversion's argument is passed (and stored in the record)
+enum arg_classes : uint8_t
+{
+    ARG_NONE, ///< %%
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_PTR,
+    ARG_STR, ///< Stored as uint8_t length + characters, or STR_IN_FLASH + pointer
+    ARG_COUNT, ///< %n, consumed, nothing stored or printed
+    ARG_INVALID ///< Unsupported, capture stops here
+};
+
+struct spec_t
+{
+    size_t len; ///< Characters from '%' to the conversion, inclusive
+    uint8_t stars; ///< '*' width/precision arguments (int) that precede the value
+    arg_classes cls;
+};
+
+/// @brief Record header, followed by the arguments in format order. size == 0 marks the unused end of the ring.
+struct record_hdr_t
+{
+    uint16_t size; ///< Bytes including the header, multiple of 4
+    uint8_t flags;
+    uint8_t args; ///< Conversions captured
+    uint32_t seq;
+    const char* fmt;
+};
+
+struct ring_t
+{
+    uint8_t buf[CONFIG_LOG_DEFER_RING_SIZE];
+    uint32_t head; ///< Bytes written (owning core, interrupts masked)
+    uint32_t tail; ///< Bytes consumed (drain task)
+    uint32_t dropped;
+    uint32_t peak;
+};
+
+static ring_t rings[portNUM_PROCESSORS];
+static uint32_t reported_drops[portNUM_PROCESSORS] = {};
+static uint32_t next_seq = 0;
+static log_defer::stats_t stats = {};
+static log_defer::sink_t sink = NULL;
+static SemaphoreHandle_t drain_mutex = NULL;
+static char line[LOG_DEFER_LINE_LEN]; ///< Drain task only (under drain_mutex)
+#if CONFIG_LOG_DEFER_BINARY
+static log_defer::formats format = log_defer::FORMAT_BINARY;
+#else
+static log_defer::formats format = log_defer::FORMAT_TEXT;
+#endif
+static bool sync_pending = true; ///< Sent before the first binary frame
+static uint32_t frames_since_sync = 0;
+static uint8_t frame_raw[FRAME_MAX_RAW];
+static uint8_t frame_cobs[FRAME_MAX_RAW + FRAME_MAX_RAW / 254 + 3];
+static size_t frame_len = 0;
+static size_t frame_seq_pos = 0; ///< 0: the frame has no sequence number
+static uint16_t frame_seq[log_route::SINK_COUNT];
+static bool frame_overflow = false;
+
+static void frame_put(const void* p, size_t n);
+
+static bool is_digit(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+/// @brief Parse a printf conversion specification
+/// @param p Points at '%'
+static spec_t parse_spec(const char* p)
+{
+    spec_t s = { .len = 1, .stars = 0, .cls = ARG_INVALID };
+    const char* q = p + 1;
+    if (*q == '%')
+    {
+        s.len = 2;
+        s.cls = ARG_NONE;
+        return s;
+    }
+    while (*q && strchr("-+ #0", *q)) q++;
+    if (*q == '*')
+    {
+        s.stars++;
+        q++;
+    }
+    else while (is_digit(*q)) q++;
+    if (*q == '.')
+    {
+        q++;
+        if (*q == '*')
+        {
+            s.stars++;
+            q++;
+        }
+        else while (is_digit(*q)) q++;
+    }
+    char length = 0; // 'H' == hh, 'q' == ll
+    if ((q[0] == 'h') && (q[1] == 'h'))
+    {
+        length = 'H';
+        q += 2;
+    }
+    else if ((q[0] == 'l') && (q[1] == 'l'))
+    {
+        length = 'q';
+        q += 2;
+    }
+    else if (*q && strchr("hlLzjt", *q))
+    {
+        length = *(q++);
+    }
+    if (!*q)
+    {
+        s.len = q - p;
+        return s;
+    }
+    s.len = q - p + 1;
+    if (s.len >= LOG_DEFER_MAX_SPEC) return s;
+    switch (*q)
+    {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+        switch (length)
+        {
+        case 'l': s.cls = (*q == 'c') ? ARG_INT : ARG_LONG; break;
+        case 'q': case 'L': s.cls = ARG_LLONG; break;
+        case 'z': s.cls = ARG_SIZE; break;
+        case 'j': s.cls = ARG_INTMAX; break;
+        case 't': s.cls = ARG_PTRDIFF; break;
+        default: s.cls = ARG_INT; break;
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        s.cls = (length == 'L') ? ARG_LDOUBLE : ARG_DOUBLE;
+        break;
+    case 's':
+        if (length != 'l') s.cls = ARG_STR;
+        break;
+    case 'p':
+        s.cls = ARG_PTR;
+        break;
+    case 'n':
+        s.cls = ARG_COUNT;
+        break;
+    default:
+        break;
+    }
+    return s;
+}
+
+template<typename T> static bool put(uint8_t* rec, size_t* off, T v)
+{
+    if (*off + sizeof(T) > LOG_DEFER_MAX_RECORD) return false;
+    memcpy(rec + *off, &v, sizeof(T));
+    *off += sizeof(T);
+    return true;
+}
+template<typename T> static T get(const uint8_t* rec, size_t* off)
+{
+    T v;
+    memcpy(&v, rec + *off, sizeof(T));
+    *off += sizeof(T);
+    return v;
+}
+/// @brief Copy the arguments of every conversion in fmt into the record
+/// @param count Conversions captured
+/// @return False if the record is full or a conversion isn't supported (count tells how far capture got)
+static bool capture_args(const char* fmt, va_list args, uint8_t* rec, size_t* off, uint8_t* count)
+{
+    for (const char* p = fmt; *p; p++)
+    {
+        if (*p != '%') continue;
+        spec_t s = parse_spec(p);
+        p += s.len - 1;
+        if (s.cls == ARG_NONE) continue;
+        if ((s.cls == ARG_INVALID) || (*count == UINT8_MAX)) return false;
+        bool ok = true;
+        for (uint8_t i = 0; (i < s.stars) && ok; i++) ok = put(rec, off, va_arg(args, int));
+        switch (s.cls)
+        {
+        case ARG_INT: ok = ok && put(rec, off, va_arg(args, int)); break;
+        case ARG_LONG: ok = ok && put(rec, off, va_arg(args, long)); break;
+        case ARG_LLONG: ok = ok && put(rec, off, va_arg(args, long long)); break;
+        case ARG_SIZE: ok = ok && put(rec, off, va_arg(args, size_t)); break;
+        case ARG_INTMAX: ok = ok && put(rec, off, va_arg(args, intmax_t)); break;
+        case ARG_PTRDIFF: ok = ok && put(rec, off, va_arg(args, ptrdiff_t)); break;
+        case ARG_DOUBLE: ok = ok && put(rec, off, va_arg(args, double)); break;
+        case ARG_LDOUBLE: ok = ok && put(rec, off, va_arg(args, long double)); break;
+        case ARG_PTR: ok = ok && put(rec, off, va_arg(args, void*)); break;
+        case ARG_STR:
+        {
+            const char* str = va_arg(args, const char*);
+            if (!str) str = "(null)";
+            if (esp_ptr_in_drom(str))
+            {
+                ok = ok && put(rec, off, static_cast<uint8_t>(STR_IN_FLASH)) && put(rec, off, str);
+                break;
+            }
+            size_t n = strnlen(str, CONFIG_LOG_DEFER_MAX_STRING_LEN);
+            ok = ok && put(rec, off, static_cast<uint8_t>(n)) && (*off + n <= LOG_DEFER_MAX_RECORD);
+            if (ok)
+            {
+                memcpy(rec + *off, str, n);
+                *off += n;
+            }
+            break;
+        }
+        case ARG_COUNT: (void)va_arg(args, int*); break;
+        default: break;
+        }
+        if (!ok) return false;
+        (*count)++;
+    }
+    return true;
+}
+/// @brief Append a record to a ring. Interrupts must be masked on the ring's core.
+static bool push(ring_t* r, const uint8_t* rec, uint32_t size)
+{
+    uint32_t head = r->head;
+    uint32_t used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    uint32_t pos = head & LOG_DEFER_RING_MASK;
+    uint32_t pad = (pos + size > CONFIG_LOG_DEFER_RING_SIZE) ? CONFIG_LOG_DEFER_RING_SIZE - pos : 0;
+    if (used + pad + size > CONFIG_LOG_DEFER_RING_SIZE)
+    {
+        r->dropped++;
+        return false;
+    }
+    if (pad) memset(&(r->buf[pos]), 0, sizeof(uint16_t)); // size == 0: wrap marker
+    memcpy(&(r->buf[(head + pad) & LOG_DEFER_RING_MASK]), rec, size);
+    used += pad + size;
+    if (used > r->peak) r->peak = used;
+    __atomic_store_n(&r->head, head + pad + size, __ATOMIC_RELEASE);
+    return true;
+}
+/// @brief esp_log vprintf hook
+static int capture_vprintf(const char* fmt, va_list args)
+{
+    uint8_t sinks = log_route::route(fmt, args);
+    if (!sinks) return 0;
+    alignas(8) uint8_t rec[LOG_DEFER_MAX_RECORD];
+    record_hdr_t hdr = { .size = 0, .flags = static_cast<uint8_t>(sinks << RECORD_SINKS_SHIFT), .args = 0, .seq = 0, .fmt = fmt };
+    size_t off = sizeof(record_hdr_t);
+    if (esp_ptr_in_drom(fmt))
+    {
+        if (!capture_args(fmt, args, rec, &off, &hdr.args))
+        {
+            hdr.flags |= RECORD_FLAG_TRUNCATED;
+            __atomic_add_fetch(&stats.truncated, 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+    {
+        char* text = reinterpret_cast<char*>(rec + off);
+        int n = vsnprintf(text, LOG_DEFER_MAX_RECORD - off, fmt, args);
+        off += (n < 0) ? 1 : MIN(static_cast<size_t>(n) + 1, LOG_DEFER_MAX_RECORD - off);
+        if (n < 0) *text = '\0';
+        hdr.flags |= RECORD_FLAG_TEXT;
+        __atomic_add_fetch(&stats.immediate, 1, __ATOMIC_RELAXED);
+    }
+    hdr.size = static_cast<uint16_t>(LOG_DEFER_ALIGN(off));
+
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    ring_t* r = &(rings[xPortGetCoreID()]);
+    hdr.seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    memcpy(rec, &hdr, sizeof(hdr));
+    bool ok = push(r, rec, hdr.size);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+
+    if (ok) __atomic_add_fetch(&stats.captured, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/// @brief Read the header of the oldest record, skipping the wrap marker
+/// @return False if the ring is empty
+static bool peek(ring_t* r, record_hdr_t* hdr)
+{
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    while (r->tail != head)
+    {
+        uint32_t pos = r->tail & LOG_DEFER_RING_MASK;
+        uint16_t size;
+        memcpy(&size, &(r->buf[pos]), sizeof(size));
+        if (size)
+        {
+            memcpy(hdr, &(r->buf[pos]), sizeof(*hdr));
+            return true;
+        }
+        __atomic_store_n(&r->tail, r->tail + CONFIG_LOG_DEFER_RING_SIZE - pos, __ATOMIC_RELEASE);
+    }
+    return false;
+}
+template<typename T> static int format_one(char* out, size_t room, const char* spec, const int* stars, uint8_t n_stars, T v)
+{
+    switch (n_stars)
+    {
+    case 0: return snprintf(out, room, spec, v);
+    case 1: return snprintf(out, room, spec, stars[0], v);
+    default: return snprintf(out, room, spec, stars[0], stars[1], v);
+    }
+}
+/// @brief Render a record into line
+/// @return Line length, the line always ends with a newline
+static size_t render(const uint8_t* rec)
+{
+    record_hdr_t hdr;
+    memcpy(&hdr, rec, sizeof(hdr));
+    size_t off = sizeof(hdr);
+    size_t len = 0;
+    if (hdr.flags & RECORD_FLAG_TEXT)
+    {
+        len = strnlen(reinterpret_cast<const char*>(rec + off), MIN(hdr.size - off, sizeof(line) - 2));
+        memcpy(line, rec + off, len);
+    }
+    else
+    {
+        uint8_t index = 0;
+        for (const char* p = hdr.fmt; *p && (len < sizeof(line) - 2); p++)
+        {
+            if (*p != '%')
+            {
+                line[len++] = *p;
+                continue;
+            }
+            spec_t s = parse_spec(p);
+            p += s.len - 1;
+            if (s.cls == ARG_NONE)
+            {
+                line[len++] = '%';
+                continue;
+            }
+            if (index++ >= hdr.args)
+            {
+                // Truncated like an argument: snprintf returns the length it would have written
+                size_t room = sizeof(line) - 1 - len;
+                int n = snprintf(line + len, room, " [...]");
+                if (n > 0) len += MIN(static_cast<size_t>(n), room - 1);
+                break;
+            }
+            char spec[LOG_DEFER_MAX_SPEC];
+            memcpy(spec, p - (s.len - 1), s.len);
+            spec[s.len] = '\0';
+            int stars[2] = {};
+            for (uint8_t i = 0; i < s.stars; i++) stars[i] = get<int>(rec, &off);
+            char* out = line + len;
+            size_t room = sizeof(line) - 1 - len;
+            int n = 0;
+            switch (s.cls)
+            {
+            case ARG_INT: n = format_one(out, room, spec, stars, s.stars, get<int>(rec, &off)); break;
+            case ARG_LONG: n = format_one(out, room, spec, stars, s.stars, get<long>(rec, &off)); break;
+            case ARG_LLONG: n = format_one(out, room, spec, stars, s.stars, get<long long>(rec, &off)); break;
+            case ARG_SIZE: n = format_one(out, room, spec, stars, s.stars, get<size_t>(rec, &off)); break;
+            case ARG_INTMAX: n = format_one(out, room, spec, stars, s.stars, get<intmax_t>(rec, &off)); break;
+            case ARG_PTRDIFF: n = format_one(out, room, spec, stars, s.stars, get<ptrdiff_t>(rec, &off)); break;
+            case ARG_DOUBLE: n = format_one(out, room, spec, stars, s.stars, get<double>(rec, &off)); break;
+            case ARG_LDOUBLE: n = format_one(out, room, spec, stars, s.stars, get<long double>(rec, &off)); break;
+            case ARG_PTR: n = format_one(out, room, spec, stars, s.stars, get<void*>(rec, &off)); break;
+            case ARG_STR:
+            {
+                char str[CONFIG_LOG_DEFER_MAX_STRING_LEN + 1];
+                uint8_t sl = get<uint8_t>(rec, &off);
+                if (sl == STR_IN_FLASH)
+                {
+                    n = format_one(out, room, spec, stars, s.stars, get<const char*>(rec, &off));
+                    break;
+                }
+                memcpy(str, rec + off, sl);
+                str[sl] = '\0';
+                off += sl;
+                n = format_one(out, room, spec, stars, s.stars, static_cast<const char*>(str));
+                break;
+            }
+            default: break;
+            }
+            if (n > 0) len += MIN(static_cast<size_t>(n), room - 1);
+        }
+    }
+    if (!len || (line[len - 1] != '\n'))
+    {
+        if (len > sizeof(line) - 2) len = sizeof(line) - 2;
+        line[len++] = '\n';
+    }
+    line[len] = '\0';
+    return len;
+}
+/// @brief Start a binary frame (drain task only)
+static void frame_begin(uint8_t type)
+{
+    frame_len = 0;
+    frame_seq_pos = 0;
+    frame_overflow = false;
+    frame_put(&type, 1);
+}
+/// @brief Append bytes, the last 2 bytes of the buffer are kept for the CRC
+static void frame_put(const void* p, size_t n)
+{
+    if (frame_len + n > sizeof(frame_raw) - sizeof(uint16_t))
+    {
+        frame_overflow = true;
+        return;
+    }
+    memcpy(frame_raw + frame_len, p, n);
+    frame_len += n;
+}
+/// @brief LEB128
+static void frame_varint(uint64_t v)
+{
+    uint8_t b[10];
+    size_t n = 0;
+    do
+    {
+        b[n] = v & 0x7Fu;
+        v >>= 7;
+        if (v) b[n] |= 0x80u;
+        n++;
+    } while (v);
+    frame_put(b, n);
+}
+static void frame_zigzag(int64_t v)
+{
+    frame_varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+/// @brief Append the CRC, COBS-encode and hand the frame to a sink. Frames are delimited by 0x00 on both sides:
+/// console text never contains 0x00, so a decoder can tell frames from text interleaved with them.
+static void frame_send_one(uint8_t sinks)
+{
+    uint16_t crc = static_cast<uint16_t>(crc32_le(0, frame_raw, frame_len));
+    memcpy(frame_raw + frame_len, &crc, sizeof(crc));
+    size_t raw_len = frame_len + sizeof(crc);
+
+    size_t o = 0;
+    frame_cobs[o++] = 0;
+    size_t code_pos = o++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < raw_len; i++)
+    {
+        if (frame_raw[i])
+        {
+            frame_cobs[o++] = frame_raw[i];
+            if (++code < 0xFF) continue;
+        }
+        frame_cobs[code_pos] = code;
+        code_pos = o++;
+        code = 1;
+    }
+    frame_cobs[code_pos] = code;
+    frame_cobs[o++] = 0;
+    sink(reinterpret_cast<const char*>(frame_cobs), o, sinks);
+}
+/// @brief Send the frame to some sinks. Records are numbered per sink, so that a decoder sees a gap only when frames
+/// were lost on its own link, not when a record was routed elsewhere.
+static void frame_send(uint8_t sinks)
+{
+    frames_since_sync++;
+    if (!frame_seq_pos)
+    {
+        frame_send_one(sinks);
+        return;
+    }
+    for (size_t s = 0; s < log_route::SINK_COUNT; s++)
+    {
+        if (!(sinks & (1u << s))) continue;
+        memcpy(frame_raw + frame_seq_pos, &(frame_seq[s]), sizeof(uint16_t));
+        frame_seq[s]++;
+        frame_send_one(1u << s);
+    }
+}
+/// @brief Type sizes and the ELF identity the decoder needs to interpret records
+static void send_sync()
+{
+    const uint8_t layout[] = { FRAME_VERSION, sizeof(int), sizeof(long), sizeof(long long), sizeof(size_t), sizeof(intmax_t),
+        sizeof(ptrdiff_t), sizeof(void*) };
+    char sha[FRAME_ELF_SHA_LEN + 1];
+    esp_app_get_elf_sha256(sha, sizeof(sha));
+    frame_begin(FRAME_SYNC);
+    frame_put(layout, sizeof(layout));
+    frame_put(sha, FRAME_ELF_SHA_LEN);
+    frame_send(LOG_ROUTE_ALL_SINKS);
+    frames_since_sync = 0;
+}
+/// @brief Re-encode a record as a binary frame: integers become zigzag varints, strings in flash stay pointers.
+/// The sequence number is filled in by frame_send().
+static void encode_record(const uint8_t* rec)
+{
+    record_hdr_t hdr;
+    memcpy(&hdr, rec, sizeof(hdr));
+    size_t off = sizeof(hdr);
+    const uint16_t seq = 0;
+    if (hdr.flags & RECORD_FLAG_TEXT)
+    {
+        const char* text = reinterpret_cast<const char*>(rec + off);
+        frame_begin(FRAME_TEXT);
+        frame_seq_pos = frame_len;
+        frame_put(&seq, sizeof(seq));
+        frame_put(text, strnlen(text, hdr.size - off));
+        return;
+    }
+    frame_begin(FRAME_RECORD);
+    const size_t flags_pos = frame_len;
+    uint8_t flags_args[2] = { static_cast<uint8_t>(hdr.flags & (RECORD_FLAG_TEXT | RECORD_FLAG_TRUNCATED)), 0 };
+    frame_put(flags_args, sizeof(flags_args));
+    frame_seq_pos = frame_len;
+    frame_put(&seq, sizeof(seq));
+    frame_put(&hdr.fmt, sizeof(hdr.fmt));
+    uint8_t index = 0;
+    for (const char* p = hdr.fmt; *p && (index < hdr.args); p++)
+    {
+        if (*p != '%') continue;
+        spec_t s = parse_spec(p);
+        p += s.len - 1;
+        if (s.cls == ARG_NONE) continue;
+        size_t before = frame_len;
+        for (uint8_t i = 0; i < s.stars; i++) frame_zigzag(get<int>(rec, &off));
+        switch (s.cls)
+        {
+        case ARG_INT: frame_zigzag(get<int>(rec, &off)); break;
+        case ARG_LONG: frame_zigzag(get<long>(rec, &off)); break;
+        case ARG_LLONG: frame_zigzag(get<long long>(rec, &off)); break;
+        case ARG_SIZE: frame_varint(get<size_t>(rec, &off)); break;
+        case ARG_INTMAX: frame_zigzag(get<intmax_t>(rec, &off)); break;
+        case ARG_PTRDIFF: frame_zigzag(get<ptrdiff_t>(rec, &off)); break;
+        case ARG_DOUBLE:
+        {
+            double v = get<double>(rec, &off);
+            frame_put(&v, sizeof(v));
+            break;
+        }
+        case ARG_LDOUBLE:
+        {
+            double v = static_cast<double>(get<long double>(rec, &off));
+            frame_put(&v, sizeof(v));
+            break;
+        }
+        case ARG_PTR:
+        {
+            void* v = get<void*>(rec, &off);
+            frame_put(&v, sizeof(v));
+            break;
+        }
+        case ARG_STR:
+        {
+            uint8_t sl = get<uint8_t>(rec, &off);
+            if (sl == STR_IN_FLASH)
+            {
+                const char* v = get<const char*>(rec, &off);
+                frame_varint(1);
+                frame_put(&v, sizeof(v));
+                break;
+            }
+            frame_varint(static_cast<uint64_t>(sl) << 1);
+            frame_put(rec + off, sl);
+            off += sl;
+            break;
+        }
+        default: break;
+        }
+        if (frame_overflow)
+        {
+            frame_len = before;
+            flags_args[0] |= RECORD_FLAG_TRUNCATED;
+            break;
+        }
+        flags_args[1] = ++index;
+    }
+    memcpy(frame_raw + flags_pos, flags_args, sizeof(flags_args));
+}
+/// @brief Render every pending record, oldest first across both cores. Call under drain_mutex.
+/// @return Records rendered
+static size_t drain()
+{
+    size_t n = 0;
+    bool binary = __atomic_load_n(&format, __ATOMIC_RELAXED) == log_defer::FORMAT_BINARY;
+    if (binary && (__atomic_exchange_n(&sync_pending, false, __ATOMIC_RELAXED) || (frames_since_sync >= FRAME_SYNC_INTERVAL))) send_sync();
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+    {
+        uint32_t dropped = __atomic_load_n(&(rings[i].dropped), __ATOMIC_RELAXED);
+        if (dropped == reported_drops[i]) continue;
+        if (binary)
+        {
+            uint8_t core = i;
+            frame_begin(FRAME_DROPS);
+            frame_put(&core, sizeof(core));
+            frame_varint(dropped - reported_drops[i]);
+            frame_send(LOG_ROUTE_ALL_SINKS);
+        }
+        else
+        {
+            size_t len = snprintf(line, sizeof(line), "W (%" PRIu32 ") %s: %" PRIu32 " records dropped on core %u\n", esp_log_timestamp(),
+                TAG, dropped - reported_drops[i], static_cast<unsigned>(i));
+            sink(line, MIN(len, sizeof(line) - 1), LOG_ROUTE_ALL_SINKS);
+        }
+        reported_drops[i] = dropped;
+    }
+    for (;;)
+    {
+        ring_t* next = NULL;
+        record_hdr_t next_hdr;
+        for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        {
+            record_hdr_t h;
+            if (!peek(&(rings[i]), &h)) continue;
+            if (!next || (static_cast<int32_t>(h.seq - next_hdr.seq) < 0))
+            {
+                next = &(rings[i]);
+                next_hdr = h;
+            }
+        }
+        if (!next) break;
+        alignas(8) uint8_t rec[LOG_DEFER_MAX_RECORD];
+        memcpy(rec, &(next->buf[next->tail & LOG_DEFER_RING_MASK]), next_hdr.size);
+        __atomic_store_n(&next->tail, next->tail + next_hdr.size, __ATOMIC_RELEASE);
+        uint8_t sinks = next_hdr.flags >> RECORD_SINKS_SHIFT;
+        if (binary)
+        {
+            encode_record(rec);
+            frame_send(sinks);
+        }
+        else
+        {
+            size_t len = render(rec);
+            sink(line, len, sinks);
+        }
+        stats.rendered++;
+        n++;
+    }
+    return n;
+}
+static void drain_task(void* arg)
+{
+    for (;;)
+    {
+        xSemaphoreTake(drain_mutex, portMAX_DELAY);
+        size_t n = drain();
+        xSemaphoreGive(drain_mutex);
+        if (!n) vTaskDelay(MAX(pdMS_TO_TICKS(CONFIG_LOG_DEFER_DRAIN_PERIOD_MS), 1));
+    }
+}
+
+namespace log_defer
+{
+    /// @brief Start the drain task and route ESP_LOG output through the rings. Lines are output by the sink from then on.
+    /// @param s Output function, called from the drain task (or from flush())
+    /// @return ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE if already started
+    esp_err_t init(sink_t s)
+    {
+        if (!s) return ESP_ERR_INVALID_ARG;
+        if (drain_mutex) return ESP_ERR_INVALID_STATE;
+        sink = s;
+        static StaticSemaphore_t drain_mutex_buffer;
+        static StackType_t drain_task_stack[LOG_DEFER_TASK_STACK_SIZE];
+        static StaticTask_t drain_task_tcb;
+        drain_mutex = static_alloc::create_mutex("log_drain", &drain_mutex_buffer);
+        static_alloc::add_buffer("log_rings", sizeof(rings));
+        static_alloc::create_task(drain_task, "log_drain", sizeof(drain_task_stack), NULL, LOG_DEFER_TASK_PRIORITY, drain_task_stack,
+            &drain_task_tcb);
+        esp_log_set_vprintf(capture_vprintf);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_register_shutdown_handler(flush));
+        ESP_LOGI(TAG, "Deferred logging started, %d B ring per core", CONFIG_LOG_DEFER_RING_SIZE);
+        return ESP_OK;
+    }
+    /// @brief Render pending records in the calling task (e.g. before a restart). Gives up if the drain task holds the rings too long.
+    void flush()
+    {
+        if (!drain_mutex) return;
+        if (xSemaphoreTake(drain_mutex, pdMS_TO_TICKS(LOG_DEFER_FLUSH_TIMEOUT_MS)) != pdTRUE) return;
+        drain();
+        xSemaphoreGive(drain_mutex);
+    }
+    /// @brief Switch between rendered text and binary frames (decoded on the host with tools/log_decode.py and the firmware ELF)
+    void set_format(formats f)
+    {
+        __atomic_store_n(&format, f, __ATOMIC_RELAXED);
+        if (f == FORMAT_BINARY) __atomic_store_n(&sync_pending, true, __ATOMIC_RELAXED);
+    }
+    formats get_format()
+    {
+        return __atomic_load_n(&format, __ATOMIC_RELAXED);
+    }
+    stats_t get_stats()
+    {
+        stats_t ret;
+        ret.captured = __atomic_load_n(&stats.captured, __ATOMIC_RELAXED);
+        ret.rendered = __atomic_load_n(&stats.rendered, __ATOMIC_RELAXED);
+        ret.truncated = __atomic_load_n(&stats.truncated, __ATOMIC_RELAXED);
+        ret.immediate = __atomic_load_n(&stats.immediate, __ATOMIC_RELAXED);
+        ret.dropped = 0;
+        for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        {
+            ret.dropped += __atomic_load_n(&(rings[i].dropped), __ATOMIC_RELAXED);
+            ret.ring_peak[i] = __atomic_load_n(&(rings[i].peak), __ATOMIC_RELAXED);
+        }
+        return ret;
+    }
+} // namespace log_defer
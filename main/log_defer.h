@@ -0,0 +1,40 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "freertos/FreeRTOS.h"
+
+/// @brief Longest rendered log line, longer lines are cut (and still end with a newline)
+#define LOG_DEFER_LINE_LEN 256
+/// @brief Largest captured record (header, format pointer and arguments), the remaining arguments of a longer one are dropped
+#define LOG_DEFER_MAX_RECORD 192
+
+namespace log_defer
+{
+    enum formats : uint8_t
+    {
+        FORMAT_TEXT, ///< Rendered lines
+        FORMAT_BINARY ///< COBS frames delimited by 0x00, see tools/log_decode.py
+    };
+    /// @brief Receives every rendered line (ends with a newline) or binary frame (contains 0x00), in the drain task
+    /// @param sinks log_route sink mask the data is meant for
+    typedef void (*sink_t)(const char* data, size_t len, uint8_t sinks);
+
+    struct stats_t
+    {
+        uint32_t captured; ///< Records written into the rings
+        uint32_t rendered; ///< Records handed to the sink
+        uint32_t dropped; ///< Records lost because a ring was full
+        uint32_t truncated; ///< Records that didn't fit LOG_DEFER_MAX_RECORD, rendered up to the last captured argument
+        uint32_t immediate; ///< Formats outside flash, formatted in the caller's context
+        uint32_t ring_peak[portNUM_PROCESSORS]; ///< Max ring usage, bytes
+    };
+
+    esp_err_t init(sink_t sink);
+    void flush();
+    void set_format(formats f);
+    formats get_format();
+    stats_t get_stats();
+} // namespace log_defer
@@ -0,0 +1,278 @@
+/**
+ * @file log_route.cpp
+ * @author MSU
+ * @brief Log routing: per-sink, per-tag level filters and per-tag token-bucket rate limits. They are evaluated in the
+ * log_defer capture hook, before anything is copied or formatted. Each rule keeps a precomputed level -> sink mask table,
+ * and tag pointers (ESP_LOG tags are static strings) are mapped to rules through a small hash cache, so a record costs
+ * a look at its level letter, one cache probe and, for rate-limited tags, a bucket refill.
+ * esp_log's own per-tag level is kept at the highest sink level of the rule: records no sink wants are still rejected
+ * by esp_log before they reach the hook.
+ * @date 2026-10-16
+ *
+ */
+
+#include "log_route.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define LOG_ROUTE_CACHE_SIZE (1u << LOG_ROUTE_CACHE_BITS)
+/** Token bucket unit: one token == 1e6 / rate, refilled by elapsed µs */
+#define LOG_ROUTE_TOKEN 1000000LL
+
+struct rule_t
+{
+    char tag[LOG_ROUTE_TAG_LEN]; ///< "*": every tag without a rule of its own
+    esp_log_level_t levels[log_route::SINK_COUNT];
+    uint8_t masks[ESP_LOG_VERBOSE + 1]; ///< Sinks accepting each level, derived from levels
+    uint16_t rate; ///< Records/s, 0: unlimited
+    uint16_t burst;
+    int64_t tokens; ///< LOG_ROUTE_TOKEN per record
+    int64_t refill_us;
+    uint32_t passed; ///< Records sent to at least one sink
+    uint32_t filtered; ///< Records below the level of every sink
+    uint32_t suppressed; ///< Records over the rate limit
+};
+struct cache_slot_t
+{
+    const char* tag;
+    uint8_t rule;
+};
+
+static const char* const level_names[] = { "none", "error", "warn", "info", "debug", "verbose" };
+static const char* const sink_names[] = { "uart", "eth" };
+static_assert(sizeof(sink_names) / sizeof(sink_names[0]) == log_route::SINK_COUNT);
+
+static constexpr void update_masks(rule_t* r)
+{
+    for (size_t l = 0; l <= ESP_LOG_VERBOSE; l++)
+    {
+        r->masks[l] = 0;
+        for (size_t s = 0; s < log_route::SINK_COUNT; s++)
+        {
+            if ((l != ESP_LOG_NONE) && (l <= r->levels[s])) r->masks[l] |= 1u << s;
+        }
+    }
+}
+static constexpr rule_t default_rule()
+{
+    rule_t r = {};
+    r.tag[0] = '*';
+    for (size_t s = 0; s < log_route::SINK_COUNT; s++) r.levels[s] = static_cast<esp_log_level_t>(CONFIG_LOG_DEFAULT_LEVEL);
+    update_masks(&r);
+    return r;
+}
+
+/** Rule 0 is the default, rules are never removed (their tags are handed to esp_log_level_set) */
+static rule_t rules[LOG_ROUTE_MAX_RULES] = { default_rule() };
+static size_t rule_count = 1;
+static cache_slot_t cache[LOG_ROUTE_CACHE_SIZE];
+static portMUX_TYPE route_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Level of an ESP_LOG format: optional color sequence, then "<letter> ("
+/// @return ESP_LOG_NONE if fmt isn't an ESP_LOG format
+static esp_log_level_t parse_format_level(const char* fmt)
+{
+    const char* p = fmt;
+    if (*p == '\033')
+    {
+        p = strchr(p, 'm');
+        if (!p) return ESP_LOG_NONE;
+        p++;
+    }
+    if ((p[0] == '\0') || (p[1] != ' ') || (p[2] != '(')) return ESP_LOG_NONE;
+    switch (p[0])
+    {
+    case 'E': return ESP_LOG_ERROR;
+    case 'W': return ESP_LOG_WARN;
+    case 'I': return ESP_LOG_INFO;
+    case 'D': return ESP_LOG_DEBUG;
+    case 'V': return ESP_LOG_VERBOSE;
+    default: return ESP_LOG_NONE;
+    }
+}
+/// @brief Slow path, call under route_spinlock
+static uint8_t match_rule(const char* tag)
+{
+    for (size_t i = 1; i < rule_count; i++)
+    {
+        if (strncmp(rules[i].tag, tag, LOG_ROUTE_TAG_LEN) == 0) return i;
+    }
+    return 0;
+}
+/// @brief Rule of a tag pointer, cached on first sight. Call under route_spinlock.
+static uint8_t find_rule(const char* tag)
+{
+    uint32_t h = (static_cast<uint32_t>(reinterpret_cast<uintptr_t>(tag) >> 2) * 2654435761u) >> (32 - LOG_ROUTE_CACHE_BITS);
+    for (size_t i = 0; i < LOG_ROUTE_CACHE_SIZE; i++)
+    {
+        cache_slot_t* s = &(cache[(h + i) & (LOG_ROUTE_CACHE_SIZE - 1)]);
+        if (s->tag == tag) return s->rule;
+        if (s->tag) continue;
+        s->tag = tag;
+        s->rule = match_rule(tag);
+        return s->rule;
+    }
+    return match_rule(tag);
+}
+/// @brief Call under route_spinlock
+static bool take_token(rule_t* r)
+{
+    int64_t now = esp_timer_get_time();
+    r->tokens = MIN(r->tokens + (now - r->refill_us) * r->rate, r->burst * LOG_ROUTE_TOKEN);
+    r->refill_us = now;
+    if (r->tokens < LOG_ROUTE_TOKEN) return false;
+    r->tokens -= LOG_ROUTE_TOKEN;
+    return true;
+}
+/// @brief Find or add the rule of a tag (new rules start as a copy of the default). Call under route_spinlock.
+/// @return -1 if the table is full
+static int get_rule(const char* tag)
+{
+    if (strcmp(tag, "*") == 0) return 0;
+    int i = match_rule(tag);
+    if (i) return i;
+    if (rule_count >= LOG_ROUTE_MAX_RULES) return -1;
+    i = rule_count++;
+    rules[i] = rules[0];
+    strncpy(rules[i].tag, tag, sizeof(rules[i].tag)); // Callers check the length
+    rules[i].passed = rules[i].filtered = rules[i].suppressed = 0;
+    memset(cache, 0, sizeof(cache)); // Tags cached as default may now have a rule
+    return i;
+}
+static esp_log_level_t get_max_level(const rule_t* r)
+{
+    esp_log_level_t ret = ESP_LOG_NONE;
+    for (size_t s = 0; s < log_route::SINK_COUNT; s++) ret = MAX(ret, r->levels[s]);
+    return ret;
+}
+/// @brief Set esp_log's per-tag levels to the max over the sinks. Setting "*" clears esp_log's tag levels, so all are reapplied.
+static void apply_esp_levels()
+{
+    esp_log_level_t levels[LOG_ROUTE_MAX_RULES];
+    portENTER_CRITICAL(&route_spinlock);
+    size_t n = rule_count;
+    for (size_t i = 0; i < n; i++) levels[i] = get_max_level(&(rules[i]));
+    portEXIT_CRITICAL(&route_spinlock);
+    for (size_t i = 0; i < n; i++) esp_log_level_set(rules[i].tag, levels[i]);
+}
+
+namespace log_route
+{
+    /// @brief Decide where a log record goes, before it is captured (called from the log vprintf hook, any context)
+    /// @param args The record's arguments, not consumed. ESP_LOG passes the timestamp and the tag first.
+    /// @return Sink mask, 0: drop. Formats that aren't ESP_LOG's go to every sink.
+    uint8_t route(const char* fmt, va_list args)
+    {
+        esp_log_level_t level = parse_format_level(fmt);
+        if (level == ESP_LOG_NONE) return LOG_ROUTE_ALL_SINKS;
+        va_list copy;
+        va_copy(copy, args);
+        (void)va_arg(copy, uint32_t);
+        const char* tag = va_arg(copy, const char*);
+        va_end(copy);
+        if (!tag) return LOG_ROUTE_ALL_SINKS;
+
+        portENTER_CRITICAL_SAFE(&route_spinlock);
+        rule_t* r = &(rules[find_rule(tag)]);
+        uint8_t mask = r->masks[level];
+        if (!mask) r->filtered++;
+        else if (r->rate && !take_token(r))
+        {
+            mask = 0;
+            r->suppressed++;
+        }
+        else r->passed++;
+        portEXIT_CRITICAL_SAFE(&route_spinlock);
+        return mask;
+    }
+    /// @brief Set the level of a tag ("*": tags without a rule of their own) on some sinks
+    esp_err_t set_level(const char* tag, uint8_t sinks, esp_log_level_t level)
+    {
+        if (!tag || (strnlen(tag, LOG_ROUTE_TAG_LEN) >= LOG_ROUTE_TAG_LEN) || (level > ESP_LOG_VERBOSE)) return ESP_ERR_INVALID_ARG;
+        portENTER_CRITICAL(&route_spinlock);
+        int i = get_rule(tag);
+        if (i >= 0)
+        {
+            for (size_t s = 0; s < SINK_COUNT; s++)
+            {
+                if (sinks & (1u << s)) rules[i].levels[s] = level;
+            }
+            update_masks(&(rules[i]));
+        }
+        portEXIT_CRITICAL(&route_spinlock);
+        if (i < 0) return ESP_ERR_NO_MEM;
+        apply_esp_levels();
+        return ESP_OK;
+    }
+    /// @brief Limit a tag to per_s records/s with bursts of up to burst records (default: per_s). 0 removes the limit.
+    esp_err_t set_rate(const char* tag, uint16_t per_s, uint16_t burst)
+    {
+        if (!tag || (strnlen(tag, LOG_ROUTE_TAG_LEN) >= LOG_ROUTE_TAG_LEN)) return ESP_ERR_INVALID_ARG;
+        if (!burst) burst = MAX(per_s, 1);
+        portENTER_CRITICAL(&route_spinlock);
+        int i = get_rule(tag);
+        if (i >= 0)
+        {
+            rules[i].rate = per_s;
+            rules[i].burst = burst;
+            rules[i].tokens = burst * LOG_ROUTE_TOKEN;
+            rules[i].refill_us = esp_timer_get_time();
+        }
+        portEXIT_CRITICAL(&route_spinlock);
+        return (i < 0) ? ESP_ERR_NO_MEM : ESP_OK;
+    }
+    void print_rules()
+    {
+        rule_t copy[LOG_ROUTE_MAX_RULES];
+        portENTER_CRITICAL(&route_spinlock);
+        size_t n = rule_count;
+        memcpy(copy, rules, n * sizeof(rule_t));
+        portEXIT_CRITICAL(&route_spinlock);
+
+        printf("%-16s", "Tag");
+        for (size_t s = 0; s < SINK_COUNT; s++) printf(" %-8s", sink_names[s]);
+        printf(" %7s %6s %10s %10s %10s\n", "Rate/s", "Burst", "Passed", "Filtered", "Suppressed");
+        for (size_t i = 0; i < n; i++)
+        {
+            const rule_t* r = &(copy[i]);
+            printf("%-16s", r->tag);
+            for (size_t s = 0; s < SINK_COUNT; s++) printf(" %-8s", level_names[r->levels[s]]);
+            if (r->rate) printf(" %7u %6u", r->rate, r->burst);
+            else printf(" %7s %6s", "-", "-");
+            printf(" %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", r->passed, r->filtered, r->suppressed);
+        }
+    }
+
+    bool parse_level(const char* name, esp_log_level_t* level)
+    {
+        for (size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+        {
+            if (strcmp(name, level_names[i])) continue;
+            *level = static_cast<esp_log_level_t>(i);
+            return true;
+        }
+        return false;
+    }
+    /// @brief "all" or a sink name
+    bool parse_sinks(const char* name, uint8_t* sinks)
+    {
+        if (strcmp(name, "all") == 0)
+        {
+            *sinks = LOG_ROUTE_ALL_SINKS;
+            return true;
+        }
+        for (size_t i = 0; i < SINK_COUNT; i++)
+        {
+            if (strcmp(name, sink_names[i])) continue;
+            *sinks = 1u << i;
+            return true;
+        }
+        return false;
+    }
+} // namespace log_route
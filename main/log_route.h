@@ -0,0 +1,36 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <esp_err.h>
+
+#include "esp_log.h"
+
+/// @brief Tag rules, the "*" default included
+#define LOG_ROUTE_MAX_RULES 16
+/// @brief Longest tag with a rule of its own, NUL included
+#define LOG_ROUTE_TAG_LEN 16
+/// @brief log2 of the tag pointer -> rule cache size
+#define LOG_ROUTE_CACHE_BITS 6
+/// @brief Every sink
+#define LOG_ROUTE_ALL_SINKS ((1u << log_route::SINK_COUNT) - 1u)
+
+namespace log_route
+{
+    enum sinks : uint8_t
+    {
+        SINK_UART, ///< stdout
+        SINK_ETH, ///< Ethernet console
+
+        SINK_COUNT
+    };
+
+    uint8_t route(const char* fmt, va_list args);
+    esp_err_t set_level(const char* tag, uint8_t sinks, esp_log_level_t level);
+    esp_err_t set_rate(const char* tag, uint16_t per_s, uint16_t burst);
+    void print_rules();
+
+    bool parse_level(const char* name, esp_log_level_t* level);
+    bool parse_sinks(const char* name, uint8_t* sinks);
+} // namespace log_route
@@ -11,22 +11,38 @@
 #include "menu.h"
 
 #include "macros.h"
+#include "my_hal.h"
+#include "glyph_cache.h"
+#include "perf.h"
+#include "static_alloc.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "sdkconfig.h"
 
 #include <inttypes.h>
 #include <math.h>
 #include <string.h>
 
 /** Display right column offset (left column offset is 0), in screen coordinate convention */
+/** Peak use is LCD formatting (snprintf of floats) in repaint */
+#define MENU_TASK_STACK_SIZE 3072
+#define MENU_TASK_PRIORITY 1
+
 #define MY_DISPLAY_WIDTH 8u
 #define MY_DISPLAY_HEIGHT 2u
 #define MY_MENU_COLUMN_OFFSET (MY_DISPLAY_WIDTH - 2)
 /** Calculates right column width based on its offset and display width */
 #define MY_MENU_RIGHT_COLUMN_WIDTH (MY_DISPLAY_WIDTH - MY_MENU_COLUMN_OFFSET)
+/** Power bar-graph: cells of the bottom line between Vlim value and units */
+#define MY_MENU_BAR_OFFSET 3u
+#define MY_MENU_BAR_CELLS (MY_MENU_COLUMN_OFFSET - MY_MENU_BAR_OFFSET)
+#define MY_MENU_BAR_CELL_PX 5u
+#define MY_MENU_BAR_PX (MY_MENU_BAR_CELLS * MY_MENU_BAR_CELL_PX)
+/** Status icons column (right after the units) */
+#define MY_MENU_ICON_COLUMN (MY_DISPLAY_WIDTH - 1u)
 
 //Localization
 /** Russian alphabet LCD ROM offset */
@@ -55,6 +71,39 @@ const char* const txt_messages[] = {
     boot_initializing
 };
 
+/**
+ * Custom glyphs (multiplexed onto 8 CGRAM slots by my_lcd::glyph_cache_t)
+ */
+enum glyph_ids : uint8_t
+{
+    GLYPH_BAR_1 = 0, //!< Bar-graph cell with 1..5 leftmost pixel columns filled
+    GLYPH_BAR_2,
+    GLYPH_BAR_3,
+    GLYPH_BAR_4,
+    GLYPH_BAR_5,
+    GLYPH_REMOTE,
+    GLYPH_LOCAL,
+    GLYPH_OUTPUT_ON,
+    GLYPH_RAMPING,
+
+    GLYPH_TOTAL
+};
+#define BAR_CELL(mask) { mask, mask, mask, mask, mask, mask, mask, 0 }
+static const my_lcd::glyph_bitmap_t glyph_table[] =
+{
+    BAR_CELL(0b10000),
+    BAR_CELL(0b11000),
+    BAR_CELL(0b11100),
+    BAR_CELL(0b11110),
+    BAR_CELL(0b11111),
+    { 0b00000, 0b01110, 0b10001, 0b00100, 0b01010, 0b00000, 0b00100, 0b00000 }, // Remote: "waves"
+    { 0b00100, 0b01110, 0b10101, 0b10101, 0b10001, 0b01110, 0b00000, 0b00000 }, // Local: knob
+    { 0b00010, 0b00100, 0b01000, 0b11111, 0b00010, 0b00100, 0b01000, 0b00000 }, // Output enabled: bolt
+    { 0b00001, 0b00011, 0b00111, 0b01111, 0b11111, 0b00000, 0b00000, 0b00000 }  // Ramping: slope
+};
+#undef BAR_CELL
+static_assert(ARRAY_SIZE(glyph_table) == GLYPH_TOTAL);
+
 /** Tries to acquire LCD repaint mutex with a timeout of 1 second */
 #define ACQUIRE_REPAINT_MUTEX() BaseType_t xResult = xSemaphoreTake(repaint_mutex, pdMS_TO_TICKS(1000))
 /** Releases previously acquired LCD repaint mutex, or report a warning into the debug console if the code was unable to acquire the mutex beforehand */
@@ -85,8 +134,19 @@ namespace menu
 
     /// @brief Part of the LCD RAM "cache": hydrogen concentration string
     static char watts_buffer[MY_MENU_COLUMN_OFFSET + 1];
-    static char vlim_buffer[MY_MENU_COLUMN_OFFSET + 1];
+    static char vlim_buffer[MY_MENU_BAR_OFFSET + 1];
+    /// @brief Part of the LCD RAM "cache": power bar-graph length, pixels
+    static uint32_t bar_px = 0;
+    /// @brief Part of the LCD RAM "cache": status icons
+    static bool status_remote = false;
+    static bool status_output_on = false;
+    static bool status_ramping = false;
     static bool have_to_clear = true;
+    /// @brief CGRAM slot cache for the custom glyphs
+    static my_lcd::glyph_cache_t glyph_cache;
+    /// @brief Repaint scheduler statistics
+    static volatile uint32_t repaints_requested = 0;
+    static volatile uint32_t repaints_performed = 0;
 
     /// @brief Initialize LCD library, create FreeRTOS primitives, start LCD repaint task
     /// @param lcd Pointer to HD44780 library configuration structure
@@ -97,10 +157,13 @@ namespace menu
         lcd_cfg = lcd;
 
         auto ret = my_lcd::init(lcd_cfg, my_lcd::an6866_page_t::AN6866_PAGE_0);
-        repaint_mutex = xSemaphoreCreateMutex();
-        assert(repaint_mutex);
-        xTaskCreate(repaint_task_body, "MY_MENU_task", 3072, NULL, 1, &repaint_task_handle);
-        assert(repaint_task_handle);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(my_lcd::glyph_cache_init(&glyph_cache, lcd_cfg, glyph_table, ARRAY_SIZE(glyph_table)));
+        static StaticSemaphore_t repaint_mutex_buffer;
+        static StackType_t repaint_task_stack[MENU_TASK_STACK_SIZE];
+        static StaticTask_t repaint_task_tcb;
+        repaint_mutex = static_alloc::create_mutex("menu_repaint", &repaint_mutex_buffer);
+        repaint_task_handle = static_alloc::create_task(repaint_task_body, "MY_MENU_task", sizeof(repaint_task_stack), NULL, MENU_TASK_PRIORITY,
+            repaint_task_stack, &repaint_task_tcb);
         return ret;
     }
     /// @brief Clear LCD and print a raw string starting at origin. Performs the operation immediately.
@@ -111,6 +174,20 @@ namespace menu
         my_lcd::puts(lcd_cfg, s);
         have_to_clear = true;
     }
+    /// @brief Print a raw string at a position, under the repaint mutex. The text stays until the next repaint (which clears the screen).
+    /// @param col Column
+    /// @param line Line
+    /// @param s String
+    void print_at(uint8_t col, uint8_t line, const char* s)
+    {
+        ACQUIRE_REPAINT_MUTEX();
+
+        my_lcd::gotoxy(lcd_cfg, col, line);
+        my_lcd::puts(lcd_cfg, s);
+        have_to_clear = true;
+
+        RELEASE_REPAINT_MUTEX();
+    }
     /// @brief 
     /// @param watts 
     /// @param vlim 
@@ -118,7 +195,9 @@ namespace menu
     bool set_values(float watts, float vlim)
     {
         const char blank[] = "-----";
+        const char blank_vlim[] = "---";
         static_assert(ARRAY_SIZE(blank) == (MY_MENU_COLUMN_OFFSET));
+        static_assert(ARRAY_SIZE(blank_vlim) == (MY_MENU_BAR_OFFSET + 1));
         static float prev_w = NAN;
         static float prev_vlim = NAN;
 
@@ -128,18 +207,21 @@ namespace menu
         if (isfinite(watts))
         {
             snprintf(watts_buffer, ARRAY_SIZE(watts_buffer), "%1.3f", watts);
+            float px = watts * (MY_MENU_BAR_PX / MY_PWR_MAX) + 0.5f;
+            bar_px = px > 0 ? (px < MY_MENU_BAR_PX ? static_cast<uint32_t>(px) : MY_MENU_BAR_PX) : 0;
         }
         else    
         {
             strncpy(watts_buffer, blank, ARRAY_SIZE(watts_buffer));
+            bar_px = 0;
         }
         if (isfinite(vlim))
         {
-            snprintf(vlim_buffer, ARRAY_SIZE(vlim_buffer), "%1.1f", vlim);
+            snprintf(vlim_buffer, ARRAY_SIZE(vlim_buffer), "%3.1f", vlim);
         }
         else
         {
-            strncpy(vlim_buffer, blank, ARRAY_SIZE(vlim_buffer));
+            strncpy(vlim_buffer, blank_vlim, ARRAY_SIZE(vlim_buffer));
         }
         prev_w = watts;
         prev_vlim = vlim;
@@ -147,12 +229,58 @@ namespace menu
         RELEASE_REPAINT_MUTEX();
         return need_repaint;
     }
+    /// @brief Update status icons
+    /// @param remote True == Modbus remote control, false == local (encoder)
+    /// @param output_on Heater output is enabled
+    /// @param ramping Soft ramp is in progress (takes precedence over output_on)
+    /// @return True == need repaint
+    bool set_status(bool remote, bool output_on, bool ramping)
+    {
+        ACQUIRE_REPAINT_MUTEX();
+
+        bool need_repaint = (status_remote != remote) || (status_output_on != output_on) || (status_ramping != ramping);
+        status_remote = remote;
+        status_output_on = output_on;
+        status_ramping = ramping;
+
+        RELEASE_REPAINT_MUTEX();
+        return need_repaint;
+    }
+    /// @brief Get display statistics: custom glyph CGRAM cache efficiency and repaint coalescing
+    /// @return Statistics snapshot
+    stats_t get_stats()
+    {
+        stats_t ret = 
+        {
+            .glyph_hits = glyph_cache.hits,
+            .glyph_misses = glyph_cache.misses,
+            .repaints_requested = repaints_requested,
+            .repaints_performed = repaints_performed
+        };
+        return ret;
+    }
     /// @brief Queue an actual hardware repaint (call after all desired changes have been submited to cache via other functions)
     void repaint()
     {
         assert(repaint_task_handle);
+        repaints_requested++;
         xTaskNotifyGive(repaint_task_handle);
     }
+    /// @brief Take the LCD (repaint mutex) for raw bus access outside the menu, e.g. a benchmark. Repaints wait meanwhile.
+    /// @param timeout_ms Longest wait for a repaint in progress
+    /// @return False if the LCD is still busy
+    bool lock(uint32_t timeout_ms)
+    {
+        assert(repaint_mutex);
+        return xSemaphoreTake(repaint_mutex, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+    }
+    /// @brief Release the LCD taken by lock() and repaint, the raw access may have left anything on the screen
+    void unlock()
+    {
+        have_to_clear = true;
+        xSemaphoreGive(repaint_mutex);
+        repaint();
+    }
     /// @brief Print a localized message on the screen
     /// @param m See localized_messages
     void print_message(localized_messages m)
@@ -188,47 +316,100 @@ namespace menu
     }
 } // namespace menu
 
-/// @brief Repaint task body function. Listens for task notifications and performs complete LCD update according to the display cache.
+/// @brief Resolve bar-graph and status icon character codes (must be done before cursor positioning, since a glyph upload moves the cursor).
+/// Has to be called with the repaint mutex held.
+/// @param bar Bar-graph cell codes (output)
+/// @param icons Status icon codes for each line (output)
+static void resolve_glyphs(char* bar, char* icons)
+{
+    for (size_t i = 0; i < MY_MENU_BAR_CELLS; i++)
+    {
+        uint32_t start = i * MY_MENU_BAR_CELL_PX;
+        if (menu::bar_px <= start)
+        {
+            bar[i] = ' ';
+            continue;
+        }
+        uint32_t fill = menu::bar_px - start;
+        if (fill > MY_MENU_BAR_CELL_PX) fill = MY_MENU_BAR_CELL_PX;
+        if (my_lcd::glyph_cache_get(&menu::glyph_cache, GLYPH_BAR_1 + fill - 1, &(bar[i])) != ESP_OK) bar[i] = ' ';
+    }
+    if (my_lcd::glyph_cache_get(&menu::glyph_cache, menu::status_remote ? GLYPH_REMOTE : GLYPH_LOCAL, &(icons[0])) != ESP_OK)
+        icons[0] = ' ';
+    icons[1] = ' ';
+    if (menu::status_ramping || menu::status_output_on)
+    {
+        if (my_lcd::glyph_cache_get(&menu::glyph_cache, menu::status_ramping ? GLYPH_RAMPING : GLYPH_OUTPUT_ON, &(icons[1])) != ESP_OK)
+            icons[1] = ' ';
+    }
+}
+
+/// @brief Repaint task body function. Sleeps until a repaint is requested, then performs complete LCD update according to the display cache.
+/// Requests are coalesced: the task waits for a short settle window (so that a burst of changes, like fast encoder spinning, results in a single repaint)
+/// and never repaints more often than CONFIG_MENU_MAX_REFRESH_HZ. Nothing is written to the shared shift-register bus while the values don't change.
 /// @param pvParameter Not used
 static void repaint_task_body(void *pvParameter)
 {
-    const uint32_t interval_ms = 200;
+    const TickType_t min_interval = pdMS_TO_TICKS(1000 / CONFIG_MENU_MAX_REFRESH_HZ);
+    const TickType_t coalesce_window = pdMS_TO_TICKS(CONFIG_MENU_REPAINT_COALESCE_MS);
+    const TickType_t mutex_timeout = pdMS_TO_TICKS(200);
     static BaseType_t xResult;
+    static TickType_t last_repaint = 0;
 
     for (;;)
     {
-        xResult = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval_ms));
-        if (xResult == pdTRUE)
-        {
-            const position_t pos_vlim = {0, 1};
-            const position_t pos_pwr_lbl_pos = {MY_MENU_COLUMN_OFFSET, 0};
-            const position_t pos_vlim_lbl_pos = {MY_MENU_COLUMN_OFFSET, 1};
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY); //Fully idle until something changes
+
+        // Coalesce the burst and respect the refresh rate cap. Any requests that arrive meanwhile are served by this repaint.
+        TickType_t since_last = xTaskGetTickCount() - last_repaint;
+        TickType_t wait = coalesce_window;
+        if (since_last + wait < min_interval) wait = min_interval - since_last;
+        if (wait > 0) vTaskDelay(wait);
+        ulTaskNotifyTake(pdTRUE, 0);
 
-            xResult = xSemaphoreTake(menu::repaint_mutex, pdMS_TO_TICKS(interval_ms));
+        const position_t pos_vlim = {0, 1};
+        const position_t pos_bar = {MY_MENU_BAR_OFFSET, 1};
+        const position_t pos_pwr_lbl_pos = {MY_MENU_COLUMN_OFFSET, 0};
+        const position_t pos_vlim_lbl_pos = {MY_MENU_COLUMN_OFFSET, 1};
+        char bar[MY_MENU_BAR_CELLS];
+        char icons[MY_DISPLAY_HEIGHT];
 
-            if (xResult == pdTRUE)
+        xResult = xSemaphoreTake(menu::repaint_mutex, mutex_timeout);
+
+        if (xResult == pdTRUE)
+        {
+            resolve_glyphs(bar, icons);
+            if (menu::have_to_clear) my_lcd::clear(lcd_cfg); //1.5mS - long operation that doesn't touch buffers, do not block
+            else my_lcd::gotoxy(lcd_cfg, 0, 0);
+            my_lcd::puts(lcd_cfg, menu::watts_buffer);
+            if (menu::have_to_clear) {
+                my_lcd::gotoxy(lcd_cfg, pos_pwr_lbl_pos.x, pos_pwr_lbl_pos.y);
+                my_lcd::puts(lcd_cfg, txt_units);
+            }
+            my_lcd::gotoxy(lcd_cfg, pos_vlim.x, pos_vlim.y);
+            my_lcd::puts(lcd_cfg, menu::vlim_buffer);
+            my_lcd::gotoxy(lcd_cfg, pos_bar.x, pos_bar.y);
+            for (auto &&c : bar) my_lcd::putc(lcd_cfg, c); //Glyph codes may be 0, can't use puts
+            if (menu::have_to_clear) {
+                my_lcd::gotoxy(lcd_cfg, pos_vlim_lbl_pos.x, pos_vlim_lbl_pos.y);
+                my_lcd::puts(lcd_cfg, txt_units_vlim);
+            }
+            for (size_t i = 0; i < MY_DISPLAY_HEIGHT; i++)
             {
-                if (menu::have_to_clear) my_lcd::clear(lcd_cfg); //1.5mS - long operation that doesn't touch buffers, do not block
-                else my_lcd::gotoxy(lcd_cfg, 0, 0);
-                my_lcd::puts(lcd_cfg, menu::watts_buffer);
-                if (menu::have_to_clear) {
-                    my_lcd::gotoxy(lcd_cfg, pos_pwr_lbl_pos.x, pos_pwr_lbl_pos.y);
-                    my_lcd::puts(lcd_cfg, txt_units);
-                }
-                my_lcd::gotoxy(lcd_cfg, pos_vlim.x, pos_vlim.y);
-                my_lcd::puts(lcd_cfg, menu::vlim_buffer);
-                if (menu::have_to_clear) {
-                    my_lcd::gotoxy(lcd_cfg, pos_vlim_lbl_pos.x, pos_vlim_lbl_pos.y);
-                    my_lcd::puts(lcd_cfg, txt_units_vlim);
-                }
-                menu::have_to_clear = false;
-
-                xSemaphoreGive(menu::repaint_mutex);
+                my_lcd::gotoxy(lcd_cfg, MY_MENU_ICON_COLUMN, i);
+                my_lcd::putc(lcd_cfg, icons[i]);
             }
+            menu::have_to_clear = false;
+
+            xSemaphoreGive(menu::repaint_mutex);
+            last_repaint = xTaskGetTickCount();
+            menu::repaints_performed++;
+            perf::trace(perf::EV_LCD_REPAINT, menu::repaints_performed);
         }
         else
         {
-            vTaskDelay(pdMS_TO_TICKS(10));
+            ESP_LOGW(TAG, "Repaint task failed to acquire LCD repaint mutex! Rescheduling...");
+            xTaskNotifyGive(xTaskGetCurrentTaskHandle());
         }
     }
 }
\ No newline at end of file
@@ -12,12 +12,25 @@ namespace menu
         TOTAL_MESSAGES
     };
 
+    struct stats_t
+    {
+        uint32_t glyph_hits; ///< CGRAM glyph lookups served without an upload
+        uint32_t glyph_misses; ///< CGRAM glyph uploads
+        uint32_t repaints_requested; ///< repaint() calls
+        uint32_t repaints_performed; ///< Actual LCD updates after coalescing
+    };
+
     esp_err_t init(my_lcd::hd44780_t* lcd);
 
     bool set_values(float watts, float vlim);
+    bool set_status(bool remote, bool output_on, bool ramping);
+    stats_t get_stats();
 
     void repaint();
+    bool lock(uint32_t timeout_ms);
+    void unlock();
     void print_str(const char* s);
+    void print_at(uint8_t col, uint8_t line, const char* s);
     void print_message(localized_messages m);
     void print_message_f(localized_messages m, ...);
 } // namespace my_menu
@@ -3,42 +3,77 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "tcp_slave.h"
 #include "mbcontroller.h"
 
 #include "my_hal.h"
+#include "boot.h"
+#include "perf.h"
+#include "static_alloc.h"
+#include "timesync.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** No formatting or logging on the request path, register access only */
+#define MB_SLAVE_TASK_STACK_SIZE 3072
+#define MB_SLAVE_TASK_PRIORITY 1
+/** Holding register that completes a time sync exchange */
+#define MB_SYNC_SEQ_REG (offsetof(holding_reg_params_t, sync_seq) / 2)
 
 namespace modbus
 {
     static const char *TAG = "MY_MODBUS";
     static TaskHandle_t mb_slave_loop_handle = NULL;
     static void* slave_handle = NULL;
+    static uint32_t request_count = 0;
 
+    /// @brief Pass a time sync exchange on, timed by the stack's event timestamp (when the request was served)
+    static void sync_exchange(const mb_param_info_t* reg_info)
+    {
+        int64_t now = esp_timer_get_time();
+        int64_t arrival = now - static_cast<uint32_t>(static_cast<uint32_t>(now) - reg_info->time_stamp);
+        mbc_slave_lock(slave_handle);
+        uint16_t seq = holding_reg_params.sync_seq;
+        uint64_t master_us = holding_reg_params.sync_master_us;
+        uint32_t prev_rtt_us = holding_reg_params.sync_prev_rtt_us;
+        mbc_slave_unlock(slave_handle);
+        timesync::exchange(seq, master_us, prev_rtt_us, arrival);
+    }
     void mb_event_cb(const mb_param_info_t* reg_info)
     {
         const char* rw_str = (reg_info->type & MB_READ_MASK) ? "READ" : "WRITE";
         int sw_type = reg_info->type & MB_READ_WRITE_MASK;
+        boot::mark_first_modbus_request();
+        request_count++;
+        perf::trace(perf::EV_MB_REQUEST, (static_cast<uint32_t>(reg_info->type) << 16) | (reg_info->mb_offset & 0xFFFF));
         // Filter events and process them accordingly
         switch (sw_type)
         {
-        case (MB_EVENT_HOLDING_REG_WR | MB_EVENT_HOLDING_REG_RD):
+        case MB_EVENT_HOLDING_REG_WR:
+        case MB_EVENT_HOLDING_REG_RD:
             // Get parameter information from parameter queue
             ESP_LOGD(TAG, "HOLDING %s (%" PRIu32 " us), ADDR:%u, TYPE:%u, INST_ADDR:0x%" PRIx32 ", SIZE:%u",
                     rw_str,
                     reg_info->time_stamp,
                     (unsigned)reg_info->mb_offset,
                     (unsigned)reg_info->type,
-                    (uint32_t)reg_info->address,
+                    (uint32_t)(uintptr_t)reg_info->address,
                     (unsigned)reg_info->size);
-            
+            if ((reg_info->type & MB_EVENT_HOLDING_REG_WR) && (reg_info->mb_offset <= MB_SYNC_SEQ_REG) &&
+                (reg_info->mb_offset + reg_info->size > MB_SYNC_SEQ_REG))
+            {
+                sync_exchange(reg_info);
+            }
             break;
         case MB_EVENT_INPUT_REG_RD:
             ESP_LOGD(TAG, "INPUT READ (%" PRIu32 " us), ADDR:%u, TYPE:%u, INST_ADDR:0x%" PRIx32 ", SIZE:%u",
                     reg_info->time_stamp,
                     (unsigned)reg_info->mb_offset,
                     (unsigned)reg_info->type,
-                    (uint32_t)reg_info->address,
+                    (uint32_t)(uintptr_t)reg_info->address,
                     (unsigned)reg_info->size);
             break;
         case MB_EVENT_DISCRETE_RD:
@@ -46,16 +81,17 @@ namespace modbus
                     reg_info->time_stamp,
                     (unsigned)reg_info->mb_offset,
                     (unsigned)reg_info->type,
-                    (uint32_t)reg_info->address,
+                    (uint32_t)(uintptr_t)reg_info->address,
                     (unsigned)reg_info->size);
             break;
-        case MB_EVENT_COILS_RD | MB_EVENT_COILS_WR:
+        case MB_EVENT_COILS_RD:
+        case MB_EVENT_COILS_WR:
             ESP_LOGD(TAG, "COILS %s (%" PRIu32 " us), ADDR:%u, TYPE:%u, INST_ADDR:0x%" PRIx32 ", SIZE:%u",
                     rw_str,
                     reg_info->time_stamp,
                     (unsigned)reg_info->mb_offset,
                     (unsigned)reg_info->type,
-                    (uint32_t)reg_info->address,
+                    (uint32_t)(uintptr_t)reg_info->address,
                     (unsigned)reg_info->size);
             break;
         default:
@@ -83,8 +119,10 @@ namespace modbus
         ESP_ERROR_CHECK(slave_init(&tcp_slave_config, mb_event_cb, &slave_handle));
         assert(slave_handle);
         // The Modbus slave logic is located in this function (user handling of Modbus)
-        xTaskCreate(slave_operation_func, "mb_slave_loop", 4096, NULL, 1, &mb_slave_loop_handle);
-        assert(mb_slave_loop_handle);
+        static StackType_t mb_slave_loop_stack[MB_SLAVE_TASK_STACK_SIZE];
+        static StaticTask_t mb_slave_loop_tcb;
+        mb_slave_loop_handle = static_alloc::create_task(slave_operation_func, "mb_slave_loop", sizeof(mb_slave_loop_stack), NULL,
+            MB_SLAVE_TASK_PRIORITY, mb_slave_loop_stack, &mb_slave_loop_tcb);
     }
 
     bool get_remote_enabled()
@@ -128,15 +166,35 @@ namespace modbus
         return ret;
     }
 
+    /// @brief Preset holding setpoint registers (e.g. restore the last remote setpoint at boot). Remote mode is not enabled by this.
+    /// @param pwr Power setpoint, W
+    /// @param vlim Voltage limit setpoint, V
+    void set_setpoints(float pwr, float vlim)
+    {
+        if (!slave_handle) return;
+        mbc_slave_lock(slave_handle);
+        holding_reg_params.power_setpoint = pwr;
+        holding_reg_params.vlim_setpoint = vlim;
+        mbc_slave_unlock(slave_handle);
+    }
+    /// @brief Publish the output values, stamped with the master clock, and the time sync state
     void set_values(bool is_on, float pwr, float vlim, float vpwr, float dac_vlim)
     {
         if (!slave_handle) return;
+        int64_t sample_us;
+        if (!timesync::now_us(&sample_us)) sample_us = 0;
+        timesync::status_t sync = timesync::get_status();
         mbc_slave_lock(slave_handle);
         discrete_reg_params.discrete_input0 = (is_on ? 1 : 0);
         input_reg_params.power_man = pwr;
         input_reg_params.vlim_man = vlim;
         input_reg_params.vpwr = vpwr;
         input_reg_params.dac_vlim = dac_vlim;
+        input_reg_params.sync_time_us = static_cast<uint64_t>(sample_us);
+        input_reg_params.sync_drift_ppb = sync.drift_ppb;
+        input_reg_params.sync_rtt_us = sync.rtt_min_us;
+        input_reg_params.sync_state = sync.state;
+        input_reg_params.sync_samples = sync.used;
         mbc_slave_unlock(slave_handle);
     }
     void disable_remote()
@@ -146,4 +204,98 @@ namespace modbus
         coil_reg_params.coil_0 = 0;
         mbc_slave_unlock(slave_handle);
     }
+    /// @brief Take a pending calibration request. Request coils are cleared once taken.
+    /// @param req Request (output)
+    /// @return True if there was a request
+    bool get_cal_request(cal_request_t* req)
+    {
+        if (!slave_handle) return false;
+        mbc_slave_lock(slave_handle);
+        req->start = coil_reg_params.coil_1 > 0;
+        req->post = coil_reg_params.coil_2 > 0;
+        req->sweep = coil_reg_params.coil_3 > 0;
+        req->channel = holding_reg_params.cal_channel;
+        req->code_from = holding_reg_params.cal_code_from;
+        req->code_to = holding_reg_params.cal_code_to;
+        req->points = holding_reg_params.cal_points;
+        req->settle_ms = holding_reg_params.cal_settle_ms;
+        req->measurement = holding_reg_params.cal_measurement;
+        coil_reg_params.coil_1 = 0;
+        coil_reg_params.coil_2 = 0;
+        coil_reg_params.coil_3 = 0;
+        mbc_slave_unlock(slave_handle);
+        return req->start || req->post || req->sweep;
+    }
+    void set_cal_status(bool active, uint16_t index, uint16_t count)
+    {
+        if (!slave_handle) return;
+        mbc_slave_lock(slave_handle);
+        input_reg_params.cal_active = active ? 1 : 0;
+        input_reg_params.cal_index = index;
+        input_reg_params.cal_count = count;
+        mbc_slave_unlock(slave_handle);
+    }
+    /// @brief Publish the last calibration sweep result
+    void set_cal_fit(esp_err_t result, float gain, float offset, float rms_residual, float max_residual)
+    {
+        if (!slave_handle) return;
+        mbc_slave_lock(slave_handle);
+        input_reg_params.cal_fit_result = static_cast<uint16_t>(result);
+        input_reg_params.cal_fit_gain = gain;
+        input_reg_params.cal_fit_offset = offset;
+        input_reg_params.cal_fit_rms_residual = rms_residual;
+        input_reg_params.cal_fit_max_residual = max_residual;
+        mbc_slave_unlock(slave_handle);
+    }
+    /// @brief Publish the diagnostics block (see perf::sample)
+    void set_diag(const perf::diag_t* d)
+    {
+        static_assert(PERF_DIAG_TASKS == MB_DIAG_TASKS);
+        if (!slave_handle) return;
+        mbc_slave_lock(slave_handle);
+        input_reg_params.diag_uptime_s = d->uptime_s;
+        input_reg_params.diag_dac_writes = d->dac_writes;
+        input_reg_params.diag_lcd_bytes = d->lcd_bytes;
+        input_reg_params.diag_mb_requests = d->mb_requests;
+        input_reg_params.diag_nvs_writes = d->nvs_writes;
+        input_reg_params.diag_free_heap = d->free_heap;
+        input_reg_params.diag_min_free_heap = d->min_free_heap;
+        input_reg_params.diag_trace_events = d->trace_events;
+        for (size_t i = 0; i < MB_DIAG_TASKS; i++)
+        {
+            input_reg_params.diag_task_cpu_permille[i] = d->tasks[i].cpu_permille;
+            input_reg_params.diag_task_stack_free[i] = d->tasks[i].stack_free;
+        }
+        mbc_slave_unlock(slave_handle);
+    }
+    /// @brief Event journal export: first record the master wants
+    uint32_t get_journal_read_seq()
+    {
+        if (!slave_handle) return 0;
+        mbc_slave_lock(slave_handle);
+        uint32_t ret = holding_reg_params.journal_read_seq;
+        mbc_slave_unlock(slave_handle);
+        return ret;
+    }
+    /// @brief Publish the event journal export window
+    /// @param head_seq Newest record in flash
+    /// @param records Records from journal_read_seq on, MB_JOURNAL_WINDOW_RECORDS at most
+    /// @param count Records, the rest of the window is cleared
+    void set_journal_window(uint32_t head_seq, const journal::record_t* records, size_t count)
+    {
+        static_assert(sizeof(journal::record_t) == MB_JOURNAL_RECORD_REGS * sizeof(uint16_t));
+        if (!slave_handle) return;
+        if (count > MB_JOURNAL_WINDOW_RECORDS) count = MB_JOURNAL_WINDOW_RECORDS;
+        mbc_slave_lock(slave_handle);
+        input_reg_params.journal_head_seq = head_seq;
+        input_reg_params.journal_window_seq = count ? records[0].seq : 0;
+        memset(input_reg_params.journal_window, 0, sizeof(input_reg_params.journal_window));
+        memcpy(input_reg_params.journal_window, records, count * sizeof(journal::record_t));
+        mbc_slave_unlock(slave_handle);
+    }
+    /// @brief Modbus register accesses served since boot
+    uint32_t get_request_count()
+    {
+        return request_count;
+    }
 } // namespace modbus
@@ -3,14 +3,39 @@
 #include <esp_err.h>
 #include <esp_netif.h>
 
+#include "perf.h"
+#include "journal.h"
+
 namespace modbus
 {
+    /// @brief Calibration request: table capture (coil 1), measurement post (coil 2), gain/offset sweep (coil 3), with the holding parameters
+    struct cal_request_t
+    {
+        bool start;
+        bool post;
+        bool sweep;
+        uint16_t channel;
+        uint16_t code_from;
+        uint16_t code_to;
+        uint16_t points;
+        uint16_t settle_ms;
+        float measurement;
+    };
+
     void init(esp_netif_t* netif_ptr);
 
     bool get_remote_enabled();
     float get_pwr_setpoint();
     float get_vlim_setpoint();
 
+    void set_setpoints(float pwr, float vlim);
     void set_values(bool is_on, float pwr, float vlim, float vpwr, float dac_vlim);
     void disable_remote();
+    bool get_cal_request(cal_request_t* req);
+    void set_cal_status(bool active, uint16_t index, uint16_t count);
+    void set_cal_fit(esp_err_t result, float gain, float offset, float rms_residual, float max_residual);
+    void set_diag(const perf::diag_t* d);
+    uint32_t get_journal_read_seq();
+    void set_journal_window(uint32_t head_seq, const journal::record_t* records, size_t count);
+    uint32_t get_request_count();
 } // namespace modbus
@@ -0,0 +1,144 @@
+/**
+ * @file my_button.cpp
+ * @author MSU
+ * @brief Interrupt-driven push-button driver. A GPIO edge interrupt masks itself and arms a one-shot esp_timer,
+ * the pin is sampled once the debounce interval has elapsed. Debounced press/release/long-press events are posted to a queue,
+ * so that the control loop never polls or blocks on user input.
+ * @date 2026-10-16
+ *
+ */
+
+#include "my_button.h"
+
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "static_alloc.h"
+
+#define MY_BUTTON_QUEUE_LEN 8
+
+static const char TAG[] = "BUTTON";
+
+static gpio_num_t btn_pin = GPIO_NUM_NC;
+static bool btn_active_high = true;
+static volatile bool stable_pressed = false;
+static volatile uint32_t dropped_events = 0;
+static QueueHandle_t event_queue = NULL;
+static esp_timer_handle_t debounce_timer = NULL;
+static esp_timer_handle_t long_press_timer = NULL;
+
+static bool read_pressed()
+{
+    return (gpio_get_level(btn_pin) > 0) == btn_active_high;
+}
+static void post_event(my_button::event_types t, int64_t timestamp)
+{
+    my_button::event_t ev = { .type = t, .timestamp_us = timestamp };
+    if (xQueueSend(event_queue, &ev, 0) != pdTRUE) dropped_events++;
+}
+/// @brief GPIO edge ISR: mask further edges (contact bounce) until the debounce timer samples the pin
+/// @param arg Not used
+static void edge_isr(void* arg)
+{
+    gpio_intr_disable(btn_pin);
+    esp_timer_start_once(debounce_timer, CONFIG_BUTTON_DEBOUNCE_MS * 1000);
+}
+/// @brief Debounce timer callback (esp_timer task context): sample the settled level and emit an event on change
+/// @param arg Not used
+static void debounce_cb(void* arg)
+{
+    bool pressed = read_pressed();
+    if (pressed != stable_pressed)
+    {
+        stable_pressed = pressed;
+        post_event(pressed ? my_button::BTN_PRESS : my_button::BTN_RELEASE, esp_timer_get_time());
+        if (pressed) esp_timer_start_once(long_press_timer, CONFIG_BUTTON_LONG_PRESS_MS * 1000);
+        else esp_timer_stop(long_press_timer);
+    }
+    gpio_intr_enable(btn_pin);
+    // An edge between the sample above and re-enabling the interrupt would be missed otherwise
+    if (read_pressed() != stable_pressed)
+    {
+        gpio_intr_disable(btn_pin);
+        esp_timer_start_once(debounce_timer, CONFIG_BUTTON_DEBOUNCE_MS * 1000);
+    }
+}
+/// @brief Long-press timer callback (esp_timer task context)
+/// @param arg Not used
+static void long_press_cb(void* arg)
+{
+    if (stable_pressed) post_event(my_button::BTN_LONG_PRESS, esp_timer_get_time());
+}
+
+namespace my_button
+{
+    /// @brief Set up edge interrupt and debounce timers. The pin has to be configured as an input beforehand.
+    /// @param pin Button GPIO
+    /// @param active_high True == high level means pressed
+    /// @return See gpio_install_isr_service, gpio_isr_handler_add, esp_timer_create
+    esp_err_t init(gpio_num_t pin, bool active_high)
+    {
+        esp_err_t err;
+        btn_pin = pin;
+        btn_active_high = active_high;
+        STATIC_QUEUE_STORAGE(event_queue, MY_BUTTON_QUEUE_LEN, event_t);
+        event_queue = static_alloc::create_queue("button_events", MY_BUTTON_QUEUE_LEN, sizeof(event_t), event_queue_storage, &event_queue_buffer);
+
+        esp_timer_create_args_t args =
+        {
+            .callback = debounce_cb,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "btn_debounce",
+            .skip_unhandled_events = false
+        };
+        if ((err = esp_timer_create(&args, &debounce_timer)) != ESP_OK) return err;
+        args.callback = long_press_cb;
+        args.name = "btn_long";
+        if ((err = esp_timer_create(&args, &long_press_timer)) != ESP_OK) return err;
+
+        stable_pressed = read_pressed();
+        err = gpio_install_isr_service(0);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err; //Already installed is fine
+        if ((err = gpio_set_intr_type(btn_pin, GPIO_INTR_ANYEDGE)) != ESP_OK) return err;
+        if ((err = gpio_isr_handler_add(btn_pin, edge_isr, NULL)) != ESP_OK) return err;
+        ESP_LOGI(TAG, "Debounce %d ms, long press %d ms", CONFIG_BUTTON_DEBOUNCE_MS, CONFIG_BUTTON_LONG_PRESS_MS);
+        return gpio_intr_enable(btn_pin);
+    }
+    /// @brief Get the next debounced button event
+    /// @param ev Event (output)
+    /// @param wait Ticks to wait for an event, 0 == poll
+    /// @return True if an event was received
+    bool get_event(event_t* ev, TickType_t wait)
+    {
+        if (!event_queue) return false;
+        return xQueueReceive(event_queue, ev, wait) == pdTRUE;
+    }
+    /// @brief Block until an event is available, without consuming it
+    /// @param wait Max ticks to wait
+    /// @return True if an event is available
+    bool wait_event(TickType_t wait)
+    {
+        if (!event_queue)
+        {
+            vTaskDelay(wait);
+            return false;
+        }
+        event_t ev;
+        return xQueuePeek(event_queue, &ev, wait) == pdTRUE;
+    }
+    /// @brief Debounced button state
+    /// @return True == pressed
+    bool is_pressed()
+    {
+        return stable_pressed;
+    }
+    /// @brief Number of events lost due to the queue being full
+    uint32_t get_dropped_events()
+    {
+        return dropped_events;
+    }
+} // namespace my_button
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <inttypes.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+#include "freertos/FreeRTOS.h"
+
+namespace my_button
+{
+    enum event_types
+    {
+        BTN_PRESS,
+        BTN_RELEASE,
+        BTN_LONG_PRESS
+    };
+
+    struct event_t
+    {
+        event_types type;
+        int64_t timestamp_us; ///< esp_timer time of the debounced transition
+    };
+
+    esp_err_t init(gpio_num_t pin, bool active_high);
+
+    bool get_event(event_t* ev, TickType_t wait);
+    bool wait_event(TickType_t wait);
+    bool is_pressed();
+    uint32_t get_dropped_events();
+} // namespace my_button
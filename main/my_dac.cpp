@@ -12,6 +12,9 @@
 #include "macros.h"
 #include "my_hal.h"
 #include "params.h"
+#include "my_math.h"
+#include "perf.h"
+#include "journal.h"
 
 #include <esp_log.h>
 #include <math.h>
@@ -25,13 +28,88 @@
 #define MY_DAC_VPWR_OUTPUT_DIVIDER ((750.0f+68.0f+3000.0f)/(750.0f+68.0f/2))
 #define MY_DAC_TO_CODE(v, full_scale) ((v) * ((full_scale - MY_DAC_ZERO_SCALE) / MY_DAC_VREF) + MY_DAC_ZERO_SCALE)
 
+#define MY_DAC_CODE_TO_VOLTS(c, full_scale) ((static_cast<float>(c) - MY_DAC_ZERO_SCALE) * (MY_DAC_VREF / (full_scale - MY_DAC_ZERO_SCALE)))
+/** Calibration table LUT nodes per channel (uniform grid over the table's voltage range) */
+#define MY_DAC_LUT_SIZE 128
+
 static const char* TAG = "DAC";
 
+/// @brief Calibration table compiled into a uniform grid, so that evaluation is O(1) regardless of the number of points
+struct cal_lut_t
+{
+    float x0;
+    float x1;
+    float inv_step;
+    float code[MY_DAC_LUT_SIZE];
+};
+
 const my_dac_cal_t* calibration = &my_params::default_dac_cal;
 /// @brief Last target voltage set
 float last_vpwr = 0;
 float last_vlim = 0;
 my_hal::dac_code_t last_code = 0;
+/// @brief Soft heat-up/cool-down profile is being executed
+static volatile bool ramping = false;
+static bool sentinel_clamped = false; ///< Last set_vpwr request was above the soft sentinel
+/// @brief Double-buffered LUTs: a new table is compiled into the inactive buffer, then the pointer is swapped (NULL == no table)
+static cal_lut_t lut_buffers[my_dac::CH_COUNT][2];
+static cal_lut_t* volatile luts[my_dac::CH_COUNT] = {};
+static const uint32_t full_scale[my_dac::CH_COUNT] = { MY_DAC_VPWR_FULL_SCALE, MY_DAC_VLIM_FULL_SCALE };
+
+/// @brief Piecewise-linear interpolation with binary search, used to build the LUT. Clamps to the end points.
+static float interpolate_table(const my_dac_cal_table_t* t, float x)
+{
+    const my_dac_cal_point_t* p = t->points;
+    if (x <= p[0].volts) return p[0].code;
+    if (x >= p[t->count - 1].volts) return p[t->count - 1].code;
+    size_t lo = 0, hi = t->count - 1;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (p[mid].volts <= x) lo = mid;
+        else hi = mid;
+    }
+    return p[lo].code + (x - p[lo].volts) * (p[hi].code - p[lo].code) / (p[hi].volts - p[lo].volts);
+}
+static float evaluate_lut(const cal_lut_t* l, float x)
+{
+    if (x <= l->x0) return l->code[0];
+    if (x >= l->x1) return l->code[MY_DAC_LUT_SIZE - 1];
+    float f = (x - l->x0) * l->inv_step;
+    size_t i = static_cast<size_t>(f);
+    if (i >= MY_DAC_LUT_SIZE - 1) return l->code[MY_DAC_LUT_SIZE - 1];
+    return l->code[i] + (f - i) * (l->code[i + 1] - l->code[i]);
+}
+/// @brief Clamp and write a channel code into the DAC shift-register chain
+static void write_code(my_dac::channels ch, float code)
+{
+    if (code > full_scale[ch])
+        code = full_scale[ch];
+    else if (code < MY_DAC_ZERO_SCALE)
+        code = MY_DAC_ZERO_SCALE;
+    my_hal::dac_code_t c = static_cast<my_hal::dac_code_t>(code + 0.5f);
+    switch (ch)
+    {
+    case my_dac::CH_VPWR:
+        if (c > MY_DAC_VPWR_SENTINEL) 
+        {
+            c = MY_DAC_VPWR_SENTINEL;
+            ESP_LOGD(TAG, "Sentinel reached.");
+        }
+        last_code &= ~(MY_DAC_VPWR_FULL_SCALE); 
+        last_code |= (c >> 2u) & 0xFF;
+        last_code |= (c & 0b11) << 8u;
+        break;
+    case my_dac::CH_VLIM:
+        last_code &= ~(MY_DAC_VLIM_FULL_SCALE << MY_DAC_SR_VLIM_OFFSET);
+        last_code |= c << MY_DAC_SR_VLIM_OFFSET;
+        break;
+    default:
+        return;
+    }
+    my_hal::sr_write(my_hal::sr_types::SR_DAC, reinterpret_cast<uint8_t*>(&last_code));
+    perf::trace(perf::EV_DAC_WRITE, last_code);
+}
 
 namespace my_dac {
     /// @brief Initialize DAC-abstraction (sets the N(V) "calibration" data)
@@ -40,6 +118,107 @@ namespace my_dac {
     {
         calibration = cal;
     }
+    /// @brief Check calibration table consistency
+    /// @param table Table to check
+    /// @param len Table size in bytes (as stored)
+    /// @return True if the table can be used
+    bool validate_cal_table(const my_dac_cal_table_t* table, size_t len)
+    {
+        if (!table || len < MY_DAC_CAL_TABLE_SIZE(0)) return false;
+        if (table->count < 2 || table->count > MY_DAC_CAL_TABLE_MAX_POINTS) return false;
+        if (len != MY_DAC_CAL_TABLE_SIZE(table->count)) return false;
+        for (size_t i = 0; i < table->count; i++)
+        {
+            if (!isfinite(table->points[i].volts) || !isfinite(table->points[i].code)) return false;
+            if (i && !(table->points[i].volts > table->points[i - 1].volts)) return false;
+        }
+        return true;
+    }
+    /// @brief Set a multi-point calibration table for a channel, it overrides gain/offset calibration.
+    /// The table is compiled into a uniform-grid LUT (not referenced afterwards).
+    /// @param ch Channel
+    /// @param table Table (must pass validate_cal_table), NULL to go back to gain/offset calibration
+    /// @return False if the table is invalid
+    bool set_cal_table(channels ch, const my_dac_cal_table_t* table)
+    {
+        assert(ch < CH_COUNT);
+        if (!table)
+        {
+            luts[ch] = NULL;
+            return true;
+        }
+        if (!validate_cal_table(table, MY_DAC_CAL_TABLE_SIZE(table->count))) return false;
+        cal_lut_t* l = (luts[ch] == &(lut_buffers[ch][0])) ? &(lut_buffers[ch][1]) : &(lut_buffers[ch][0]);
+        l->x0 = table->points[0].volts;
+        l->x1 = table->points[table->count - 1].volts;
+        float step = (l->x1 - l->x0) / (MY_DAC_LUT_SIZE - 1);
+        l->inv_step = 1.0f / step;
+        for (size_t i = 0; i < MY_DAC_LUT_SIZE; i++) l->code[i] = interpolate_table(table, l->x0 + step * i);
+        luts[ch] = l;
+        ESP_LOGI(TAG, "Channel %d: %" PRIu32 "-point table, %.3f..%.3f V", ch, table->count, l->x0, l->x1);
+        return true;
+    }
+    bool has_cal_table(channels ch)
+    {
+        assert(ch < CH_COUNT);
+        return luts[ch] != NULL;
+    }
+    /// @brief Map target output voltage to DAC code: calibration table LUT if present, gain/offset otherwise
+    /// @param ch Channel
+    /// @param volts Heater amplifier voltage (Vpwr) or voltage limit (Vlim), volts
+    /// @return DAC code (not clamped)
+    float get_code_for(channels ch, float volts)
+    {
+        assert(ch < CH_COUNT);
+        const cal_lut_t* l = luts[ch];
+        if (l) return evaluate_lut(l, volts);
+        if (ch == CH_VPWR)
+            return MY_DAC_TO_CODE(volts * calibration->gain_vpwr * MY_DAC_VPWR_OUTPUT_DIVIDER + calibration->offset_vpwr, MY_DAC_VPWR_FULL_SCALE);
+        return MY_DAC_TO_CODE(my_math::vlim_to_dac_vlim(volts) * calibration->gain_vlim + calibration->offset_vlim, MY_DAC_VLIM_FULL_SCALE);
+    }
+    uint32_t get_full_scale(channels ch)
+    {
+        assert(ch < CH_COUNT);
+        return full_scale[ch];
+    }
+    /// @brief Map output voltage to the quantity gain/offset calibration is applied to: DAC voltage = gain * input + offset
+    /// @param ch Channel
+    /// @param volts Heater amplifier voltage (Vpwr) or voltage limit (Vlim), volts
+    /// @return Nominal DAC voltage, volts
+    float get_cal_input(channels ch, float volts)
+    {
+        assert(ch < CH_COUNT);
+        if (ch == CH_VPWR) return volts * MY_DAC_VPWR_OUTPUT_DIVIDER;
+        return my_math::vlim_to_dac_vlim(volts);
+    }
+    /// @brief Convert DAC code to DAC output voltage
+    /// @param ch Channel
+    /// @param code DAC code
+    /// @return Volts
+    float code_to_dac_volts(channels ch, float code)
+    {
+        assert(ch < CH_COUNT);
+        return MY_DAC_CODE_TO_VOLTS(code, full_scale[ch]);
+    }
+    /// @brief Get DAC resolution
+    /// @param ch Channel
+    /// @return Volts per code
+    float get_lsb_volts(channels ch)
+    {
+        assert(ch < CH_COUNT);
+        return MY_DAC_VREF / (full_scale[ch] - MY_DAC_ZERO_SCALE);
+    }
+    /// @brief Write a raw DAC code (calibration purposes). Range limits and Vpwr sentinel still apply.
+    /// @param ch Channel
+    /// @param code DAC code
+    void set_code(channels ch, uint32_t code)
+    {
+        assert(ch < CH_COUNT);
+        float v = MY_DAC_CODE_TO_VOLTS(code, full_scale[ch]);
+        if (ch == CH_VPWR) last_vpwr = v;
+        else last_vlim = v;
+        write_code(ch, code);
+    }
     /// @brief Set sensor heater amplifier output voltage directly.
     /// @param volt Target voltage, volts.
     void set_vpwr(float volt)
@@ -49,26 +228,18 @@ namespace my_dac {
             return;
         }
         last_vpwr = volt;
-        if (volt > my_params::get_dac_soft_sentinel())
+        bool clamp = volt > my_params::get_dac_soft_sentinel();
+        if (clamp != sentinel_clamped)
         {
-            volt = my_params::get_dac_soft_sentinel();
-            ESP_LOGD(TAG, "Soft sentinel reached");
+            sentinel_clamped = clamp;
+            journal::record(clamp ? journal::EV_SENTINEL_CLAMP : journal::EV_SENTINEL_RELEASE, journal::SRC_INTERNAL, volt);
         }
-        volt = MY_DAC_TO_CODE(volt * calibration->gain_vpwr * MY_DAC_VPWR_OUTPUT_DIVIDER + calibration->offset_vpwr, MY_DAC_VPWR_FULL_SCALE);
-        if (volt > MY_DAC_VPWR_FULL_SCALE)
-            volt = MY_DAC_VPWR_FULL_SCALE;
-        else if (volt < MY_DAC_ZERO_SCALE)
-            volt = MY_DAC_ZERO_SCALE;
-        if (volt > MY_DAC_VPWR_SENTINEL) 
+        if (clamp)
         {
-            volt = MY_DAC_VPWR_SENTINEL;
-            ESP_LOGD(TAG, "Sentinel reached.");
+            volt = my_params::get_dac_soft_sentinel();
+            ESP_LOGD(TAG, "Soft sentinel reached");
         }
-        last_code &= ~(MY_DAC_VPWR_FULL_SCALE); 
-        my_hal::dac_code_t code = static_cast<my_hal::dac_code_t>(volt + 0.5f);
-        last_code |= (code >> 2u) & 0xFF;
-        last_code |= (code & 0b11) << 8u;
-        my_hal::sr_write(my_hal::sr_types::SR_DAC, reinterpret_cast<uint8_t*>(&last_code));
+        write_code(CH_VPWR, get_code_for(CH_VPWR, volt));
     }
     /// @brief Get last set heater amplifier output voltage
     /// @return Volts
@@ -76,8 +247,8 @@ namespace my_dac {
     {
         return last_vpwr;
     }
-    /// @brief 
-    /// @param volt Target voltage, volts.
+    /// @brief Set voltage limit DAC output voltage directly (gain/offset calibration only)
+    /// @param volt Target DAC voltage, volts.
     void set_vlim(float volt)
     {
         if (!isfinite(volt)) {
@@ -85,14 +256,24 @@ namespace my_dac {
             return;
         }
         last_vlim = volt;
-        volt = MY_DAC_TO_CODE(volt * calibration->gain_vlim + calibration->offset_vlim, MY_DAC_VLIM_FULL_SCALE);
-        if (volt > MY_DAC_VLIM_FULL_SCALE)
-            volt = MY_DAC_VLIM_FULL_SCALE;
-        else if (volt < MY_DAC_ZERO_SCALE)
-            volt = MY_DAC_ZERO_SCALE;
-        last_code &= ~(MY_DAC_VLIM_FULL_SCALE << MY_DAC_SR_VLIM_OFFSET);
-        last_code |= static_cast<my_hal::dac_code_t>(volt + 0.5f) << MY_DAC_SR_VLIM_OFFSET;
-        my_hal::sr_write(my_hal::sr_types::SR_DAC, reinterpret_cast<uint8_t*>(&last_code));
+        write_code(CH_VLIM, MY_DAC_TO_CODE(volt * calibration->gain_vlim + calibration->offset_vlim, MY_DAC_VLIM_FULL_SCALE));
+    }
+    /// @brief Set heater voltage limit. Uses the calibration table if present, my_math::vlim_to_dac_vlim otherwise.
+    /// @param limit_volts Voltage limit, volts
+    void set_vlim_target(float limit_volts)
+    {
+        if (!isfinite(limit_volts)) {
+            ESP_LOGW(TAG, "DAC ignored infinte value: %f", limit_volts);
+            return;
+        }
+        if (!has_cal_table(CH_VLIM))
+        {
+            set_vlim(my_math::vlim_to_dac_vlim(limit_volts));
+            return;
+        }
+        float code = get_code_for(CH_VLIM, limit_volts);
+        last_vlim = MY_DAC_CODE_TO_VOLTS(code, MY_DAC_VLIM_FULL_SCALE);
+        write_code(CH_VLIM, code);
     }
     /// @brief 
     /// @return Volts
@@ -115,6 +296,8 @@ namespace my_dac {
         TickType_t previous_wake = xTaskGetTickCount();
         ESP_LOGI(TAG, "Soft heatup params: cycles = %" PRIu32 ", step = %.3f", cycles, voltage_step);
 
+        ramping = true;
+        journal::record(journal::EV_RAMP_START, journal::SRC_INTERNAL, target_volts);
         for (uint32_t i = 1; i <= cycles; i++)
         {
             float v = voltage_step * i;
@@ -122,6 +305,8 @@ namespace my_dac {
             if (i % (cycles / 10) == 0) printf("Heatup: %.3f\n", v);
             xTaskDelayUntil(&previous_wake, pdMS_TO_TICKS(time_step_ms));
         }
+        ramping = false;
+        journal::record(journal::EV_RAMP_END, journal::SRC_INTERNAL, get_vpwr());
     }
     /// @brief Perform linear cooldown profile (from current voltage to 0 in time_seconds)
     /// @param time_seconds Seconds
@@ -136,6 +321,8 @@ namespace my_dac {
         TickType_t previous_wake = xTaskGetTickCount();
         ESP_LOGI(TAG, "Soft cooldown params: cycles = %" PRIi32 ", step = %.3f", cycles, voltage_step);
 
+        ramping = true;
+        journal::record(journal::EV_RAMP_START, journal::SRC_INTERNAL, 0);
         for (int32_t i = cycles - 1; i >= 0; i--)
         {
             float v = voltage_step * i;
@@ -143,5 +330,13 @@ namespace my_dac {
             if (i % (cycles / 10) == 0) printf("Cooldown: %.3f\n", v);
             xTaskDelayUntil(&previous_wake, pdMS_TO_TICKS(time_step_ms));
         }
+        ramping = false;
+        journal::record(journal::EV_RAMP_END, journal::SRC_INTERNAL, get_vpwr());
+    }
+    /// @brief Check whether a soft heat-up/cool-down profile is in progress
+    /// @return True == ramping
+    bool is_ramping()
+    {
+        return ramping;
     }
 }
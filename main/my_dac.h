@@ -1,6 +1,9 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
+
+#define MY_DAC_CAL_TABLE_MAX_POINTS 64
 
 struct my_dac_cal_t
 {
@@ -10,9 +13,40 @@ struct my_dac_cal_t
     float offset_vlim;
 };
 
+/// @brief Calibration point: DAC code that produces the given output
+struct my_dac_cal_point_t
+{
+    float volts; ///< Measured output: heater amplifier voltage (Vpwr) or voltage limit (Vlim)
+    float code;
+};
+/// @brief Multi-point calibration table, points sorted by volts (strictly increasing). Only count points are stored.
+struct my_dac_cal_table_t
+{
+    uint32_t count;
+    my_dac_cal_point_t points[MY_DAC_CAL_TABLE_MAX_POINTS];
+};
+#define MY_DAC_CAL_TABLE_SIZE(n) (offsetof(my_dac_cal_table_t, points) + (n) * sizeof(my_dac_cal_point_t))
+
 namespace my_dac
 {
+    enum channels
+    {
+        CH_VPWR,
+        CH_VLIM,
+        CH_COUNT
+    };
+
     void init(const my_dac_cal_t* cal);
+    bool set_cal_table(channels ch, const my_dac_cal_table_t* table);
+    bool has_cal_table(channels ch);
+    bool validate_cal_table(const my_dac_cal_table_t* table, size_t len);
+    float get_code_for(channels ch, float volts);
+    void set_code(channels ch, uint32_t code);
+    uint32_t get_full_scale(channels ch);
+    float get_cal_input(channels ch, float volts);
+    float code_to_dac_volts(channels ch, float code);
+    float get_lsb_volts(channels ch);
+    void set_vlim_target(float limit_volts);
     void set_vpwr(float volt);
     float get_vpwr();
     void set_vlim(float volt);
@@ -20,4 +54,5 @@ namespace my_dac
 
     void soft_heat_up(float target_volts, float time_seconds);
     void soft_cool_down(float time_seconds);
+    bool is_ramping();
 }
\ No newline at end of file
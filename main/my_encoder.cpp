@@ -0,0 +1,164 @@
+/**
+ * @file my_encoder.cpp
+ * @author MSU
+ * @brief Quadrature encoder input layer. PCNT counts are sampled by a periodic esp_timer, rotation velocity is estimated
+ * from the timestamps of count changes and an acceleration curve is applied, so that fast spinning covers the whole range quickly
+ * while slow turning keeps single-step resolution. The resulting position is clamped here, in the sampling layer,
+ * so the control loop only reads it and never has to write the PCNT counter back.
+ * @date 2026-10-16
+ *
+ */
+
+#include "my_encoder.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "ESP32Encoder.h"
+
+#include <math.h>
+
+/** Movement older than this is considered a new gesture (velocity starts from zero) */
+#define MY_ENCODER_IDLE_US 150000
+/** Velocity estimate smoothing factor (weight of the newest sample) */
+#define MY_ENCODER_VELOCITY_ALPHA 0.5f
+
+static const char TAG[] = "ENCODER";
+
+static ESP32Encoder encoder;
+static esp_timer_handle_t sample_timer = NULL;
+static portMUX_TYPE encoder_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static my_encoder::accel_cfg_t accel =
+{
+    .threshold_cps = CONFIG_ENCODER_ACCEL_THRESHOLD_CPS,
+    .slope = CONFIG_ENCODER_ACCEL_SLOPE_PERCENT / 100.0f,
+    .max_gain = CONFIG_ENCODER_ACCEL_MAX_GAIN
+};
+static int32_t pos_min = 0;
+static int32_t pos_max = 0;
+/// @brief Accelerated, clamped position (fractional part is kept to avoid losing steps at gains that are not integer)
+static float position = 0;
+static float velocity = 0;
+static int64_t last_raw = 0;
+static int64_t last_move_us = 0;
+
+/// @brief Sampling timer callback (esp_timer task context)
+/// @param arg Not used
+static void sample_cb(void* arg)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t raw = encoder.getCount();
+
+    portENTER_CRITICAL(&encoder_spinlock);
+    int64_t delta = raw - last_raw;
+    last_raw = raw;
+    if (delta == 0)
+    {
+        if ((now - last_move_us) > MY_ENCODER_IDLE_US) velocity = 0;
+        portEXIT_CRITICAL(&encoder_spinlock);
+        return;
+    }
+
+    int64_t since_move = now - last_move_us;
+    last_move_us = now;
+    if (since_move > MY_ENCODER_IDLE_US)
+    {
+        velocity = 0;
+    }
+    else
+    {
+        float v = static_cast<float>(llabs(delta)) * 1e6f / static_cast<float>(since_move);
+        velocity += MY_ENCODER_VELOCITY_ALPHA * (v - velocity);
+    }
+
+    float gain = 1;
+    if (velocity > accel.threshold_cps)
+    {
+        gain += accel.slope * (velocity - accel.threshold_cps);
+        if (gain > accel.max_gain) gain = accel.max_gain;
+    }
+    position += static_cast<float>(delta) * gain;
+    if (position > pos_max) position = pos_max;
+    else if (position < pos_min) position = pos_min;
+    portEXIT_CRITICAL(&encoder_spinlock);
+}
+
+namespace my_encoder
+{
+    /// @brief Attach PCNT to the encoder pins and start velocity sampling
+    /// @param pin_a Encoder channel A
+    /// @param pin_b Encoder channel B
+    /// @param min Lower position limit, counts
+    /// @param max Upper position limit, counts
+    /// @return See esp_timer_create, esp_timer_start_periodic
+    esp_err_t init(gpio_num_t pin_a, gpio_num_t pin_b, int32_t min, int32_t max)
+    {
+        assert(min <= max);
+        pos_min = min;
+        pos_max = max;
+        position = min;
+
+        ESP32Encoder::useInternalWeakPullResistors = puType::none;
+        encoder.attachHalfQuad(pin_a, pin_b);
+        last_raw = encoder.getCount();
+
+        const esp_timer_create_args_t args =
+        {
+            .callback = sample_cb,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "enc_sample",
+            .skip_unhandled_events = true
+        };
+        esp_err_t err = esp_timer_create(&args, &sample_timer);
+        if (err != ESP_OK) return err;
+        err = esp_timer_start_periodic(sample_timer, CONFIG_ENCODER_SAMPLE_PERIOD_MS * 1000);
+        if (err == ESP_OK) ESP_LOGI(TAG, "Sampling every %d ms", CONFIG_ENCODER_SAMPLE_PERIOD_MS);
+        return err;
+    }
+    /// @brief Get accelerated position
+    /// @return Counts, within [min, max] passed to init
+    int32_t get_position()
+    {
+        portENTER_CRITICAL(&encoder_spinlock);
+        int32_t ret = static_cast<int32_t>(floorf(position + 0.5f));
+        portEXIT_CRITICAL(&encoder_spinlock);
+        return ret;
+    }
+    /// @brief Get current rotation velocity estimate
+    /// @return Counts per second (absolute value)
+    float get_velocity()
+    {
+        return velocity;
+    }
+    /// @brief Get raw (not accelerated, not clamped) PCNT counts, for debug purposes
+    int64_t get_raw_counts()
+    {
+        return encoder.getCount();
+    }
+    /// @brief Move position to the lower limit. PCNT counter is left alone: only deltas are used.
+    void reset()
+    {
+        portENTER_CRITICAL(&encoder_spinlock);
+        position = pos_min;
+        velocity = 0;
+        portEXIT_CRITICAL(&encoder_spinlock);
+    }
+
+    const accel_cfg_t* get_accel()
+    {
+        return &accel;
+    }
+    /// @brief Set acceleration curve (runtime only, defaults come from Kconfig)
+    /// @param cfg New curve
+    void set_accel(const accel_cfg_t* cfg)
+    {
+        assert(cfg);
+        portENTER_CRITICAL(&encoder_spinlock);
+        accel = *cfg;
+        portEXIT_CRITICAL(&encoder_spinlock);
+    }
+} // namespace my_encoder
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <inttypes.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+
+namespace my_encoder
+{
+    /// @brief Acceleration curve: gain = 1 + slope * (velocity - threshold), limited to max_gain. No acceleration below threshold.
+    struct accel_cfg_t
+    {
+        float threshold_cps; ///< Velocity (counts/s) up to which every count is one step
+        float slope; ///< Gain increase per count/s above the threshold
+        float max_gain; ///< Gain limit
+    };
+
+    esp_err_t init(gpio_num_t pin_a, gpio_num_t pin_b, int32_t min, int32_t max);
+
+    int32_t get_position();
+    float get_velocity();
+    int64_t get_raw_counts();
+    void reset();
+
+    const accel_cfg_t* get_accel();
+    void set_accel(const accel_cfg_t* cfg);
+} // namespace my_encoder
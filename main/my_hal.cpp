@@ -17,6 +17,7 @@
 #include <esp_check.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/event_groups.h"
 #include <rom/ets_sys.h>
 #include <driver/ledc.h>
 #include <soc/rtc.h>
@@ -25,15 +26,20 @@
 #include <rom/gpio.h>
 #include <esp_eth.h>
 #include <esp_event.h>
+#include <esp_timer.h>
 
 #include "ethernet_init.h"
-#include "ESP32Encoder.h"
+#include "my_encoder.h"
+#include "my_button.h"
+#include "static_alloc.h"
 
 #define MAX_CPU_FREQ_MHZ 160
 #define DEFAULT_CPU_FREQ_MHZ 80
 #define MIN_CPU_FREQ_MHZ 40
 #define ENCODER_MAX_COUNTS (MY_PWR_MAX / ENCODER_RESOLUTION_STEP)
 #define ENCODER_MIN_COUNTS 0
+/** Internal EMAC plus up to two SPI modules, see ethernet_init */
+#define MAX_ETH_PORTS 3
 
 static const char TAG[] = "HAL";
 
@@ -81,7 +87,16 @@ const my_sr regs[] =
     { GPIO_NUM_12, GPIO_NUM_2, GPIO_NUM_4, true, 3 }, // DACs
     { GPIO_NUM_12, GPIO_NUM_15, GPIO_NUM_4, true, 1 } // LCD
 };
+/// @brief Shift-register bus (shared data and latch lines) mutex. FreeRTOS mutexes provide priority inheritance,
+/// so an LCD transfer holding the bus is boosted to the priority of a waiting DAC writer.
 static SemaphoreHandle_t sr_mutex_handle = NULL;
+/// @brief Number of DAC transactions waiting for the bus. LCD transfers (one byte per bus acquisition) yield to them,
+/// so a DAC update waits for at most one LCD byte.
+static volatile uint32_t sr_dac_pending = 0;
+#define SR_DAC_IDLE_BIT BIT0
+/// @brief SR_DAC_IDLE_BIT is set while no DAC transaction is waiting for the bus: LCD transfers block on it instead of polling
+static EventGroupHandle_t sr_event_group = NULL;
+static my_hal::sr_stats_t sr_stats = {};
 
 /// @brief LCD configuration for hd44780 library. Note that the databus is handled externally, because it's driven by a 595 shift register.
 static my_lcd::hd44780_t lcd_cfg = 
@@ -105,13 +120,10 @@ static my_lcd::hd44780_t lcd_cfg =
     true        //!< Current backlight state
 };
 
-// ENCODER
-static ESP32Encoder encoder;
-
 // Ethernet
 static uint8_t eth_port_cnt = 0;
 static esp_eth_handle_t *eth_handles;
-esp_netif_t **eth_netifs;
+esp_netif_t *eth_netifs[MAX_ETH_PORTS];
 /** Event handler for Ethernet events */
 static void eth_event_handler(void *arg, esp_event_base_t event_base,
                               int32_t event_id, void *event_data)
@@ -162,11 +174,10 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
 
 namespace my_hal
 {
-    /// @brief Initialize HAL and the peripherals it contorls.
-    /// @param buzzer_freq Buzzer frequency (driving square wave frequency, harmonics will be present)
-    /// @param shdn_pump_freq Driving frequency for the charge pump that drives the gate of the MOSFET that enables analog PSU
+    /// @brief First boot stage: configure GPIO and load zeros into the shift registers, so that the heater output is in a safe state
+    /// before anything else (including NVS access) happens.
     /// @return ESK_OK, or panics otherwise
-    esp_err_t init()
+    esp_err_t init_safe_state()
     {
         const uint32_t zero = 0;
         const uint8_t* const zero_ptr = reinterpret_cast<const uint8_t*>(&zero);
@@ -188,8 +199,11 @@ namespace my_hal
         }
 
         ESP_LOGI(TAG, "Init SRs...");
-        sr_mutex_handle = xSemaphoreCreateMutex();
-        assert(sr_mutex_handle);
+        static StaticSemaphore_t sr_mutex_buffer;
+        sr_mutex_handle = static_alloc::create_mutex("sr_bus", &sr_mutex_buffer);
+        static StaticEventGroup_t sr_event_group_buffer;
+        sr_event_group = static_alloc::create_event_group("sr_bus", &sr_event_group_buffer);
+        xEventGroupSetBits(sr_event_group, SR_DAC_IDLE_BIT);
         //Set shift register pins as outputs and load all zeros
         for (size_t i = 0; i < ARRAY_SIZE(regs); i++)
         {
@@ -204,19 +218,33 @@ namespace my_hal
         }
         set_output_enable(true);
 
+        return ESP_OK;
+    }
+    /// @brief Initialize user input peripherals (button, encoder). Requires init_safe_state.
+    /// @return ESK_OK, or panics otherwise
+    esp_err_t init_inputs()
+    {
+        ESP_LOGI(TAG, "Init button...");
+        ESP_ERROR_CHECK(my_button::init(pin_btn, true)); //Active HIGH
+
         ESP_LOGI(TAG, "Init encoder...");
-        ESP32Encoder::useInternalWeakPullResistors = puType::none;
-        encoder.attachHalfQuad(pin_enc_a, pin_enc_b);
+        ESP_ERROR_CHECK(my_encoder::init(pin_enc_a, pin_enc_b, ENCODER_MIN_COUNTS, static_cast<int32_t>(ENCODER_MAX_COUNTS)));
 
+        return ESP_OK;
+    }
+    /// @brief Initialize Ethernet driver, esp-netif and the default event loop. Independent of the other HAL parts.
+    /// @return ESK_OK, or panics otherwise
+    esp_err_t init_network()
+    {
         // Initialize Ethernet driver
         ESP_LOGI(TAG, "Init ethernet...");
         ESP_ERROR_CHECK(example_eth_init(&eth_handles, &eth_port_cnt));
-        eth_netifs = new esp_netif_t* [eth_port_cnt];
+        assert(eth_port_cnt <= MAX_ETH_PORTS);
         // Initialize TCP/IP network interface aka the esp-netif (should be called only once in application)
         ESP_ERROR_CHECK(esp_netif_init());
         // Create default event loop that running in background
         ESP_ERROR_CHECK(esp_event_loop_create_default());
-        esp_eth_netif_glue_handle_t eth_netif_glues[eth_port_cnt];
+        esp_eth_netif_glue_handle_t eth_netif_glues[MAX_ETH_PORTS];
         // Create instance(s) of esp-netif for Ethernet(s)
         if (eth_port_cnt == 1)
         {
@@ -262,7 +290,7 @@ namespace my_hal
             ESP_ERROR_CHECK(esp_eth_start(eth_handles[i]));
         }
 
-        ESP_LOGI(TAG, "HAL init finished");
+        ESP_LOGI(TAG, "Network init finished");
         return ESP_OK;
     }
 
@@ -272,20 +300,11 @@ namespace my_hal
     {
         return &lcd_cfg;
     }
+    /// @brief Get encoder position (accelerated and clamped to the power range by my_encoder)
+    /// @return Counts
     int64_t get_encoder_counts()
     {
-        int64_t c = encoder.getCount();
-        if (c > ENCODER_MAX_COUNTS)
-        {
-            c = ENCODER_MAX_COUNTS;
-            encoder.setCount(ENCODER_MAX_COUNTS);
-        }
-        else if (c < ENCODER_MIN_COUNTS)
-        {
-            c = ENCODER_MIN_COUNTS;
-            encoder.setCount(ENCODER_MIN_COUNTS);
-        }
-        return c;
+        return my_encoder::get_position();
     }
     esp_netif_t* get_netif()
     {
@@ -294,8 +313,45 @@ namespace my_hal
 
     void reset_encoder()
     {
-        encoder.clearCount();
+        my_encoder::reset();
+    }
+    /// @brief Acquire the shift-register bus. DAC transactions have strict priority: LCD transfers don't start while any DAC write is pending,
+    /// they block until the last pending one has the bus.
+    /// @param t Shift register chain that is going to be written
+    static void sr_acquire(sr_types t)
+    {
+        if (t == sr_types::SR_DAC)
+        {
+            int64_t start = esp_timer_get_time();
+            __atomic_add_fetch(&sr_dac_pending, 1, __ATOMIC_SEQ_CST);
+            xEventGroupClearBits(sr_event_group, SR_DAC_IDLE_BIT);
+            while (xSemaphoreTake(sr_mutex_handle, portMAX_DELAY) != pdTRUE);
+            // The last pending DAC writer wakes the LCD. A stale set racing a new writer's clear only costs the LCD one
+            // more check under the mutex below, and every writer sets the bit again once it's the last one.
+            if (__atomic_sub_fetch(&sr_dac_pending, 1, __ATOMIC_SEQ_CST) == 0) xEventGroupSetBits(sr_event_group, SR_DAC_IDLE_BIT);
+            uint32_t waited = static_cast<uint32_t>(esp_timer_get_time() - start);
+            sr_stats.dac_writes++;
+            sr_stats.dac_wait_total_us += waited;
+            if (waited > sr_stats.dac_wait_max_us) sr_stats.dac_wait_max_us = waited;
+            return;
+        }
+        bool deferred = false;
+        for (;;)
+        {
+            if (__atomic_load_n(&sr_dac_pending, __ATOMIC_SEQ_CST) > 0)
+            {
+                deferred = true;
+                xEventGroupWaitBits(sr_event_group, SR_DAC_IDLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+            }
+            while (xSemaphoreTake(sr_mutex_handle, portMAX_DELAY) != pdTRUE);
+            if (__atomic_load_n(&sr_dac_pending, __ATOMIC_SEQ_CST) == 0) break;
+            xSemaphoreGive(sr_mutex_handle); //A DAC write arrived while we were waiting, let it go first
+            deferred = true;
+        }
+        sr_stats.lcd_bytes++;
+        if (deferred) sr_stats.lcd_yields++;
     }
+
     /// @brief Write bytes to a shift register chain
     /// @param t Shift register chain
     /// @param contents Buffer to write from
@@ -306,7 +362,7 @@ namespace my_hal
         assert(sr_mutex_handle);
         static_assert(sizeof(dac_code_t) >= 3, "Warning: check DAC shift register length!");
         
-        while (xSemaphoreTake(sr_mutex_handle, portMAX_DELAY) != pdTRUE);
+        sr_acquire(t);
 
         auto sr = regs[t];
         ESP_ERROR_CHECK(gpio_set_level(sr.latch, 0));
@@ -326,7 +382,17 @@ namespace my_hal
 
         xSemaphoreGive(sr_mutex_handle);
     }
-    /// @brief 
+    /// @brief Get shift-register bus arbitration statistics
+    /// @return Statistics snapshot
+    sr_stats_t get_sr_stats()
+    {
+        return sr_stats;
+    }
+    void reset_sr_stats()
+    {
+        sr_stats = {};
+    }
+    /// @brief Raw (not debounced) button state. Use my_button events for control purposes.
     /// @return True == the button is pressed, false otherwise
     bool get_btn_pressed()
     {
@@ -34,8 +34,19 @@ namespace my_hal
     {
         pcbV1
     };
+    /// @brief Shift-register bus arbitration statistics
+    struct sr_stats_t
+    {
+        uint32_t dac_writes;
+        uint32_t dac_wait_max_us; ///< Worst-case time a DAC write waited for the bus
+        uint64_t dac_wait_total_us;
+        uint32_t lcd_bytes;
+        uint32_t lcd_yields; ///< LCD transfers deferred in favor of a DAC write (once per transfer, however long it waited)
+    };
 
-    esp_err_t init();
+    esp_err_t init_safe_state();
+    esp_err_t init_inputs();
+    esp_err_t init_network();
 
     my_lcd::hd44780_t* get_lcd_config();
     int64_t get_encoder_counts();
@@ -44,6 +55,8 @@ namespace my_hal
 
     void reset_encoder();
     void sr_write(sr_types t, const uint8_t* contents);
+    sr_stats_t get_sr_stats();
+    void reset_sr_stats();
     void set_output_enable(bool v);
 }
 
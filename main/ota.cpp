@@ -0,0 +1,351 @@
+/**
+ * @file ota.cpp
+ * @author MSU
+ * @brief Firmware update over Ethernet. A low-priority task listens on CONFIG_OTA_PORT for one client at a time: header
+ * (OTA_MAGIC, image size, SHA-256 of the image), then the image itself. The output is held off through the control loop
+ * (cmd_bus::CMD_SAFE_HOLD) before the first byte is written and until the device restarts, or released if the update
+ * fails. The image is streamed into the inactive OTA partition in CONFIG_OTA_CHUNK_SIZE pieces: sectors are erased as the
+ * writes reach them (no erase of the whole partition up front) and the SHA-256 is updated as the bytes arrive, so an
+ * update takes one pass over the network and needs one chunk of RAM. A new image boots pending verification: it is
+ * confirmed once it has run CONFIG_OTA_HEALTH_CHECK_S with a clean boot and a running control loop, or rolled back
+ * (the bootloader also rolls back an image that resets before being confirmed).
+ * Trust model: the receiver is reachable by anything on the network, so a client has to prove it knows the pre-shared key
+ * CONFIG_OTA_PSK before the output is touched or the partition is opened. The device sends a random nonce on connect and
+ * the header carries HMAC-SHA256(PSK, nonce | magic | size | SHA-256 of the image): it can't be replayed, and the image
+ * hash it authorizes is checked against the received bytes before the image is made bootable. The receiver stays off while
+ * the key is empty. Not covered: confidentiality (the image travels in the clear), an attacker who can read the key from
+ * the device's flash, or one who holds the key - use secure boot with signed images where that matters.
+ * @date 2026-10-16
+ *
+ */
+
+#include "ota.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_app_format.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/md.h"
+#include "esp_random.h"
+#include "sdkconfig.h"
+
+#include "macros.h"
+#include "static_alloc.h"
+#include "cmd_bus.h"
+#include "journal.h"
+#include "control.h"
+#include "boot.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define OTA_TASK_STACK_SIZE 4096
+/** Below the control loop and Modbus: the update only gets the time they leave */
+#define OTA_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+/** Back-off after the listening socket failed */
+#define OTA_RETRY_MS 1000
+/** Time for the result to reach the client before the restart */
+#define OTA_REBOOT_DELAY_MS 500
+/** Back-off after a refused client: one guess per this much time */
+#define OTA_AUTH_FAIL_DELAY_MS 1000
+/** Image header, segment header, then the application description */
+#define OTA_APP_DESC_OFFSET (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+
+static_assert(CONFIG_OTA_CHUNK_SIZE >= OTA_APP_DESC_OFFSET + sizeof(esp_app_desc_t), "The first chunk must hold the app description");
+
+#pragma pack(push, 1)
+struct header_t
+{
+    char magic[OTA_MAGIC_LEN];
+    uint32_t size;
+    uint8_t sha256[OTA_SHA256_LEN];
+    uint8_t hmac[OTA_SHA256_LEN]; ///< Over the nonce and the preceding fields
+};
+#pragma pack(pop)
+
+static const char TAG[] = "OTA";
+static const char* const state_names[] = { "idle", "receiving", "rebooting", "verifying", "disabled" };
+static_assert(ARRAY_SIZE(state_names) == ota::OTA_COUNT);
+
+static uint8_t chunk[CONFIG_OTA_CHUNK_SIZE];
+static portMUX_TYPE status_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static ota::status_t status = { .state = ota::OTA_IDLE, .received = 0, .size = 0, .last_result = ESP_OK, .updates = 0, .auth_failures = 0,
+    .last_duration_ms = 0 };
+
+static void set_state(ota::states s)
+{
+    portENTER_CRITICAL(&status_spinlock);
+    status.state = s;
+    portEXIT_CRITICAL(&status_spinlock);
+}
+static void set_received(uint32_t n)
+{
+    portENTER_CRITICAL(&status_spinlock);
+    status.received = n;
+    portEXIT_CRITICAL(&status_spinlock);
+}
+/// @brief Hold the output off (or release it) through the control loop, waits for it
+static esp_err_t safe_hold(bool on)
+{
+    cmd_bus::cmd_t c = { .type = cmd_bus::CMD_SAFE_HOLD, .source = cmd_bus::SRC_OTA };
+    c.enable = on;
+    return cmd_bus::call(&c);
+}
+/// @return ESP_ERR_TIMEOUT if the client stalled for CONFIG_OTA_RECV_TIMEOUT_S, ESP_ERR_INVALID_SIZE if it closed early
+static esp_err_t recv_all(int sock, void* buf, size_t len)
+{
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len)
+    {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n == 0) return ESP_ERR_INVALID_SIZE;
+        if (n < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+static void send_line(int sock, const char* line)
+{
+    send(sock, line, strlen(line), 0);
+}
+/// @brief The header has to carry HMAC-SHA256(CONFIG_OTA_PSK, nonce | magic | size | sha256)
+static bool authorized(const header_t* h, const uint8_t* nonce)
+{
+    if (memcmp(h->magic, OTA_MAGIC, OTA_MAGIC_LEN) != 0) return false;
+    uint8_t msg[OTA_NONCE_LEN + offsetof(header_t, hmac)];
+    memcpy(msg, nonce, OTA_NONCE_LEN);
+    memcpy(msg + OTA_NONCE_LEN, h, offsetof(header_t, hmac));
+    uint8_t mac[OTA_SHA256_LEN];
+    const char psk[] = CONFIG_OTA_PSK;
+    if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), reinterpret_cast<const uint8_t*>(psk), strlen(psk), msg,
+        sizeof(msg), mac) != 0) return false;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(mac); i++) diff |= mac[i] ^ h->hmac[i]; // Constant time
+    return diff == 0;
+}
+/// @brief The first chunk must be an application image of this project
+static esp_err_t check_image(const uint8_t* data, size_t len)
+{
+    if ((len < OTA_APP_DESC_OFFSET + sizeof(esp_app_desc_t)) || (data[0] != ESP_IMAGE_HEADER_MAGIC)) return ESP_ERR_INVALID_ARG;
+    esp_app_desc_t desc;
+    memcpy(&desc, data + OTA_APP_DESC_OFFSET, sizeof(desc));
+    if (desc.magic_word != ESP_APP_DESC_MAGIC_WORD) return ESP_ERR_INVALID_ARG;
+    const esp_app_desc_t* running = esp_app_get_description();
+    if (strncmp(desc.project_name, running->project_name, sizeof(desc.project_name)) != 0)
+    {
+        ESP_LOGE(TAG, "Image of project '%.32s', this is '%.32s'", desc.project_name, running->project_name);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    ESP_LOGI(TAG, "Receiving version %.32s (running %.32s)", desc.version, running->version);
+    return ESP_OK;
+}
+/// @brief Stream the image into the next OTA partition and make it the boot partition
+static esp_err_t receive_image(int sock, const header_t* h)
+{
+    const esp_partition_t* part = esp_ota_get_next_update_partition(NULL);
+    if (!part) return ESP_ERR_NOT_FOUND;
+    if (!h->size || (h->size > part->size)) return ESP_ERR_INVALID_SIZE;
+    esp_ota_handle_t handle;
+    esp_err_t err = esp_ota_begin(part, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+    if (err != ESP_OK) return err;
+    ESP_LOGI(TAG, "Writing %" PRIu32 " bytes to %s at 0x%" PRIx32, h->size, part->label, part->address);
+    send_line(sock, "READY\n");
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    uint32_t received = 0;
+    while ((err == ESP_OK) && (received < h->size))
+    {
+        size_t n = MIN(h->size - received, sizeof(chunk));
+        err = recv_all(sock, chunk, n);
+        if ((err == ESP_OK) && !received) err = check_image(chunk, n);
+        if (err != ESP_OK) break;
+        mbedtls_sha256_update(&sha, chunk, n);
+        err = esp_ota_write(handle, chunk, n);
+        received += n;
+        set_received(received);
+    }
+    uint8_t digest[OTA_SHA256_LEN];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if ((err == ESP_OK) && (memcmp(digest, h->sha256, sizeof(digest)) != 0)) err = ESP_ERR_INVALID_CRC;
+    if (err != ESP_OK)
+    {
+        esp_ota_abort(handle);
+        return err;
+    }
+    err = esp_ota_end(handle); // Checks the image itself (segments, checksum, signature with secure boot)
+    if (err != ESP_OK) return err;
+    return esp_ota_set_boot_partition(part);
+}
+static void serve_client(int sock)
+{
+    struct timeval tv = { .tv_sec = CONFIG_OTA_RECV_TIMEOUT_S, .tv_usec = 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint8_t nonce[OTA_NONCE_LEN];
+    esp_fill_random(nonce, sizeof(nonce));
+    if (send(sock, nonce, sizeof(nonce), 0) != sizeof(nonce)) return;
+    header_t h;
+    esp_err_t err = recv_all(sock, &h, sizeof(h));
+    if (err != ESP_OK) return;
+    if (!authorized(&h, nonce))
+    {
+        portENTER_CRITICAL(&status_spinlock);
+        status.auth_failures++;
+        portEXIT_CRITICAL(&status_spinlock);
+        ESP_LOGW(TAG, "Client refused: bad magic or HMAC");
+        send_line(sock, "ERR ESP_ERR_NOT_ALLOWED\n");
+        vTaskDelay(pdMS_TO_TICKS(OTA_AUTH_FAIL_DELAY_MS));
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    ESP_LOGW(TAG, "Update of %" PRIu32 " bytes started, holding the output off", h.size);
+    portENTER_CRITICAL(&status_spinlock);
+    status.state = ota::OTA_RECEIVING;
+    status.size = h.size;
+    status.received = 0;
+    status.updates++;
+    portEXIT_CRITICAL(&status_spinlock);
+    journal::record_int(journal::EV_OTA_BEGIN, journal::SRC_OTA, h.size);
+
+    err = safe_hold(true);
+    if (err == ESP_OK) err = receive_image(sock, &h);
+    journal::record_int(journal::EV_OTA_END, journal::SRC_OTA, static_cast<uint32_t>(err));
+    uint32_t took_ms = static_cast<uint32_t>((esp_timer_get_time() - start) / 1000);
+    portENTER_CRITICAL(&status_spinlock);
+    status.last_result = err;
+    status.last_duration_ms = took_ms;
+    status.state = (err == ESP_OK) ? ota::OTA_REBOOTING : ota::OTA_IDLE;
+    portEXIT_CRITICAL(&status_spinlock);
+
+    char line[48];
+    snprintf(line, sizeof(line), (err == ESP_OK) ? "OK\n" : "ERR %s\n", esp_err_to_name(err));
+    send_line(sock, line);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Update failed: %s", esp_err_to_name(err));
+        ESP_ERROR_CHECK_WITHOUT_ABORT(safe_hold(false));
+        return;
+    }
+    ESP_LOGW(TAG, "Update written in %" PRIu32 " ms, restarting", took_ms);
+    shutdown(sock, SHUT_WR);
+    vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+    esp_restart(); // The output stays held off until then, the journal is flushed by its shutdown handler
+}
+/// @brief First boot of a new image: confirm it, or roll back to the previous one
+static void health_check()
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    if ((esp_ota_get_state_partition(running, &state) != ESP_OK) || (state != ESP_OTA_IMG_PENDING_VERIFY)) return;
+    set_state(ota::OTA_VERIFYING);
+    ESP_LOGW(TAG, "New image in %s, health check in %d s", running->label, CONFIG_OTA_HEALTH_CHECK_S);
+    uint32_t steps = control::get_step_count();
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_OTA_HEALTH_CHECK_S * 1000));
+    steps = control::get_step_count() - steps;
+    const uint32_t expected = CONFIG_OTA_HEALTH_CHECK_S * 1000 / CONTROL_LOOP_PERIOD_MS;
+    esp_err_t boot_result = boot::get_result();
+    if ((boot_result == ESP_OK) && (steps >= expected / 2))
+    {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_mark_app_valid_cancel_rollback());
+        journal::record(journal::EV_OTA_CONFIRM, journal::SRC_OTA, 1);
+        ESP_LOGI(TAG, "Image confirmed");
+        set_state(ota::OTA_IDLE);
+        return;
+    }
+    ESP_LOGE(TAG, "Health check failed: boot %s, %" PRIu32 "/%" PRIu32 " control loop iterations. Rolling back.", esp_err_to_name(boot_result),
+        steps, expected);
+    journal::record(journal::EV_OTA_CONFIRM, journal::SRC_OTA, 0);
+    journal::flush();
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+static int open_listener()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) return -1;
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(CONFIG_OTA_PORT);
+    if ((bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(sock, 1) != 0))
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+/// @brief Health check of a new image first (no update is accepted before it's confirmed), then serve clients one by one
+/// @param arg Not used
+static void ota_task(void* arg)
+{
+    health_check();
+    if (!strlen(CONFIG_OTA_PSK))
+    {
+        ESP_LOGW(TAG, "CONFIG_OTA_PSK is empty, firmware updates over the network are disabled");
+        set_state(ota::OTA_DISABLED);
+        vTaskDelete(NULL);
+    }
+    int listener;
+    while ((listener = open_listener()) < 0)
+    {
+        ESP_LOGE(TAG, "Can't listen on port %u (errno %d)", CONFIG_OTA_PORT, errno);
+        vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_MS));
+    }
+    ESP_LOGI(TAG, "Listening on port %u", CONFIG_OTA_PORT);
+    for (;;)
+    {
+        int sock = accept(listener, NULL, NULL);
+        if (sock < 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_MS));
+            continue;
+        }
+        serve_client(sock);
+        close(sock);
+    }
+}
+
+namespace ota
+{
+    /// @brief Start the receiver task. Call once the network is up.
+    esp_err_t init()
+    {
+        static StackType_t ota_task_stack[OTA_TASK_STACK_SIZE];
+        static StaticTask_t ota_task_tcb;
+        static_alloc::add_buffer("ota_chunk", sizeof(chunk));
+        static_alloc::create_task(ota_task, "ota", sizeof(ota_task_stack), NULL, OTA_TASK_PRIORITY, ota_task_stack, &ota_task_tcb);
+        return ESP_OK;
+    }
+    /// @brief An image is being received (the output is held off)
+    bool is_active()
+    {
+        return get_status().state == OTA_RECEIVING;
+    }
+    status_t get_status()
+    {
+        portENTER_CRITICAL(&status_spinlock);
+        status_t ret = status;
+        portEXIT_CRITICAL(&status_spinlock);
+        return ret;
+    }
+    const char* get_state_name(states s)
+    {
+        return (s < OTA_COUNT) ? state_names[s] : "?";
+    }
+} // namespace ota
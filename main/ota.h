@@ -0,0 +1,42 @@
+#pragma once
+
+#include <inttypes.h>
+#include <esp_err.h>
+
+/// @brief OTA image header: magic, image size, SHA-256 of the image, HMAC-SHA256 authorizing it (little-endian, 76 bytes)
+#define OTA_MAGIC "CPWROTA2"
+#define OTA_MAGIC_LEN 8
+#define OTA_SHA256_LEN 32
+/// @brief Challenge the device sends on connect, covered by the header's HMAC
+#define OTA_NONCE_LEN 16
+
+/// @brief Firmware update over Ethernet: a raw TCP receiver (CONFIG_OTA_PORT) that streams the image into the inactive
+/// OTA partition while the output is held off, and the health check that confirms a new image or rolls it back
+namespace ota
+{
+    enum states : uint8_t
+    {
+        OTA_IDLE,
+        OTA_RECEIVING,
+        OTA_REBOOTING, ///< Image accepted, restarting into it
+        OTA_VERIFYING, ///< First boot of a new image, health check pending
+        OTA_DISABLED, ///< No CONFIG_OTA_PSK, nothing is accepted
+
+        OTA_COUNT
+    };
+    struct status_t
+    {
+        states state;
+        uint32_t received; ///< Bytes of the current (or last) image
+        uint32_t size;
+        esp_err_t last_result; ///< Of the last update since boot, ESP_OK if none
+        uint32_t updates; ///< Attempted since boot
+        uint32_t auth_failures; ///< Clients refused since boot: bad magic or HMAC
+        uint32_t last_duration_ms;
+    };
+
+    esp_err_t init();
+    bool is_active();
+    status_t get_status();
+    const char* get_state_name(states s);
+} // namespace ota
@@ -2,8 +2,8 @@
  * @file params_common.cpp
  * @author MSU
  * @brief NVS: Common parameter storage. 
- * SPIFFS: temperature profile, device info, measurements history, sensor calibration curve (left for debug purposes, legacy)
- * Memory-mapped partition: ML model
+ * SPIFFS: temperature profile, measurements history, sensor calibration curve (left for debug purposes, legacy)
+ * Memory-mapped "devcal" partition: device info, calibration tables
  * @date 2024-11-26
  * 
  */
@@ -11,6 +11,9 @@
 #include "params.h"
 
 #include "eth_mdns_init.h"
+#include "devcal.h"
+#include "perf.h"
+#include "static_alloc.h"
 
 #include "nvs.h"
 #include "nvs_handle.hpp"
@@ -18,21 +21,28 @@
 #include "macros.h"
 #include "esp_check.h"
 #include "esp_spiffs.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
 
 #include <string.h>
 
 using namespace my_params_helpers;
 
-/// @brief This is the main parameter blob
-/// Do not modify! If you do, OTA update will be impossible (breaking change) due to NVS layout change.
-/// If you need to add a new parameter, create a new NVS entry with a new ID (see several of those below).
+/// @brief Parameter RAM cache, initialized with defaults. Not stored as a whole: every field has its own NVS key, see registry below.
 struct my_param_storage_common_t
 {
     my_dac_cal_t dac_cal;
     float dac_soft_sentinel;
     char mdns_name[MDNS_MAX_HOSTNAME_LEN];
 };
-/// @brief NVS RAM cache, initialized with defaults
+/// @brief Layout of the monolithic "storage" blob used by schema versions up to 4. Frozen, only used for migration.
+struct my_param_storage_v4_t
+{
+    my_dac_cal_t dac_cal;
+    float dac_soft_sentinel;
+    char mdns_name[MDNS_MAX_HOSTNAME_LEN];
+};
 static my_param_storage_common_t storage =
 {
     .dac_cal = my_params::default_dac_cal,
@@ -52,85 +62,476 @@ static esp_vfs_spiffs_conf_t flash_conf =
 /// @brief Debug console log tag
 static const char TAG[] = "PARAMS";
 /*** NVS storage constants */
-static const uint8_t storage_ver = 4;
-static const char storage_ver_id[] = "storage_ver";
-static const char storage_val_id[] = "storage";
+static const uint8_t schema_ver = 5;
+static const char schema_ver_id[] = "schema_ver";
+static const char legacy_storage_ver_id[] = "storage_ver";
+static const char legacy_storage_val_id[] = "storage";
 static const char my_nvs_namespace[] = "my";
 static const char key_last_set_pwr[] = "pwr";
 static const char key_last_set_vlim[] = "vlim";
+
+/*** NVS parameter registry */
+enum param_types
+{
+    PARAM_FLOAT, ///< Stored bitwise as u32
+    PARAM_STR
+};
+/** Changes are flushed by the deferred flush task, without an explicit save */
+#define PARAM_FLAG_AUTO_FLUSH (1u << 0)
+/** NVS writes need ~2 KiB (nvs_set_blob and the flash driver) */
+#define PARAMS_FLUSH_TASK_STACK_SIZE 3072
+/** The shutdown handler gives up on the flush if another flush holds the mutex this long: esp_restart must not hang */
+#define PARAMS_SHUTDOWN_FLUSH_TIMEOUT_MS 500
+/** Max RAM cache size of a single parameter */
+#define PARAM_MAX_SIZE MDNS_MAX_HOSTNAME_LEN
+/** NVS entry size and data entries per 4 KiB page */
+#define NVS_ENTRY_SIZE 32
+#define NVS_ENTRIES_PER_PAGE 126
+#define NVS_PAGE_SIZE 4096
+struct param_desc_t
+{
+    const char* key; ///< NVS key, 15 characters max
+    param_types type;
+    void* value; ///< RAM cache (holds the default until loaded)
+    size_t size; ///< Size of the RAM cache, bytes
+    uint8_t since_ver; ///< Schema version that introduced the key
+    uint8_t flags;
+};
+/// @brief Every persistent parameter. To add one: append an entry with since_ver = new schema_ver and bump schema_ver.
+/// Missing keys are filled with defaults on load; keys are never reused with a different type.
+static const param_desc_t registry[] =
+{
+    { "cal_pwr_k", PARAM_FLOAT, &storage.dac_cal.gain_vpwr, sizeof(float), 5, 0 },
+    { "cal_pwr_b", PARAM_FLOAT, &storage.dac_cal.offset_vpwr, sizeof(float), 5, 0 },
+    { "cal_lim_k", PARAM_FLOAT, &storage.dac_cal.gain_vlim, sizeof(float), 5, 0 },
+    { "cal_lim_b", PARAM_FLOAT, &storage.dac_cal.offset_vlim, sizeof(float), 5, 0 },
+    { "sentinel", PARAM_FLOAT, &storage.dac_soft_sentinel, sizeof(float), 5, 0 },
+    { "hostname", PARAM_STR, storage.mdns_name, sizeof(storage.mdns_name), 5, 0 },
+    { key_last_set_pwr, PARAM_FLOAT, &last_set_pwr, sizeof(float), 4, PARAM_FLAG_AUTO_FLUSH },
+    { key_last_set_vlim, PARAM_FLOAT, &last_set_vlim, sizeof(float), 4, PARAM_FLAG_AUTO_FLUSH }
+};
+/// @brief Keys that have to be written back (changed, defaults filled in, migrated values, ...). Guarded by registry_spinlock.
+static bool registry_dirty[ARRAY_SIZE(registry)] = {};
+/// @brief NVS writes per key since boot
+static uint32_t registry_writes[ARRAY_SIZE(registry)] = {};
+static portMUX_TYPE registry_spinlock = portMUX_INITIALIZER_UNLOCKED;
+/// @brief Serializes flushes (deferred flush task, explicit save, shutdown handler)
+static SemaphoreHandle_t flush_mutex = NULL;
+static TaskHandle_t flush_task_handle = NULL;
+static uint32_t flush_count = 0;
+static uint32_t entries_written = 0;
+/// @brief Keys that are no longer used by the current schema, erased after a successful migration
+static const char* const obsolete_keys[] = { legacy_storage_ver_id, legacy_storage_val_id };
+
+/*** NVS schema migrations */
+static void mark_dirty(const void* value);
+/// @brief v4 -> v5: monolithic blob split into per-field keys
+/// @param handle Open R/W NVS handle
+/// @return ESP_OK, also if there was nothing to migrate or the blob was unusable (discarded, defaults kept): a bad legacy
+/// blob must not fail every boot from now on
+static esp_err_t migrate_v5(nvs_handle_t handle)
+{
+    my_param_storage_v4_t old;
+    size_t len = sizeof(old);
+    esp_err_t err = nvs_get_blob(handle, legacy_storage_val_id, &old, &len);
+    if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+    if ((err == ESP_OK) && (len != sizeof(old))) err = ESP_ERR_NVS_INVALID_LENGTH;
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Legacy blob is unusable (%s), discarded, defaults used", esp_err_to_name(err));
+        return ESP_OK; // Erased with the other obsolete keys
+    }
+    storage.dac_cal = old.dac_cal;
+    storage.dac_soft_sentinel = old.dac_soft_sentinel;
+    memcpy(storage.mdns_name, old.mdns_name, sizeof(storage.mdns_name));
+    storage.mdns_name[sizeof(storage.mdns_name) - 1] = '\0';
+    mark_dirty(&storage.dac_cal.gain_vpwr);
+    mark_dirty(&storage.dac_cal.offset_vpwr);
+    mark_dirty(&storage.dac_cal.gain_vlim);
+    mark_dirty(&storage.dac_cal.offset_vlim);
+    mark_dirty(&storage.dac_soft_sentinel);
+    mark_dirty(storage.mdns_name);
+    return ESP_OK;
+}
+struct migration_t
+{
+    uint8_t to_ver;
+    esp_err_t (*apply)(nvs_handle_t handle);
+};
+/// @brief Forward migrations, in ascending order. Versions before 4 had no persistent data worth keeping.
+static const migration_t migrations[] =
+{
+    { 5, migrate_v5 }
+};
+
+static void mark_dirty(const void* value)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(registry); i++)
+    {
+        if (registry[i].value == value) registry_dirty[i] = true;
+    }
+}
+/// @brief Read a single registry entry into its RAM cache. The cache is left untouched on failure.
+static esp_err_t read_field(nvs_handle_t handle, const param_desc_t* f)
+{
+    switch (f->type)
+    {
+    case PARAM_FLOAT:
+        return nvs_get_u32(handle, f->key, static_cast<uint32_t*>(f->value));
+    case PARAM_STR:
+    {
+        size_t len = 0;
+        esp_err_t err = nvs_get_str(handle, f->key, NULL, &len);
+        if (err != ESP_OK) return err;
+        if (len > f->size) return ESP_ERR_NVS_INVALID_LENGTH;
+        return nvs_get_str(handle, f->key, static_cast<char*>(f->value), &len);
+    }
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+/// @brief Write a single registry entry
+/// @param src Value to write (a snapshot of the RAM cache)
+/// @return See nvs_set_*
+static esp_err_t write_field(nvs_handle_t handle, const param_desc_t* f, const void* src)
+{
+    switch (f->type)
+    {
+    case PARAM_FLOAT:
+        return nvs_set_u32(handle, f->key, *static_cast<const uint32_t*>(src));
+    case PARAM_STR:
+        return nvs_set_str(handle, f->key, static_cast<const char*>(src));
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+/// @brief Number of NVS entries a write of this value occupies (a u32 takes one, a string takes a header plus its data)
+static size_t entries_for(const param_desc_t* f, const void* src)
+{
+    if (f->type != PARAM_STR) return 1;
+    size_t len = strnlen(static_cast<const char*>(src), f->size) + 1;
+    return 1 + (len + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE;
+}
+/// @brief Schema version of the data currently stored in NVS
+/// @return 0 if NVS is empty
+static uint8_t read_schema_ver(nvs_handle_t handle)
+{
+    uint8_t v;
+    if (nvs_get_u8(handle, schema_ver_id, &v) == ESP_OK) return v;
+    if (nvs_get_u8(handle, legacy_storage_ver_id, &v) == ESP_OK) return v;
+    return 0;
+}
+/// @brief Write back dirty registry entries only. Values are snapshotted under the spinlock, so setters are never blocked by flash writes.
+/// @return ESP_OK if all succeeded, last error otherwise (the rest are still written, failed ones stay dirty)
+static esp_err_t write_dirty(nvs_handle_t handle)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t snapshot[PARAM_MAX_SIZE / sizeof(uint32_t)];
+    for (size_t i = 0; i < ARRAY_SIZE(registry); i++)
+    {
+        const param_desc_t* f = &(registry[i]);
+        assert(f->size <= sizeof(snapshot));
+        portENTER_CRITICAL(&registry_spinlock);
+        bool dirty = registry_dirty[i];
+        if (dirty) memcpy(snapshot, f->value, f->size);
+        registry_dirty[i] = false;
+        portEXIT_CRITICAL(&registry_spinlock);
+        if (!dirty) continue;
+
+        esp_err_t err = write_field(handle, f, snapshot);
+        if (err == ESP_OK)
+        {
+            registry_writes[i]++;
+            entries_written += entries_for(f, snapshot);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to write key '%s': %s", f->key, esp_err_to_name(err));
+            portENTER_CRITICAL(&registry_spinlock);
+            registry_dirty[i] = true;
+            portEXIT_CRITICAL(&registry_spinlock);
+            ret = err;
+        }
+    }
+    return ret;
+}
+static bool any_dirty()
+{
+    bool ret = false;
+    portENTER_CRITICAL(&registry_spinlock);
+    for (auto d : registry_dirty) ret |= d;
+    portEXIT_CRITICAL(&registry_spinlock);
+    return ret;
+}
+/// @brief Write all dirty keys and commit
+/// @param wait Longest wait for another flush to finish
+/// @return ESP_ERR_TIMEOUT if the wait ran out (nothing written), see also open_helper, write_dirty, nvs_commit
+static esp_err_t flush(TickType_t wait)
+{
+    if (!flush_mutex) return ESP_ERR_INVALID_STATE;
+    if (xSemaphoreTake(flush_mutex, wait) != pdTRUE) return ESP_ERR_TIMEOUT;
+    esp_err_t err = ESP_OK;
+    if (any_dirty())
+    {
+        nvs_handle_t handle;
+        err = open_helper(&handle, NVS_READWRITE);
+        if (err == ESP_OK)
+        {
+            err = write_dirty(handle);
+            esp_err_t commit_err = nvs_commit(handle);
+            if (err == ESP_OK) err = commit_err;
+            nvs_close(handle);
+            flush_count++;
+            perf::trace(perf::EV_NVS_FLUSH, entries_written);
+        }
+    }
+    xSemaphoreGive(flush_mutex);
+    return err;
+}
+/// @brief Deferred flush task: the first change of an auto-flush key starts the delay, changes made during the delay are written in the same batch
+/// @param arg Not used
+static void flush_task(void* arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_PARAMS_FLUSH_DELAY_MS));
+        ESP_ERROR_CHECK_WITHOUT_ABORT(flush(portMAX_DELAY));
+    }
+}
+/// @brief Shutdown handler (esp_restart, panic is not covered): flush pending changes right away.
+/// Skipped if another flush holds the mutex for too long, e.g. the restart was requested from inside it.
+static void shutdown_flush()
+{
+    flush(pdMS_TO_TICKS(PARAMS_SHUTDOWN_FLUSH_TIMEOUT_MS));
+}
+/// @brief Update a RAM cache entry, marking it dirty only if the value has actually changed
+/// @param value RAM cache pointer (as listed in the registry)
+/// @param new_value New value, same size as the registry entry
+static void set_field(void* value, const void* new_value)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(registry); i++)
+    {
+        const param_desc_t* f = &(registry[i]);
+        if (f->value != value) continue;
+        portENTER_CRITICAL(&registry_spinlock);
+        bool changed = memcmp(f->value, new_value, f->size) != 0;
+        if (changed)
+        {
+            memcpy(f->value, new_value, f->size);
+            registry_dirty[i] = true;
+        }
+        portEXIT_CRITICAL(&registry_spinlock);
+        if (changed && (f->flags & PARAM_FLAG_AUTO_FLUSH) && flush_task_handle) xTaskNotifyGive(flush_task_handle);
+        return;
+    }
+    assert(false); // Not a registry entry
+}
+/// @brief Load all registry entries in one pass, migrating older schemas and filling in defaults. Never resets the device.
+/// @param handle Open R/W NVS handle
+/// @return ESP_OK if NVS is consistent with the current schema afterwards
+static esp_err_t load_registry(nvs_handle_t handle)
+{
+    uint8_t stored_ver = read_schema_ver(handle);
+    ESP_LOGI(TAG, "Stored schema v%u, current v%u", stored_ver, schema_ver);
+    if (stored_ver > schema_ver) ESP_LOGW(TAG, "NVS was written by a newer firmware, unknown keys are left as is");
+
+    for (size_t i = 0; i < ARRAY_SIZE(registry); i++)
+    {
+        const param_desc_t* f = &(registry[i]);
+        esp_err_t err = read_field(handle, f);
+        if (err == ESP_OK) continue;
+        registry_dirty[i] = true;
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGW(TAG, "Key '%s' is unreadable (%s), default used", f->key, esp_err_to_name(err));
+        }
+        else if (f->since_ver <= stored_ver)
+        {
+            ESP_LOGW(TAG, "Key '%s' is missing, default used", f->key);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "New key '%s', default used", f->key);
+        }
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (auto& m : migrations)
+    {
+        if (m.to_ver <= stored_ver) continue;
+        esp_err_t err = m.apply(handle);
+        ESP_LOGI(TAG, "Migration to v%u: %s", m.to_ver, esp_err_to_name(err));
+        if (err != ESP_OK) ret = err;
+    }
+
+    esp_err_t err = write_dirty(handle);
+    if (err != ESP_OK) ret = err;
+    if ((ret == ESP_OK) && (stored_ver < schema_ver))
+    {
+        if ((err = nvs_commit(handle)) != ESP_OK) return err; // Migrated data has to be on flash before the old keys are erased
+        for (auto k : obsolete_keys) nvs_erase_key(handle, k);
+        ret = nvs_set_u8(handle, schema_ver_id, schema_ver);
+    }
+    err = nvs_commit(handle);
+    return (ret == ESP_OK) ? err : ret;
+}
+
 /*** SPIFFS storage constants */
-static const char flash_info_path[] = "/spiffs/i.bin"; //Device info, strings at constant offsets (32*6 = 192 --> 256B)
+static const char flash_info_path[] = "/spiffs/i.bin"; //Legacy device info, strings at constant offsets (32*6 = 192 --> 256B). Imported into devcal once.
+/*** Device info record (devcal partition) */
+enum dev_info_fields
+{
+    DEV_INFO_NAME,
+    DEV_INFO_MANUFACTURER,
+    DEV_INFO_MODEL,
+    DEV_INFO_SN,
+    DEV_INFO_PCB_REV,
+    DEV_INFO_FIELDS
+};
+/// @brief devcal::SECTION_DEV_INFO contents, field order matches my_dev_info_t
+struct my_dev_info_record_t
+{
+    char str[DEV_INFO_FIELDS][INFO_STR_MAX_LEN + 1];
+};
+static const my_dev_info_t default_dev_info = { "MDC", "SensorBurner", "N/A", "N/A", "N/A" };
+static const my_dev_info_record_t empty_dev_info = {};
+/// @brief devcal sections for DAC calibration tables, indexed by my_dac::channels
+static const uint16_t cal_table_sections[my_dac::CH_COUNT] = { devcal::SECTION_CAL_VPWR, devcal::SECTION_CAL_VLIM };
+#define SPIFFS_DONE_BIT BIT0
+#define SPIFFS_OK_BIT BIT1
+/// @brief SPIFFS mount status, set by init_spiffs
+static EventGroupHandle_t spiffs_event_group = NULL;
+
+/// @brief Check a devcal section for a device info record
+/// @return NULL if there is none or it's malformed
+static const my_dev_info_record_t* to_dev_info_record(const void* p, size_t len)
+{
+    auto r = static_cast<const my_dev_info_record_t*>(p);
+    if (!r || len != sizeof(my_dev_info_record_t)) return NULL;
+    for (size_t i = 0; i < DEV_INFO_FIELDS; i++)
+    {
+        if (strnlen(r->str[i], sizeof(r->str[i])) == sizeof(r->str[i])) return NULL; // Not terminated
+    }
+    return r;
+}
+/// @brief Get device info record from the devcal partition
+/// @return NULL if there is none or it's malformed
+static const my_dev_info_record_t* get_dev_info_record()
+{
+    size_t len = 0;
+    const void* p = devcal::get_section(devcal::SECTION_DEV_INFO, &len);
+    return to_dev_info_record(p, len);
+}
+struct dev_info_edit_t
+{
+    dev_info_fields field;
+    const char* val;
+};
+/// @brief devcal::modifier_t: current record (or an empty one) with one field replaced
+static void edit_dev_info(void* data, const void* old, size_t old_len, void* arg)
+{
+    auto r = static_cast<my_dev_info_record_t*>(data);
+    auto e = static_cast<const dev_info_edit_t*>(arg);
+    const my_dev_info_record_t* cur = to_dev_info_record(old, old_len);
+    *r = cur ? *cur : empty_dev_info;
+    memset(r->str[e->field], 0, sizeof(r->str[e->field]));
+    strncpy(r->str[e->field], e->val, INFO_STR_MAX_LEN);
+}
+/// @brief Rewrite device info record with one field changed. The record is read and written under the devcal write lock,
+/// so concurrent setters (console, Modbus) don't lose each other's fields.
+/// @return See devcal::modify_section
+static esp_err_t set_dev_info_field(dev_info_fields field, const char* val)
+{
+    dev_info_edit_t e = { .field = field, .val = val };
+    ESP_LOGI(TAG, "Writing device info field #%u: '%.*s'", field, INFO_STR_MAX_LEN, val);
+    return devcal::modify_section(devcal::SECTION_DEV_INFO, sizeof(my_dev_info_record_t), edit_dev_info, &e);
+}
+/// @brief One-shot import of the legacy SPIFFS device info file into the devcal record (SPIFFS has to be mounted)
+static void import_legacy_dev_info()
+{
+    if (get_dev_info_record()) return;
+    FILE* f = fopen(flash_info_path, "rb");
+    if (f == NULL) return;
+    // Slot indices as used by the legacy setters (serial number @ 2, PCB revision @ 3)
+    const dev_info_fields legacy_slots[] = { DEV_INFO_NAME, DEV_INFO_MANUFACTURER, DEV_INFO_SN, DEV_INFO_PCB_REV };
+    my_dev_info_record_t r = {};
+    for (size_t i = 0; i < ARRAY_SIZE(legacy_slots); i++)
+    {
+        read_str(f, r.str[legacy_slots[i]], (INFO_STR_MAX_LEN + 1) * i, INFO_STR_MAX_LEN);
+    }
+    fclose(f);
+    esp_err_t err = devcal::update_section(devcal::SECTION_DEV_INFO, &r, sizeof(r));
+    ESP_LOGI(TAG, "Imported device info from %s: %s", flash_info_path, esp_err_to_name(err));
+}
+/// @brief Register SPIFFS VFS, check its consistency and report partition usage
+/// @return See esp_vfs_spiffs_register, esp_spiffs_check, esp_spiffs_info
+static esp_err_t init_spiffs_helper()
+{
+    ESP_LOGI(TAG, "SPIFFS init...");
+    esp_err_t err = esp_vfs_spiffs_register(&flash_conf);
+    if (err != ESP_OK)
+    {
+        if (err == ESP_FAIL)
+        {
+            ESP_LOGE(TAG, "Failed to mount or format SPIFFS");
+        }
+        else if (err == ESP_ERR_NOT_FOUND)
+        {
+            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(err));
+        }
+        return err;
+    }
+    err = esp_spiffs_check(flash_conf.partition_label);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "SPIFFS check failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "SPIFFS check successful");
+    }
+    size_t total = 0, used = 0;
+    err = esp_spiffs_info(flash_conf.partition_label, &total, &used);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s). Formatting...", esp_err_to_name(err));
+        esp_spiffs_format(flash_conf.partition_label);
+        return err;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "SPIFFS: Partition size: total: %d, used: %d", total, used);
+    }
+
+    return ESP_OK;
+}
 
 namespace my_params
 {
     //PUBLIC
     const my_dac_cal_t default_dac_cal = { 1, 0, 1, 0 };
 
-    /// @brief Gets device info strings. If none have been written to the SPIFFS file, default strings will be used as required.
-    /// @return Pointer to a static my_dev_info_t buffer inside this function.
+    /// @brief Gets device info strings. Fields that have not been set are reported as defaults.
+    /// @return Pointer to a static my_dev_info_t, strings point directly into the memory-mapped devcal record (no copies).
+    /// They stay valid until the second devcal update after the call (device info or calibration table), which recycles
+    /// the slot: print them right away, copy them to keep them.
     my_dev_info_t* get_dev_info()
     {
-        const size_t len = 4;
-        static const char na[] = "N/A";
-        static char buffer[len][INFO_STR_MAX_LEN + 1];
         static my_dev_info_t res;
-
-        res = { "MDC", "SensorBurner", na, na };
-        FILE* f = fopen(flash_info_path, "rb");
-        if (f == NULL) 
-        {
-            report_spiffs_error("SPIFFS: file does not exist, reset to defaults", flash_info_path);
-            ESP_LOGD(TAG, "Errno: %i", errno);
-            //Pad the file with null-characters manually, since SPIFFS doesn't support seeking past EOF
-            f = fopen(flash_info_path, "w+b");
-            if (f == NULL)
-            {
-                report_spiffs_error("SPIFFS: failed to create file", flash_info_path);
-                return &res;
-            }
-            const char pad_chr = '\0';
-            const size_t pad_len = (INFO_STR_MAX_LEN + 1) * len + 1;
-            if (fwrite(&pad_chr, sizeof(pad_chr), pad_len, f) < pad_len)
-            {
-                report_spiffs_error("SPIFFS: failed to pad file", flash_info_path);
-                return &res;
-            }
-            const char nl = '\n';
-            if (fwrite(&nl, sizeof(nl), 1, f) < 1)
-            {
-                report_spiffs_error("SPIFFS: failed to finalize file padding", flash_info_path);
-                return &res;
-            }
-            ESP_LOGI(TAG, "Padded i.bin with %u null-bytes + \\n", pad_len);
-            for (size_t i = 0; i < len; i++)
-            {
-                size_t w = 0;
-                size_t o = i * (INFO_STR_MAX_LEN + 1);
-                if ( (w = write_str(f, reinterpret_cast<const char**>(&res)[i], o)) )
-                {
-                    ESP_LOGI(TAG, "Written %u bytes into string #%u @ %u in i.bin", w, i, o);
-                }
-                else
-                {
-                    ESP_LOGE(TAG, "Failed to write into string #%u @ %u in i.bin", i, o);
-                }
-            }
-            fclose(f);
-            return &res;
-        }
-        
+        res = default_dev_info;
+        const my_dev_info_record_t* r = get_dev_info_record();
+        if (!r) return &res;
         auto p = reinterpret_cast<const char**>(&res);
-        for (size_t i = 0; i < len; i++)
+        for (size_t i = 0; i < DEV_INFO_FIELDS; i++)
         {
-            size_t o = (INFO_STR_MAX_LEN + 1) * i;
-            if (read_str(f, buffer[i], o, INFO_STR_MAX_LEN)) p[i] = buffer[i];
-            else
-            {
-                ESP_LOGW(TAG, "Failed to read devinfo string #%u @ %u", i, o);
-            }
+            if (r->str[i][0] != '\0') p[i] = r->str[i];
         }
-
-        fclose(f);
         return &res;
     }
 
@@ -143,13 +544,16 @@ namespace my_params
         return last_set_vlim;
     }
 
+    /// @brief Remember last power setpoint (local or remote). Flushed to NVS automatically after CONFIG_PARAMS_FLUSH_DELAY_MS,
+    /// cheap to call every control loop iteration.
     void set_last_saved_vpwr(float v)
     {
-        last_set_pwr = v;
+        set_field(&last_set_pwr, &v);
     }
+    /// @brief Remember last voltage limit setpoint (local or remote). Flushed to NVS automatically, see set_last_saved_vpwr.
     void set_last_saved_vlim(float v)
     {
-        last_set_vlim = v;
+        set_field(&last_set_vlim, &v);
     }
 
     const char* get_hostname()
@@ -158,40 +562,22 @@ namespace my_params
     }
     void set_hostname(const char* n)
     {
-        strncpy(storage.mdns_name, n, MDNS_MAX_HOSTNAME_LEN);
+        char buf[sizeof(storage.mdns_name)] = {};
+        strncpy(buf, n, sizeof(buf) - 1);
+        set_field(storage.mdns_name, buf);
     }
 
     /// @brief Set serial number string
     /// @param val Can't be longer than INFO_STR_MAX_LEN characters (usually 31)
     void set_serial_number(const char* val)
     {
-        FILE* f = fopen(flash_info_path, "r+b");
-        if (f == NULL) 
-        {
-            report_spiffs_error("Failed to open file", flash_info_path);
-            unlink(flash_info_path);
-            return;
-        }
-        const size_t offset = (INFO_STR_MAX_LEN + 1) * 2;
-        ESP_LOGI(TAG, "Writing %u bytes at %u offset (sn) into i.bin", strnlen(val, INFO_STR_MAX_LEN), offset);
-        write_str(f, val, offset);
-        fclose(f);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(set_dev_info_field(DEV_INFO_SN, val));
     }
     /// @brief Set PCB revision string
     /// @param val Can't be longer than INFO_STR_MAX_LEN characters (usually 31)
     void set_pcb_revision(const char* val)
     {
-        FILE* f = fopen(flash_info_path, "r+b");
-        if (f == NULL) 
-        {
-            report_spiffs_error("Failed to open file", flash_info_path);
-            unlink(flash_info_path);
-            return;
-        }
-        const size_t offset = (INFO_STR_MAX_LEN + 1) * 3;
-        ESP_LOGI(TAG, "Writing %u bytes at %u offset (pcb rev) into i.bin", strnlen(val, INFO_STR_MAX_LEN), offset);
-        write_str(f, val, offset);
-        fclose(f);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(set_dev_info_field(DEV_INFO_PCB_REV, val));
     }
     /// @brief Get DAC calibration coefficients (k,b). Usually b = 0 and k is calculated from datasheet and circuit parameters
     /// (see default value calculation in variant params.cpp, mainly it depends on DAC resoultion, reference voltage and heater amplifier).
@@ -209,7 +595,30 @@ namespace my_params
     /// @param c Tuple (k,b), usually b=0
     void set_dac_cal(my_dac_cal_t* c)
     {
-        storage.dac_cal = *c;
+        set_field(&storage.dac_cal.gain_vpwr, &c->gain_vpwr);
+        set_field(&storage.dac_cal.offset_vpwr, &c->offset_vpwr);
+        set_field(&storage.dac_cal.gain_vlim, &c->gain_vlim);
+        set_field(&storage.dac_cal.offset_vlim, &c->offset_vlim);
+    }
+    /// @brief Get multi-point DAC calibration table (devcal partition)
+    /// @param ch DAC channel
+    /// @return Pointer into the memory-mapped record, NULL if there is no valid table for this channel
+    const my_dac_cal_table_t* get_dac_cal_table(my_dac::channels ch)
+    {
+        size_t len;
+        auto t = static_cast<const my_dac_cal_table_t*>(devcal::get_section(cal_table_sections[ch], &len));
+        return my_dac::validate_cal_table(t, len) ? t : NULL;
+    }
+    /// @brief Store multi-point DAC calibration table (devcal partition). Doesn't apply it, see my_dac::set_cal_table.
+    /// @param ch DAC channel
+    /// @param table Table, NULL removes the table (gain/offset calibration is used then)
+    /// @return ESP_ERR_INVALID_ARG if the table is malformed, see also devcal::update_section
+    esp_err_t set_dac_cal_table(my_dac::channels ch, const my_dac_cal_table_t* table)
+    {
+        if (!table) return devcal::update_section(cal_table_sections[ch], NULL, 0);
+        size_t len = MY_DAC_CAL_TABLE_SIZE(table->count);
+        if (!my_dac::validate_cal_table(table, len)) return ESP_ERR_INVALID_ARG;
+        return devcal::update_section(cal_table_sections[ch], table, len);
     }
     /// @brief DAC max range soft limit
     /// @return Volts 
@@ -221,14 +630,17 @@ namespace my_params
     /// @param v Volts
     void set_dac_soft_sentinel(float v)
     {
-        storage.dac_soft_sentinel = v;
+        set_field(&storage.dac_soft_sentinel, &v);
     }
 
-    /// @brief Initialize all of the common storage spaces
-    /// @return ESP_OK if succeeded, ESP_ERR_NOT_FOUND if calibration curve was not found, see also nvs_flash_init, esp_vfs_spiffs_register,
-    /// my_params_helpers::map_model, my_params_helpers::open_model_file, esp_spiffs_info
+    /// @brief Initialize NVS and load the parameters stored in it. SPIFFS is mounted separately, see init_spiffs.
+    /// @return ESP_OK if succeeded, see also nvs_flash_init
     esp_err_t init()
     {
+        static StaticEventGroup_t spiffs_event_group_buffer;
+        static StaticSemaphore_t flush_mutex_buffer;
+        if (!spiffs_event_group) spiffs_event_group = static_alloc::create_event_group("spiffs_events", &spiffs_event_group_buffer);
+        flush_mutex = static_alloc::create_mutex("params_flush", &flush_mutex_buffer);
         // Initialize NVS
         ESP_LOGI(TAG, "Init...");
         esp_err_t err = nvs_flash_init();
@@ -243,71 +655,77 @@ namespace my_params
             err = nvs_flash_init();
         }
         ESP_ERROR_CHECK(err);
-        my_params_helpers::init_nvs(storage_ver_id, storage_ver, storage_val_id, &storage); //Reads main storage blob
-        //Read other (non-monolithic and non-essential) NVS keys
+        ESP_ERROR_CHECK_WITHOUT_ABORT(devcal::init());
+
         nvs_handle_t nvs_handle;
-        err = open_helper(&nvs_handle, NVS_READONLY);
-        if (err == ESP_OK)
-        {
-            ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_get_u32(nvs_handle, key_last_set_pwr, reinterpret_cast<uint32_t*>(&last_set_pwr)));
-            ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_get_u32(nvs_handle, key_last_set_vlim, reinterpret_cast<uint32_t*>(&last_set_vlim)));
-            nvs_close(nvs_handle);
-        }
+        err = open_helper(&nvs_handle, NVS_READWRITE);
+        if (err != ESP_OK) return err; // RAM defaults stay in effect
+        err = load_registry(nvs_handle);
+        nvs_close(nvs_handle);
+        if (err != ESP_OK) ESP_LOGE(TAG, "NVS load finished with errors: %s", esp_err_to_name(err));
 
-        // Initialize SPIFFS
-        ESP_LOGI(TAG, "SPIFFS init...");
-        err = esp_vfs_spiffs_register(&flash_conf);
-        if (err != ESP_OK)
-        {
-            if (err == ESP_FAIL)
-            {
-                ESP_LOGE(TAG, "Failed to mount or format SPIFFS");
-            }
-            else if (err == ESP_ERR_NOT_FOUND)
-            {
-                ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-            }
-            else
-            {
-                ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(err));
-            }
-            return err;
-        }
-        err = esp_spiffs_check(flash_conf.partition_label);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "SPIFFS check failed (%s)", esp_err_to_name(err));
-            return err;
-        }
-        else
+        static StackType_t flush_task_stack[PARAMS_FLUSH_TASK_STACK_SIZE];
+        static StaticTask_t flush_task_tcb;
+        flush_task_handle = static_alloc::create_task(flush_task, "params_flush", sizeof(flush_task_stack), NULL, tskIDLE_PRIORITY + 1,
+            flush_task_stack, &flush_task_tcb);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_register_shutdown_handler(shutdown_flush));
+        return err;
+    }
+    /// @brief Mount SPIFFS and run its consistency check. The check walks the whole partition, so this is meant to be
+    /// called from a low-priority background task. SPIFFS users block in wait_spiffs until this has finished.
+    /// @return ESP_OK if succeeded, see also esp_vfs_spiffs_register, esp_spiffs_check, esp_spiffs_info
+    esp_err_t init_spiffs()
+    {
+        esp_err_t err = init_spiffs_helper();
+        if (err == ESP_OK) import_legacy_dev_info();
+        xEventGroupSetBits(spiffs_event_group, SPIFFS_DONE_BIT | ((err == ESP_OK) ? SPIFFS_OK_BIT : 0));
+        return err;
+    }
+    /// @brief Wait for SPIFFS to be mounted and checked by init_spiffs
+    /// @param wait Max ticks to wait
+    /// @return True if SPIFFS is usable
+    bool wait_spiffs(TickType_t wait)
+    {
+        if (!spiffs_event_group) return false;
+        EventBits_t bits = xEventGroupWaitBits(spiffs_event_group, SPIFFS_DONE_BIT, pdFALSE, pdTRUE, wait);
+        return (bits & SPIFFS_OK_BIT) != 0;
+    }
+    /// @brief Save changed parameters to NVS. Only the keys that have changed since the last flush are written.
+    /// @return ESP_OK if succeeded, else see open_helper, nvs_set_*, nvs_commit
+    esp_err_t save()
+    {
+        return flush(portMAX_DELAY);
+    }
+    /// @brief Print per-key write counts, NVS usage and a flash wear estimate to stdout (for the debug console)
+    void print_nvs_stats()
+    {
+        printf("%-12s %8s %6s %s\n", "Key", "Writes", "Dirty", "Auto");
+        for (size_t i = 0; i < ARRAY_SIZE(registry); i++)
         {
-            ESP_LOGI(TAG, "SPIFFS check successful");
+            printf("%-12s %8" PRIu32 " %6s %s\n", registry[i].key, registry_writes[i], registry_dirty[i] ? "yes" : "no",
+                (registry[i].flags & PARAM_FLAG_AUTO_FLUSH) ? "yes" : "no");
         }
-        size_t total = 0, used = 0;
-        err = esp_spiffs_info(flash_conf.partition_label, &total, &used);
-        if (err != ESP_OK)
+        printf("Flushes = %" PRIu32 ", entries written = %" PRIu32 "\n", flush_count, entries_written);
+
+        nvs_stats_t st;
+        if (nvs_get_stats(NULL, &st) == ESP_OK)
         {
-            ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s). Formatting...", esp_err_to_name(err));
-            esp_spiffs_format(flash_conf.partition_label);
-            return err;
+            printf("NVS entries: used = %u, free = %u, total = %u\n", st.used_entries, st.free_entries, st.total_entries);
         }
-        else
+        const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, NULL);
+        if (part && (part->size > NVS_PAGE_SIZE))
         {
-            ESP_LOGI(TAG, "SPIFFS: Partition size: total: %d, used: %d", total, used);
+            // NVS writes pages sequentially and keeps one page spare for garbage collection,
+            // so every page is erased once per (pages - 1) * NVS_ENTRIES_PER_PAGE entries written
+            size_t pages = part->size / NVS_PAGE_SIZE;
+            float erases = static_cast<float>(entries_written) / ((pages - 1) * NVS_ENTRIES_PER_PAGE);
+            printf("Estimated erase cycles per sector since boot: %.4f (%u pages, 100k cycles endurance)\n", erases, pages);
         }
-
-        return ESP_OK;
     }
-    /// @brief Save common NVS
-    /// @return ESP_OK if succeeded, else see open_helper, save_helper
-    esp_err_t save()
+    /// @brief NVS entries written since boot (flash wear indicator)
+    uint32_t get_nvs_writes()
     {
-        nvs_handle_t handle;
-        esp_err_t err = open_helper(&handle, NVS_READWRITE);
-        if (err != ESP_OK) return err;
-        ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_set_u32(handle, key_last_set_pwr, *reinterpret_cast<uint32_t*>(&last_set_pwr)));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_set_u32(handle, key_last_set_vlim, *reinterpret_cast<uint32_t*>(&last_set_vlim)));
-        return save_helper(handle, storage_ver_id, storage_ver, storage_val_id, &storage);
+        return entries_written;
     }
     /// @brief Bytewise NVS dump
     /// @param len NVS size (output)
@@ -323,21 +741,27 @@ namespace my_params
     {
         return nvs_flash_erase();
     }
-    /// @brief Reset only common NVS storage
-    /// @return 
+    /// @brief Erase all keys of the common NVS namespace (defaults are loaded after reset)
+    /// @return See open_helper, nvs_erase_all
     esp_err_t reset()
     {
-        return my_params_helpers::reset_nvs(storage_ver_id, storage_val_id);
+        nvs_handle_t handle;
+        esp_err_t err = open_helper(&handle, nvs_open_mode::NVS_READWRITE);
+        if (err != ESP_OK) return err;
+        err = nvs_erase_all(handle);
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+        return err;
     }
+    /// @brief Schema version of the data stored in NVS
     uint8_t get_nvs_version()
     {
         nvs_handle_t h;
-        my_params_helpers::open_helper(&h, nvs_open_mode::NVS_READONLY);
-        auto ret = my_params_helpers::read_nvs_ver(h, storage_ver_id);
+        if (my_params_helpers::open_helper(&h, nvs_open_mode::NVS_READONLY) != ESP_OK) return 0;
+        auto ret = read_schema_ver(h);
         nvs_close(h);
         return ret;
     }
-
     void test_crc_dbg()
     {
         nvs_handle_t handle;
@@ -346,13 +770,16 @@ namespace my_params
             ESP_LOGW(TAG, "Failed to open NVS for r/w.");
             return;
         }
-        nvs_set_u32(handle, storage_ver_id, 0);
+        nvs_set_u8(handle, schema_ver_id, 0); // Makes the next boot go through migrations and key checks
+        nvs_commit(handle);
         nvs_close(handle);
     }
-    /// @brief Unlink device info strings file in SPIFFS
+    /// @brief Clear device info strings (defaults are reported afterwards)
     void reset_dev_info_dbg()
     {
-        unlink(flash_info_path);
+        ESP_ERROR_CHECK_WITHOUT_ABORT(devcal::update_section(devcal::SECTION_DEV_INFO, &empty_dev_info, sizeof(empty_dev_info)));
+        // Otherwise it would be imported again on the next boot
+        if (wait_spiffs(portMAX_DELAY)) unlink(flash_info_path);
     }
 }
 
@@ -388,28 +815,6 @@ namespace my_params_helpers
         } while (*buf++ != '\0');
         return buf - start - 1;
     }
-    /// @brief Helper function to write a variable-length device info C-string into a SPIFFS file at specified offset.
-    /// @param f The file
-    /// @param buf The string
-    /// @param offset File offset to start at
-    /// @return Number of characters written
-    size_t write_str(FILE *f, const char *buf, size_t offset)
-    {
-        int ret;
-        if ((ret = fseek(f, offset, SEEK_SET)))
-        {
-            report_spiffs_error("Failed to seek to specified offset. Reset the file.", flash_info_path);
-            ESP_LOGD(TAG, "fseek errno: %i", ret);
-            return 0;
-        }
-        size_t len = strnlen(buf, INFO_STR_MAX_LEN) + 1; // null-term
-        size_t written = fwrite(buf, sizeof(*buf), len, f);
-        if (written < len)
-            report_spiffs_error("Failed to write string", flash_info_path);
-        else
-            ESP_LOGI(TAG, "SPIFFS: Written %u characters to %s", written, flash_info_path);
-        return written;
-    }
     /// @brief Helper-function to open a new NVS handle and log any possible errors
     /// @param handle Handle (output)
     /// @param mode NVS open mode (R or R/W)
@@ -432,39 +837,4 @@ namespace my_params_helpers
         }
         return err;
     }
-    /// @brief Read common NVS storage version.
-    /// @param handle An open NVS handle, provided by open_helper
-    /// @param id NVS version key ID
-    /// @return 0 if failed, NVS version otherwise
-    uint8_t read_nvs_ver(nvs_handle_t handle, const char* id)
-    {
-        uint8_t res;
-        esp_err_t err = nvs_get_u8(handle, id, &res);
-        if (err != ESP_OK) 
-        {
-            ESP_LOGW(TAG, "Failed to read NVS storage version, error %s. Returning 0.", esp_err_to_name(err));
-            return 0;
-        }
-        ESP_LOGI(TAG, "Read storage key version: 0x%X", res);
-        return res;
-    }
-    /// @brief Helper function to erase NVS storage and storage version keys.
-    /// @param ver_id Storage version NVS entry ID
-    /// @param id Storage NVS entry ID
-    /// @return See open_helper and nvs_erase_key
-    esp_err_t reset_nvs(const char* ver_id, const char* id)
-    {
-        nvs_handle_t handle;
-        esp_err_t ret;
-        if ((ret = open_helper(&handle, nvs_open_mode::NVS_READWRITE)) == ESP_OK)
-        {
-            nvs_erase_key(handle, ver_id);
-            return nvs_erase_key(handle, id);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to reset common NVS storge. A factory reset is required to fix this.");
-            return ret;
-        }
-    }
 }
\ No newline at end of file
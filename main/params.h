@@ -5,6 +5,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 #include "rom/crc.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -12,7 +13,7 @@
 
 #define INFO_STR_MAX_LEN 31
 
-/// @brief Pointers to device info strings
+/// @brief Pointers to device info strings, see my_params::get_dev_info for how long they stay valid
 struct my_dev_info_t
 {
     const char* name;
@@ -26,7 +27,11 @@ struct my_dev_info_t
 namespace my_params 
 {
     esp_err_t init();
+    esp_err_t init_spiffs();
+    bool wait_spiffs(TickType_t wait);
     esp_err_t save();
+    void print_nvs_stats();
+    uint32_t get_nvs_writes();
     const uint8_t* get_nvs_dump(size_t* len);
     esp_err_t factory_reset();
     esp_err_t reset();
@@ -37,59 +42,7 @@ namespace my_params_helpers
 {
     void report_spiffs_error(const char* msg, const char* path);
     size_t read_str(FILE* f, char* buf, size_t offset, size_t max_len);
-    size_t write_str(FILE* f, const char* buf, size_t offset);
     esp_err_t open_helper(nvs_handle_t* handle, nvs_open_mode_t mode);
-    uint8_t read_nvs_ver(nvs_handle_t handle, const char* id);
-    esp_err_t reset_nvs(const char* ver_id, const char* id);
-
-    template<typename T> esp_err_t save_helper(nvs_handle_t handle, const char* ver_id, uint8_t ver, const char* id, T* val)
-    {
-        nvs_set_u8(handle, ver_id, ver);
-        return nvs_set_blob(handle, id, val, sizeof(T));
-    }
-    template<typename T> esp_err_t init_nvs(const char* ver_id, uint8_t ver, const char* id, T* val)
-    {
-        esp_err_t err;
-        nvs_handle_t handle;
-        err = open_helper(&handle, NVS_READONLY);
-        if (err != ESP_OK) return err;
-        // Read the size of memory space required for blob
-        T tmp;
-        size_t required_size = sizeof(tmp); // value will default to sizeof(tmp), if not set yet in NVS
-        err = nvs_get_blob(handle, id, &tmp, &required_size);
-        if (err == ESP_ERR_NVS_NOT_FOUND || err == ESP_ERR_NVS_INVALID_LENGTH) 
-        {
-            nvs_close(handle);
-            open_helper(&handle, nvs_open_mode::NVS_READWRITE);
-            save_helper(handle, ver_id, ver, id, val); //If not found, write defaults
-            ESP_LOGW("PARAMS", "NVS storage not found. Reset to defaults.");
-        }
-        else if (err == ESP_ERR_NVS_INVALID_STATE)
-        {
-            my_params::factory_reset();
-            ESP_LOGW("PARAMS", "NVS state not consistent. Reset to defaults.");
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            abort();
-        }
-        else if (err != ESP_OK) {
-            ESP_LOGE("PARAMS", "Error reading NVS: %s", esp_err_to_name(err));
-            return err;
-        }
-        else
-        {
-            *val = tmp;
-        }
-        uint8_t v = read_nvs_ver(handle, ver_id);
-        nvs_close(handle);
-        if (v != ver)
-        {
-            ESP_LOGW("PARAMS", "NVS version not consistent. Reset to defaults.");
-            ESP_ERROR_CHECK(reset_nvs(ver_id, id));
-            vTaskDelay(pdMS_TO_TICKS(500));
-            abort();
-        }
-        return err;
-    }
 }
 
 namespace my_params
@@ -102,6 +55,8 @@ namespace my_params
     uint8_t get_nvs_version();
 
     const my_dac_cal_t* get_dac_cal();
+    const my_dac_cal_table_t* get_dac_cal_table(my_dac::channels ch);
+    esp_err_t set_dac_cal_table(my_dac::channels ch, const my_dac_cal_table_t* table);
     float get_dac_soft_sentinel();
     float get_last_saved_vpwr();
     float get_last_saved_vlim();
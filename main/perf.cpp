@@ -0,0 +1,260 @@
+/**
+ * @file perf.cpp
+ * @author MSU
+ * @brief Runtime instrumentation for field profiling: per-task CPU usage (FreeRTOS run time stats) and stack high-water marks,
+ * subsystem counters (DAC writes, LCD bytes, Modbus requests, NVS writes) and a fixed-size binary trace ring of key events.
+ * The ring is lock-free: writers reserve a slot with an atomic increment and publish it with a sequence number,
+ * so perf::trace() may be called from any task or ISR on either core. Readers skip entries that are being overwritten.
+ * Task statistics are sampled periodically by the control loop and published through the Modbus diagnostics block.
+ * @date 2026-10-16
+ *
+ */
+
+#include "perf.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "macros.h"
+#include "my_hal.h"
+#include "modbus.h"
+#include "params.h"
+#include "static_alloc.h"
+#include "log_defer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define PERF_MAX_TASKS 32
+
+static_assert((CONFIG_PERF_TRACE_LENGTH & (CONFIG_PERF_TRACE_LENGTH - 1)) == 0, "Trace length must be a power of 2");
+
+static const char TAG[] = "PERF";
+
+/// @brief Published over Modbus, see perf::diag_t::tasks. Tasks sharing a name (the console worker pool) are reported as one:
+/// CPU summed, lowest free stack.
+static const char* const diag_task_names[PERF_DIAG_TASKS] = {
+    "main", "MY_MENU_task", "mb_slave_loop", "uart_console_parser", "console_server", "console_worker", "params_flush", "IDLE0", "IDLE1"
+};
+static const char* const event_names[] = {
+    "control_step", "button", "dac_write", "lcd_repaint", "mb_request", "nvs_flush", "cal_point"
+};
+static_assert(ARRAY_SIZE(event_names) == perf::EV_TOTAL);
+
+/// @brief Task state over the last sampling window
+struct task_sample_t
+{
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t number;
+    UBaseType_t prio;
+    BaseType_t core;
+    uint32_t run_time; ///< Run time counter at the end of the window
+    uint16_t cpu_permille;
+    uint32_t stack_free;
+};
+
+static perf::trace_entry_t ring[CONFIG_PERF_TRACE_LENGTH];
+static uint32_t ring_head = 0;
+static uint32_t ring_base = 0; ///< Sequence number of the first event after clear_trace()
+
+static SemaphoreHandle_t sample_mutex = NULL;
+static TaskStatus_t status_buf[PERF_MAX_TASKS];
+static task_sample_t samples[PERF_MAX_TASKS];
+static task_sample_t next_samples[PERF_MAX_TASKS];
+static size_t sample_count = 0;
+static uint32_t last_total_run_time = 0;
+static int64_t last_sample_us = 0;
+static perf::diag_t diag = {};
+
+/// @brief Find the previous window's sample of a task
+static const task_sample_t* find_sample(UBaseType_t number)
+{
+    for (size_t i = 0; i < sample_count; i++)
+    {
+        if (samples[i].number == number) return &(samples[i]);
+    }
+    return NULL;
+}
+/// @brief Read a trace entry that is consistent (not being overwritten)
+/// @return False if the slot doesn't hold event seq
+static bool read_entry(uint32_t seq, perf::trace_entry_t* out)
+{
+    const perf::trace_entry_t* e = &ring[(seq - 1) & (CONFIG_PERF_TRACE_LENGTH - 1)];
+    if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != seq) return false;
+    out->cycles = e->cycles;
+    out->event = e->event;
+    out->core = e->core;
+    out->arg = e->arg;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) return false;
+    out->seq = seq;
+    return true;
+}
+
+namespace perf
+{
+    void init()
+    {
+        static StaticSemaphore_t sample_mutex_buffer;
+        sample_mutex = static_alloc::create_mutex("perf", &sample_mutex_buffer);
+        static_alloc::add_buffer("perf_trace", sizeof(ring));
+        static_alloc::add_buffer("perf_samples", sizeof(status_buf) + sizeof(samples) + sizeof(next_samples));
+    }
+    /// @brief Record an event into the trace ring (lock-free, task or ISR context)
+    /// @param ev Event
+    /// @param arg Event argument, see events
+    void trace(events ev, uint32_t arg)
+    {
+        uint32_t seq = __atomic_add_fetch(&ring_head, 1, __ATOMIC_RELAXED);
+        trace_entry_t* e = &ring[(seq - 1) & (CONFIG_PERF_TRACE_LENGTH - 1)];
+        __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        e->cycles = esp_cpu_get_cycle_count();
+        e->event = ev;
+        e->core = static_cast<uint16_t>(esp_cpu_get_core_id());
+        e->arg = arg;
+        __atomic_store_n(&e->seq, seq, __ATOMIC_RELEASE);
+    }
+    /// @brief Sample task statistics and counters if the sampling period (CONFIG_PERF_SAMPLE_PERIOD_MS) has elapsed. Call periodically.
+    /// @return True if a new snapshot is available (see get_diag)
+    bool sample()
+    {
+        int64_t now = esp_timer_get_time();
+        if (!sample_mutex || (now - last_sample_us < CONFIG_PERF_SAMPLE_PERIOD_MS * 1000ll)) return false;
+        last_sample_us = now;
+
+        uint32_t total = 0;
+        UBaseType_t n = uxTaskGetSystemState(status_buf, PERF_MAX_TASKS, &total);
+        xSemaphoreTake(sample_mutex, portMAX_DELAY);
+        uint32_t window = total - last_total_run_time;
+        last_total_run_time = total;
+        for (UBaseType_t i = 0; i < n; i++)
+        {
+            const TaskStatus_t* st = &(status_buf[i]);
+            const task_sample_t* prev = find_sample(st->xTaskNumber);
+            uint32_t ran = st->ulRunTimeCounter - (prev ? prev->run_time : 0);
+            task_sample_t* s = &(next_samples[i]);
+            snprintf(s->name, sizeof(s->name), "%s", st->pcTaskName);
+            s->number = st->xTaskNumber;
+            s->prio = st->uxCurrentPriority;
+            s->core = st->xCoreID;
+            s->run_time = st->ulRunTimeCounter;
+            s->cpu_permille = (window && prev) ? static_cast<uint16_t>(MIN(1000ull, ran * 1000ull / window)) : 0;
+            s->stack_free = st->usStackHighWaterMark;
+        }
+        memcpy(samples, next_samples, n * sizeof(task_sample_t));
+        sample_count = n;
+
+        auto sr = my_hal::get_sr_stats();
+        diag.uptime_s = static_cast<uint32_t>(now / 1000000);
+        diag.dac_writes = sr.dac_writes;
+        diag.lcd_bytes = sr.lcd_bytes;
+        diag.mb_requests = modbus::get_request_count();
+        diag.nvs_writes = my_params::get_nvs_writes();
+        diag.free_heap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+        diag.min_free_heap = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+        diag.trace_events = __atomic_load_n(&ring_head, __ATOMIC_RELAXED) - ring_base;
+        for (size_t i = 0; i < PERF_DIAG_TASKS; i++)
+        {
+            diag.tasks[i] = {};
+            bool found = false;
+            for (size_t j = 0; j < sample_count; j++)
+            {
+                if (strcmp(samples[j].name, diag_task_names[i])) continue;
+                auto stack_free = static_cast<uint16_t>(MIN(UINT16_MAX, samples[j].stack_free));
+                diag.tasks[i].cpu_permille += samples[j].cpu_permille;
+                diag.tasks[i].stack_free = found ? MIN(diag.tasks[i].stack_free, stack_free) : stack_free;
+                found = true;
+            }
+        }
+        xSemaphoreGive(sample_mutex);
+        return true;
+    }
+    /// @brief Get the last snapshot, see sample()
+    diag_t get_diag()
+    {
+        if (!sample_mutex) return diag;
+        xSemaphoreTake(sample_mutex, portMAX_DELAY);
+        diag_t ret = diag;
+        xSemaphoreGive(sample_mutex);
+        return ret;
+    }
+    /// @brief Print per-task CPU usage over the last sampling window and stack high-water marks
+    void print_tasks()
+    {
+        if (!sample_mutex) return;
+        xSemaphoreTake(sample_mutex, portMAX_DELAY);
+        printf("%-20s %4s %4s %7s %10s\n", "Task", "Prio", "Core", "CPU,%", "Stack free");
+        for (size_t i = 0; i < sample_count; i++)
+        {
+            const task_sample_t* s = &(samples[i]);
+            char core[12] = "-";
+            if (s->core != tskNO_AFFINITY) snprintf(core, sizeof(core), "%" PRIi32, static_cast<int32_t>(s->core));
+            printf("%-20s %4" PRIu32 " %4s %7.1f %10" PRIu32 "\n", s->name, static_cast<uint32_t>(s->prio), core,
+                s->cpu_permille / 10.0, s->stack_free);
+        }
+        printf("Window %d ms, CPU %% of one core\n", CONFIG_PERF_SAMPLE_PERIOD_MS);
+        xSemaphoreGive(sample_mutex);
+    }
+    void print_counters()
+    {
+        auto sr = my_hal::get_sr_stats();
+        auto log = log_defer::get_stats();
+        printf("Uptime = %" PRIi64 " s\n"
+            "DAC writes = %" PRIu32 "\n"
+            "LCD bytes = %" PRIu32 "\n"
+            "Modbus requests = %" PRIu32 "\n"
+            "NVS entries written = %" PRIu32 "\n"
+            "Free heap = %u B (min %u B)\n"
+            "Trace events = %" PRIu32 " (ring %d)\n"
+            "Log records = %" PRIu32 " (dropped %" PRIu32 ", truncated %" PRIu32 ", formatted immediately %" PRIu32 ")\n",
+            esp_timer_get_time() / 1000000,
+            sr.dac_writes, sr.lcd_bytes, modbus::get_request_count(), my_params::get_nvs_writes(),
+            static_cast<unsigned>(heap_caps_get_free_size(MALLOC_CAP_DEFAULT)),
+            static_cast<unsigned>(heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT)),
+            __atomic_load_n(&ring_head, __ATOMIC_RELAXED) - ring_base, CONFIG_PERF_TRACE_LENGTH,
+            log.captured, log.dropped, log.truncated, log.immediate);
+    }
+    /// @brief Print the most recent trace events, oldest first. dt is the time since the previous event on the same core.
+    /// @param max Max events to print, 0 == the whole ring
+    void print_trace(size_t max)
+    {
+        uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+        uint32_t count = MIN(head - ring_base, static_cast<uint32_t>(CONFIG_PERF_TRACE_LENGTH));
+        if (max && (count > max)) count = max;
+        uint32_t last_cycles[portNUM_PROCESSORS] = {};
+        bool have_last[portNUM_PROCESSORS] = {};
+        size_t torn = 0;
+        printf("%10s %4s %12s %10s %-14s %s\n", "Seq", "Core", "Cycles", "dt,us", "Event", "Arg");
+        for (uint32_t seq = head - count + 1; seq != head + 1; seq++)
+        {
+            trace_entry_t e;
+            if (!read_entry(seq, &e))
+            {
+                torn++;
+                continue;
+            }
+            size_t core = e.core < portNUM_PROCESSORS ? e.core : 0;
+            char dt[16] = "-";
+            if (have_last[core]) snprintf(dt, sizeof(dt), "%.1f", (e.cycles - last_cycles[core]) / static_cast<double>(CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ));
+            last_cycles[core] = e.cycles;
+            have_last[core] = true;
+            printf("%10" PRIu32 " %4u %12" PRIu32 " %10s %-14s 0x%08" PRIx32 "\n", e.seq, e.core, e.cycles, dt,
+                e.event < EV_TOTAL ? event_names[e.event] : "?", e.arg);
+        }
+        if (torn) printf("%u entries were being overwritten\n", static_cast<unsigned>(torn));
+    }
+    /// @brief Forget recorded events (the ring isn't erased, older sequence numbers are just not reported)
+    void clear_trace()
+    {
+        ring_base = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+        ESP_LOGI(TAG, "Trace cleared at event %" PRIu32, ring_base);
+    }
+} // namespace perf
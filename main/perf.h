@@ -0,0 +1,60 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/// @brief Tasks published in the Modbus diagnostics block, in this order (see perf.cpp)
+#define PERF_DIAG_TASKS 9
+
+namespace perf
+{
+    /// @brief Trace event identifiers, the argument meaning is given for each
+    enum events : uint16_t
+    {
+        EV_CONTROL_STEP, ///< Control loop iteration start, arg: 0
+        EV_BUTTON, ///< Button event consumed by the control loop, arg: my_button event type
+        EV_DAC_WRITE, ///< DAC shift register word written, arg: the word
+        EV_LCD_REPAINT, ///< LCD repaint performed, arg: repaints performed so far
+        EV_MB_REQUEST, ///< Modbus register access, arg: (event type << 16) | register address
+        EV_NVS_FLUSH, ///< Parameters flushed to NVS, arg: entries written so far
+        EV_CAL_POINT, ///< Calibration point measured, arg: DAC code
+        EV_TOTAL
+    };
+    /// @brief Trace ring entry. seq is the 1-based sequence number of the event, 0 while the entry is being written.
+    struct trace_entry_t
+    {
+        uint32_t seq;
+        uint32_t cycles; ///< esp_cpu_get_cycle_count() of the recording core
+        uint16_t event;
+        uint16_t core;
+        uint32_t arg;
+    };
+    struct task_diag_t
+    {
+        uint16_t cpu_permille; ///< Share of one core over the last sampling window
+        uint16_t stack_free; ///< Stack high-water mark: minimum free stack since the task started, bytes
+    };
+    /// @brief Snapshot published over Modbus (input registers, diag_* fields)
+    struct diag_t
+    {
+        uint32_t uptime_s;
+        uint32_t dac_writes;
+        uint32_t lcd_bytes;
+        uint32_t mb_requests;
+        uint32_t nvs_writes; ///< NVS entries written
+        uint32_t free_heap;
+        uint32_t min_free_heap;
+        uint32_t trace_events; ///< Events recorded since boot (or since the trace was cleared)
+        task_diag_t tasks[PERF_DIAG_TASKS]; ///< Absent tasks are zero
+    };
+
+    void init();
+    void trace(events ev, uint32_t arg);
+    bool sample();
+    diag_t get_diag();
+    void print_tasks();
+    void print_counters();
+    void print_trace(size_t max);
+    void clear_trace();
+} // namespace perf
@@ -0,0 +1,140 @@
+/**
+ * @file static_alloc.cpp
+ * @author MSU
+ * @brief Static allocation of the long-lived kernel objects (tasks, queues, mutexes, event groups) and the RAM budget report.
+ * Owners keep the stacks and control blocks in their own .bss, so that the whole budget is known at link time and nothing
+ * long-lived fragments the heap. Every object created here (and any other large static buffer added with add_buffer())
+ * is listed by print_report(), together with the stack high-water marks used to size the task stacks.
+ * @date 2026-10-16
+ *
+ */
+
+#include "static_alloc.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char TAG[] = "STATIC_ALLOC";
+
+static const char* const kind_names[] = { "task", "queue", "mutex", "event_group", "buffer" };
+
+struct entry_t
+{
+    const char* name;
+    static_alloc::kinds kind;
+    size_t size; ///< Bytes: stack + TCB, storage + queue control block etc.
+    TaskHandle_t task; ///< Tasks only, for the stack high-water mark
+    uint32_t stack_size;
+};
+
+static entry_t entries[STATIC_ALLOC_MAX_ENTRIES];
+static size_t entry_count = 0;
+static size_t total_size = 0;
+static portMUX_TYPE entries_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Add an object to the budget. Overflowing the registry only affects the report.
+static void add_entry(const char* name, static_alloc::kinds kind, size_t size, TaskHandle_t task = NULL, uint32_t stack_size = 0)
+{
+    bool full;
+    portENTER_CRITICAL(&entries_spinlock);
+    total_size += size;
+    full = entry_count >= STATIC_ALLOC_MAX_ENTRIES;
+    if (!full) entries[entry_count++] = { .name = name, .kind = kind, .size = size, .task = task, .stack_size = stack_size };
+    portEXIT_CRITICAL(&entries_spinlock);
+    if (full) ESP_LOGW(TAG, "Registry full, %s is counted in the total only", name);
+}
+
+namespace static_alloc
+{
+    /// @brief Create a task with a caller-provided stack and TCB (both must outlive the task, i.e. be static)
+    /// @param stack_size Bytes, the size of stack
+    /// @return Task handle, never NULL (the buffers are checked by the kernel, a failure is a programming error)
+    TaskHandle_t create_task(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg, UBaseType_t prio, StackType_t* stack,
+        StaticTask_t* tcb, BaseType_t core)
+    {
+        TaskHandle_t h = xTaskCreateStaticPinnedToCore(fn, name, stack_size, arg, prio, stack, tcb, core);
+        assert(h);
+        add_entry(name, KIND_TASK, stack_size + sizeof(StaticTask_t), h, stack_size);
+        return h;
+    }
+    /// @param storage length * item_size bytes, see STATIC_QUEUE_STORAGE
+    QueueHandle_t create_queue(const char* name, UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer)
+    {
+        QueueHandle_t q = xQueueCreateStatic(length, item_size, storage, buffer);
+        assert(q);
+        add_entry(name, KIND_QUEUE, length * item_size + sizeof(StaticQueue_t));
+        return q;
+    }
+    SemaphoreHandle_t create_mutex(const char* name, StaticSemaphore_t* buffer)
+    {
+        SemaphoreHandle_t m = xSemaphoreCreateMutexStatic(buffer);
+        assert(m);
+        add_entry(name, KIND_MUTEX, sizeof(StaticSemaphore_t));
+        return m;
+    }
+    SemaphoreHandle_t create_recursive_mutex(const char* name, StaticSemaphore_t* buffer)
+    {
+        SemaphoreHandle_t m = xSemaphoreCreateRecursiveMutexStatic(buffer);
+        assert(m);
+        add_entry(name, KIND_MUTEX, sizeof(StaticSemaphore_t));
+        return m;
+    }
+    EventGroupHandle_t create_event_group(const char* name, StaticEventGroup_t* buffer)
+    {
+        EventGroupHandle_t g = xEventGroupCreateStatic(buffer);
+        assert(g);
+        add_entry(name, KIND_EVENT_GROUP, sizeof(StaticEventGroup_t));
+        return g;
+    }
+    /// @brief Account for a large static buffer that isn't a kernel object (trace rings, netif tables etc.)
+    void add_buffer(const char* name, size_t size)
+    {
+        add_entry(name, KIND_BUFFER, size);
+    }
+
+    /// @brief Total bytes of the registered objects
+    size_t get_total()
+    {
+        portENTER_CRITICAL(&entries_spinlock);
+        size_t ret = total_size;
+        portEXIT_CRITICAL(&entries_spinlock);
+        return ret;
+    }
+    /// @brief Print every registered object (with the task stack usage) and the totals against the heap state
+    void print_report()
+    {
+        entry_t copy[STATIC_ALLOC_MAX_ENTRIES];
+        portENTER_CRITICAL(&entries_spinlock);
+        size_t n = entry_count;
+        size_t total = total_size;
+        memcpy(copy, entries, n * sizeof(entry_t));
+        portEXIT_CRITICAL(&entries_spinlock);
+
+        size_t stacks = 0, stacks_used = 0;
+        printf("Static RAM budget:\n%-20s %-12s %8s %10s\n", "Object", "Kind", "Bytes", "Stack used");
+        for (size_t i = 0; i < n; i++)
+        {
+            const entry_t* e = &(copy[i]);
+            char used[24] = "";
+            if (e->kind == KIND_TASK)
+            {
+                uint32_t free_bytes = uxTaskGetStackHighWaterMark(e->task);
+                uint32_t peak = e->stack_size > free_bytes ? e->stack_size - free_bytes : 0;
+                snprintf(used, sizeof(used), "%" PRIu32 "/%" PRIu32, peak, e->stack_size);
+                stacks += e->stack_size;
+                stacks_used += peak;
+            }
+            printf("%-20s %-12s %8u %10s\n", e->name, kind_names[e->kind], static_cast<unsigned>(e->size), used);
+        }
+        printf("Static total = %u B in %u objects (task stacks %u B, peak use %u B)\n", static_cast<unsigned>(total),
+            static_cast<unsigned>(n), static_cast<unsigned>(stacks), static_cast<unsigned>(stacks_used));
+        printf("Heap: total %u B, free %u B (min %u B), largest block %u B\n",
+            static_cast<unsigned>(heap_caps_get_total_size(MALLOC_CAP_DEFAULT)),
+            static_cast<unsigned>(heap_caps_get_free_size(MALLOC_CAP_DEFAULT)),
+            static_cast<unsigned>(heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT)),
+            static_cast<unsigned>(heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT)));
+    }
+} // namespace static_alloc
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+/// @brief Max long-lived kernel objects and buffers in the RAM budget report
+#define STATIC_ALLOC_MAX_ENTRIES 48
+
+/// @brief Define the storage of a statically allocated queue: <name>_storage and <name>_buffer
+#define STATIC_QUEUE_STORAGE(name, length, item_type) \
+    static uint8_t name##_storage[(length) * sizeof(item_type)]; \
+    static StaticQueue_t name##_buffer
+
+namespace static_alloc
+{
+    enum kinds : uint8_t
+    {
+        KIND_TASK,
+        KIND_QUEUE,
+        KIND_MUTEX,
+        KIND_EVENT_GROUP,
+        KIND_BUFFER
+    };
+
+    TaskHandle_t create_task(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg, UBaseType_t prio, StackType_t* stack,
+        StaticTask_t* tcb, BaseType_t core = tskNO_AFFINITY);
+    QueueHandle_t create_queue(const char* name, UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer);
+    SemaphoreHandle_t create_mutex(const char* name, StaticSemaphore_t* buffer);
+    SemaphoreHandle_t create_recursive_mutex(const char* name, StaticSemaphore_t* buffer);
+    EventGroupHandle_t create_event_group(const char* name, StaticEventGroup_t* buffer);
+    void add_buffer(const char* name, size_t size);
+
+    size_t get_total();
+    void print_report();
+} // namespace static_alloc
@@ -0,0 +1,268 @@
+/**
+ * @file timesync.cpp
+ * @author MSU
+ * @brief Time synchronization over Modbus. The master writes sync_master_us (its clock when it sent the request, T1),
+ * sync_prev_rtt_us and sync_seq in one request; the device takes the request's arrival time from the slave stack's event
+ * timestamp, so the delay until the event is processed doesn't count. The round trip of an exchange is only known to the
+ * master once the response is back, so it's piggybacked on the next exchange: exchange n-1 then yields one sample, the
+ * offset master - device = T1 + RTT / 2 - arrival, assuming symmetric legs (error: RTT / 2 at most).
+ * Offset and drift are fitted by least squares over the newest CONFIG_TIMESYNC_SAMPLES samples, leaving out the ones with
+ * a round trip well above the window's shortest (delayed on one leg). Everything here runs in the Modbus slave task,
+ * readers take a copy of the model under a spinlock.
+ * @date 2026-10-16
+ *
+ */
+
+#include "timesync.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "macros.h"
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+/** Shortest window span a drift estimate is made from, us: shorter spans amplify the offset jitter too much */
+#define TIMESYNC_MIN_SPAN_US 10000000LL
+/** Exchanges handled later than this after their request are dropped: the registers may hold the next exchange already.
+ * Masters must not sync more often. */
+#define TIMESYNC_MAX_LAG_US 100000LL
+
+struct sample_t
+{
+    int64_t device_us;
+    int64_t offset_us;
+    uint32_t rtt_us;
+};
+/// @brief offset(t) = ref_offset_us + slope * (t - ref_us), slope in us/s (ppm)
+struct model_t
+{
+    bool valid;
+    int64_t ref_us;
+    int64_t ref_offset_us;
+    double slope;
+};
+struct pending_t
+{
+    bool valid;
+    uint16_t seq;
+    uint64_t master_us;
+    int64_t arrival_us;
+};
+
+static const char* const state_names[] = { "none", "synced", "stale" };
+static_assert(ARRAY_SIZE(state_names) == timesync::TS_COUNT);
+
+// Modbus slave task only
+static sample_t window[CONFIG_TIMESYNC_SAMPLES];
+static size_t window_count = 0;
+static size_t window_next = 0;
+static pending_t pending = {};
+static int64_t last_anchor_us = 0;
+
+static portMUX_TYPE model_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static model_t model = {}; ///< Guarded by model_spinlock
+static timesync::status_t stats = {}; ///< Guarded by model_spinlock, fit and counters only
+
+static model_t get_model()
+{
+    portENTER_CRITICAL(&model_spinlock);
+    model_t ret = model;
+    portEXIT_CRITICAL(&model_spinlock);
+    return ret;
+}
+static int64_t predict(const model_t* m, int64_t device_us)
+{
+    return m->ref_offset_us + llround(m->slope * (device_us - m->ref_us) / 1e6);
+}
+/// @brief Refit the model to the window
+static void fit(model_t* m, timesync::status_t* st)
+{
+    uint32_t rtt_min = UINT32_MAX;
+    for (size_t i = 0; i < window_count; i++)
+    {
+        if (window[i].rtt_us < rtt_min) rtt_min = window[i].rtt_us;
+    }
+    uint64_t limit = 2ull * rtt_min + CONFIG_TIMESYNC_RTT_SLACK_US;
+    // Relative to the newest sample: the offsets are ~1e15 us, differences keep the sums exact in double
+    const sample_t* newest = &(window[(window_next + CONFIG_TIMESYNC_SAMPLES - 1) % CONFIG_TIMESYNC_SAMPLES]);
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int64_t first = newest->device_us;
+    size_t n = 0;
+    for (size_t i = 0; i < window_count; i++)
+    {
+        if (window[i].rtt_us > limit) continue;
+        double x = (window[i].device_us - newest->device_us) / 1e6;
+        double y = static_cast<double>(window[i].offset_us - newest->offset_us);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        if (window[i].device_us < first) first = window[i].device_us;
+        n++;
+    }
+    double slope = m->valid ? m->slope : 0;
+    double d = n * sxx - sx * sx;
+    if ((n >= 2) && (newest->device_us - first >= TIMESYNC_MIN_SPAN_US) && (d > 0)) slope = (n * sxy - sx * sy) / d;
+    double intercept = (sy - slope * sx) / n;
+
+    double sq = 0;
+    for (size_t i = 0; i < window_count; i++)
+    {
+        if (window[i].rtt_us > limit) continue;
+        double x = (window[i].device_us - newest->device_us) / 1e6;
+        double r = (window[i].offset_us - newest->offset_us) - (intercept + slope * x);
+        sq += r * r;
+    }
+    m->valid = true;
+    m->ref_us = newest->device_us;
+    m->ref_offset_us = newest->offset_us + llround(intercept);
+    m->slope = slope;
+    st->rtt_min_us = rtt_min;
+    st->residual_us = static_cast<float>(sqrt(sq / n));
+    st->samples = window_count;
+    st->used = n;
+    st->drift_ppb = static_cast<int32_t>(lround(slope * 1000));
+    st->last_us = newest->device_us;
+}
+/// @brief Journal a clock anchor: the device time the master clock read its last whole second at
+static void record_anchor(const model_t* m)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t master = now + predict(m, now);
+    int64_t s = master / 1000000;
+    int64_t since = llround((master - s * 1000000) / (1 + m->slope / 1e6));
+    journal::record_time_sync(static_cast<uint32_t>(s), now - since);
+    last_anchor_us = now;
+}
+static void count_rejected()
+{
+    portENTER_CRITICAL(&model_spinlock);
+    stats.rejected++;
+    portEXIT_CRITICAL(&model_spinlock);
+}
+static void add_sample(const sample_t* s)
+{
+    model_t m = get_model();
+    timesync::status_t st;
+    portENTER_CRITICAL(&model_spinlock);
+    st = stats;
+    portEXIT_CRITICAL(&model_spinlock);
+
+    bool anchor = !m.valid || (s->device_us - last_anchor_us >= CONFIG_TIMESYNC_JOURNAL_INTERVAL_S * 1000000LL);
+    if (m.valid && (llabs(s->offset_us - predict(&m, s->device_us)) > CONFIG_TIMESYNC_STEP_MS * 1000LL))
+    {
+        window_count = 0; // The master's clock was set: restart the window, fit() reads window[0 .. window_count)
+        window_next = 0;
+        st.steps++;
+        anchor = true;
+    }
+    window[window_next] = *s;
+    window_next = (window_next + 1) % CONFIG_TIMESYNC_SAMPLES;
+    if (window_count < CONFIG_TIMESYNC_SAMPLES) window_count++;
+    fit(&m, &st);
+    st.exchanges++;
+
+    portENTER_CRITICAL(&model_spinlock);
+    model = m;
+    stats = st;
+    portEXIT_CRITICAL(&model_spinlock);
+    if (anchor) record_anchor(&m);
+}
+
+namespace timesync
+{
+    /// @brief Sync exchange written by the master. Modbus slave task only, no logging (request path).
+    /// @param seq sync_seq
+    /// @param master_us sync_master_us: master clock when it sent this request
+    /// @param prev_rtt_us sync_prev_rtt_us: round trip of exchange seq - 1, 0 if unknown
+    /// @param arrival_us esp_timer time the request was served at
+    void exchange(uint16_t seq, uint64_t master_us, uint32_t prev_rtt_us, int64_t arrival_us)
+    {
+        if (esp_timer_get_time() - arrival_us > TIMESYNC_MAX_LAG_US)
+        {
+            pending.valid = false;
+            count_rejected();
+            return;
+        }
+        if (pending.valid && (seq == pending.seq)) // Repeated by the master, keep the first arrival
+        {
+            count_rejected();
+            return;
+        }
+        if (pending.valid && (seq == static_cast<uint16_t>(pending.seq + 1)) && prev_rtt_us)
+        {
+            sample_t s = {
+                .device_us = pending.arrival_us,
+                .offset_us = static_cast<int64_t>(pending.master_us + prev_rtt_us / 2) - pending.arrival_us,
+                .rtt_us = prev_rtt_us
+            };
+            add_sample(&s);
+        }
+        else if (pending.valid)
+        {
+            count_rejected();
+        }
+        pending = { .valid = true, .seq = seq, .master_us = master_us, .arrival_us = arrival_us };
+    }
+    /// @brief Convert a device timestamp to the master clock, any task
+    /// @param device_us esp_timer time
+    /// @param master_us Master clock, us (output)
+    /// @return False if no exchange has completed yet (master_us is not set)
+    bool to_master_us(int64_t device_us, int64_t* master_us)
+    {
+        model_t m = get_model();
+        if (!m.valid) return false;
+        *master_us = device_us + predict(&m, device_us);
+        return true;
+    }
+    /// @brief Master clock now, see to_master_us
+    bool now_us(int64_t* master_us)
+    {
+        return to_master_us(esp_timer_get_time(), master_us);
+    }
+    status_t get_status()
+    {
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&model_spinlock);
+        status_t ret = stats;
+        model_t m = model;
+        portEXIT_CRITICAL(&model_spinlock);
+        if (!m.valid) ret.state = TS_NONE;
+        else ret.state = (now - ret.last_us > CONFIG_TIMESYNC_STALE_S * 1000000LL) ? TS_STALE : TS_SYNCED;
+        ret.offset_us = m.valid ? predict(&m, now) : 0;
+        return ret;
+    }
+    const char* get_state_name(states s)
+    {
+        return (s < TS_COUNT) ? state_names[s] : "?";
+    }
+    void print_status()
+    {
+        status_t st = get_status();
+        printf("State: %s\n", get_state_name(st.state));
+        if (st.state == TS_NONE)
+        {
+            printf("Exchanges: %" PRIu32 ", rejected %" PRIu32 "\n", st.exchanges, st.rejected);
+            return;
+        }
+        int64_t master = 0;
+        now_us(&master);
+        time_t s = static_cast<time_t>(master / 1000000);
+        struct tm tm;
+        gmtime_r(&s, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("Master time: %s.%06" PRId32 " UTC\n", buf, static_cast<int32_t>(master % 1000000));
+        printf("Offset: %.6f s (master - device), drift %+.3f ppm\n", st.offset_us / 1e6, st.drift_ppb / 1000.0);
+        printf("Window: %u exchanges, %u used, rtt min %" PRIu32 " us, residual %.1f us\n", st.samples, st.used, st.rtt_min_us,
+            st.residual_us);
+        printf("Exchanges: %" PRIu32 ", rejected %" PRIu32 ", steps %" PRIu32 ", last %.1f s ago\n", st.exchanges, st.rejected, st.steps,
+            (esp_timer_get_time() - st.last_us) / 1e6);
+    }
+} // namespace timesync
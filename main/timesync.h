@@ -0,0 +1,39 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/// @brief Device clock (esp_timer) to Modbus master clock mapping, estimated from sync exchanges the master writes into
+/// the holding registers: no SNTP/PTP server needed, only the Modbus link every fleet device already has
+namespace timesync
+{
+    enum states : uint16_t
+    {
+        TS_NONE, ///< No exchange completed since boot
+        TS_SYNCED,
+        TS_STALE, ///< No exchange for CONFIG_TIMESYNC_STALE_S, extrapolating
+
+        TS_COUNT
+    };
+    struct status_t
+    {
+        states state;
+        int64_t offset_us; ///< Master - device clock, now
+        int32_t drift_ppb; ///< Device clock rate error: positive if it runs slow against the master
+        uint32_t rtt_min_us; ///< Shortest round trip in the window
+        float residual_us; ///< RMS deviation of the exchanges used from the fit
+        uint16_t samples; ///< Exchanges in the window
+        uint16_t used; ///< Exchanges that passed the round trip filter
+        uint32_t exchanges; ///< Completed since boot
+        uint32_t rejected; ///< Incomplete: sequence gap, unknown round trip, repeated sequence number, handled too late
+        uint32_t steps; ///< Master clock steps (window restarts)
+        int64_t last_us; ///< Device time of the newest exchange
+    };
+
+    void exchange(uint16_t seq, uint64_t master_us, uint32_t prev_rtt_us, int64_t arrival_us);
+    bool to_master_us(int64_t device_us, int64_t* master_us);
+    bool now_us(int64_t* master_us);
+    status_t get_status();
+    const char* get_state_name(states s);
+    void print_status();
+} // namespace timesync
@@ -0,0 +1,339 @@
+#!/usr/bin/env python3
+"""Decode binary log frames (log_format binary, see main/log_defer.cpp) back into ESP_LOG text.
+
+The firmware sends the address of the format string and the raw arguments; formats and constant strings are read
+from the firmware ELF. Plain text between frames (console output, logs sent before the switch) is passed through.
+
+    log_decode.py --elf build/cpwr.elf --tcp cpwr.local      # Ethernet console
+    log_decode.py --elf build/cpwr.elf --port /dev/ttyUSB0   # UART, needs pyserial
+    log_decode.py --elf build/cpwr.elf capture.bin           # file, '-' or nothing for stdin
+"""
+
+import argparse
+import hashlib
+import socket
+import struct
+import sys
+import zlib
+
+FRAME_VERSION = 1
+MAX_FRAME = 320  # COBS-encoded FRAME_MAX_RAW, longer chunks are text
+IDLE_S = 0.2
+
+STR_IN_FLASH = 1
+
+# Argument classes, same as parse_spec() in log_defer.cpp
+NONE, INT, LONG, LLONG, SIZE, INTMAX, PTRDIFF, DOUBLE, LDOUBLE, PTR, STR, COUNT, INVALID = range(13)
+MAX_SPEC = 16
+
+
+class Elf:
+    """Allocated sections of an ELF32/ELF64 little-endian file, addressed by VMA"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError(f"{path}: not an ELF file")
+        is64 = self.data[4] == 2
+        if is64:
+            shoff, = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+            fmt = "<IIQQQQ"
+        else:
+            shoff, = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+            fmt = "<IIIIII"
+        self.pointer_size = 8 if is64 else 4
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from(fmt, self.data, shoff + i * shentsize)
+            SHT_NOBITS, SHF_ALLOC = 8, 2
+            if (flags & SHF_ALLOC) and sh_type != SHT_NOBITS and addr:
+                self.sections.append((addr, offset, size))
+        self.sha = hashlib.sha256(self.data).hexdigest()
+
+    def string(self, addr):
+        for start, offset, size in self.sections:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                end = self.data.find(b"\0", pos, offset + size)
+                return self.data[pos:end if end >= 0 else offset + size].decode("utf-8", "replace")
+        return None
+
+
+def parse_spec(fmt, i):
+    """Port of parse_spec(): returns (length, stars, class, length modifier, conversion)"""
+    q = i + 1
+    if fmt[q:q + 1] == "%":
+        return 2, 0, NONE, "", "%"
+    stars = 0
+    while q < len(fmt) and fmt[q] in "-+ #0":
+        q += 1
+    if fmt[q:q + 1] == "*":
+        stars += 1
+        q += 1
+    else:
+        while q < len(fmt) and fmt[q].isdigit():
+            q += 1
+    if fmt[q:q + 1] == ".":
+        q += 1
+        if fmt[q:q + 1] == "*":
+            stars += 1
+            q += 1
+        else:
+            while q < len(fmt) and fmt[q].isdigit():
+                q += 1
+    length = ""
+    if fmt[q:q + 2] in ("hh", "ll"):
+        length = "H" if fmt[q] == "h" else "q"
+        q += 2
+    elif q < len(fmt) and fmt[q] in "hlLzjt":
+        length = fmt[q]
+        q += 1
+    if q >= len(fmt):
+        return q - i, stars, INVALID, length, ""
+    n = q - i + 1
+    conv = fmt[q]
+    if n >= MAX_SPEC:
+        return n, stars, INVALID, length, conv
+    if conv in "diuoxXc":
+        cls = {"l": INT if conv == "c" else LONG, "q": LLONG, "L": LLONG, "z": SIZE, "j": INTMAX, "t": PTRDIFF}.get(length, INT)
+    elif conv in "fFeEgGaA":
+        cls = LDOUBLE if length == "L" else DOUBLE
+    elif conv == "s":
+        cls = INVALID if length == "l" else STR
+    elif conv == "p":
+        cls = PTR
+    elif conv == "n":
+        cls = COUNT
+    else:
+        cls = INVALID
+    return n, stars, cls, length, conv
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise IndexError
+        b = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return b
+
+    def u(self, n):
+        return int.from_bytes(self.take(n), "little")
+
+    def varint(self):
+        v, shift = 0, 0
+        while True:
+            b = self.take(1)[0]
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def zigzag(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+class Decoder:
+    def __init__(self, elf, out):
+        self.elf = elf
+        self.out = out
+        # ESP32 until the first sync frame
+        ptr = elf.pointer_size if elf else 4
+        self.sizes = {"int": 4, "long": ptr, "llong": 8, "size": ptr, "intmax": 8, "ptrdiff": ptr, "ptr": ptr}
+        self.seq = None  # Counts the records sent to this link: a gap means frames lost in transit
+
+    def write(self, text):
+        self.out.write(text)
+        self.out.flush()
+
+    def chunk(self, data):
+        """One 0x00-delimited chunk: a frame if it decodes and the CRC matches, text otherwise"""
+        raw = cobs_decode(data) if 3 <= len(data) <= MAX_FRAME else None
+        if raw and len(raw) >= 3 and int.from_bytes(raw[-2:], "little") == zlib.crc32(raw[:-2]) & 0xFFFF:
+            try:
+                self.frame(raw[:-2])
+                return
+            except IndexError:
+                self.write("[log_decode: malformed frame]\n")
+                return
+        self.write(data.decode("utf-8", "replace"))
+
+    def check_seq(self, seq):
+        if self.seq is not None:
+            missing = (seq - self.seq - 1) & 0xFFFF
+            if missing:
+                self.write(f"[log_decode: {missing} records missing]\n")
+        self.seq = seq
+
+    def frame(self, raw):
+        r = Reader(raw)
+        t = chr(r.u(1))
+        if t == "S":
+            version = r.u(1)
+            if version != FRAME_VERSION:
+                self.write(f"[log_decode: frame version {version}, expected {FRAME_VERSION}]\n")
+            keys = ("int", "long", "llong", "size", "intmax", "ptrdiff", "ptr")
+            self.sizes = dict(zip(keys, r.take(len(keys))))
+            sha = r.take(16).decode("ascii", "replace")
+            if self.elf and sha.strip("0") and not self.elf.sha.startswith(sha):
+                self.write(f"[log_decode: device ELF {sha} doesn't match {self.elf.sha[:16]}]\n")
+        elif t == "D":
+            core, count = r.u(1), r.varint()
+            self.write(f"[log_decode: {count} records dropped on core {core}]\n")
+        elif t == "T":
+            self.check_seq(r.u(2))
+            self.write(raw[r.pos:].decode("utf-8", "replace"))
+        elif t == "R":
+            _flags, args = r.u(1), r.u(1)
+            self.check_seq(r.u(2))
+            fmt_addr = r.u(self.sizes["ptr"])
+            fmt = self.elf.string(fmt_addr) if self.elf else None
+            if fmt is None:
+                self.write(f"[log_decode: format 0x{fmt_addr:x} not in the ELF]\n")
+                return
+            self.write(self.render(fmt, args, r))
+
+    def string_arg(self, r):
+        v = r.varint()
+        if v & STR_IN_FLASH:
+            addr = r.u(self.sizes["ptr"])
+            s = self.elf.string(addr)
+            return s if s is not None else f"<0x{addr:x}>"
+        return r.take(v >> 1).decode("utf-8", "replace")
+
+    def render(self, fmt, args, r):
+        out = []
+        index = 0
+        i = 0
+        while i < len(fmt):
+            if fmt[i] != "%":
+                out.append(fmt[i])
+                i += 1
+                continue
+            n, stars, cls, length, conv = parse_spec(fmt, i)
+            spec = fmt[i:i + n]
+            i += n
+            if cls == NONE:
+                out.append("%")
+                continue
+            if index >= args:
+                out.append(" [...]")
+                break
+            index += 1
+            for _ in range(stars):
+                spec = spec.replace("*", str(r.zigzag()), 1)
+            pyspec = "%" + "".join(c for c in spec[1:-1] if c not in "hlLzjt") + conv
+            if cls in (INT, LONG, LLONG, INTMAX, PTRDIFF, SIZE):
+                v = r.varint() if cls == SIZE else r.zigzag()
+                bits = 8 * {INT: self.sizes["int"], LONG: self.sizes["long"], LLONG: self.sizes["llong"],
+                            INTMAX: self.sizes["intmax"], PTRDIFF: self.sizes["ptrdiff"], SIZE: self.sizes["size"]}[cls]
+                bits = {"H": 8, "h": 16}.get(length, bits)
+                if conv == "c":
+                    out.append(pyspec % chr(v & 0xFF))
+                    continue
+                v &= (1 << bits) - 1
+                if conv in "di" and v >> (bits - 1):
+                    v -= 1 << bits
+                text = (pyspec[:-1] + "d" if conv in "iu" else pyspec) % v
+                out.append(text.replace("0o", "0") if conv == "o" else text)
+            elif cls in (DOUBLE, LDOUBLE):
+                v, = struct.unpack("<d", r.take(8))
+                out.append((pyspec[:-1] + "s") % v.hex() if conv in "aA" else pyspec % v)
+            elif cls == PTR:
+                out.append((pyspec[:-1] + "s") % f"0x{r.u(self.sizes['ptr']):x}")
+            elif cls == STR:
+                out.append(pyspec % self.string_arg(r))
+        text = "".join(out)
+        return text if text.endswith("\n") else text + "\n"
+
+
+def chunks(args):
+    """Raw input bytes, b'' when the source has been idle for IDLE_S"""
+    if args.tcp:
+        host, _, port = args.tcp.partition(":")
+        s = socket.create_connection((host, int(port or 3142)))
+        s.settimeout(IDLE_S)
+        while True:
+            try:
+                data = s.recv(4096)
+            except socket.timeout:
+                yield b""
+                continue
+            if not data:
+                return
+            yield data
+    elif args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=IDLE_S) as s:
+            while True:
+                yield s.read(4096)
+    else:
+        f = sys.stdin.buffer if args.input in (None, "-") else open(args.input, "rb")
+        with f:
+            while True:
+                data = f.read1(4096) if hasattr(f, "read1") else f.read(4096)
+                if not data:
+                    return
+                yield data
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("input", nargs="?", help="capture file, '-' for stdin (default)")
+    p.add_argument("--elf", help="firmware ELF (formats and constant strings)")
+    p.add_argument("--tcp", metavar="HOST[:PORT]", help="Ethernet console, default port 3142")
+    p.add_argument("--port", help="serial port (pyserial)")
+    p.add_argument("--baud", type=int, default=115200)
+    args = p.parse_args()
+
+    dec = Decoder(Elf(args.elf) if args.elf else None, sys.stdout)
+    pending = bytearray()
+    try:
+        for data in chunks(args):
+            if not data:
+                # Idle: whatever is pending isn't a frame in progress
+                if pending:
+                    dec.write(pending.decode("utf-8", "replace"))
+                    pending.clear()
+                continue
+            pending += data
+            while True:
+                end = pending.find(0)
+                if end < 0:
+                    break
+                if end:
+                    dec.chunk(bytes(pending[:end]))
+                del pending[:end + 1]
+            if len(pending) > MAX_FRAME:
+                dec.write(pending.decode("utf-8", "replace"))
+                pending.clear()
+        if pending:
+            dec.chunk(bytes(pending))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Modbus master side of the device time synchronization (see main/timesync.cpp): writes this host's clock into the sync
+holding registers at a fixed period, with the round trip of the previous exchange, and prints the device's sync state.
+
+    mb_time_sync.py cpwr.local                 # every 10 s until interrupted
+    mb_time_sync.py cpwr.local --period 1 --count 30
+
+Only the standard library is used (Modbus TCP over a plain socket). Sync this host with NTP/PTP: the devices follow it.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+# Register addresses, see components/my_modbus/modbus_params.h
+HOLD_SYNC_MASTER_US = 13  # sync_master_us (4), sync_prev_rtt_us (2), sync_seq (1)
+INPUT_SYNC_TIME_US = 90  # sync_time_us (4), sync_drift_ppb (2), sync_rtt_us (2), sync_state, sync_samples
+STATES = ["none", "synced", "stale"]
+
+
+class Master:
+    def __init__(self, host, port, unit):
+        self.sock = socket.create_connection((host, port), timeout=2)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.unit = unit
+        self.tid = 0
+
+    def _recv(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError("connection closed")
+            data += chunk
+        return data
+
+    def request(self, pdu):
+        self.tid = (self.tid + 1) & 0xFFFF
+        self.sock.sendall(struct.pack(">HHHB", self.tid, 0, len(pdu) + 1, self.unit) + pdu)
+        tid, _, length, _ = struct.unpack(">HHHB", self._recv(7))
+        reply = self._recv(length - 1)
+        if tid != self.tid:
+            raise ConnectionError(f"transaction {tid}, expected {self.tid}")
+        if reply[0] & 0x80:
+            raise ConnectionError(f"exception {reply[1]} for function {reply[0] & 0x7F}")
+        return reply
+
+    def write_registers(self, addr, regs):
+        self.request(struct.pack(">BHHB", 16, addr, len(regs), 2 * len(regs)) + struct.pack(f">{len(regs)}H", *regs))
+
+    def read_input(self, addr, count):
+        reply = self.request(struct.pack(">BHH", 4, addr, count))
+        return struct.unpack(f">{count}H", reply[2:2 + 2 * count])
+
+
+def words(fmt, *values):
+    """Little-endian struct fields as 16-bit registers, the device's register layout"""
+    raw = struct.pack("<" + fmt, *values)
+    return list(struct.unpack(f"<{len(raw) // 2}H", raw))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("host")
+    ap.add_argument("--port", type=int, default=502)
+    ap.add_argument("--unit", type=int, default=1)
+    ap.add_argument("--period", type=float, default=10, help="seconds between exchanges (>= 0.1)")
+    ap.add_argument("--count", type=int, default=0, help="exchanges, 0 = until interrupted")
+    args = ap.parse_args()
+
+    m = Master(args.host, args.port, args.unit)
+    seq, rtt, n = 0, 0, 0
+    while not args.count or n < args.count:
+        seq = (seq + 1) & 0xFFFF
+        t1 = time.time_ns() // 1000
+        m.write_registers(HOLD_SYNC_MASTER_US, words("QIH", t1, rtt, seq))
+        rtt = time.time_ns() // 1000 - t1
+        n += 1
+        regs = m.read_input(INPUT_SYNC_TIME_US, 10)
+        sync_time, drift, rtt_min, state, samples = struct.unpack("<QiIHH", struct.pack("<10H", *regs))
+        lag = (time.time_ns() // 1000 - sync_time) / 1000 if sync_time else float("nan")
+        print(f"seq {seq}: rtt {rtt} us, device {STATES[state] if state < len(STATES) else state}, "
+              f"drift {drift / 1000:+.3f} ppm, rtt min {rtt_min} us, {samples} samples, sample age {lag:.1f} ms")
+        sys.stdout.flush()
+        time.sleep(max(args.period, 0.1))
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Firmware update over Ethernet (see main/ota.cpp): sends an application image to one or more devices, each over its own
+connection, and waits for every device to accept it. Accepted images boot on restart and roll back unless they pass the
+device's health check.
+
+    CPWR_OTA_PSK=... ota_push.py build/constant_power.bin cpwr.local
+    CPWR_OTA_PSK=... ota_push.py build/constant_power.bin 192.168.1.21 192.168.1.22 192.168.1.23   # a rack, in parallel
+
+Protocol: the device sends a 16-byte nonce, the client a header (b"CPWROTA2", image size u32 LE, SHA-256 of the image,
+HMAC-SHA256 with the device's CONFIG_OTA_PSK over nonce + the preceding header fields). The device answers "READY" once the
+output is held off and the partition is open, then the image, then "OK" or "ERR <reason>". Only the standard library is used.
+"""
+
+import argparse
+import hashlib
+import hmac
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+MAGIC = b"CPWROTA2"
+NONCE_LEN = 16
+CHUNK = 4096
+
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        data += chunk
+    return data
+
+
+def read_line(sock):
+    line = b""
+    while not line.endswith(b"\n"):
+        c = sock.recv(1)
+        if not c:
+            raise ConnectionError("connection closed")
+        line += c
+    return line.decode(errors="replace").strip()
+
+
+def push(host, port, image, digest, psk, timeout, progress):
+    start = time.monotonic()
+    with socket.create_connection((host, port), timeout=timeout) as sock:
+        nonce = recv_exact(sock, NONCE_LEN)
+        header = struct.pack("<8sI32s", MAGIC, len(image), digest)
+        sock.sendall(header + hmac.new(psk, nonce + header, hashlib.sha256).digest())
+        reply = read_line(sock)
+        if reply != "READY":
+            return f"refused: {reply}"
+        for off in range(0, len(image), CHUNK):
+            sock.sendall(image[off:off + CHUNK])
+            progress(host, off + min(CHUNK, len(image) - off))
+        reply = read_line(sock)
+    took = time.monotonic() - start
+    return f"{reply} in {took:.1f} s" if reply == "OK" else reply
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("image", help="application binary (build/<project>.bin, not the merged flash image)")
+    ap.add_argument("hosts", nargs="+")
+    ap.add_argument("--port", type=int, default=3232)
+    ap.add_argument("--timeout", type=float, default=30, help="seconds, per socket operation")
+    ap.add_argument("--psk-file", help="file holding the devices' CONFIG_OTA_PSK (default: $CPWR_OTA_PSK)")
+    args = ap.parse_args()
+    if args.psk_file:
+        with open(args.psk_file, "rb") as f:
+            psk = f.read().strip()
+    else:
+        psk = os.environ.get("CPWR_OTA_PSK", "").encode()
+    if not psk:
+        ap.error("no key: set CPWR_OTA_PSK or pass --psk-file")
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    digest = hashlib.sha256(image).digest()
+    print(f"{args.image}: {len(image)} bytes, sha256 {digest.hex()}")
+
+    lock = threading.Lock()
+    sent = {h: 0 for h in args.hosts}
+    results = {}
+
+    def progress(host, n):
+        with lock:
+            sent[host] = n
+            done = sum(sent.values()) * 100 // (len(image) * len(sent))
+            sys.stderr.write(f"\r{done:3d}% ")
+
+    def run(host):
+        try:
+            r = push(host, args.port, image, digest, psk, args.timeout, progress)
+        except OSError as e:
+            r = f"failed: {e}"
+        with lock:
+            results[host] = r
+
+    threads = [threading.Thread(target=run, args=(h,)) for h in args.hosts]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    sys.stderr.write("\n")
+    ok = True
+    for h in args.hosts:
+        print(f"{h}: {results[h]}")
+        ok = ok and results[h].startswith("OK")
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()